@@ -0,0 +1,98 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Times code generation alone: builds the graph for a keyword file once,
+// then compiles it to a program repeatedly.
+//
+//   make benchmarks/codegen
+//   benchmarks/codegen pytest/keys/twain.txt [iterations] [--no-det]
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "compiler.h"
+#include "fsmthingy.h"
+#include "parser.h"
+#include "parsetree.h"
+#include "program.h"
+#include "timer.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " KEYWORDS [ITERATIONS] [--no-det]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::ifstream keys(argv[1]);
+  if (!keys) {
+    std::cerr << "could not open " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const uint32_t iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10;
+  const bool determinize = !(argc > 3 && !std::strcmp(argv[3], "--no-det"));
+
+  FSMThingy fsm(1 << 20);
+  ParseTree tree;
+  std::string line;
+  uint32_t label = 0;
+
+  const Timer buildTimer;
+  while (std::getline(keys, line)) {
+    if (line.empty()) {
+      continue;
+    }
+
+    if (parse({line, false, false}, tree)) {
+      fsm.addPattern(tree, "ASCII", label++);
+    }
+    else {
+      std::cerr << "skipping " << line << std::endl;
+    }
+  }
+  fsm.finalizeGraph(determinize);
+
+  std::cout << label << " patterns, "
+            << fsm.Frozen->verticesSize() << " vertices, built in "
+            << buildTimer.elapsed() << "s" << std::endl;
+
+  double best = 0.0, total = 0.0;
+  uint32_t size = 0;
+
+  for (uint32_t i = 0; i < iterations; ++i) {
+    const Timer t;
+    ProgramPtr prog(Compiler::createProgram(*fsm.Frozen));
+    const double secs = t.elapsed();
+
+    size = prog->size();
+    total += secs;
+    if (i == 0 || secs < best) {
+      best = secs;
+    }
+  }
+
+  std::cout << size << " instructions; codegen best " << best
+            << "s, mean " << (iterations ? total / iterations : 0.0)
+            << "s over " << iterations << " runs" << std::endl;
+
+  return EXIT_SUCCESS;
+}
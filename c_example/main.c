@@ -104,10 +104,12 @@ int main() {
   int ret = 1;
   if (isgood) {
     // create a "program" from the parsed keywords
-    LG_ProgramOptions opts;
+    LG_ProgramOptions opts = {1, 0, 0};
 
-    if (!lg_compile_program(fsm, prog, &opts)) {
-      fprintf(stderr, "Failed to compile program");
+    if (!lg_compile_program(fsm, prog, &opts, &err)) {
+      fprintf(stderr, "Failed to compile program: %s", err->Message);
+      lg_free_error(err);
+      err = 0;
     }
 
     // discard the FSM now that we have a program
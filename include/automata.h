@@ -19,6 +19,7 @@
 #pragma once
 
 #include "basic.h"
+#include "frozengraph.h"
 #include "graph.h"
 #include "transition.h"
 #include "transitionfactory.h"
@@ -34,11 +35,13 @@ struct Properties {
 struct Glushkov {
   static const uint32_t NOLABEL;
 
-  Glushkov(): Trans(0), IsMatch(false), Label(NOLABEL) {}
+  Glushkov(): Trans(0), Rep(0), IsMatch(false), Label(NOLABEL) {}
 
   std::string label() const;
 
   Transition* Trans;
+  // set for a counted repetition, which loops on itself without an edge
+  const Repetition* Rep;
   bool IsMatch;
   uint32_t Label;
 };
@@ -47,3 +50,5 @@ struct Empty {};
 
 typedef Graph<Properties,Glushkov,Empty,VectorFamily> NFA;
 
+typedef FrozenGraph<Properties,Glushkov> FrozenNFA;
+
@@ -22,8 +22,11 @@
 
 #include "automata.h"
 #include "instructions.h"
+#include "states.h"
 #include "utility.h"
 
+#include <algorithm>
+#include <map>
 #include <vector>
 
 static const uint32_t NONE = std::numeric_limits<uint32_t>::max();
@@ -35,10 +38,12 @@ struct StateLayoutInfo {
            NumOther,
            CheckIndex;
   OpCodes Op;
+  // index of the state's jump table in CodeGenHelper::JumpTables, if any
+  uint32_t JumpTable;
 
-  StateLayoutInfo(): Start(NONE), NumEval(NONE), NumOther(NONE), CheckIndex(NONE), Op(HALT_OP) {}
+  StateLayoutInfo(): Start(NONE), NumEval(NONE), NumOther(NONE), CheckIndex(NONE), Op(HALT_OP), JumpTable(NONE) {}
 
-  StateLayoutInfo(uint32_t s, uint32_t e, uint32_t o, uint32_t chk = NONE): Start(s), NumEval(e), NumOther(o), CheckIndex(chk), Op(HALT_OP) {}
+  StateLayoutInfo(uint32_t s, uint32_t e, uint32_t o, uint32_t chk = NONE): Start(s), NumEval(e), NumOther(o), CheckIndex(chk), Op(HALT_OP), JumpTable(NONE) {}
 
   uint32_t numTotal() const { return NumEval + NumOther; }
 
@@ -52,15 +57,58 @@ struct StateLayoutInfo {
   }
 };
 
+// A counted repetition loops on its own transition when its loop accepts
+// the same bytes; otherwise the loop body is laid out after the entry.
+inline bool hasSeparateLoop(const Glushkov& state) {
+  return state.Rep && state.Rep->Loop->bytes() != state.Trans->bytes();
+}
+
+// The targets of a jump table are kept in CodeGenHelper's buffers, so that
+// laying out tables allocates nothing per state. A table has NumSlots slots,
+// slot k holding JumpTargets[JumpSlots[SlotBegin+k], JumpSlots[SlotBegin+k+1]).
+// JUMP_TABLE_RANGE_OP has a slot per byte in [First, Last]; for
+// JUMP_TABLE_INDEX_OP, JumpIndex[IndexBegin, IndexBegin+Last-First] gives the
+// 1-based slot of each byte, 0 for none, and slots are in order of first use.
+struct JumpTableLayout {
+  OpCodes Op;
+  uint32_t First,
+           Last,
+           Size,
+           SlotBegin,
+           NumSlots,
+           IndexBegin;
+
+  static uint32_t indexWords(uint32_t first, uint32_t last) {
+    return (last - first + 4) / 4;
+  }
+};
+
 struct CodeGenHelper {
-  CodeGenHelper(uint32_t numStates): DiscoverRanks(numStates, NONE),
+  CodeGenHelper(uint32_t numStates, bool poolByteSets = true): DiscoverRanks(numStates, NONE),
     Snippets(numStates), Guard(0),
-    NumDiscovered(0), MaxLabel(0), MaxCheck(0) {}
+    NumDiscovered(0), MaxLabel(0), MaxCheck(0), PoolStart(0),
+    PoolByteSets(poolByteSets), JumpTablesDone(false) {}
+
+  // starts the layout over, keeping the jump tables, which do not depend
+  // on where states land
+  void reset(bool poolByteSets) {
+    std::fill(DiscoverRanks.begin(), DiscoverRanks.end(), NONE);
+    for (StateLayoutInfo& info : Snippets) {
+      info.Start = info.NumEval = info.NumOther = info.CheckIndex = NONE;
+    }
+    Guard = NumDiscovered = MaxLabel = MaxCheck = PoolStart = 0;
+    PoolByteSets = poolByteSets;
+    ByteSetPool.clear();
+    JumpTablesDone = true;
+  }
 
-  void discover(NFA::VertexDescriptor v, const NFA& graph) {
+  template <class GraphType>
+  void discover(NFA::VertexDescriptor v, const GraphType& graph) {
     DiscoverRanks[v] = NumDiscovered++;
 
-    if (graph.inDegree(v) > 1) {
+    // threads leaving a counted repetition at the same offset have the
+    // same future, whatever their count was
+    if (graph.inDegree(v) > 1 || graph[v].Rep) {
       Snippets[v].CheckIndex = ++MaxCheck;
     }
 
@@ -78,29 +126,102 @@ struct CodeGenHelper {
     Guard += info.numTotal();
   }
 
+  // returns the pool slot of the set, adding it if it is new
+  uint32_t poolByteSet(const ByteSet& bits) {
+    return ByteSetPool.insert(std::make_pair(bits, ByteSetPool.size())).first->second;
+  }
+
+  // places the byte set pool after the code; Guard moves past it
+  void layoutPool() {
+    PoolStart = Guard;
+    Guard += 8 * ByteSetPool.size();
+  }
+
+  // returns the size of the instruction matching a transition
+  uint32_t transitionSize(const Transition* trans) {
+    if (PoolByteSets && trans->type() == ByteSetStateType) {
+      poolByteSet(trans->bytes());
+      return InstructionSize<BIT_VECTOR_POOL_OP>::VAL;
+    }
+    return trans->numInstructions();
+  }
+
+  uint32_t poolAddress(const ByteSet& bits) const {
+    return PoolStart + 8 * ByteSetPool.find(bits)->second;
+  }
+
+  const NFA::VertexDescriptor* slotBegin(const JumpTableLayout& tbl, uint32_t k) const {
+    return JumpTargets.data() + JumpSlots[tbl.SlotBegin + k];
+  }
+
+  const NFA::VertexDescriptor* slotEnd(const JumpTableLayout& tbl, uint32_t k) const {
+    return JumpTargets.data() + JumpSlots[tbl.SlotBegin + k + 1];
+  }
+
+  // roughly the bytes held for the layout, not counting scratch
+  std::size_t memoryUsage() const {
+    return DiscoverRanks.capacity() * sizeof(uint32_t) +
+           Snippets.capacity() * sizeof(StateLayoutInfo) +
+           ByteSetPool.size() * (sizeof(ByteSet) + sizeof(uint32_t) + 4 * sizeof(void*)) +
+           JumpTables.capacity() * sizeof(JumpTableLayout) +
+           JumpSlots.capacity() * sizeof(uint32_t) +
+           JumpTargets.capacity() * sizeof(NFA::VertexDescriptor) +
+           JumpIndex.capacity();
+  }
+
   std::vector<uint32_t> DiscoverRanks;
   std::vector<StateLayoutInfo> Snippets;
   uint32_t Guard,
            NumDiscovered,
            MaxLabel,
-           MaxCheck;
+           MaxCheck,
+           PoolStart;
+
+  // when set, byte set states share 8-word sets in a pool after the code
+  // instead of inlining them in a BitVector instruction
+  bool PoolByteSets;
+  std::map<ByteSet, uint32_t> ByteSetPool;
+
+  std::vector<JumpTableLayout> JumpTables;
+  std::vector<uint32_t> JumpSlots;
+  std::vector<NFA::VertexDescriptor> JumpTargets;
+  std::vector<byte> JumpIndex;
+  // set once every state's jump table is known
+  bool JumpTablesDone;
+
+  // scratch, reused from state to state
+  PivotTable Pivots;
+  std::vector<uint64_t> LandingKeys;
+  std::vector<NFA::VertexDescriptor> VisitQueue,
+                                     VisitOrder;
 };
 
-typedef std::vector<std::vector<NFA::VertexDescriptor>> TransitionTbl;
+// Lays out the jump table for v: JUMP_TABLE_RANGE_OP with a 32-bit address
+// per byte, or JUMP_TABLE_INDEX_OP with a byte per byte indexing into the
+// distinct targets when that is smaller. Returns the size of the table, 0 if
+// v gets none; otherwise the table is added to cg and noted in v's snippet.
+template <class GraphType>
+uint32_t layoutJumpTable(NFA::VertexDescriptor v, const GraphType& graph, uint32_t outDegree, CodeGenHelper& cg);
 
 class CodeGenVisitor {
 public:
   CodeGenVisitor(CodeGenHelper& helper): Helper(helper) {}
 
-  void discover_vertex(NFA::VertexDescriptor v, const NFA& graph);
+  template <class GraphType>
+  void discover_vertex(NFA::VertexDescriptor v, const GraphType& graph);
+
+  template <class GraphType>
+  uint32_t calcJumpTableSize(NFA::VertexDescriptor v, const GraphType& graph, uint32_t outDegree);
 
-  uint32_t calcJumpTableSize(NFA::VertexDescriptor v, const NFA& graph, uint32_t outDegree);
+  template <class GraphType>
+  void finish_vertex(NFA::VertexDescriptor v, const GraphType& graph);
 
-  void finish_vertex(NFA::VertexDescriptor v, const NFA& graph);
+  CodeGenHelper& helper() { return Helper; }
 
 private:
   CodeGenHelper& Helper;
 };
 
-void specialVisit(const NFA& graph, NFA::VertexDescriptor startVertex, CodeGenVisitor& vis);
+template <class GraphType>
+void specialVisit(const GraphType& graph, NFA::VertexDescriptor startVertex, CodeGenVisitor& vis);
 
@@ -0,0 +1,160 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "basic.h"
+
+#include "lightgrep/api.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+// Thrown when the caller's progress callback asks to stop compiling
+class CompileCancelled: public std::runtime_error {
+public:
+  CompileCancelled(): std::runtime_error("Compiling was cancelled") {}
+};
+
+// Thrown when compiling is estimated to need more memory than its budget;
+// the message says what was being done, e.g., which pattern was being added
+class CompileOverBudget: public std::runtime_error {
+public:
+  CompileOverBudget(uint64_t budget, const std::string& doing);
+
+  uint64_t budget() const { return Budget; }
+
+private:
+  uint64_t Budget;
+};
+
+// The peak resident memory of the process so far, in bytes; 0 if the
+// platform does not say
+uint64_t peakResidentBytes();
+
+// Relays progress and timings to the LG_CompileObserver attached to an FSM,
+// and holds the memory budget for compiling. Without an observer or a
+// budget, everything here is a no-op. It is only a pointer and a number, so
+// pass it by value.
+class CompileObserver {
+public:
+  CompileObserver(LG_CompileObserver* obs = nullptr, uint64_t budget = 0):
+    Obs(obs), Budget(budget) {}
+
+  LG_CompileObserver* observer() const { return Obs; }
+
+  // 0 => no budget
+  uint64_t budget() const { return Budget; }
+
+  bool overBudget(uint64_t bytes) const {
+    return Budget && bytes > Budget;
+  }
+
+  // throws CompileOverBudget if the phase is estimated to hold more bytes
+  // than the budget allows
+  void checkMemory(LG_CompilePhase phase, uint64_t bytes) const;
+
+  // throws CompileCancelled if the callback asks to stop
+  void progress(LG_CompilePhase phase, uint64_t done, uint64_t total) const {
+    if (Obs && Obs->Progress &&
+        (*Obs->Progress)(Obs->UserData, phase, done, total)) {
+      throw CompileCancelled();
+    }
+  }
+
+  // Adds the time from construction to destruction to the phase
+  class Timing {
+  public:
+    Timing(CompileObserver obs, LG_CompilePhase phase):
+      Stats(obs.Obs ? &obs.Obs->Stats : nullptr), Which(phase)
+    {
+      if (Stats) {
+        Start = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~Timing() {
+      if (Stats) {
+        Stats->Seconds[Which] += std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - Start
+        ).count();
+      }
+    }
+
+  private:
+    LG_CompileStats* Stats;
+    LG_CompilePhase Which;
+    std::chrono::steady_clock::time_point Start;
+  };
+
+  // Adds the growth of peak memory from construction to destruction to the
+  // phase. This costs a system call at each end, so is not for per-pattern
+  // work.
+  class PeakGrowth {
+  public:
+    PeakGrowth(CompileObserver obs, LG_CompilePhase phase):
+      Stats(obs.Obs ? &obs.Obs->Stats : nullptr), Which(phase),
+      Before(Stats ? peakResidentBytes() : 0) {}
+
+    ~PeakGrowth() {
+      if (Stats) {
+        Stats->PeakGrowth[Which] += peakResidentBytes() - Before;
+      }
+    }
+
+  private:
+    LG_CompileStats* Stats;
+    LG_CompilePhase Which;
+    uint64_t Before;
+  };
+
+  // Times a phase which works on the whole FSM, measures its memory, and
+  // reports its start and end as progress
+  class Phase;
+
+private:
+  LG_CompileObserver* Obs;
+  uint64_t Budget;
+};
+
+class CompileObserver::Phase {
+public:
+  Phase(CompileObserver obs, LG_CompilePhase phase, uint64_t total):
+    Obs(obs), Which(phase), Total(total), Time(obs, phase), Peak(obs, phase)
+  {
+    Obs.progress(Which, 0, Total);
+  }
+
+  // reports the end of the phase, which may throw, so is not left to
+  // the destructor; finished is the work done, for a phase which could
+  // not say at the start
+  void done() const { done(Total); }
+
+  void done(uint64_t finished) const {
+    Obs.progress(Which, finished, finished);
+  }
+
+private:
+  CompileObserver Obs;
+  LG_CompilePhase Which;
+  uint64_t Total;
+  Timing Time;
+  PeakGrowth Peak;
+};
@@ -20,12 +20,24 @@
 
 #include "basic.h"
 
+#include "compile_observer.h"
 #include "fwd_pointers.h"
 
+#include <vector>
+
 class Compiler {
 public:
 
-  static ProgramPtr createProgram(const NFA& graph);
+  // If merged is given, *unmergedSize is set to an estimate of the number
+  // of instructions the program would have had if each vertex v were
+  // merged[v] vertices, as it was before sharing suffixes
+  template <class GraphType>
+  static ProgramPtr createProgram(
+    const GraphType& graph,
+    CompileObserver obs = CompileObserver(),
+    const std::vector<uint32_t>* merged = nullptr,
+    uint32_t* unmergedSize = nullptr
+  );
 
 
 };
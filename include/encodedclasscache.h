@@ -0,0 +1,75 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+#include "byteset.h"
+#include "rangeset.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//
+// The NFA fragment built for an encoded character class, with vertices
+// numbered from zero in the order they were created. Copying this into
+// a graph skips both encoding the class and assembling its fragment.
+//
+struct EncodedClass {
+  struct Vertex {
+    ByteSet Bytes;
+    std::vector<uint32_t> Out;
+  };
+
+  std::vector<Vertex> Vertices;
+  std::vector<uint32_t> InList, OutList;
+};
+
+//
+// A process-wide map from (encoding chain, code points) to the fragment
+// built for that class, shared by every NFABuilder. Safe for concurrent
+// use; fragments are immutable once inserted.
+//
+class EncodedClassCache {
+public:
+  static const size_t MAX_ENTRIES;
+
+  static EncodedClassCache& instance();
+
+  std::shared_ptr<const EncodedClass> find(const std::string& chain, const UnicodeSet& uset) const;
+
+  void insert(const std::string& chain, const UnicodeSet& uset, const std::shared_ptr<const EncodedClass>& frag);
+
+  size_t size() const;
+
+  void clear();
+
+private:
+  typedef std::pair<std::string,UnicodeSet> Key;
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const;
+  };
+
+  mutable std::mutex Mutex;
+  std::unordered_map<Key,std::shared_ptr<const EncodedClass>,KeyHash> Cache;
+};
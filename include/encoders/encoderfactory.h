@@ -30,6 +30,12 @@ public:
 
   std::shared_ptr<Encoder> get(const std::string& chain);
 
+  // The chain with each transformation under its canonical name, so that
+  // aliases such as ASCII and US-ASCII compare equal. Invalid chains come
+  // back unchanged, for get() to report.
+  const std::string& canonical(const std::string& chain);
+
 private:
   std::map<std::string,std::shared_ptr<Encoder>> Cache;
+  std::map<std::string,std::string> Canonical;
 };
@@ -0,0 +1,198 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "basic.h"
+
+#include <iterator>
+#include <ostream>
+#include <vector>
+
+//
+// A read-only graph in compressed sparse row form. Adjacency lives in
+// two contiguous arrays indexed by per-vertex offsets, so a finished
+// Graph can be frozen once and then walked by the passes which only
+// relabel vertices without touching the edges.
+//
+template <class GraphType, class VertexType>
+class FrozenGraph: public GraphType
+{
+public:
+  typedef uint32_t VertexDescriptor;
+
+  typedef typename std::vector<VertexType>::size_type VertexSizeType;
+  typedef typename std::vector<VertexDescriptor>::size_type EdgeSizeType;
+
+  typedef VertexType Vertex;
+
+  class NeighborList {
+  public:
+    typedef VertexDescriptor const* ConstIterator;
+    typedef std::reverse_iterator<ConstIterator> ConstReverseIterator;
+
+    NeighborList(ConstIterator beg, ConstIterator end): Beg(beg), End(end) {}
+
+    ConstIterator begin() const { return Beg; }
+
+    ConstIterator end() const { return End; }
+
+    ConstReverseIterator rbegin() const {
+      return ConstReverseIterator(End);
+    }
+
+    ConstReverseIterator rend() const {
+      return ConstReverseIterator(Beg);
+    }
+
+  private:
+    ConstIterator Beg, End;
+  };
+
+  // passed to freeze a graph which is not needed afterwards
+  struct ReleaseEdges {};
+
+  template <class SrcGraph>
+  explicit FrozenGraph(const SrcGraph& g):
+    GraphType(g), InOff(1, 0), OutOff(1, 0)
+  {
+    copyEdges(g);
+    copyVertices(g);
+  }
+
+  // Freezes g, freeing its edges as soon as they are copied, so that the
+  // two graphs are never held in full at once. g is left without edges.
+  template <class SrcGraph>
+  FrozenGraph(SrcGraph& g, ReleaseEdges):
+    GraphType(g), InOff(1, 0), OutOff(1, 0)
+  {
+    copyEdges(g);
+    g.releaseEdges();
+    copyVertices(g);
+  }
+
+  //
+  // lookup & access
+  //
+
+  VertexDescriptor inVertex(VertexDescriptor tail, EdgeSizeType i) const {
+    return In[InOff[tail] + i];
+  }
+
+  VertexDescriptor outVertex(VertexDescriptor head, EdgeSizeType i) const {
+    return Out[OutOff[head] + i];
+  }
+
+  EdgeSizeType inDegree(VertexDescriptor tail) const {
+    return InOff[tail+1] - InOff[tail];
+  }
+
+  EdgeSizeType outDegree(VertexDescriptor head) const {
+    return OutOff[head+1] - OutOff[head];
+  }
+
+  VertexType& operator[](VertexDescriptor vd) {
+    return Vertices[vd];
+  }
+
+  const VertexType& operator[](VertexDescriptor vd) const {
+    return Vertices[vd];
+  }
+
+  NeighborList inVertices(VertexDescriptor tail) const {
+    return NeighborList(In.data() + InOff[tail], In.data() + InOff[tail+1]);
+  }
+
+  NeighborList outVertices(VertexDescriptor head) const {
+    return NeighborList(Out.data() + OutOff[head], Out.data() + OutOff[head+1]);
+  }
+
+  //
+  // capacity
+  //
+
+  VertexSizeType verticesSize() const {
+    return Vertices.size();
+  }
+
+  EdgeSizeType edgesSize() const {
+    return Out.size();
+  }
+
+  // roughly the bytes held by the graph
+  std::size_t memoryUsage() const {
+    return Vertices.capacity() * sizeof(VertexType) +
+           (InOff.capacity() + OutOff.capacity()) * sizeof(uint32_t) +
+           (In.capacity() + Out.capacity()) * sizeof(VertexDescriptor);
+  }
+
+private:
+  template <class SrcGraph>
+  void copyEdges(const SrcGraph& g) {
+    const VertexSizeType numVs = g.verticesSize();
+
+    InOff.reserve(numVs + 1);
+    OutOff.reserve(numVs + 1);
+    In.reserve(g.edgesSize());
+    Out.reserve(g.edgesSize());
+
+    for (VertexDescriptor v = 0; v < numVs; ++v) {
+      // preserve edge order, as it encodes priority
+      for (const VertexDescriptor h : g.inVertices(v)) {
+        In.push_back(h);
+      }
+      InOff.push_back(In.size());
+
+      for (const VertexDescriptor t : g.outVertices(v)) {
+        Out.push_back(t);
+      }
+      OutOff.push_back(Out.size());
+    }
+  }
+
+  template <class SrcGraph>
+  void copyVertices(const SrcGraph& g) {
+    const VertexSizeType numVs = g.verticesSize();
+
+    Vertices.reserve(numVs);
+    for (VertexDescriptor v = 0; v < numVs; ++v) {
+      Vertices.push_back(g[v]);
+    }
+  }
+
+  std::vector<VertexType> Vertices;
+  // uint32_t suffices, as Graph also numbers its edges with uint32_t
+  std::vector<uint32_t> InOff, OutOff;
+  std::vector<VertexDescriptor> In, Out;
+};
+
+template <class G, class V> std::ostream& operator<<(std::ostream& out, const FrozenGraph<G,V>& g) {
+  const typename FrozenGraph<G,V>::VertexSizeType vnum = g.verticesSize();
+
+  // print graph size
+  out << "|g| = " << vnum << '\n';
+
+  // print out edges for each vertex
+  for (typename FrozenGraph<G,V>::VertexDescriptor v = 0; v < vnum; ++v) {
+    for (const typename FrozenGraph<G,V>::VertexDescriptor t : g.outVertices(v)) {
+      out << v << " -> " << t << '\n';
+    }
+  }
+
+  return out;
+}
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "basic.h"
+#include "compile_observer.h"
 #include "nfabuilder.h"
 #include "nfaoptimizer.h"
 #include "encoders/encoderfactory.h"
 
 #include <memory>
+#include <string>
+#include <vector>
 
 class FSMThingy {
 public:
@@ -14,9 +17,44 @@ public:
   EncoderFactory EncFac;
   NFABuilder Nfab;
   NFAOptimizer Comp;
+  // the graph as patterns are added; once compiled, only Frozen is kept
   NFAPtr Fsm;
+  FrozenNFAPtr Frozen;
+
+  // receives progress and timings for adding patterns and compiling
+  CompileObserver Observer;
 
   void addPattern(const ParseTree& tree, const char* chain, uint32_t label);
 
-  void finalizeGraph(bool determinize);
+  // Adds a fixed string straight to the FSM, without parsing it. Returns
+  // false, leaving the FSM untouched, if the string must be parsed instead.
+  bool addFixedString(const std::string& text, bool caseInsensitive, const std::string& chain, uint32_t label);
+
+  // Sharing suffixes merges equivalent tails of the graph, those of
+  // different patterns included; the vertex count it started from is kept
+  // in UnsharedVertices, and compiling estimates UnsharedInstructions from
+  // Merged.
+  void finalizeGraph(bool determinize, bool shareSuffixes = false, uint32_t threads = 1);
+
+  // roughly the bytes held by the graphs and their transitions
+  uint64_t memoryUsage() const;
+
+  uint32_t UnsharedVertices,
+           UnsharedInstructions;
+
+  // with shared suffixes, the number of unshared vertices each vertex of
+  // the graph stands for; empty otherwise
+  std::vector<uint32_t> Merged;
+
+private:
+  void minimize(std::vector<uint32_t>* merged);
+
+  bool encodeFixedString(const std::string& text, bool caseInsensitive, const std::string& chain);
+
+  // these are temporaries we need for every fixed string
+  std::vector<int> TempCodePoints;
+  std::vector<Transition*> TempTrans;
+  std::vector<std::vector<ByteSet>> TempEncRanges;
+  std::vector<byte> TempBuf;
+  bool TempBranches;
 };
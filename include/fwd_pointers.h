@@ -35,6 +35,13 @@ typedef Graph<Properties, Glushkov, Empty, VectorFamily> NFA;
 
 typedef std::shared_ptr<NFA> NFAPtr;
 
+template <class GraphType, class VertexType>
+class FrozenGraph;
+
+typedef FrozenGraph<Properties, Glushkov> FrozenNFA;
+
+typedef std::shared_ptr<FrozenNFA> FrozenNFAPtr;
+
 class Program;
 
 typedef std::shared_ptr<Program> ProgramPtr;
@@ -316,6 +316,17 @@ public:
     Edges.clear();
   }
 
+  // removes all the edges, and frees the memory which held them
+  void releaseEdges() {
+    EList().swap(Edges);
+    Store = EdgeDescriptorStorage<EdgeDescriptor>();
+
+    const typename VList::iterator iend(Vertices.end());
+    for (typename VList::iterator i(Vertices.begin()); i != iend; ++i) {
+      i->In = i->Out = typename EdgeDescriptorStorage<EdgeDescriptor>::List();
+    }
+  }
+
   VertexDescriptor addVertex(const VertexType& v = VertexType()) {
     Vertices.emplace_back(v);
     return Vertices.size() - 1;
@@ -373,6 +384,14 @@ public:
     return Edges.capacity();
   }
 
+  // roughly the bytes held by the graph; each edge is on two lists
+  std::size_t memoryUsage() const {
+    return Vertices.capacity() * sizeof(VertexData) +
+           Edges.capacity() * sizeof(EdgeData) +
+           2 * Edges.size() * sizeof(EdgeDescriptor) +
+           Store.memoryUsage();
+  }
+
   void reserveVertices(VertexSizeType size) {
     return Vertices.reserve(size);
   }
@@ -28,6 +28,7 @@
 #include "fwd_pointers.h"
 #include "parsetree.h"
 #include "pattern_map.h"
+#include "ring.h"
 #include "vm_interface.h"
 #include "pattern.h"
 #include "decoders/decoderfactory.h"
@@ -46,12 +47,21 @@ struct FSMHandle {
 };
 
 struct ProgramHandle {
+  // memory into which a deserialized program points, if it owns any;
+  // declared first so that it outlives PMap and Prog
+  std::shared_ptr<void> Storage;
   std::unique_ptr<PatternMap> PMap;
   ProgramPtr Prog;
 };
 
 struct ContextHandle {
   std::shared_ptr<VmInterface> Impl;
+  // the patterns sharing each label, if any do
+  std::shared_ptr<const LabelFanOut> FanOut;
+};
+
+struct RingHandle {
+  std::unique_ptr<Ring> Impl;
 };
 
 struct DecoderHandle {
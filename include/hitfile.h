@@ -0,0 +1,158 @@
+#pragma once
+
+#include <lightgrep/api.h>
+
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+//
+// Binary hit files, written by "--output-format binary"
+//
+// A hit file is a header, the hits as fixed-size records, a table of the
+// paths searched, a table of the patterns, the strings for both tables,
+// and a trailer giving where each of those is. The records start right
+// after the header, so they can be written as the search goes and the
+// tables put after them once it is done. A reader finds the tables from
+// the trailer, at the end of the file.
+//
+// Every field is in the byte order of the machine which wrote the file
+// (little-endian for all the platforms we build on) and every part of the
+// file starts on an 8-byte boundary, so a reader can map the file and use
+// the records and tables where they lie.
+//
+//   HitFileHeader
+//   HitRecord      [NumHits]
+//   HitFileString  [NumPaths]      indexed by HitRecord::FileID
+//   HitFilePattern [NumPatterns]   indexed by HitRecord::PatternIndex
+//   strings        [StringsSize]   padded to 8 bytes
+//   HitFileTrailer
+//
+
+struct HitFileHeader {
+  char     Magic[8];
+  uint32_t Version;
+  uint32_t Flags;
+};
+
+struct HitRecord {
+  uint64_t Start,
+           End;
+  uint32_t PatternIndex,
+           FileID;
+};
+
+// a string in the strings section
+struct HitFileString {
+  uint64_t Offset,
+           Length;
+};
+
+struct HitFilePattern {
+  uint64_t      UserIndex;
+  HitFileString Pattern,
+                EncodingChain;
+};
+
+struct HitFileTrailer {
+  uint64_t NumHits,
+           PathsOffset,
+           NumPaths,
+           PatternsOffset,
+           NumPatterns,
+           StringsOffset,
+           StringsSize;
+  char     Magic[8];
+};
+
+static_assert(sizeof(HitFileHeader) == 16, "HitFileHeader is not packed");
+static_assert(sizeof(HitRecord) == 24, "HitRecord is not packed");
+static_assert(sizeof(HitFilePattern) == 40, "HitFilePattern is not packed");
+static_assert(sizeof(HitFileTrailer) == 64, "HitFileTrailer is not packed");
+
+//
+// Writes the parts of a hit file other than the records. The header goes
+// out on construction; the records are written by binaryHitWriter(), and
+// finish() writes the tables and the trailer once they are all out.
+//
+class HitFileWriter {
+public:
+  static constexpr uint32_t FORMAT_VERSION = 1;
+
+  // set when the paths should be printed with the hits, as for -H
+  static constexpr uint32_t PRINT_PATH = 1;
+
+  HitFileWriter(std::ostream& out, LG_HPROGRAM prog, uint32_t flags);
+
+  // Records a path searched, returning its file id; a path recorded
+  // before keeps its id. Safe to call from more than one thread.
+  uint32_t addPath(const std::string& path);
+
+  // Writes the tables and the trailer, given the number of records written
+  void finish(uint64_t numHits);
+
+private:
+  std::ostream& Out;
+  LG_HPROGRAM Prog;
+
+  std::mutex PathsLock;
+  std::vector<std::string> Paths;
+  std::unordered_map<std::string, uint32_t> PathIDs;
+};
+
+//
+// Reads a hit file in place, by mapping it
+//
+class HitFileReader {
+public:
+  // throws std::runtime_error if the file is not a hit file
+  explicit HitFileReader(const std::string& path);
+
+  // reads a hit file already in memory, which must outlive the reader
+  HitFileReader(const char* data, size_t size);
+
+  uint32_t flags() const { return Header->Flags; }
+
+  uint64_t numHits() const { return Trailer->NumHits; }
+
+  const HitRecord* hits() const { return Hits; }
+
+  uint64_t numPaths() const { return Trailer->NumPaths; }
+
+  std::string_view path(uint32_t fileID) const {
+    return string(Paths[fileID]);
+  }
+
+  uint64_t numPatterns() const { return Trailer->NumPatterns; }
+
+  const HitFilePattern& pattern(uint32_t patternIndex) const {
+    return Patterns[patternIndex];
+  }
+
+  std::string_view string(const HitFileString& s) const {
+    return std::string_view(Strings + s.Offset, s.Length);
+  }
+
+private:
+  void init(const char* data, size_t size);
+
+  boost::interprocess::file_mapping M;
+  boost::interprocess::mapped_region Region;
+
+  const HitFileHeader* Header;
+  const HitRecord* Hits;
+  const HitFileString* Paths;
+  const HitFilePattern* Patterns;
+  const char* Strings;
+  const HitFileTrailer* Trailer;
+};
+
+// Writes the hits in a hit file as the text search output would have
+void writeHitsAsText(const HitFileReader& in, std::ostream& out);
@@ -4,9 +4,62 @@
 #include <lightgrep/search_hit.h>
 #include <lightgrep/util.h>
 
+#include <charconv>
 #include <iosfwd>
 #include <string>
+#include <vector>
+
+class HitFileWriter;
+
+//
+// Collects formatted output and writes it to a stream in large pieces,
+// or whenever the searcher flushes it, as it does after each block.
+// Numbers are formatted with std::to_chars, which skips the locale and
+// stream state work of operator<< on a stream.
+//
+class HitBuffer {
+public:
+  explicit HitBuffer(std::ostream& out): Out(out) {
+    Buf.reserve(FLUSH_SIZE + 4096);
+  }
+
+  ~HitBuffer() { flush(); }
+
+  HitBuffer& operator<<(char c) {
+    Buf.push_back(c);
+    return *this;
+  }
+
+  HitBuffer& operator<<(const std::string& s) {
+    return write(s.data(), s.size());
+  }
+
+  HitBuffer& operator<<(const char* s) {
+    return write(s, std::char_traits<char>::length(s));
+  }
 
+  HitBuffer& operator<<(uint64_t n) {
+    char num[20];
+    return write(num, std::to_chars(num, num + sizeof(num), n).ptr - num);
+  }
+
+  HitBuffer& write(const char* s, size_t len) {
+    Buf.append(s, len);
+    if (Buf.size() >= FLUSH_SIZE) {
+      flush();
+    }
+    return *this;
+  }
+
+  // writes what has been collected to the stream
+  void flush();
+
+  static constexpr size_t FLUSH_SIZE = 1 << 16;
+
+private:
+  std::ostream& Out;
+  std::string Buf;
+};
 
 struct HitCounterInfo {
   HitCounterInfo(): NumHits(0) {}
@@ -18,6 +71,12 @@ struct HitCounterInfo {
   virtual void setPath(const std::string&) {}
 
   virtual void setBuffer(const char*, size_t, uint64_t) {}
+
+  // the next hit starts the output, so needs no group separator
+  virtual void resetGroups() {}
+
+  // writes out the hits collected so far
+  virtual void flush() {}
 };
 
 void nullWriter(void* userData, const LG_SearchHit* const);
@@ -26,9 +85,17 @@ struct HitWriterInfo: public HitCounterInfo {
   HitWriterInfo(std::ostream& outStream, const LG_HPROGRAM hProg):
     Out(outStream), Prog(hProg) {}
 
-  std::ostream& Out;
+  HitBuffer Out;
 
   const ProgramHandle* Prog;
+
+  // the user index, pattern, and encoding columns for each pattern,
+  // formatted on the first hit for the pattern
+  std::vector<std::string> Columns;
+
+  const std::string& columns(uint32_t patternIndex);
+
+  virtual void flush() override { Out.flush(); }
 };
 
 void hitWriter(void* userData, const LG_SearchHit* const hit);
@@ -76,6 +143,8 @@ struct LineContextHitWriterInfo: public HitWriterInfo {
     BufLen = blen;
     BufOff = boff;
   }
+
+  virtual void resetGroups() override { FirstHit = true; }
 };
 
 void lineContextHitWriter(void* userData, const LG_SearchHit* const hit);
@@ -96,6 +165,25 @@ struct LineContextPathWriterInfo: public LineContextHitWriterInfo {
 
 void lineContextPathWriter(void* userData, const LG_SearchHit* const hit);
 
+struct BinaryHitWriterInfo: public HitCounterInfo {
+  BinaryHitWriterInfo(std::ostream& outStream, HitFileWriter& file):
+    Out(outStream), File(file), FileID(0) {}
+
+  HitBuffer Out;
+
+  // holds the table of paths, shared by the threads writing to the file
+  HitFileWriter& File;
+
+  uint32_t FileID;
+
+  virtual void setPath(const std::string& path) override;
+
+  virtual void flush() override { Out.flush(); }
+};
+
+// writes a HitRecord for each hit; see hitfile.h
+void binaryHitWriter(void* userData, const LG_SearchHit* const hit);
+
 const char* find_leading_context(const char* const bbeg, const char* const hbeg, size_t lines);
 
 const char* find_trailing_context(const char* const hend, const char* const bend, size_t lines);
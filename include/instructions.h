@@ -36,7 +36,10 @@ enum OpCodes {
   LABEL_OP,
   MATCH_OP,
   HALT_OP,
-  ADJUST_START_OP
+  ADJUST_START_OP,
+  BIT_VECTOR_POOL_OP,
+  JUMP_TABLE_INDEX_OP,
+  COUNT_LOOP_OP
 };
 
 template<int OPCODE> struct InstructionSize { enum { VAL = 1 }; };
@@ -44,6 +47,7 @@ template<int OPCODE> struct InstructionSize { enum { VAL = 1 }; };
 template<> struct InstructionSize<BIT_VECTOR_OP> { enum { VAL = 9 }; };
 template<> struct InstructionSize<FORK_OP> { enum { VAL = 2 }; };
 template<> struct InstructionSize<JUMP_OP> { enum { VAL = 2 }; };
+template<> struct InstructionSize<COUNT_LOOP_OP> { enum { VAL = 3 }; };
 
 #pragma pack(push, 1)
 struct InstructionType1 {
@@ -81,6 +85,8 @@ struct Instruction {
     case FORK_OP:
     case JUMP_OP:
       return InstructionSize<FORK_OP>::VAL;
+    case COUNT_LOOP_OP:
+      return InstructionSize<COUNT_LOOP_OP>::VAL;
     default:
       return InstructionSize<HALT_OP>::VAL;
     }
@@ -103,6 +109,9 @@ struct Instruction {
   static Instruction makeBitVector();
   static Instruction makeJump(Instruction* ptr, uint32_t offset);
   static Instruction makeJumpTableRange(byte first, byte last);
+  static Instruction makeBitVectorPool(uint32_t offset);
+  static Instruction makeJumpTableIndex(byte first, byte last, byte numSlots);
+  static Instruction makeCountLoop(Instruction* ptr, uint32_t min, uint32_t max, uint32_t body);
   static Instruction makeLabel(uint32_t label);
   static Instruction makeMatch();
   static Instruction makeFork(Instruction* ptr, uint32_t offset);
@@ -31,11 +31,13 @@ extern "C" {
   struct FSMHandle;
   struct ProgramHandle;
   struct ContextHandle;
+  struct RingHandle;
 
   typedef struct PatternHandle*    LG_HPATTERN;
   typedef struct FSMHandle*        LG_HFSM;
   typedef struct ProgramHandle*    LG_HPROGRAM;
   typedef struct ContextHandle*    LG_HCONTEXT;
+  typedef struct RingHandle*       LG_HRING;
 
   // Options for pattern parsing
   typedef struct {
@@ -86,8 +88,48 @@ extern "C" {
   // Options for compiling patterns
   typedef struct {
     char Determinize;     // 0 => build NFA, non-zero => build (pseudo)DFA
+    char ShareSuffixes;   // non-zero => merge equivalent pattern tails
+    uint32_t Threads;     // threads for determinizing, at most one per
+                          // core; 0 or 1 => just the calling thread. The
+                          // program is the same for any number of threads.
   } LG_ProgramOptions;
 
+  // Phases of compiling patterns into a program
+  typedef enum {
+    LG_PHASE_PARSE,       // parsing patterns
+    LG_PHASE_BUILD,       // building an NFA for each pattern
+    LG_PHASE_MERGE,       // merging the pattern NFAs into the FSM
+    LG_PHASE_DETERMINIZE, // the subset construction
+    LG_PHASE_MINIMIZE,    // merging equivalent states
+    LG_PHASE_GUARDS,      // labeling guard states
+    LG_PHASE_FILTER,      // choosing the two-byte prefilter
+    LG_PHASE_CODEGEN,     // laying out and emitting instructions
+    LG_PHASE_COUNT
+  } LG_CompilePhase;
+
+  // Called as compiling moves along. Done counts the work finished in the
+  // phase so far, out of Total, or of an unknown amount if Total is 0.
+  // While adding patterns, the phase is LG_PHASE_MERGE and the work is
+  // counted in patterns; otherwise it is counted in states. Return non-zero
+  // to cancel: the call in progress fails, and the FSM should be destroyed.
+  typedef int (*LG_COMPILE_PROGRESS_FN)(void* userData,
+                                        LG_CompilePhase phase,
+                                        uint64_t done,
+                                        uint64_t total);
+
+  typedef struct {
+    double Seconds[LG_PHASE_COUNT];       // time spent in each phase
+    uint64_t PeakGrowth[LG_PHASE_COUNT];  // bytes by which each phase raised
+                                          // the peak resident memory of the
+                                          // process, 0 where not measured
+  } LG_CompileStats;
+
+  typedef struct {
+    LG_COMPILE_PROGRESS_FN Progress; // null => no progress reports
+    void* UserData;                  // passed through to Progress
+    LG_CompileStats Stats;           // added to by each call observed
+  } LG_CompileObserver;
+
 // TODO: nix these, don't expose trace in the lib
   typedef struct {
     uint64_t TraceBegin,    // starting offset of trace output
@@ -128,8 +170,30 @@ extern "C" {
 
   void lg_destroy_fsm(LG_HFSM hFsm);
 
+  // Attach an observer to the FSM, or detach it with null. Adding patterns
+  // to the FSM and compiling it report progress and add timings to the
+  // observer, which must outlive those calls. Memory is measured for the
+  // phases which work on the whole FSM, and across lg_add_pattern_list(),
+  // where it counts toward LG_PHASE_MERGE.
+  void lg_set_compile_observer(LG_HFSM hFsm, LG_CompileObserver* observer);
+
+  // Limit the memory used for adding patterns to the FSM and compiling it
+  // to about the given number of bytes; 0 => no limit, the default. The
+  // limit applies to estimates of what the graphs, transitions, and
+  // determinizer hold, not to all the memory the process uses. Going over
+  // it fails lg_add_pattern(), lg_add_pattern_list(), or
+  // lg_compile_program() with an error naming the pattern or phase, after
+  // which the FSM may only be destroyed.
+  void lg_set_memory_budget(LG_HFSM hFsm, uint64_t bytes);
+
+  // A short name for the phase, e.g., "determinize"
+  const char* lg_compile_phase_name(LG_CompilePhase phase);
+
   // Returns negative on failure; otherwise returns unique index for the
-  // pattern-encoding pair.
+  // pattern-encoding pair. A pattern added again with the same encoding
+  // and options gets a new index but shares the first one's match states,
+  // so it costs the FSM nothing; each hit on it is reported once for each
+  // index.
   int lg_add_pattern(LG_HFSM hFsm,
                      LG_HPROGRAM hProg,
                      LG_HPATTERN hPattern,
@@ -173,26 +237,81 @@ extern "C" {
 
   // Compile the FSM into the search logic held by a Program. Once a Program
   // has been compiled, it may no longer be altered and the FSM may be
-  // discarded.
-  int lg_compile_program(const LG_HFSM hFsm, LG_HPROGRAM hProg, const LG_ProgramOptions* options);
+  // discarded. Returns 0 on failure, and sets err if it is not null.
+  int lg_compile_program(const LG_HFSM hFsm, LG_HPROGRAM hProg, const LG_ProgramOptions* options, LG_Error** err);
+
+  // Combine compiled programs into one which searches for all of their
+  // patterns in a single pass, without parsing or compiling them again.
+  // The patterns of progs[0] keep their indices; those of each later
+  // program follow on, shifted up by the number of patterns before them.
+  // The programs linked are left as they were. Returns null on failure.
+  LG_HPROGRAM lg_link_programs(const LG_HPROGRAM* progs,
+                               unsigned int numProgs,
+                               LG_Error** err);
 
   // The size, in bytes, of the search program. Used for serialization.
   unsigned int lg_program_size(const LG_HPROGRAM hProg);
 
   // Serialize the program, in binary format, to a buffer. The buffer must be
-  // at least as large as lg_program_size() in bytes.
+  // at least as large as lg_program_size() in bytes. The format is versioned
+  // and checksummed, and can be searched in place, either from memory or
+  // from a file mapped with lg_map_program().
   void lg_write_program(const LG_HPROGRAM hProg, void* buffer);
 
   // Convert a buffer containing a serialized program to a program, given the
-  // binary buffer and size. No versioning check is done so don't keep these
-  // around too long. The caller is responsible for freeing the buffer after
-  // calling lg_destroy_program on the handle.
+  // binary buffer and size. The program uses the buffer in place, so the
+  // caller is responsible for freeing the buffer after calling
+  // lg_destroy_program on the handle. Returns null if the buffer does not
+  // hold a valid program of a supported version. The checksum is not
+  // checked; see lg_verify_program().
   LG_HPROGRAM lg_read_program(const void* buffer, int size);
 
+  // Map a file written from the output of lg_write_program() into memory
+  // and use it in place. Processes which map the same file share its pages,
+  // and only the pages searched are read. Returns null on failure.
+  LG_HPROGRAM lg_map_program(const char* path, LG_Error** err);
+
+  // Check a buffer written by lg_write_program() against its checksum,
+  // which reads the whole of it. Returns zero if the buffer is corrupt or
+  // not a program, positive otherwise.
+  int lg_verify_program(const void* buffer, uint64_t size, LG_Error** err);
+
   // A Program must live as long as any associated contexts,
   // so only call this at the end.
   void lg_destroy_program(LG_HPROGRAM hProg);
 
+  // Options for the compiled program cache
+  typedef struct {
+    const char* Directory; // directory in which cached programs are kept
+    uint64_t MaxSize;      // bytes of cached programs to retain, 0 => no limit
+  } LG_CacheOptions;
+
+  // Look up a program in the cache. The pattern lists are formatted as for
+  // lg_add_pattern_list(), and are keyed together with the default encodings,
+  // the key options, the program options, and the library version. Returns
+  // null if there is no matching program in the cache.
+  LG_HPROGRAM lg_load_cached_program(const LG_CacheOptions* cache,
+                                     const char** patternLists,
+                                     unsigned int patternListsNum,
+                                     const char** defaultEncodings,
+                                     unsigned int defaultEncodingsNum,
+                                     const LG_KeyOptions* defaultOptions,
+                                     const LG_ProgramOptions* progOptions);
+
+  // Store a compiled program in the cache under the same key as used by
+  // lg_load_cached_program(), then evict the least recently used programs
+  // until the cache is no larger than MaxSize. Returns zero on failure,
+  // positive otherwise.
+  int lg_store_cached_program(const LG_CacheOptions* cache,
+                              const LG_HPROGRAM hProg,
+                              const char** patternLists,
+                              unsigned int patternListsNum,
+                              const char** defaultEncodings,
+                              unsigned int defaultEncodingsNum,
+                              const LG_KeyOptions* defaultOptions,
+                              const LG_ProgramOptions* progOptions,
+                              LG_Error** err);
+
   // Create a "search context" from a program. Many search contexts can be
   // associated with a single program. A context lets you search a byte stream
   // and keeps track of the necessary state so that you can treat buffers as
@@ -255,6 +374,71 @@ extern "C" {
                          void* userData,
                          LG_HITCALLBACK_FN callbackFn);
 
+  //
+  // Shared-memory rings
+  //
+  // A ring lets producers in other processes on the same machine hand data
+  // to a searcher without copying it. The searcher creates a ring of
+  // fixed-size slots under a name; producers open it by that name, acquire
+  // a slot, fill it with a piece of a stream, and publish it. The searcher
+  // takes the slots in the order they were published, searches them in
+  // place, and releases them for reuse. Any number of producers may share
+  // a ring, but only one process may take slots from it.
+  //
+  // Each slot is described by the stream it belongs to and the offset of
+  // its data in that stream. The pieces of a stream must be published in
+  // order, and the last piece flagged with LG_RING_END_OF_STREAM.
+  //
+
+  #define LG_RING_END_OF_STREAM 1
+
+  typedef struct {
+    char*    Data;     // the slot's memory
+    uint64_t Position; // the slot's place in the ring, set by the ring
+    uint64_t StreamID; // the stream to which the data belongs
+    uint64_t Offset;   // offset of the data in the stream
+    uint32_t Length;   // bytes of data; the slot size, from lg_ring_acquire()
+    uint32_t Flags;    // LG_RING_END_OF_STREAM for the last piece of a stream
+  } LG_RingSlot;
+
+  // Create a ring of numSlots slots, each of slotSize bytes, replacing any
+  // ring by the same name. The name is removed when the ring is destroyed.
+  // Returns null on failure.
+  LG_HRING lg_create_ring(const char* name,
+                          unsigned int numSlots,
+                          unsigned int slotSize,
+                          LG_Error** err);
+
+  // Open a ring created by another process. Returns null on failure.
+  LG_HRING lg_open_ring(const char* name, LG_Error** err);
+
+  void lg_destroy_ring(LG_HRING hRing);
+
+  unsigned int lg_ring_slot_size(LG_HRING hRing);
+
+  // Wait for a free slot, for a producer to fill. Returns zero if the ring
+  // has been closed, positive otherwise.
+  int lg_ring_acquire(LG_HRING hRing, LG_RingSlot* slot);
+
+  // Hand a filled slot to the searcher. Length, StreamID, Offset, and Flags
+  // must be set. Returns zero on failure, positive otherwise.
+  int lg_ring_publish(LG_HRING hRing, const LG_RingSlot* slot, LG_Error** err);
+
+  // Stop producers from acquiring any more slots. Slots already acquired
+  // may still be published.
+  void lg_ring_close(LG_HRING hRing);
+
+  // Wait for the next published slot, for the searcher. Returns zero once
+  // the ring is closed and every slot published has been taken, positive
+  // otherwise. Slots acquired but not published within a second of the
+  // searcher finding the ring closed, as by a producer which died, are
+  // skipped, as are slots published with a Length over the slot size.
+  int lg_ring_next(LG_HRING hRing, LG_RingSlot* slot);
+
+  // Return a slot taken with lg_ring_next() to the producers. Returns zero
+  // on failure, positive otherwise.
+  int lg_ring_release(LG_HRING hRing, const LG_RingSlot* slot, LG_Error** err);
+
 #ifdef __cplusplus
 }
 #endif
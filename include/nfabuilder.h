@@ -23,11 +23,13 @@
 #include "fragment.h"
 
 #include <stack>
+#include <string>
 
 struct ParseNode;
 class Encoder;
 class ParseTree;
 class TransitionFactory;
+struct EncodedClass;
 
 class NFABuilder {
 public:
@@ -38,6 +40,9 @@ public:
   void callback(const ParseNode& n);
 
   void setEncoder(const std::shared_ptr<Encoder>& e);
+
+  // Naming the chain lets charClass share fragments process-wide
+  void setEncoder(const std::shared_ptr<Encoder>& e, const std::string& chain);
   void setSizeHint(uint64_t reserveSize);
 
   void alternate(const ParseNode& n);
@@ -77,10 +82,20 @@ private:
 
   void traverse(const ParseNode* root);
 
+  // large repetitions of single bytes become counted vertices
+  bool countable(const ParseNode& n);
+  bool encodesToOneByte(const ParseNode& n);
+  void counted(const ParseNode& n);
+
+  void encodeClass(const ParseNode& n, const UnicodeSet& uset);
+  std::shared_ptr<const EncodedClass> makeEncodedClass(NFA::VertexDescriptor first) const;
+  void addEncodedClass(const EncodedClass& frag, const ParseNode& n);
+
   bool IsGood;
   uint32_t CurLabel;
   uint64_t ReserveSize;
   std::shared_ptr<Encoder> Enc;
+  std::string Chain;
   NFAPtr Fsm;
   std::shared_ptr<TransitionFactory> TransFac;
 
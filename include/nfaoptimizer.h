@@ -20,6 +20,7 @@
 
 #include "basic.h"
 #include "automata.h"
+#include "compile_observer.h"
 
 #include <map>
 #include <set>
@@ -32,20 +33,31 @@ public:
 
   void mergeIntoFSM(NFA& dst, const NFA& src);
 
-  void labelGuardStates(NFA& g);
+  template <class GraphType>
+  void labelGuardStates(GraphType& g);
 
-  void propagateMatchLabels(NFA& g);
-  void removeNonMinimalLabels(NFA& g);
+  template <class GraphType>
+  void propagateMatchLabels(GraphType& g);
 
-  void subsetDFA(NFA& dst, const NFA& src);
+  template <class GraphType>
+  void removeNonMinimalLabels(GraphType& g);
+
+  // threads > 1 expands subset states in parallel; the result is the same
+  void subsetDFA(NFA& dst, const NFA& src, uint32_t threads = 1, CompileObserver obs = CompileObserver());
+
+  // If merged is given, merged[v] is set to the number of vertices of src
+  // which became vertex v of dst
+  void minimizeDFA(NFA& dst, const NFA& src, std::vector<uint32_t>* merged = nullptr);
 
   void pruneBranches(NFA& g);
 
   StatePair processChild(const NFA& src, NFA& dst, uint32_t si, NFA::VertexDescriptor srcHead, NFA::VertexDescriptor dstHead);
 
-  bool canMerge(const NFA& dst, NFA::VertexDescriptor dstTail, const Transition* dstTrans, ByteSet& dstBits, const NFA& src, NFA::VertexDescriptor srcTail, const ByteSet& srcBits) const;
+  bool canMerge(const NFA& dst, NFA::VertexDescriptor dstTail, const Transition* dstTrans, const NFA& src, NFA::VertexDescriptor srcTail, const Transition* srcTrans) const;
 
 private:
+  void parallelSubsetDFA(NFA& dst, const NFA& src, uint32_t threads, CompileObserver obs);
+
   std::map<NFA::VertexDescriptor, std::vector<NFA::VertexDescriptor>> Dst2Src;
   std::vector<NFA::VertexDescriptor> Src2Dst;
   std::stack<EdgePair> Edges;
@@ -23,6 +23,7 @@ public:
     SAMPLES,
     VALIDATE,
     SERVER,
+    CONVERT,
     SHOW_VERSION,
     SHOW_HELP,
     LIST_ENCODINGS,
@@ -31,7 +32,10 @@ public:
 
   std::string Output,
               ProgramFile,
-              GroupSeparator;
+              CacheDir,
+              GroupSeparator,
+              SocketPath,
+              RingName;
 
   std::vector<std::string> Inputs,
                            InputLists,
@@ -39,7 +43,16 @@ public:
                            KeyFiles,
                            Encodings;
 
-  uint32_t BlockSize;
+  uint32_t BlockSize,
+           ReadAhead,
+           Threads,
+           CompileThreads,
+           RingSlots;
+
+  uint16_t Port;
+
+  uint64_t CacheSize,
+           MemoryBudget;
 
   int32_t BeforeContext = -1,
           AfterContext = -1;
@@ -49,10 +62,16 @@ public:
        UnicodeMode,
        NoOutput,
        Determinize,
+       ShareSuffixes,
+       CompileStats,
        PrintPath,
        Recursive,
        Binary,
-       MemoryMapped;
+       MemoryMapped,
+       IoUring,
+       DirectIO,
+       MmapPopulate,
+       BinaryOutput;
 
   mutable std::ofstream OutputFile;
 
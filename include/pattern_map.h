@@ -2,16 +2,27 @@
 
 #include <istream>
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "lightgrep/api.h"
 
+// The patterns which hit under each label, for a program in which some
+// patterns share one: those for label l are Patterns[Begin[l]] up to
+// Patterns[Begin[l+1]], in the order they were added
+struct LabelFanOut {
+  std::vector<uint32_t> Begin, Patterns;
+};
+
 class PatternMap {
 public:
 // TODO: make this private
   std::vector<LG_PatternInfo> Patterns;
 
-  PatternMap(unsigned int sizeHint): Patterns(), Shared(false) {
+  static const uint32_t NOLABEL = 0xFFFFFFFF;
+
+  PatternMap(unsigned int sizeHint): Patterns(), Shared(false), NumLabels(0) {
     Patterns.reserve(sizeHint);
   }
 
@@ -26,17 +37,65 @@ public:
 
   void addPattern(const char* pattern, const char* chain, uint64_t index);
 
+  // Adds a pattern which hits under label: numLabels() for a pattern unlike
+  // any before it, or the label of the pattern it duplicates. A non-empty
+  // key identifies the pattern to labelOf().
+  void addPattern(const char* pattern, const char* chain, uint64_t index, uint32_t label, const std::string& key = std::string());
+
+  // The label of the pattern added with key, or NOLABEL if there is none
+  uint32_t labelOf(const std::string& key) const;
+
+  // Forgets the keys, which are needed only while patterns are added
+  void clearKeys();
+
+  uint32_t numLabels() const {
+    return Labels.empty() ? Patterns.size() : NumLabels;
+  }
+
+  // The label under which the program reports hits on the pattern
+  uint32_t label(uint32_t pattern) const {
+    return Labels.empty() ? pattern : Labels[pattern];
+  }
+
+  // The label of each pattern; empty when each pattern has its own
+  const std::vector<uint32_t>& labels() const { return Labels; }
+
+  // Sets the label of each pattern, e.g., as read from a program file.
+  // Throws unless the labels are numbered in order of first use.
+  void setLabels(const uint32_t* labels);
+
+  // null when each pattern has its own label
+  std::shared_ptr<const LabelFanOut> fanOut() const;
+
   size_t bufSize() const;
   std::vector<char> marshall() const;
 
   static std::unique_ptr<PatternMap> unmarshall(const void* buf, size_t len);
 
+  // Fixed-size pattern table entry used by the mappable program format.
+  // The strings are stored as offsets into a separate string table.
+  struct TableEntry {
+    uint64_t Pattern, EncodingChain, UserIndex;
+  };
+
+  void marshallTable(std::vector<TableEntry>& table, std::vector<char>& strings) const;
+
+  // The resulting PatternMap points into strings, which the caller must
+  // keep alive for as long as the PatternMap.
+  static std::unique_ptr<PatternMap> unmarshallTable(const TableEntry* table, size_t num, const char* strings);
+
   bool operator==(const PatternMap& rhs) const;
 
 private:
   void usePattern(const char* pattern, const char* chain, uint64_t index);
 
   bool Shared;
+
+  std::vector<uint32_t> Labels;
+  uint32_t NumLabels;
+
+  // label by key, for finding duplicates while patterns are added
+  std::unordered_map<std::string, uint32_t> Keys;
 };
 
 bool operator==(const LG_PatternInfo& lhs, const LG_PatternInfo& rhs);
@@ -142,18 +142,34 @@ public:
     return sizeof(MaxLabel) +
            sizeof(MaxCheck) +
            sizeof(FilterOff) +
-           Filter.size()/8 +
+           FilterBytes +
            size()*sizeof(Instruction);
   }
 
   std::vector<char> marshall() const;
   static ProgramPtr unmarshall(const void* buf, size_t len);
 
+  // Filter bits packed eight to a byte, least significant bit first
+  static const size_t FilterBytes = 256*256/8;
+
+  void packFilter(char* dst) const;
+  void unpackFilter(const char* src);
+
+  // Creates a Program which uses instructions held elsewhere. The caller
+  // must keep the instructions alive for as long as the Program.
+  static ProgramPtr view(const Instruction* ibeg, size_t icount);
+
 private:
   std::unique_ptr<Instruction[], void(*)(Instruction*)> IBeg;
   Instruction* IEnd;
 };
 
+// Joins compiled programs into one which runs them all from a shared start,
+// as though their graphs had been united at the root. The labels of
+// progs[i] are shifted up by labelOffsets[i], and their checked states
+// are renumbered so that no two programs share one.
+ProgramPtr linkPrograms(const std::vector<const Program*>& progs, const std::vector<uint32_t>& labelOffsets);
+
 std::ostream& operator<<(std::ostream& out, const Program& prog);
 
 std::istream& operator>>(std::istream& in, Program& prog);
@@ -0,0 +1,61 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "lightgrep/api.h"
+
+#include "basic.h"
+
+#include <string>
+
+//
+// The compiled program cache stores serialized programs in a directory,
+// one file per distinct set of pattern lists and options. Files are named
+// for a hash of the cache key and carry the whole key, so a hash collision
+// is a miss rather than a wrong program.
+//
+
+// Builds the cache key: the library version, the program options, and each
+// pattern line with any omitted columns filled in from the defaults.
+std::string programCacheKey(
+  const char** patternLists,
+  size_t patternListsNum,
+  const char** defaultEncodings,
+  size_t defaultEncodingsNum,
+  const LG_KeyOptions& defaultOptions,
+  const LG_ProgramOptions& progOptions
+);
+
+// The path of the cache file for the given key.
+std::string programCachePath(const std::string& dir, const std::string& key);
+
+// Returns the cached program for the key, or null if there is none.
+LG_HPROGRAM loadCachedProgram(const std::string& dir, const std::string& key);
+
+// Writes the program to the cache, then evicts the least recently used
+// programs until the cache holds no more than maxSize bytes (0 => no limit).
+void storeCachedProgram(
+  const std::string& dir,
+  const std::string& key,
+  const LG_HPROGRAM hProg,
+  uint64_t maxSize
+);
+
+void evictCachedPrograms(const std::string& dir, uint64_t maxSize);
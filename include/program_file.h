@@ -0,0 +1,87 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "lightgrep/api.h"
+
+#include "basic.h"
+
+#include <string>
+
+//
+// The program file format holds a compiled program in a form which can
+// be searched in place, whether read into memory or mapped from disk.
+// All sections are aligned, so the instructions, the filter, and the
+// pattern table are used directly; only the pattern table's string
+// offsets are converted to pointers, in a single pass.
+//
+// Layout: header, filter bits, instructions, pattern table, strings,
+// and, when some patterns share a label, the label of each pattern.
+// Values are in host byte order; ByteOrder detects a mismatch.
+//
+
+struct ProgramFileHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t ByteOrder;
+  uint64_t Size;            // of the whole file
+  uint64_t Checksum;        // of the whole file, taken with this zeroed;
+                            // checked only by verifyProgramFile()
+  uint32_t MaxLabel;
+  uint32_t MaxCheck;
+  uint32_t FilterOff;
+  uint32_t Reserved;
+  uint64_t FilterPos;
+  uint64_t InstructionsPos;
+  uint64_t InstructionsNum;
+  uint64_t PatternsPos;
+  uint64_t PatternsNum;
+  uint64_t StringsPos;
+  uint64_t StringsSize;
+  uint64_t LabelsPos;       // 0 => each pattern has its own label
+};
+
+// version 2 added pooled bit vectors and indexed jump tables, version 3
+// counted loops, version 4 pattern labels, and version 5 tails shared
+// between patterns, whose CheckHalts hold one thread per label. Older
+// files lack only these, so they still load.
+static const uint32_t PROGRAM_FILE_VERSION = 5;
+static const uint32_t PROGRAM_FILE_MIN_VERSION = 1;
+
+uint64_t programFileSize(const ProgramHandle& hProg);
+
+void writeProgramFile(const ProgramHandle& hProg, void* buf);
+
+// Whether the buffer starts with a program file header
+bool isProgramFile(const void* buf, size_t size);
+
+// Checks the checksum of the whole program file. Throws if it does not
+// match, or the header is not valid.
+void verifyProgramFile(const void* buf, size_t size);
+
+// Creates a program which uses the buffer in place, so the buffer must
+// outlive the program. Throws if the buffer is not a valid program file.
+// Only the header and the pattern tables are checked, so that the pages
+// of the instructions are not read until they are searched.
+LG_HPROGRAM readProgramFile(const void* buf, size_t size);
+
+// Maps a program file, starting at offset, read-only into memory. The
+// returned program owns the mapping.
+LG_HPROGRAM mapProgramFile(const std::string& path, uint64_t offset = 0);
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
+#include <exception>
 #include <future>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
@@ -15,30 +22,160 @@ public:
   virtual std::future<std::pair<const char*, size_t>> read(size_t len) = 0;
 };
 
+//
+// Reads a file on a thread of its own, which stays depth - 1 blocks
+// ahead of the searcher in a ring of depth blocks. Each call to read()
+// returns the next block; the block returned by the call before the
+// previous one may then be refilled, so a caller may search one block
+// while waiting for the next, as with any Reader. Blocks are aligned
+// to pages.
+//
+// Direct I/O reads around the page cache, in blocks which must be whole
+// sectors; where the file system won't, what was read is dropped from
+// the cache instead.
+//
 class FileReader: public Reader {
 public:
-  FileReader(const std::string& path, size_t blockSize);
+  static const uint32_t DEFAULT_DEPTH = 4;
+
+  // the largest sector size in common use
+  static const size_t DIRECT_ALIGNMENT = 4096;
+
+  FileReader(const std::string& path, size_t blockSize, uint32_t depth = DEFAULT_DEPTH, bool direct = false);
 
   virtual ~FileReader();
 
+  // len must be the block size
   virtual std::future<std::pair<const char*, size_t>> read(size_t len) override;
 
 private:
+  void fill();
+
+  std::pair<const char*, size_t> wait(uint64_t block);
+
+  const size_t BlockSize, Stride;
+  const uint32_t Depth;
+  std::unique_ptr<char[], void(*)(char*)> Ring;
+  std::vector<size_t> Lengths;
+
+  bool Direct;
   FILE* File;
-  std::unique_ptr<char[]> Cur, Next;
+  const bool DropCache;
+
+  std::mutex Lock;
+  std::condition_variable Filled, Freed;
+
+  // blocks filled by the thread, returned by read(), and free to refill
+  uint64_t NumFilled, NumRead, NumFree;
+  bool End, Stop;
+  std::exception_ptr Error;
+
+  std::thread Thread;
 };
 
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+class IoUring;
+
+//
+// Reads a regular file or block device with io_uring, keeping a read in
+// flight for each block of a ring like FileReader's, without a thread of
+// its own. The ring's blocks are registered with the kernel when it
+// allows, so that it reads into them without mapping them for each read.
+// Direct I/O works as for FileReader. Use openFileReader() to fall back
+// to FileReader where io_uring won't do.
+//
+class IoUringReader: public Reader {
+public:
+  IoUringReader(const std::string& path, size_t blockSize, uint32_t depth = FileReader::DEFAULT_DEPTH, bool direct = false);
+
+  virtual ~IoUringReader();
+
+  // len must be the block size
+  virtual std::future<std::pair<const char*, size_t>> read(size_t len) override;
+
+private:
+  void submit(uint64_t block, size_t done);
+
+  void submitUpTo(uint64_t end);
+
+  void reap(bool wait);
+
+  // waits for the reads in flight, so the blocks may be freed
+  void drain();
+
+  std::pair<const char*, size_t> wait(uint64_t block);
+
+  const size_t BlockSize, Stride;
+  const uint32_t Depth;
+  std::unique_ptr<char[], void(*)(char*)> Ring;
+
+  // bytes read into each block so far, and whether all have been
+  std::vector<size_t> Lengths;
+  std::vector<bool> Done;
+
+  bool Direct, DropCache;
+  int Fd;
+  uint64_t Size, NumBlocks;
+
+  std::unique_ptr<IoUring> Uring;
+  bool Fixed;
+
+  // blocks whose reads were submitted and returned by read()
+  uint64_t NumSubmitted, NumRead;
+  uint32_t InFlight;
+};
+
+#endif
+
+// Opens a FileReader, or an IoUringReader if ioUring is set and io_uring
+// works for the input, which it won't for stdin, pipes, or a kernel or
+// sandbox without it
+std::unique_ptr<Reader> openFileReader(const std::string& path, size_t blockSize, uint32_t depth, bool ioUring, bool direct = false);
+
 namespace bip = boost::interprocess;
 
+//
+// Maps a file a block at a time rather than all at once, so that huge
+// inputs need little address space. Of the depth blocks mapped, the
+// caller has the last two returned, and the rest, ahead of them, are
+// advised as needed soon; each block is dropped on the call to read()
+// after the one which found the caller done with it. Populating
+// prefaults each block as it's mapped.
+//
+// A caller which reads back from a block into those before it, as
+// context output does for hits which started in an earlier block, needs
+// the file mapped whole, with each block right after the one before;
+// populating then prefaults all of it.
+//
 class MemoryMappedFileReader: public Reader {
 public:
-  MemoryMappedFileReader(const std::string& path);
+  MemoryMappedFileReader(const std::string& path, uint32_t depth = FileReader::DEFAULT_DEPTH, bool populate = false, bool whole = false);
 
+  // len must be the same for every call
   virtual std::future<std::pair<const char*, size_t>> read(size_t len) override;
 
 private:
+  void map(size_t len);
+
   bip::file_mapping M;
-  bip::mapped_region R;
-  const char* Buf;
-  const char* const Bend;
+  const uint64_t Size;
+  const uint32_t Depth;
+  const bool Populate, Whole;
+
+  // the whole file, if mapped whole, and how much has been returned
+  bip::mapped_region File;
+  uint64_t Returned;
+
+  // the blocks mapped, from the oldest the caller may still have; the
+  // first Given of them were returned by read()
+  std::deque<bip::mapped_region> Blocks;
+  uint32_t Given;
+  uint64_t MappedEnd;
 };
@@ -0,0 +1,98 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "lightgrep/api.h"
+
+#include <chrono>
+#include <string>
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+//
+// A ring of fixed-size slots in POSIX shared memory, through which
+// producers in other processes hand pieces of streams to a searcher
+// without copying them.
+//
+// The ring is a bounded multi-producer, single-consumer queue. Each slot
+// has a sequence number saying whose turn it is: a slot at position p is
+// free for the producer which claims p when its sequence is p, ready for
+// the searcher when it is p + 1, and free again for position p + NumSlots
+// once the searcher releases it. Producers claim positions by advancing
+// Head; the searcher takes them in order from Tail. Waiters sleep on the
+// Published and Released counters, with futexes on Linux.
+//
+class Ring {
+public:
+  struct Header;
+  struct Descriptor;
+
+  // Creates a ring, replacing any ring by that name; the name is removed
+  // when the ring is destroyed
+  static Ring* create(const std::string& name, uint32_t numSlots, uint32_t slotSize);
+
+  // Opens a ring created by another process
+  static Ring* open(const std::string& name);
+
+  ~Ring();
+
+  uint32_t numSlots() const;
+
+  uint32_t slotSize() const;
+
+  // Waits for a free slot, returning false if the ring is closed
+  bool acquire(LG_RingSlot& slot);
+
+  void publish(const LG_RingSlot& slot);
+
+  // Waits for the next published slot, returning false once the ring is
+  // closed and every slot published has been taken. Slots not published
+  // within a second of the searcher finding the ring closed are
+  // skipped, as are slots published with a bad length.
+  bool next(LG_RingSlot& slot);
+
+  void release(const LG_RingSlot& slot);
+
+  // Stops producers from acquiring any more slots
+  void close();
+
+private:
+  Ring(const std::string& name, bool owner);
+
+  void init();
+
+  Descriptor& descriptor(uint64_t pos) const;
+
+  const std::string Name;
+  const bool Owner;
+
+  boost::interprocess::shared_memory_object Shm;
+  boost::interprocess::mapped_region Region;
+
+  Header* Hdr;
+  Descriptor* Descs;
+  char* Slots;
+
+  // whether the searcher has found the ring closed, and when it then stops
+  // waiting for slots which were acquired but not published
+  bool SawClosed;
+  std::chrono::steady_clock::time_point GiveUpAt;
+};
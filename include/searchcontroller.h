@@ -5,10 +5,17 @@
 
 #include <lightgrep/api.h>
 
+#include <string>
+
 class SearchController {
 public:
-  SearchController(uint32_t blkSize):
+  SearchController(uint32_t blkSize, uint32_t readDepth = FileReader::DEFAULT_DEPTH, bool ioUring = false, bool directIO = false, bool mmapPopulate = false, bool mmapWhole = false):
     BlockSize(blkSize),
+    ReadDepth(readDepth),
+    IoUring(ioUring),
+    DirectIO(directIO),
+    MmapPopulate(mmapPopulate),
+    MmapWhole(mmapWhole),
     BytesSearched(0),
     TotalTime(0.0) {}
 
@@ -19,7 +26,40 @@ public:
     LG_HITCALLBACK_FN callback
   );
 
+  // Opens the input, a path or "-" for stdin, and searches it from the
+  // start with a reset context
+  bool searchInput(
+    const std::string& input,
+    bool mmapped,
+    ContextHandle* searcher,
+    HitCounterInfo* hinfo,
+    LG_HITCALLBACK_FN callback
+  );
+
+  // Searches the slots producers publish to the ring in place, until it is
+  // closed, with a context for each stream. The hits of a stream are
+  // reported with its id as the path.
+  void searchRing(
+    LG_HRING ring,
+    LG_HPROGRAM prog,
+    const LG_ContextOptions& ctxOpts,
+    HitCounterInfo* hinfo,
+    LG_HITCALLBACK_FN callback
+  );
+
   size_t BlockSize;
+  // blocks in the ring of a FileReader, or mapped by a
+  // MemoryMappedFileReader
+  uint32_t ReadDepth;
+  // whether to read files with io_uring, where it works
+  bool IoUring;
+  // whether to read files around the page cache
+  bool DirectIO;
+  // whether to prefault memory-mapped blocks
+  bool MmapPopulate;
+  // whether to map files whole, for hit writers which read back into
+  // the blocks before a hit's
+  bool MmapWhole;
   uint64_t BytesSearched;
   double TotalTime;
 };
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "hitwriter.h"
+#include "searchcontroller.h"
+
+#include <lightgrep/api.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Searches whole files on a pool of threads, each with its own context
+// over the shared program. Each thread writes the hits for a file to a
+// buffer of its own, which goes to the output in one piece once the file
+// is done, so the hits for a file stay together and in order. A file with
+// more hits than the buffer holds spills them to a temporary file until
+// it is done.
+//
+class SearchPool {
+public:
+  // makes the hit info for a thread, writing to the given stream
+  typedef std::function<std::unique_ptr<HitCounterInfo>(std::ostream&)> HitInfoMaker;
+
+  SearchPool(
+    ProgramHandle* prog,
+    const LG_ContextOptions& ctxOpts,
+    uint32_t numThreads,
+    const SearchController& ctrl,
+    bool mmapped,
+    std::ostream& out,
+    const std::string& groupSeparator,
+    LG_HITCALLBACK_FN callback,
+    HitInfoMaker makeHitInfo
+  );
+
+  ~SearchPool();
+
+  // Queues an input for searching, waiting while the queue is full
+  void push(const std::string& input);
+
+  // Waits for the queued inputs to be searched and stops the threads.
+  // Rethrows the first error any thread had.
+  void finish();
+
+  uint64_t BytesSearched;
+  uint64_t NumHits;
+
+private:
+  class FileOutput;
+
+  void work(HitInfoMaker makeHitInfo);
+
+  bool pop(std::string& input);
+
+  void write(const std::string& hits);
+
+  ProgramHandle* Prog;
+  const LG_ContextOptions CtxOpts;
+  // copied for each thread, for its settings
+  const SearchController Ctrl;
+  const bool MemoryMapped;
+
+  // written between the hits for files when printing context, as a
+  // single thread would
+  const std::string GroupSeparator;
+  const LG_HITCALLBACK_FN Callback;
+
+  std::mutex QueueLock;
+  std::condition_variable QueueNotEmpty, QueueNotFull;
+  std::deque<std::string> Queue;
+  bool Done;
+
+  std::mutex OutLock;
+  std::ostream& Out;
+  bool Wrote;
+
+  std::exception_ptr Error;
+
+  std::vector<std::thread> Threads;
+};
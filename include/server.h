@@ -0,0 +1,131 @@
+#pragma once
+
+#include <lightgrep/api.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+// A daemon which searches byte streams sent to it over TCP or a Unix
+// domain socket with a program loaded once, for "-c server"
+//
+// A client sends requests, each a 26-byte header followed, for SEARCH, by
+// Length bytes of data. The header is packed little-endian ("<BBQQQ" to
+// Python's struct):
+//
+//   uint8  Cmd
+//   uint8  Type          reserved, 0
+//   uint64 ID            the stream
+//   uint64 StartOffset   offset of the data in the stream
+//   uint64 Length        bytes of data following
+//
+// A client may interleave any number of streams, each in as many pieces
+// as it likes, but the pieces of a stream must be sent in order. Each
+// stream is searched with a context of its own, taken from a pool shared
+// by the connections, and the data is searched as it arrives, so nothing
+// is buffered but the results.
+//
+// A client may have at most MAX_CLIENT_STREAMS streams open at once, and
+// the server MAX_STREAMS across all its clients. A SEARCH which would
+// start a stream past either limit is answered with REFUSED, and its data
+// is skipped; the client may try the stream again once it has ended
+// others.
+//
+// The server answers with 32-byte ServerReply records. A client which
+// stops reading them is not read from in turn once a few MB of them are
+// waiting, so a slow client holds back only itself.
+//
+class SearchServer {
+public:
+  enum Commands {
+    SEARCH   = 0,  // Length bytes of data for stream ID
+    END      = 1,  // stream ID is done; its last hits follow
+    HANGUP   = 2,  // end the client's streams and close the connection
+    SHUTDOWN = 3,  // end all streams and stop the server
+    REFUSED  = 4   // sent for a SEARCH whose stream could not be started
+  };
+
+  static constexpr size_t MAX_CLIENT_STREAMS = 1024;
+  static constexpr size_t MAX_STREAMS = 1 << 16;
+
+  static constexpr uint16_t DEFAULT_PORT = 12777;
+
+  // Listens on 127.0.0.1:port, unless port is 0, and on the Unix domain
+  // socket at socketPath, unless it is empty
+  SearchServer(
+    ProgramHandle* prog,
+    const LG_ContextOptions& ctxOpts,
+    uint16_t port,
+    const std::string& socketPath
+  );
+
+  ~SearchServer();
+
+  // Serves clients until one sends SHUTDOWN
+  void run();
+
+  uint64_t BytesSearched;
+  uint64_t NumHits;
+  uint64_t NumStreams;
+
+private:
+  struct Connection;
+
+  void listenOn(int fd);
+
+  void accept(int listener);
+
+  void read(Connection& conn);
+
+  void handle(Connection& conn, const char* buf, size_t len);
+
+  void request(Connection& conn);
+
+  void write(Connection& conn);
+
+  void watch(Connection& conn);
+
+  void endStream(Connection& conn, uint64_t id);
+
+  void endStreams(Connection& conn);
+
+  void drop(int fd);
+
+  static void onHit(void* userData, const LG_SearchHit* const hit);
+
+  void shutdown();
+
+  ProgramHandle* Prog;
+  const LG_ContextOptions CtxOpts;
+
+  const std::string SocketPath;
+
+  int Epoll;
+  std::vector<int> Listeners;
+
+  std::unordered_map<int, std::unique_ptr<Connection>> Connections;
+
+  // contexts not in use by a stream
+  std::vector<ContextHandle*> Contexts;
+  // streams open across all connections
+  size_t OpenStreams;
+
+  std::unique_ptr<char[]> ReadBuf;
+
+  bool Stopping;
+};
+
+// sent by the server
+struct ServerReply {
+  uint8_t  Cmd;          // SEARCH for a hit, END, HANGUP, or REFUSED
+  uint8_t  Reserved[3];
+  uint32_t PatternIndex; // the pattern hit, for lg_pattern_info()
+  uint64_t ID,           // the stream
+           Start,        // the hit, for SEARCH, or the data skipped, for REFUSED
+           End;
+};
+
+static_assert(sizeof(ServerReply) == 32, "ServerReply is not packed");
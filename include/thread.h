@@ -37,6 +37,7 @@ struct Thread {
     Id(0),
     #endif
     Label(label),
+    Count(0),
     Lead(false) {}
 
   #ifdef LBT_TRACE_ENABLED
@@ -47,6 +48,7 @@ struct Thread {
     End(end),
     Id(id),
     Label(label),
+    Count(0),
     Lead(false) {}
   #endif
 
@@ -73,6 +75,8 @@ struct Thread {
   uint64_t Id;
   #endif
   uint32_t Label;
+  // bytes consumed so far by the counted repetition the thread is in
+  uint16_t Count;
   bool Lead;
 
 //  uint32_t Dummy;
@@ -89,7 +93,7 @@ struct Thread {
   #endif
 
   bool operator==(const Thread& x) const {
-    return PC == x.PC && Label == x.Label &&
+    return PC == x.PC && Label == x.Label && Count == x.Count &&
            Start == x.Start && End == x.End;
   }
 };
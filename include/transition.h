@@ -30,12 +30,19 @@ public:
 
   virtual const byte* allowed(const byte* beg, const byte* end) const = 0;
 
-  virtual ByteSet& getBytes(ByteSet& bs) const {
-    bs.reset();
-    return orBytes(bs);
+  // The accepted bytes are fixed at construction, so callers get them
+  // without a virtual call or rebuilding the set.
+  const ByteSet& bytes() const { return Bytes; }
+
+  ByteSet& getBytes(ByteSet& bs) const {
+    return bs = Bytes;
+  }
+
+  ByteSet& orBytes(ByteSet& bs) const {
+    bs |= Bytes;
+    return bs;
   }
 
-  virtual ByteSet& orBytes(ByteSet& bs) const = 0;
   virtual byte type() const = 0;
   virtual size_t objSize() const = 0;
   virtual Transition* clone(void* buffer = 0) const = 0;
@@ -43,7 +50,19 @@ public:
   virtual bool toInstruction(Instruction* addr) const = 0;
   virtual std::string label() const = 0;
 
+protected:
+  Transition(const Transition& x): Bytes(x.Bytes) {}
+
+  ByteSet Bytes;
+
 private:
-  Transition(const Transition&) {}
   Transition& operator=(const Transition&) {return *this;}
 };
+
+// A counted repetition of a single-byte transition. A vertex carrying one
+// consumes its own transition once, then Loop until it has consumed
+// between Min and Max bytes in all.
+struct Repetition {
+  uint32_t Min, Max;
+  Transition* Loop;
+};
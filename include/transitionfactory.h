@@ -19,8 +19,13 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <functional>
+#include <map>
 #include <memory>
-#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 #include "byteset.h"
 #include "transition.h"
@@ -28,8 +33,9 @@
 
 class TransitionFactory {
 public:
-  TransitionFactory():
-    Byte(0), Either(0, 0), Range(0, 0), BSet(ByteSet()) {}
+  TransitionFactory() {
+    Bytes.fill(nullptr);
+  }
 
   ~TransitionFactory() {
     std::for_each(Exemplars.begin(), Exemplars.end(),
@@ -37,34 +43,46 @@ public:
   }
 
   Transition* getByte(byte b) {
-    Byte.Byte = b;
-    return get(&Byte);
+    // single bytes are the common case, so they get a direct table
+    Transition*& t = Bytes[b];
+    if (!t) {
+      t = keep(new ByteState(b));
+    }
+    return t;
   }
 
   Transition* getEither(byte b1, byte b2) {
-    Either.Byte1 = b1;
-    Either.Byte2 = b2;
-    return get(&Either);
+    Transition*& t = Eithers[(b1 << 8) | b2];
+    if (!t) {
+      t = keep(new EitherState(b1, b2));
+    }
+    return t;
   }
 
   Transition* getRange(byte first, byte last) {
-    Range.First = first;
-    Range.Last = last;
-    return get(&Range);
+    Transition*& t = Ranges[(first << 8) | last];
+    if (!t) {
+      t = keep(new RangeState(first, last));
+    }
+    return t;
   }
 
   Transition* getByteSet(const ByteSet& bset) {
-    BSet.Allowed = bset;
-    return get(&BSet);
+    Transition*& t = ByteSets[bset];
+    if (!t) {
+      t = keep(new ByteSetState(bset));
+    }
+    return t;
   }
 
   Transition* getByteSet(const UnicodeSet& bset) {
     // NB: This should be used *only* when we intend to intersect
     // the input set with [0x00,0xFF].
+    ByteSet bs;
     for (uint32_t i = 0; i < 256; ++i) {
-      BSet.Allowed.set(i, bset.test(i));
+      bs.set(i, bset.test(i));
     }
-    return get(&BSet);
+    return getByteSet(bs);
   }
 
   template <class SetType>
@@ -123,17 +141,45 @@ public:
     return getByteSet(bset);
   }
 
+  Repetition* getRepetition(uint32_t min, uint32_t max, Transition* loop) {
+    std::unique_ptr<Repetition>& r = Repetitions[std::make_tuple(min, max, loop)];
+    if (!r) {
+      r.reset(new Repetition{min, max, loop});
+    }
+    return r.get();
+  }
+
+  // roughly the bytes held by the factory; ByteSetState is the largest
+  // Transition, and each table entry costs about two pointers besides
+  std::size_t memoryUsage() const {
+    const std::size_t entry = 2 * sizeof(void*) + sizeof(Transition*);
+    return sizeof(*this) +
+           Exemplars.capacity() * sizeof(Transition*) +
+           Exemplars.size() * sizeof(ByteSetState) +
+           (Eithers.size() + Ranges.size()) * (entry + sizeof(uint16_t)) +
+           ByteSets.size() * (entry + sizeof(ByteSet)) +
+           Repetitions.size() * (entry + sizeof(Repetition) +
+             sizeof(std::tuple<uint32_t, uint32_t, Transition*>));
+  }
+
 private:
-  Transition* get(Transition* t) {
-    auto i = Exemplars.find(t);
-    return i == Exemplars.end() ? *Exemplars.insert(t->clone()).first : *i;
+  struct ByteSetHash {
+    size_t operator()(const ByteSet& bs) const {
+      return std::hash<std::bitset<256>>()(bs);
+    }
+  };
+
+  Transition* keep(Transition* t) {
+    Exemplars.push_back(t);
+    return t;
   }
 
-  std::set<Transition*,TransitionComparator> Exemplars;
+  // owns every interned Transition
+  std::vector<Transition*> Exemplars;
 
-  // Local states so we don't have to create one on each lookup
-  ByteState Byte;
-  EitherState Either;
-  RangeState Range;
-  ByteSetState BSet;
+  // lookup tables, keyed by the Transition's own data
+  std::array<Transition*, 256> Bytes;
+  std::unordered_map<uint16_t, Transition*> Eithers, Ranges;
+  std::unordered_map<ByteSet, Transition*, ByteSetHash> ByteSets;
+  std::map<std::tuple<uint32_t, uint32_t, Transition*>, std::unique_ptr<Repetition>> Repetitions;
 };
@@ -20,6 +20,7 @@
 
 #include "basic.h"
 
+#include <array>
 #include <string>
 #include <vector>
 
@@ -53,9 +54,40 @@ uint32_t estimateGraphSize(const std::vector<T>& keywords) {
   return ret;
 }
 
-std::pair<uint32_t,std::bitset<256*256>> bestPair(const NFA& graph);
+template <class GraphType>
+std::pair<uint32_t,std::bitset<256*256>> bestPair(const GraphType& graph);
 
-std::vector<std::vector<NFA::VertexDescriptor>> pivotStates(NFA::VertexDescriptor source, const NFA& graph);
+// The out vertices of a state grouped by the bytes leading to them. The
+// targets on byte b are Targets[Begin[b], Begin[b+1]), in edge order. A
+// table can be refilled for one state after another without allocating
+// once its buffers have grown.
+struct PivotTable {
+  std::array<uint32_t,257> Begin;
+  std::vector<NFA::VertexDescriptor> Targets;
+  // scratch for pivotStates(); Seen is all false between calls
+  std::vector<NFA::VertexDescriptor> Outs;
+  std::vector<bool> Seen;
+
+  const NFA::VertexDescriptor* begin(uint32_t b) const {
+    return Targets.data() + Begin[b];
+  }
+
+  const NFA::VertexDescriptor* end(uint32_t b) const {
+    return Targets.data() + Begin[b+1];
+  }
+
+  uint32_t size(uint32_t b) const { return Begin[b+1] - Begin[b]; }
+
+  bool empty(uint32_t b) const { return Begin[b+1] == Begin[b]; }
+
+  uint32_t maxOutbound() const;
+};
+
+template <class GraphType>
+void pivotStates(NFA::VertexDescriptor source, const GraphType& graph, PivotTable& tbl);
+
+template <class GraphType>
+std::vector<std::vector<NFA::VertexDescriptor>> pivotStates(NFA::VertexDescriptor source, const GraphType& graph);
 
 uint32_t maxOutbound(const std::vector<std::vector<NFA::VertexDescriptor>>& tranTable);
 
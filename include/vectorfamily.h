@@ -24,6 +24,7 @@
 #include <initializer_list>
 #include <limits>
 #include <type_traits>
+#include <utility>
 
 template <typename T>
 class VectorFamily {
@@ -207,6 +208,12 @@ public:
     }
   }
 
+  // the bytes held for lists of more than one element, apart from the
+  // elements themselves
+  std::size_t memoryUsage() const {
+    return Store.capacity() * sizeof(Vec);
+  }
+
 private:
   typename List::const_iterator begin_few(const List& l) const { return &l.What; }
 
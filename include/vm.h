@@ -20,6 +20,7 @@
 
 #include <bitset>
 #include <set>
+#include <unordered_set>
 #include <vector>
 
 #include "basic.h"
@@ -72,6 +73,12 @@ private:
   void _markLive(const uint32_t label);
   bool _liveCheck(const uint64_t start, const uint32_t label) const;
 
+  bool _checkTaken(const uint32_t check, const uint32_t label) const;
+  void _takeCheck(const uint32_t check, const uint32_t label);
+
+  bool _loopTaken(const uint32_t loop, const uint32_t count, const uint32_t label) const;
+  void _takeLoop(const uint32_t loop, const uint32_t count, const uint32_t label);
+
   bool _execute(const Instruction* const base, ThreadList::iterator t, const byte* const cur) const;
 
   template <uint32_t X>
@@ -119,7 +126,34 @@ private:
              Active,
              Next;
 
+  // the checked states taken at this offset, each by the label of the
+  // first thread to take it; a state shared by the tails of several
+  // patterns is taken for each of their labels apart, and any taken for a
+  // second label are kept in SharedChecks
   SparseSet CheckLabels;
+  std::vector<uint32_t> CheckOwners;
+  std::unordered_set<uint64_t> SharedChecks;
+
+  // the counted repetitions gone around at this offset, by loop, count,
+  // and label; a thread going around a loop behind another with the same
+  // count and label can only repeat its work, so it is held like a thread
+  // at a CheckHalt
+  struct LoopKey {
+    uint32_t Loop, Count, Label;
+
+    bool operator==(const LoopKey& x) const {
+      return Loop == x.Loop && Count == x.Count && Label == x.Label;
+    }
+  };
+
+  struct LoopKeyHash {
+    size_t operator()(const LoopKey& k) const {
+      return std::hash<uint64_t>()((uint64_t(k.Loop) << 32) | k.Count) ^
+             std::hash<uint32_t>()(k.Label);
+    }
+  };
+
+  std::unordered_set<LoopKey, LoopKeyHash> LoopChecks;
 
   bool LiveNoLabel;
   SparseSet Live;
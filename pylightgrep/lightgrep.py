@@ -187,11 +187,17 @@ class KeyOpts(Structure):
 
 
 class ProgOpts(Structure):
-    _fields_ = [("Determinize", c_char)]
+    _fields_ = [
+        ("Determinize", c_char),
+        ("ShareSuffixes", c_char),
+        ("Threads", c_uint32)
+    ]
 
-    def __init__(self, shouldDet = True):
+    def __init__(self, shouldDet = True, shareSuffixes = False, threads = 0):
         super().__init__()
         self.Determinize = char_cast_bool(shouldDet)
+        self.ShareSuffixes = char_cast_bool(shareSuffixes)
+        self.Threads = threads
 
 
 class CtxOpts(Structure):
@@ -296,6 +302,11 @@ class Fsm(Handle):
         _LG.lg_destroy_fsm(self.handle)
         super().close()
 
+    def set_memory_budget(self, size):
+        if size < 0:
+            raise ValueError(f"Memory budget must be >= 0, but was {size}")
+        _LG.lg_set_memory_budget(self.get(), size)
+
     def add_pattern(self, prog, pat, enc, userIdx):
         with Error() as err:
             idx = _LG.lg_add_pattern(self.get(), prog.get(), pat.get(), enc.encode("utf-8"), userIdx, byref(err.get()))
@@ -319,26 +330,33 @@ class Fsm(Handle):
 
 
 class Program(Handle):
-    def __init__(self, arg, shared=False):
+    def __init__(self, arg):
+        self.buf = None
         if isinstance(arg, int):
             # nonnegative ints create fresh programs
             if arg < 0:
                 raise ValueError(f"Size hint must be >= 0, but was {arg}")
             handle = _LG.lg_create_program(arg)
         else:
-            # buffers unserialize programs
-            c_buf = buf_beg(arg, c_char)
-            handle = _LG.lg_read_program(c_buf, len(arg)) if shared else _LG.lg_read_program(c_buf, len(arg))
+            # buffers unserialize programs, which use them in place; the
+            # view keeps the buffer alive, and unresized, as long as we are
+            self.buf = memoryview(arg)
+            c_buf = buf_beg(self.buf, c_char)
+            handle = _LG.lg_read_program(c_buf, self.buf.nbytes)
 
         super().__init__(handle)
 
     def close(self):
         _LG.lg_destroy_program(self.handle)
         super().close()
+        if self.buf is not None:
+            self.buf.release()
+            self.buf = None
 
     def compile(self, fsm, opts):
-        if _LG.lg_compile_program(fsm.get(), self.get(), byref(opts)) == 0:
-            raise RuntimeError(f"Failed to compile program")
+        with Error() as err:
+            if _LG.lg_compile_program(fsm.get(), self.get(), byref(opts), byref(err.get())) == 0:
+                raise RuntimeError(f"Failed to compile program: {err}")
 
     def count(self):
         return _LG.lg_pattern_count(self.get())
@@ -497,6 +515,9 @@ _LG.lg_create_fsm.restype = c_void_p
 _LG.lg_destroy_fsm.argtypes = [c_void_p]
 _LG.lg_destroy_fsm.restype = None
 
+_LG.lg_set_memory_budget.argtypes = [c_void_p, c_uint64]
+_LG.lg_set_memory_budget.restype = None
+
 _LG.lg_add_pattern.argtypes = [c_void_p, c_void_p, c_void_p, c_char_p, c_int, POINTER(POINTER(Err))]
 _LG.lg_add_pattern.restype = c_int
 
@@ -512,7 +533,7 @@ _LG.lg_pattern_info.restype = POINTER(PatternInfo)
 _LG.lg_create_program.argtypes = [c_uint]
 _LG.lg_create_program.restype = c_void_p
 
-_LG.lg_compile_program.argtypes = [c_void_p, c_void_p, POINTER(ProgOpts)]
+_LG.lg_compile_program.argtypes = [c_void_p, c_void_p, POINTER(ProgOpts), POINTER(POINTER(Err))]
 _LG.lg_compile_program.restype = c_int
 
 _LG.lg_program_size.argtypes = [c_void_p]
@@ -2,6 +2,7 @@
 
 import array
 import ctypes
+import gc
 import mmap
 import unittest
 
@@ -302,6 +303,28 @@ class ProgTests(unittest.TestCase):
                 self.assertEqual(prog2.count(), prog1.count())
                 self.assertEqual(prog2.size(), prog1.size())
 
+    def test_read_keeps_buffer(self):
+        with lightgrep.Program(0) as prog1:
+            with lightgrep.Pattern() as pat:
+                with lightgrep.Fsm(0) as fsm:
+                    pat.parse("a+b", lightgrep.KeyOpts())
+                    fsm.add_pattern(prog1, pat, 'UTF-8', 42)
+                    prog1.compile(fsm, lightgrep.ProgOpts())
+
+            # the program uses the bytes in place, and holds onto them
+            prog2 = lightgrep.Program(bytes(prog1.write()))
+            gc.collect()
+            self.assertEqual(prog2.count(), prog1.count())
+            self.assertEqual(prog2.size(), prog1.size())
+
+            # a bytearray can't be resized under it
+            buf = prog1.write()
+            with lightgrep.Program(buf) as prog3:
+                with self.assertRaises(BufferError):
+                    buf.extend(b'x')
+            buf.extend(b'x')
+            prog2.close()
+
 
 class ContextSimpleTests(unittest.TestCase):
     def test_ctor_prog_closed(self):
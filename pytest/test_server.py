@@ -0,0 +1,201 @@
+#!/usr/bin/python3
+
+# Drives "lightgrep -c server" over its Unix domain socket, as a client
+# would. Run from the build directory, or with LIGHTGREP set to the binary.
+
+import os
+import socket
+import struct
+import subprocess
+import tempfile
+import time
+import unittest
+
+
+LIGHTGREP = os.environ.get('LIGHTGREP', 'src/cmd/lightgrep')
+
+HEADER = struct.Struct('<BBQQQ')
+REPLY = struct.Struct('<B3xIQQQ')
+
+SEARCH, END, HANGUP, SHUTDOWN, REFUSED = range(5)
+
+MAX_CLIENT_STREAMS = 1024
+
+
+class Client:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.settimeout(30)
+        self.sock.connect(path)
+        self.buf = b''
+
+    def close(self):
+        self.sock.close()
+
+    def search(self, id, data, offset=0):
+        self.sock.sendall(HEADER.pack(SEARCH, 0, id, offset, len(data)) + data)
+
+    def end(self, id):
+        self.sock.sendall(HEADER.pack(END, 0, id, 0, 0))
+
+    def hangup(self):
+        self.sock.sendall(HEADER.pack(HANGUP, 0, 0, 0, 0))
+
+    def shutdown(self):
+        self.sock.sendall(HEADER.pack(SHUTDOWN, 0, 0, 0, 0))
+
+    def reply(self):
+        while len(self.buf) < REPLY.size:
+            more = self.sock.recv(1 << 16)
+            if not more:
+                return None
+            self.buf += more
+        r = REPLY.unpack(self.buf[:REPLY.size])
+        self.buf = self.buf[REPLY.size:]
+        return r
+
+    def replies_until(self, cmd, id=None):
+        # replies up to and including the first cmd for id
+        got = []
+        while True:
+            r = self.reply()
+            if r is None:
+                raise EOFError('server hung up')
+            got.append(r)
+            if r[0] == cmd and (id is None or r[2] == id):
+                return got
+
+
+def hits(replies, id):
+    return sorted((r[3], r[4], r[1]) for r in replies if r[0] == SEARCH and r[2] == id)
+
+
+class ServerTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.dir.name, 'lg.sock')
+        self.server = subprocess.Popen(
+            [LIGHTGREP, '-c', 'server', '--port', '0', '--socket', self.path,
+             '-p', 'needle', '-p', 'hay+stack'],
+            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE
+        )
+        for _ in range(300):
+            if os.path.exists(self.path):
+                break
+            self.assertIsNone(self.server.poll(), 'the server did not start')
+            time.sleep(0.1)
+        else:
+            self.fail('the server did not listen on ' + self.path)
+
+    def tearDown(self):
+        if self.server.poll() is None:
+            self.server.kill()
+        self.server.wait()
+        self.server.stderr.close()
+        self.dir.cleanup()
+
+    def stop(self):
+        c = Client(self.path)
+        c.shutdown()
+        self.assertIsNone(c.reply())
+        c.close()
+        self.assertEqual(0, self.server.wait(timeout=30))
+        return self.server.stderr.read().decode()
+
+    def test_interleaved_streams(self):
+        c = Client(self.path)
+        # hits straddle the pieces of each stream
+        c.search(1, b'xxnee')
+        c.search(2, b'hayyy')
+        c.search(1, b'dlexx', 5)
+        c.search(2, b'ystack', 5)
+        c.search(1, b'needle', 10)
+        c.end(2)
+        c.end(1)
+
+        got = c.replies_until(END, 1)
+        self.assertEqual([(2, 8, 0), (10, 16, 0)], hits(got, 1))
+        self.assertEqual([(0, 11, 1)], hits(got, 2))
+        # stream 2 was ended first, and its hits came before its END
+        ends = [r[2] for r in got if r[0] == END]
+        self.assertEqual([2, 1], ends)
+        for id in (1, 2):
+            last = max(i for i, r in enumerate(got) if r[0] == SEARCH and r[2] == id)
+            self.assertLess(last, [i for i, r in enumerate(got) if r[0] == END and r[2] == id][0])
+
+        # an ended stream's ID starts a new stream
+        c.search(1, b'needle')
+        c.end(1)
+        self.assertEqual([(0, 6, 0)], hits(c.replies_until(END, 1), 1))
+
+        c.hangup()
+        self.assertEqual(HANGUP, c.replies_until(HANGUP)[-1][0])
+        self.assertIsNone(c.reply())
+        c.close()
+
+        self.assertIn('3 streams', self.stop())
+
+    def test_connections_are_separate(self):
+        a = Client(self.path)
+        b = Client(self.path)
+        a.search(7, b'nee')
+        b.search(7, b'dle')
+        a.search(7, b'dle', 3)
+        a.end(7)
+        b.end(7)
+        self.assertEqual([(0, 6, 0)], hits(a.replies_until(END, 7), 7))
+        self.assertEqual([], hits(b.replies_until(END, 7), 7))
+        a.close()
+        b.close()
+        self.stop()
+
+    def test_stream_limit(self):
+        c = Client(self.path)
+        for id in range(MAX_CLIENT_STREAMS):
+            c.search(id, b'x')
+        # one stream too many is refused, and its data skipped
+        c.search(MAX_CLIENT_STREAMS, b'needle', 100)
+        c.search(0, b'needle', 1)
+        c.end(0)
+        got = c.replies_until(END, 0)
+        self.assertIn((REFUSED, 0, MAX_CLIENT_STREAMS, 100, 106), got)
+        self.assertEqual([], hits(got, MAX_CLIENT_STREAMS))
+        self.assertEqual([(1, 7, 0)], hits(got, 0))
+
+        # with a stream ended, there is room for another
+        c.search(MAX_CLIENT_STREAMS, b'needle')
+        c.end(MAX_CLIENT_STREAMS)
+        got = c.replies_until(END, MAX_CLIENT_STREAMS)
+        self.assertNotIn(REFUSED, [r[0] for r in got])
+        self.assertEqual([(0, 6, 0)], hits(got, MAX_CLIENT_STREAMS))
+        c.close()
+        self.stop()
+
+    def test_shutdown_ends_open_streams(self):
+        a = Client(self.path)
+        a.search(1, b'xneedle')
+        a.search(2, b'haysta')
+        a.search(2, b'ck', 6)
+
+        b = Client(self.path)
+        b.shutdown()
+        self.assertIsNone(b.reply())
+        b.close()
+
+        got = []
+        while True:
+            r = a.reply()
+            if r is None:
+                break
+            got.append(r)
+        a.close()
+
+        self.assertEqual([(1, 7, 0)], hits(got, 1))
+        self.assertEqual([(0, 8, 1)], hits(got, 2))
+        self.assertEqual([1, 2], sorted(r[2] for r in got if r[0] == END))
+        self.assertEqual(0, self.server.wait(timeout=30))
+        self.assertFalse(os.path.exists(self.path))
+
+
+if __name__ == '__main__':
+    unittest.main()
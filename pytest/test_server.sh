@@ -0,0 +1,5 @@
+#!/bin/bash -e
+
+if [ -e src/cmd/lightgrep ]; then
+  pytest/test_server.py -v
+fi
@@ -0,0 +1,201 @@
+#include "hitfile.h"
+#include "hitwriter.h"
+
+#include <cstring>
+#include <filesystem>
+#include <ostream>
+#include <stdexcept>
+
+namespace bip = boost::interprocess;
+
+namespace {
+  const char HEADER_MAGIC[8] = {'L', 'G', 'H', 'I', 'T', 'S', '\0', '\0'};
+  const char TRAILER_MAGIC[8] = {'L', 'G', 'H', 'I', 'T', 'E', 'N', 'D'};
+
+  const char PADDING[8] = {};
+
+  uint64_t padded(uint64_t n) {
+    return (n + 7) & ~uint64_t(7);
+  }
+
+  template <typename T>
+  void writeRaw(std::ostream& out, const T& t) {
+    out.write(reinterpret_cast<const char*>(&t), sizeof(t));
+  }
+
+  // adds a string to the strings section
+  HitFileString addString(std::string& strings, const char* s, size_t len) {
+    const HitFileString ret{strings.size(), len};
+    strings.append(s, len);
+    return ret;
+  }
+
+  void badFile(const char* why) {
+    throw std::runtime_error(std::string("not a lightgrep hit file: ") + why);
+  }
+}
+
+HitFileWriter::HitFileWriter(std::ostream& out, LG_HPROGRAM prog, uint32_t flags):
+  Out(out), Prog(prog)
+{
+  HitFileHeader hdr;
+  std::memcpy(hdr.Magic, HEADER_MAGIC, sizeof(hdr.Magic));
+  hdr.Version = FORMAT_VERSION;
+  hdr.Flags = flags;
+  writeRaw(Out, hdr);
+}
+
+uint32_t HitFileWriter::addPath(const std::string& path) {
+  std::lock_guard<std::mutex> lock(PathsLock);
+  const auto i = PathIDs.emplace(path, Paths.size());
+  if (i.second) {
+    Paths.push_back(path);
+  }
+  return i.first->second;
+}
+
+void HitFileWriter::finish(uint64_t numHits) {
+  std::string strings;
+
+  std::vector<HitFileString> paths;
+  paths.reserve(Paths.size());
+  for (const std::string& p : Paths) {
+    paths.push_back(addString(strings, p.data(), p.size()));
+  }
+
+  const unsigned int numPatterns = lg_pattern_count(Prog);
+  std::vector<HitFilePattern> patterns;
+  patterns.reserve(numPatterns);
+  for (unsigned int i = 0; i < numPatterns; ++i) {
+    const LG_PatternInfo* info = lg_pattern_info(Prog, i);
+    patterns.push_back(HitFilePattern{
+      info->UserIndex,
+      addString(strings, info->Pattern, std::strlen(info->Pattern)),
+      addString(strings, info->EncodingChain, std::strlen(info->EncodingChain))
+    });
+  }
+
+  HitFileTrailer tr;
+  tr.NumHits = numHits;
+  tr.PathsOffset = sizeof(HitFileHeader) + numHits * sizeof(HitRecord);
+  tr.NumPaths = paths.size();
+  tr.PatternsOffset = tr.PathsOffset + paths.size() * sizeof(HitFileString);
+  tr.NumPatterns = patterns.size();
+  tr.StringsOffset = tr.PatternsOffset + patterns.size() * sizeof(HitFilePattern);
+  tr.StringsSize = strings.size();
+  std::memcpy(tr.Magic, TRAILER_MAGIC, sizeof(tr.Magic));
+
+  Out.write(reinterpret_cast<const char*>(paths.data()), paths.size() * sizeof(HitFileString));
+  Out.write(reinterpret_cast<const char*>(patterns.data()), patterns.size() * sizeof(HitFilePattern));
+  Out.write(strings.data(), strings.size());
+  Out.write(PADDING, padded(strings.size()) - strings.size());
+  writeRaw(Out, tr);
+  Out.flush();
+}
+
+HitFileReader::HitFileReader(const std::string& path) {
+  if (std::filesystem::file_size(path) < sizeof(HitFileHeader) + sizeof(HitFileTrailer)) {
+    badFile("too short");
+  }
+
+  M = bip::file_mapping(path.c_str(), bip::read_only);
+  Region = bip::mapped_region(M, bip::read_only);
+  Region.advise(bip::mapped_region::advice_sequential);
+  init(static_cast<const char*>(Region.get_address()), Region.get_size());
+}
+
+HitFileReader::HitFileReader(const char* data, size_t size) {
+  init(data, size);
+}
+
+void HitFileReader::init(const char* data, size_t size) {
+  if (size < sizeof(HitFileHeader) + sizeof(HitFileTrailer)) {
+    badFile("too short");
+  }
+
+  Header = reinterpret_cast<const HitFileHeader*>(data);
+  if (std::memcmp(Header->Magic, HEADER_MAGIC, sizeof(Header->Magic))) {
+    badFile("bad header");
+  }
+
+  if (Header->Version != HitFileWriter::FORMAT_VERSION) {
+    badFile("unknown version");
+  }
+
+  Trailer = reinterpret_cast<const HitFileTrailer*>(data + size - sizeof(HitFileTrailer));
+  if (std::memcmp(Trailer->Magic, TRAILER_MAGIC, sizeof(Trailer->Magic))) {
+    badFile("bad trailer, perhaps the search did not finish");
+  }
+
+  // the sections must follow one another as the writer put them; the
+  // counts are checked by division so that they cannot overflow
+  const uint64_t end = size - sizeof(HitFileTrailer);
+  if (Trailer->PathsOffset < sizeof(HitFileHeader) ||
+      Trailer->PathsOffset > end ||
+      (Trailer->PathsOffset - sizeof(HitFileHeader)) / sizeof(HitRecord) != Trailer->NumHits ||
+      Trailer->PatternsOffset < Trailer->PathsOffset ||
+      Trailer->PatternsOffset > end ||
+      (Trailer->PatternsOffset - Trailer->PathsOffset) / sizeof(HitFileString) != Trailer->NumPaths ||
+      Trailer->StringsOffset < Trailer->PatternsOffset ||
+      Trailer->StringsOffset > end ||
+      (Trailer->StringsOffset - Trailer->PatternsOffset) / sizeof(HitFilePattern) != Trailer->NumPatterns ||
+      end - Trailer->StringsOffset != padded(Trailer->StringsSize))
+  {
+    badFile("bad section offsets");
+  }
+
+  Hits = reinterpret_cast<const HitRecord*>(data + sizeof(HitFileHeader));
+  Paths = reinterpret_cast<const HitFileString*>(data + Trailer->PathsOffset);
+  Patterns = reinterpret_cast<const HitFilePattern*>(data + Trailer->PatternsOffset);
+  Strings = data + Trailer->StringsOffset;
+
+  const auto inStrings = [this](const HitFileString& s) {
+    return s.Offset <= Trailer->StringsSize &&
+           s.Length <= Trailer->StringsSize - s.Offset;
+  };
+
+  for (uint64_t i = 0; i < numPaths(); ++i) {
+    if (!inStrings(Paths[i])) {
+      badFile("bad path");
+    }
+  }
+
+  for (uint64_t i = 0; i < numPatterns(); ++i) {
+    if (!inStrings(Patterns[i].Pattern) || !inStrings(Patterns[i].EncodingChain)) {
+      badFile("bad pattern");
+    }
+  }
+}
+
+void writeHitsAsText(const HitFileReader& in, std::ostream& out) {
+  // format the columns for each pattern once, as HitWriterInfo does
+  std::vector<std::string> columns;
+  columns.reserve(in.numPatterns());
+  for (uint64_t i = 0; i < in.numPatterns(); ++i) {
+    const HitFilePattern& p = in.pattern(i);
+    columns.push_back(
+      std::to_string(p.UserIndex) + '\t' +
+      std::string(in.string(p.Pattern)) + '\t' +
+      std::string(in.string(p.EncodingChain))
+    );
+  }
+
+  const bool printPath = in.flags() & HitFileWriter::PRINT_PATH;
+
+  HitBuffer buf(out);
+  const HitRecord* const end = in.hits() + in.numHits();
+  for (const HitRecord* h = in.hits(); h != end; ++h) {
+    if (h->FileID >= in.numPaths() || h->PatternIndex >= in.numPatterns()) {
+      badFile("bad hit record");
+    }
+
+    if (printPath) {
+      const std::string_view path(in.path(h->FileID));
+      buf.write(path.data(), path.size()) << '\t';
+    }
+
+    buf << h->Start << '\t'
+        << h->End << '\t'
+        << columns[h->PatternIndex] << '\n';
+  }
+}
@@ -1,4 +1,5 @@
 #include "hitwriter.h"
+#include "hitfile.h"
 
 #include <algorithm>
 #include <cstring>
@@ -6,22 +7,42 @@
 #include <memory>
 #include <iostream>
 #include <ostream>
+#include <sstream>
 
 
+void HitBuffer::flush() {
+  Out.write(Buf.data(), Buf.size());
+  Buf.clear();
+}
+
 void nullWriter(void* userData, const LG_SearchHit* const) {
   HitCounterInfo* hi = static_cast<HitCounterInfo*>(userData);
   ++hi->NumHits;
 }
 
+const std::string& HitWriterInfo::columns(uint32_t patternIndex) {
+  if (patternIndex >= Columns.size()) {
+    Columns.resize(patternIndex + 1);
+  }
+
+  std::string& cols = Columns[patternIndex];
+  if (cols.empty()) {
+    const LG_PatternInfo* info = lg_pattern_info(const_cast<ProgramHandle*>(Prog), patternIndex);
+
+    std::ostringstream ss;
+    ss << info->UserIndex << '\t'
+       << info->Pattern << '\t'
+       << info->EncodingChain;
+    cols = ss.str();
+  }
+  return cols;
+}
+
 void writeHit(HitWriterInfo* hi, const LG_SearchHit* const hit) {
   ++hi->NumHits;
-  const LG_PatternInfo* info = lg_pattern_info(const_cast<ProgramHandle*>(hi->Prog), hit->KeywordIndex);
-
   hi->Out << hit->Start << '\t'
           << hit->End << '\t'
-          << info->UserIndex << '\t'
-          << info->Pattern << '\t'
-          << info->EncodingChain;
+          << hi->columns(hit->KeywordIndex);
 }
 
 void hitWriter(void* userData, const LG_SearchHit* const hit) {
@@ -155,3 +176,15 @@ void lineContextPathWriter(void* userData, const LG_SearchHit* const hit) {
   writeLineContext(hi, hit);
   hi->Out << '\n';
 }
+
+void BinaryHitWriterInfo::setPath(const std::string& path) {
+  FileID = File.addPath(path);
+}
+
+void binaryHitWriter(void* userData, const LG_SearchHit* const hit) {
+  BinaryHitWriterInfo* hi = static_cast<BinaryHitWriterInfo*>(userData);
+  ++hi->NumHits;
+
+  const HitRecord rec{hit->Start, hit->End, hit->KeywordIndex, hi->FileID};
+  hi->Out.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+}
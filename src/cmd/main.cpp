@@ -4,9 +4,11 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <csignal>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
 #include <set>
@@ -23,12 +25,16 @@
 #include "program.h"
 #include "utility.h"
 
+#include "hitfile.h"
 #include "hitwriter.h"
 #include "matchgen.h"
 #include "options.h"
 #include "optparser.h"
 #include "reader.h"
 #include "searchcontroller.h"
+#include "searchpool.h"
+#include "server.h"
+#include "timer.h"
 #include "util.h"
 
 #include <lightgrep/api.h>
@@ -126,46 +132,13 @@ size_t countErrors(LG_Error* err) {
   return numErrors;
 }
 
-void search(
-  const std::string& input,
-  bool mmapped,
-  SearchController& ctrl,
-  ContextHandle* searcher,
-  HitCounterInfo* hinfo,
-  LG_HITCALLBACK_FN callback)
-{
-  std::unique_ptr<Reader> reader;
-
-  if (input == "-") {
-    // stdin can't be mmap'd
-    reader.reset(static_cast<Reader*>(new FileReader(input, ctrl.BlockSize)));
-    hinfo->setPath("(standard input)");
-  }
-  else {
-    reader.reset(mmapped ?
-      static_cast<Reader*>(new MemoryMappedFileReader(input)) :
-      static_cast<Reader*>(new FileReader(input, ctrl.BlockSize))
-    );
-    hinfo->setPath(input);
-  }
-
-  lg_reset_context(searcher);
-  ctrl.searchFile(searcher, hinfo, *reader, callback);
-}
-
-void searchRecursively(
-  const fs::path& path,
-  bool mmapped,
-  SearchController& ctrl,
-  ContextHandle* searcher,
-  HitCounterInfo* hinfo,
-  LG_HITCALLBACK_FN callback)
-{
+template <class F>
+void searchRecursively(const fs::path& path, F&& searchInput) {
   const fs::recursive_directory_iterator end;
   for (fs::recursive_directory_iterator d(path); d != end; ++d) {
     const fs::path p(d->path());
     if (!fs::is_directory(p)) {
-      search(p.string(), mmapped, ctrl, searcher, hinfo, callback);
+      searchInput(p.string());
     }
   }
 }
@@ -187,7 +160,9 @@ std::tuple<
 >
 parsePatterns(const T& keyFiles,
               const std::vector<std::string>& defaultEncodings = { "ASCII" },
-              const LG_KeyOptions& defaultOpts = {0, 0, 1})
+              const LG_KeyOptions& defaultOpts = {0, 0, 1},
+              LG_CompileObserver* observer = nullptr,
+              uint64_t memoryBudget = 0)
 {
   // read the patterns and parse them
 
@@ -211,6 +186,9 @@ parsePatterns(const T& keyFiles,
 // FIXME: What to do here?
   }
 
+  lg_set_compile_observer(fsm.get(), observer);
+  lg_set_memory_budget(fsm.get(), memoryBudget);
+
   // set default encoding(s) of patterns which have none specified
   const std::unique_ptr<const char*[]> defEncs(c_str_arr(defaultEncodings));
 
@@ -250,41 +228,137 @@ parsePatterns(const T& keyFiles,
 
 std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)>
 loadProgram(const std::string& pfile) {
-  std::ifstream pin(pfile, std::ios::in | std::ios::binary);
-  if (!pin) {
-    std::cerr << "Could not open program file " << pfile << std::endl;
-    return std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)>(
-      nullptr, nullptr
-    );
+  // the program is used in place from the mapped file
+  LG_Error* err = nullptr;
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    lg_map_program(pfile.c_str(), &err),
+    lg_destroy_program
+  );
+
+  if (err) {
+    std::cerr << "Could not load program file " << pfile << ": "
+              << err->Message << std::endl;
+    lg_free_error(err);
+  }
+  else {
+    std::cerr << "program file is " << lg_program_size(prog.get())
+              << " bytes long" << std::endl;
   }
 
-// FIXME: we need to handle the case where the read fails
-// FIXME: what to do for the pattern map?
+  return prog;
+}
 
-  const std::streampos end = stream_size(pin);
-  std::cerr << "program file is " << end << " bytes long" << std::endl;
+std::vector<const char*> patternListPtrs(
+  const std::vector<std::pair<std::string,std::string>>& patLines)
+{
+  std::vector<const char*> lists;
+  for (const std::pair<std::string,std::string>& pf : patLines) {
+    lists.push_back(pf.second.c_str());
+  }
+  return lists;
+}
 
-  std::vector<char> buf(end);
-  pin.read(&buf[0], end);
-  pin.close();
+std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)>
+loadCachedProgram(
+  const std::vector<std::pair<std::string,std::string>>& patLines,
+  const Options& opts)
+{
+  const LG_CacheOptions cacheOpts{opts.CacheDir.c_str(), opts.CacheSize};
+  std::vector<const char*> lists(patternListPtrs(patLines));
+  const std::unique_ptr<const char*[]> defEncs(c_str_arr(opts.Encodings));
+  const LG_KeyOptions keyOpts{
+    opts.LiteralMode, opts.CaseInsensitive, opts.UnicodeMode
+  };
+  const LG_ProgramOptions progOpts{opts.Determinize, opts.ShareSuffixes, opts.CompileThreads};
 
-  return std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)>(
-    lg_read_program(&buf[0], end),
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    lg_load_cached_program(
+      &cacheOpts, lists.data(), lists.size(),
+      defEncs.get(), opts.Encodings.size(), &keyOpts, &progOpts
+    ),
     lg_destroy_program
   );
+
+  if (prog) {
+    std::cerr << "using cached program, "
+              << prog->Prog->size() << " instructions" << std::endl;
+  }
+
+  return prog;
 }
 
-bool buildProgram(FSMHandle* fsm, ProgramHandle* prog, const Options& opts) {
-  LG_ProgramOptions progOpts{opts.Determinize};
+void storeCachedProgram(
+  ProgramHandle* prog,
+  const std::vector<std::pair<std::string,std::string>>& patLines,
+  const Options& opts)
+{
+  const LG_CacheOptions cacheOpts{opts.CacheDir.c_str(), opts.CacheSize};
+  std::vector<const char*> lists(patternListPtrs(patLines));
+  const std::unique_ptr<const char*[]> defEncs(c_str_arr(opts.Encodings));
+  const LG_KeyOptions keyOpts{
+    opts.LiteralMode, opts.CaseInsensitive, opts.UnicodeMode
+  };
+  const LG_ProgramOptions progOpts{opts.Determinize, opts.ShareSuffixes, opts.CompileThreads};
+
+  LG_Error* err = nullptr;
+
+  lg_store_cached_program(
+    &cacheOpts, prog, lists.data(), lists.size(),
+    defEncs.get(), opts.Encodings.size(), &keyOpts, &progOpts, &err
+  );
 
-  if (lg_compile_program(fsm, prog, &progOpts)) {
-    std::cerr << fsm->Impl->Fsm->verticesSize() << " vertices\n"
-              << prog->Prog->size() << " instructions"
-              << std::endl;
+  if (err) {
+    std::unique_ptr<LG_Error,void(*)(LG_Error*)> e(err, lg_free_error);
+    std::cerr << "Could not cache program: " << err->Message << std::endl;
+  }
+}
+
+void printCompileStats(const LG_CompileStats& stats) {
+  double total = 0.0;
+  for (uint32_t i = 0; i < LG_PHASE_COUNT; ++i) {
+    total += stats.Seconds[i];
+  }
+
+  std::cerr << "compile phase        seconds      %   peak growth (KB)\n";
+  for (uint32_t i = 0; i < LG_PHASE_COUNT; ++i) {
+    const LG_CompilePhase phase = static_cast<LG_CompilePhase>(i);
+    std::cerr << std::left << std::setw(14) << lg_compile_phase_name(phase)
+              << std::right << std::fixed
+              << std::setw(14) << std::setprecision(6) << stats.Seconds[i]
+              << std::setw(7) << std::setprecision(1)
+              << (total > 0.0 ? 100.0 * stats.Seconds[i] / total : 0.0)
+              << std::setw(20) << stats.PeakGrowth[i] / 1024 << '\n';
+  }
+  std::cerr << std::left << std::setw(14) << "total"
+            << std::right << std::setw(14) << std::setprecision(6) << total
+            << std::defaultfloat << std::endl;
+}
+
+bool buildProgram(FSMHandle* fsm, ProgramHandle* prog, const Options& opts) {
+  LG_ProgramOptions progOpts{opts.Determinize, opts.ShareSuffixes, opts.CompileThreads};
+
+  LG_Error* err = nullptr;
+  if (lg_compile_program(fsm, prog, &progOpts, &err)) {
+    const FSMThingy& impl(*fsm->Impl);
+    std::cerr << impl.Frozen->verticesSize() << " vertices";
+    if (opts.ShareSuffixes) {
+      std::cerr << " (" << impl.UnsharedVertices << " before sharing suffixes)";
+    }
+    std::cerr << '\n' << prog->Prog->size() << " instructions";
+    if (opts.ShareSuffixes) {
+      std::cerr << " (about " << impl.UnsharedInstructions << " before sharing suffixes)";
+    }
+    std::cerr << std::endl;
     return true;
   }
   else {
-    std::cerr << "Failed to create program" << std::endl;
+    std::cerr << "Failed to create program";
+    if (err) {
+      std::cerr << ": " << err->Message;
+      lg_free_error(err);
+    }
+    std::cerr << std::endl;
     return false;
   }
 }
@@ -331,15 +405,12 @@ bool skipStdin(const std::string& path, bool& stdinUsed) {
   return false;
 }
 
-template <class T>
+template <class T, class F>
 void search(
   T&& inputs,
   const Options& opts,
   bool& stdinUsed,
-  SearchController& ctrl,
-  ContextHandle* searcher,
-  HitCounterInfo* hinfo,
-  LG_HITCALLBACK_FN callback)
+  F&& searchInput)
 {
   if (opts.Recursive) {
     for (const std::string& i: inputs) {
@@ -349,10 +420,10 @@ void search(
 
       const fs::path p(i);
       if (fs::is_directory(p)) {
-        searchRecursively(p, opts.MemoryMapped, ctrl, searcher, hinfo, callback);
+        searchRecursively(p, searchInput);
       }
       else {
-        search(i, opts.MemoryMapped, ctrl, searcher, hinfo, callback);
+        searchInput(i);
       }
     }
   }
@@ -363,72 +434,98 @@ void search(
       }
 
       if (!fs::is_directory(fs::path(i))) {
-        const fs::path p(i);
-        search(i, opts.MemoryMapped, ctrl, searcher, hinfo, callback);
+        searchInput(i);
       }
     }
   }
 }
 
-void search(const Options& opts) {
-  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
-    nullptr, nullptr
-  );
-
-  if (!opts.ProgramFile.empty()) {
-    // read a program in from file
-    prog = loadProgram(opts.ProgramFile);
-  }
-  else {
-    // read the patterns and parse them
-    std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(nullptr, nullptr);
-    std::unique_ptr<LG_Error,void(*)(LG_Error*)> err(nullptr, nullptr);
+// Passes each input to searchInput; false if an input list can't be read
+template <class F>
+bool searchInputs(const Options& opts, F&& searchInput) {
+  bool stdinUsed = false;
 
-    std::tie(prog, fsm, err) = parsePatterns(
-      opts.getPatternLines(), opts.Encodings,
-      {opts.LiteralMode, opts.CaseInsensitive, opts.UnicodeMode}
-    );
+  // search each input file in each input list
+  for (const auto& i: opts.InputLists) {
+    std::ifstream ilf;
+    std::istream* is;
 
-    const bool printFilename =
-      opts.CmdLinePatterns.empty() && opts.KeyFiles.size() > 1;
+    if (i == "-") {
+      if (stdinUsed) {
+        std::cerr << "stdin already read, skipping '-' in --args-list" << std::endl;
+        continue;
+      }
 
-    handleParseErrors(err.get(), printFilename);
+      is = &std::cin;
+      stdinUsed = true;
+    }
+    else {
+      ilf.open(i, std::ios::in | std::ios::binary);
 
-    // build a program from parsed patterns
-    if (fsm) {
-      if (!buildProgram(fsm.get(), prog.get(), opts)) {
-        prog.reset();
+      if (!ilf) {
+        std::cerr << "Could not open input file list " << i << std::endl;
+        return false;
       }
+
+      is = &ilf;
+    }
+
+    search(Lines(*is), opts, stdinUsed, searchInput);
+
+    if (is->bad()) {
+      std::cerr << "Error reading input file list " << i << ": "
+                << std::strerror(errno) << std::endl;
     }
   }
 
-  if (!prog) {
-    std::cerr << "Did not get a proper program" << std::endl;
-    return;
+  // serach each input file (positional args or stdin)
+  if (!opts.Inputs.empty()) {
+    search(opts.Inputs, opts, stdinUsed, searchInput);
   }
 
-  // setup hit callback
-  LG_HITCALLBACK_FN callback = 0;
-  std::unique_ptr<HitCounterInfo> hinfo;
+  return true;
+}
+
+LG_HITCALLBACK_FN hitCallback(const Options& opts) {
+  if (opts.NoOutput) {
+    return &nullWriter;
+  }
+  else if (opts.BinaryOutput) {
+    return &binaryHitWriter;
+  }
+  else if (opts.BeforeContext > -1 || opts.AfterContext > -1) {
+    return opts.PrintPath ? &lineContextPathWriter : &lineContextHitWriter;
+  }
+  else {
+    return opts.PrintPath ? &pathWriter : &hitWriter;
+  }
+}
 
+// Makes the user data for the callback from hitCallback()
+std::unique_ptr<HitCounterInfo> makeHitInfo(
+  const Options& opts,
+  ProgramHandle* prog,
+  std::ostream& out,
+  HitFileWriter* hitFile)
+{
   if (opts.NoOutput) {
-    callback = &nullWriter;
-    hinfo.reset(new HitCounterInfo);
+    return std::unique_ptr<HitCounterInfo>(new HitCounterInfo);
+  }
+  else if (opts.BinaryOutput) {
+    return std::unique_ptr<HitCounterInfo>(new BinaryHitWriterInfo(out, *hitFile));
   }
   else if (opts.BeforeContext > -1 || opts.AfterContext > -1) {
     if (opts.PrintPath) {
-      callback = &lineContextPathWriter;
-      hinfo.reset(new LineContextPathWriterInfo(
-        opts.openOutput(), prog.get(),
+      return std::unique_ptr<HitCounterInfo>(new LineContextPathWriterInfo(
+        out, prog,
         std::max(opts.BeforeContext, 0),
         std::max(opts.AfterContext, 0),
         opts.GroupSeparator
       ));
     }
     else {
-      callback = &lineContextHitWriter;
-      hinfo.reset(new LineContextHitWriterInfo(
-        opts.openOutput(), prog.get(),
+      return std::unique_ptr<HitCounterInfo>(new LineContextHitWriterInfo(
+        out, prog,
         std::max(opts.BeforeContext, 0),
         std::max(opts.AfterContext, 0),
         opts.GroupSeparator
@@ -436,12 +533,92 @@ void search(const Options& opts) {
     }
   }
   else if (opts.PrintPath) {
-    callback = &pathWriter;
-    hinfo.reset(new PathWriterInfo(opts.openOutput(), prog.get()));
+    return std::unique_ptr<HitCounterInfo>(new PathWriterInfo(out, prog));
   }
   else {
-    callback = &hitWriter;
-    hinfo.reset(new HitWriterInfo(opts.openOutput(), prog.get()));
+    return std::unique_ptr<HitCounterInfo>(new HitWriterInfo(out, prog));
+  }
+}
+
+// Reads the program from --program-file or the cache, or compiles it from
+// the patterns; null if there is no usable program
+std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> getProgram(const Options& opts) {
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    nullptr, nullptr
+  );
+
+  if (!opts.ProgramFile.empty()) {
+    // read a program in from file
+    prog = loadProgram(opts.ProgramFile);
+  }
+  else {
+    const std::vector<std::pair<std::string,std::string>> patLines(
+      opts.getPatternLines()
+    );
+
+    if (!opts.CacheDir.empty()) {
+      // try for a program compiled by an earlier run
+      prog = loadCachedProgram(patLines, opts);
+    }
+
+    if (!prog) {
+      // read the patterns and parse them
+      std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(nullptr, nullptr);
+      std::unique_ptr<LG_Error,void(*)(LG_Error*)> err(nullptr, nullptr);
+
+      LG_CompileObserver observer{nullptr, nullptr, {}};
+
+      std::tie(prog, fsm, err) = parsePatterns(
+        patLines, opts.Encodings,
+        {opts.LiteralMode, opts.CaseInsensitive, opts.UnicodeMode},
+        opts.CompileStats ? &observer : nullptr,
+        opts.MemoryBudget
+      );
+
+      const bool printFilename =
+        opts.CmdLinePatterns.empty() && opts.KeyFiles.size() > 1;
+
+      handleParseErrors(err.get(), printFilename);
+
+      // build a program from parsed patterns
+      if (fsm) {
+        if (!buildProgram(fsm.get(), prog.get(), opts)) {
+          prog.reset();
+        }
+        else if (opts.CompileStats) {
+          printCompileStats(observer.Stats);
+        }
+
+        if (prog && !opts.CacheDir.empty() && !err) {
+          // don't cache programs missing bad patterns, so that the
+          // errors are reported on every run
+          storeCachedProgram(prog.get(), patLines, opts);
+        }
+      }
+    }
+  }
+
+  return prog;
+}
+
+namespace {
+  // the ring being searched, for a signal to close
+  LG_HRING ActiveRing = nullptr;
+
+  void closeActiveRing(int) {
+    // lets the slots already published be searched, then stops
+    lg_ring_close(ActiveRing);
+  }
+}
+
+void search(const Options& opts) {
+  const std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    getProgram(opts)
+  );
+
+  if (!prog) {
+    std::cerr << "Did not get a proper program" << std::endl;
+    return;
   }
 
   // setup search context
@@ -449,51 +626,111 @@ void search(const Options& opts) {
   ctxOpts.TraceBegin = opts.DebugBegin;
   ctxOpts.TraceEnd = opts.DebugEnd;
 
-  std::unique_ptr<ContextHandle, void(*)(ContextHandle*)> searcher(
-    lg_create_context(prog.get(), &ctxOpts),
-    lg_destroy_context
+  const LG_HITCALLBACK_FN callback = hitCallback(opts);
+  // context for a hit which started in an earlier block is read from there
+  SearchController ctrl(
+    opts.BlockSize, opts.ReadAhead, opts.IoUring, opts.DirectIO, opts.MmapPopulate,
+    opts.BeforeContext > -1 || opts.AfterContext > -1
   );
+  uint64_t numHits;
 
-  SearchController ctrl(opts.BlockSize);
-
-  bool stdinUsed = false;
+  std::ostream& out(opts.openOutput());
 
-  // search each input file in each input list
-  for (const auto& i: opts.InputLists) {
-    std::ifstream ilf;
-    std::istream* is;
+  std::unique_ptr<HitFileWriter> hitFile;
+  if (opts.BinaryOutput && !opts.NoOutput) {
+    hitFile.reset(new HitFileWriter(
+      out, prog.get(),
+      opts.PrintPath ? HitFileWriter::PRINT_PATH : 0
+    ));
+  }
 
-    if (i == "-") {
-      if (stdinUsed) {
-        std::cerr << "stdin already read, skipping '-' in --args-list" << std::endl;
-        continue;
-      }
+  if (!opts.RingName.empty()) {
+    // search the streams producers put in the ring, on this thread
+    LG_Error* err = nullptr;
+    const std::unique_ptr<RingHandle, void(*)(RingHandle*)> ring(
+      lg_create_ring(opts.RingName.c_str(), opts.RingSlots, opts.BlockSize, &err),
+      lg_destroy_ring
+    );
 
-      is = &std::cin;
-      stdinUsed = true;
+    if (!ring) {
+      std::cerr << "Could not create the ring: " << err->Message << std::endl;
+      lg_free_error(err);
+      return;
     }
-    else {
-      ilf.open(i, std::ios::in | std::ios::binary);
 
-      if (!ilf) {
-        std::cerr << "Could not open input file list " << i << std::endl;
-        return;
+    const std::unique_ptr<HitCounterInfo> hinfo(
+      makeHitInfo(opts, prog.get(), out, hitFile.get())
+    );
+
+    ActiveRing = ring.get();
+    std::signal(SIGINT, closeActiveRing);
+    std::signal(SIGTERM, closeActiveRing);
+
+    ctrl.searchRing(ring.get(), prog.get(), ctxOpts, hinfo.get(), callback);
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    ActiveRing = nullptr;
+
+    numHits = hinfo->NumHits;
+  }
+  else if (opts.Threads > 1) {
+    // search a file on each thread at once
+    const std::string groupSeparator(
+      opts.BeforeContext > 0 || opts.AfterContext > 0 ?
+      opts.GroupSeparator + '\n' : std::string()
+    );
+
+    const Timer searchClock;
+
+    SearchPool pool(
+      prog.get(), ctxOpts, opts.Threads, ctrl, opts.MemoryMapped,
+      out, groupSeparator, callback,
+      [&opts, &prog, &hitFile](std::ostream& out) {
+        return makeHitInfo(opts, prog.get(), out, hitFile.get());
       }
+    );
 
-      is = &ilf;
+    const bool ok = searchInputs(
+      opts, [&pool](const std::string& i) { pool.push(i); }
+    );
+    pool.finish();
+
+    if (!ok) {
+      return;
     }
 
-    search(Lines(*is), opts, stdinUsed, ctrl, searcher.get(), hinfo.get(), callback);
+    // the threads overlap, so the time is for all of them
+    ctrl.TotalTime = searchClock.elapsed();
+    ctrl.BytesSearched = pool.BytesSearched;
+    numHits = pool.NumHits;
+  }
+  else {
+    const std::unique_ptr<HitCounterInfo> hinfo(
+      makeHitInfo(opts, prog.get(), out, hitFile.get())
+    );
+
+    std::unique_ptr<ContextHandle, void(*)(ContextHandle*)> searcher(
+      lg_create_context(prog.get(), &ctxOpts),
+      lg_destroy_context
+    );
 
-    if (is->bad()) {
-      std::cerr << "Error reading input file list " << i << ": "
-                << std::strerror(errno) << std::endl;
+    const bool ok = searchInputs(opts,
+      [&](const std::string& i) {
+        ctrl.searchInput(i, opts.MemoryMapped, searcher.get(), hinfo.get(), callback);
+      }
+    );
+
+    if (!ok) {
+      return;
     }
+
+    numHits = hinfo->NumHits;
   }
 
-  // serach each input file (positional args or stdin)
-  if (!opts.Inputs.empty()) {
-    search(opts.Inputs, opts, stdinUsed, ctrl, searcher.get(), hinfo.get(), callback);
+  if (hitFile) {
+    // the tables of paths and patterns follow the hits
+    hitFile->finish(numHits);
   }
 
   std::cerr << ctrl.BytesSearched << " bytes\n"
@@ -505,8 +742,8 @@ void search(const Options& opts) {
     std::cerr << "+inf";
   }
   std::cerr << " MB/s avg\n"
-            << hinfo->NumHits
-            << " hit" << (hinfo->NumHits != 1 ? "s" : "") << std::endl;
+            << numHits
+            << " hit" << (numHits != 1 ? "s" : "") << std::endl;
 }
 
 bool writeGraphviz(const Options& opts) {
@@ -514,9 +751,13 @@ bool writeGraphviz(const Options& opts) {
   std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(nullptr, nullptr);
   std::unique_ptr<LG_Error,void(*)(LG_Error*)> err(nullptr, nullptr);
 
+  LG_CompileObserver observer{nullptr, nullptr, {}};
+
   std::tie(prog, fsm, err) = parsePatterns(
     opts.getPatternLines(), opts.Encodings,
-    {opts.LiteralMode, opts.CaseInsensitive, opts.UnicodeMode}
+    {opts.LiteralMode, opts.CaseInsensitive, opts.UnicodeMode},
+    opts.CompileStats ? &observer : nullptr,
+    opts.MemoryBudget
   );
 
   const bool printFilename =
@@ -535,8 +776,12 @@ bool writeGraphviz(const Options& opts) {
     return false;
   }
 
+  if (opts.CompileStats) {
+    printCompileStats(observer.Stats);
+  }
+
   // break on through the C API to print the graph
-  opts.openOutput() << *fsm->Impl->Fsm;
+  opts.openOutput() << *fsm->Impl->Frozen;
   return true;
 }
 
@@ -546,9 +791,13 @@ void writeProgram(const Options& opts) {
   std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(nullptr, nullptr);
   std::unique_ptr<LG_Error,void(*)(LG_Error*)> err(nullptr, nullptr);
 
+  LG_CompileObserver observer{nullptr, nullptr, {}};
+
   std::tie(prog, fsm, err) = parsePatterns(
     opts.getPatternLines(), opts.Encodings,
-    {opts.LiteralMode, opts.CaseInsensitive, opts.UnicodeMode}
+    {opts.LiteralMode, opts.CaseInsensitive, opts.UnicodeMode},
+    opts.CompileStats ? &observer : nullptr,
+    opts.MemoryBudget
   );
 
   const bool printFilename =
@@ -564,17 +813,24 @@ void writeProgram(const Options& opts) {
     return;
   }
 
+  if (opts.CompileStats) {
+    printCompileStats(observer.Stats);
+  }
+
   fsm.reset();
 
   // break on through the C API to print the program
   ProgramPtr p(prog->Prog);
+  const size_t psize = lg_program_size(prog.get());
   std::cerr << p->size() << " instructions\n"
-            << p->bufSize() << " program size in bytes" << std::endl;
+            << psize << " program size in bytes" << std::endl;
 
   std::ostream& out(opts.openOutput());
   if (opts.Binary) {
-    const std::vector<char> s = p->marshall();
-    out.write(s.data(), s.size());
+    // write the whole program, as --program-file expects
+    std::unique_ptr<char[]> buf(new char[psize]);
+    lg_write_program(prog.get(), buf.get());
+    out.write(buf.get(), psize);
   }
   else {
     out << *p << std::endl;
@@ -656,6 +912,35 @@ void writeSampleMatches(const Options& opts) {
   }
 }
 
+void serve(const Options& opts) {
+  const std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    getProgram(opts)
+  );
+
+  if (!prog) {
+    std::cerr << "Did not get a proper program" << std::endl;
+    return;
+  }
+
+  LG_ContextOptions ctxOpts;
+  ctxOpts.TraceBegin = opts.DebugBegin;
+  ctxOpts.TraceEnd = opts.DebugEnd;
+
+  SearchServer server(prog.get(), ctxOpts, opts.Port, opts.SocketPath);
+  server.run();
+
+  std::cerr << server.NumStreams << " stream" << (server.NumStreams != 1 ? "s" : "") << '\n'
+            << server.BytesSearched << " bytes\n"
+            << server.NumHits << " hit" << (server.NumHits != 1 ? "s" : "") << std::endl;
+}
+
+void convert(const Options& opts) {
+  std::ostream& out(opts.openOutput());
+  for (const std::string& i : opts.Inputs) {
+    writeHitsAsText(HitFileReader(i), out);
+  }
+}
+
 int main(int argc, char** argv) {
   Options opts;
   po::options_description desc;
@@ -677,6 +962,12 @@ int main(int argc, char** argv) {
     case Options::VALIDATE:
       validate(opts);
       break;
+    case Options::CONVERT:
+      convert(opts);
+      break;
+    case Options::SERVER:
+      serve(opts);
+      break;
     case Options::SHOW_VERSION:
       printVersion();
       break;
@@ -13,7 +13,7 @@ std::ostream& Options::openOutput() const {
   else {
     OutputFile.clear();
     std::ios_base::openmode mode = std::ios::out;
-    if (Binary) {
+    if (Binary || BinaryOutput) {
       mode |= std::ios::binary;
     }
     OutputFile.open(Output.c_str(), mode);
@@ -1,6 +1,7 @@
 #include <fstream>
 
 #include "optparser.h"
+#include "server.h"
 
 #include <lightgrep/encodings.h>
 
@@ -9,6 +10,7 @@
 #include <map>
 #include <set>
 #include <string>
+#include <thread>
 
 #include <boost/lexical_cast.hpp>
 
@@ -42,7 +44,8 @@ void parse_opts(int argc, char** argv,
   // set up argument parsing
   //
 
-  std::string command;
+  std::string command,
+              outputFormat;
 
   po::positional_options_description posOpts;
   posOpts.add("pargs", -1);
@@ -58,7 +61,7 @@ void parse_opts(int argc, char** argv,
   // Command selection options
   po::options_description general("Command selection");
   general.add_options()
-    ("command,c", po::value<std::string>(&command)->value_name("CMD")->default_value("search"), "command to perform [search|graph|prog|samp|validate]")
+    ("command,c", po::value<std::string>(&command)->value_name("CMD")->default_value("search"), "command to perform [search|graph|prog|samp|validate|convert|server]")
     ("help", "display this help message")
     ("list-encodings", "list known encodings")
     ("version,V", "print version information and exit")
@@ -87,16 +90,32 @@ void parse_opts(int argc, char** argv,
     ("context,C", po::value<int32_t>(&opts.BeforeContext)->value_name("NUM"), "print NUM lines of context")
     ("group-separator", po::value<std::string>(&opts.GroupSeparator)->value_name("SEP")->default_value("--"), "use SEP as the group separator")
     ("no-output", "do not output hits (good for profiling)")
+    ("output-format", po::value<std::string>(&outputFormat)->value_name("FORMAT")->default_value("text"), "format for hits [text|binary]; read binary hits back with -c convert")
     ("block-size", po::value<uint32_t>(&opts.BlockSize)->default_value(8 * 1024 * 1024)->value_name("BYTES"), "block size to use for buffering, in bytes")
+    ("read-ahead", po::value<uint32_t>(&opts.ReadAhead)->default_value(4)->value_name("BLOCKS"), "number of blocks to buffer or map when reading, at least 2")
     ("mmap", "memory-map input file(s)")
+    ("mmap-populate", "prefault memory-mapped input, a block at a time; implies --mmap")
+    ("io-uring", "read input files with io_uring where the system supports it")
+    ("direct-io", "read input files around the page cache; needs a block size which is a multiple of 4096")
+    ("threads", po::value<uint32_t>(&opts.Threads)->default_value(1)->value_name("NUM"), "search NUM files at once (0 for one per core)")
+    ("ring", po::value<std::string>(&opts.RingName)->value_name("NAME"), "create the shared-memory ring NAME and search the streams producers put in it, until it is closed")
+    ("ring-slots", po::value<uint32_t>(&opts.RingSlots)->default_value(16)->value_name("NUM"), "number of slots in the --ring, each of --block-size bytes")
     ;
 
   // Other options
   po::options_description misc("Miscellaneous");
   misc.add_options()
     ("no-det", "do not determinize NFAs")
+    ("share-suffixes", "merge equivalent pattern tails, and report the savings")
+    ("compile-threads", po::value<uint32_t>(&opts.CompileThreads)->default_value(1)->value_name("NUM"), "determinize with NUM threads (0 for one per core)")
+    ("compile-stats", "report the time and memory taken by each phase of compiling")
+    ("memory-budget", po::value<uint64_t>(&opts.MemoryBudget)->default_value(0)->value_name("BYTES"), "stop compiling if it would need more than BYTES of memory (0 for no limit)")
     ("binary", "output program as binary")
     ("program-file", po::value<std::string>(&opts.ProgramFile)->value_name("FILE"), "read search program from file")
+    ("cache-dir", po::value<std::string>(&opts.CacheDir)->value_name("DIR"), "reuse search programs compiled earlier, cached in DIR")
+    ("cache-size", po::value<uint64_t>(&opts.CacheSize)->default_value(uint64_t(1) << 30)->value_name("BYTES"), "maximum size of the program cache, in bytes (0 for no limit)")
+    ("port", po::value<uint16_t>(&opts.Port)->default_value(SearchServer::DEFAULT_PORT)->value_name("NUM"), "port on 127.0.0.1 for -c server to listen on (0 for none)")
+    ("socket", po::value<std::string>(&opts.SocketPath)->value_name("PATH"), "Unix domain socket for -c server to listen on")
     #ifdef LBT_TRACE_ENABLED
     ("begin-debug", po::value<uint64_t>(&opts.DebugBegin)->default_value(std::numeric_limits<uint64_t>::max()), "offset for beginning of debug logging")
     ("end-debug", po::value<uint64_t>(&opts.DebugEnd)->default_value(std::numeric_limits<uint64_t>::max()), "offset for end of debug logging")
@@ -153,6 +172,8 @@ void parse_opts(int argc, char** argv,
     cmds.insert(std::make_pair("prog",     Options::PROGRAM));
     cmds.insert(std::make_pair("samp",     Options::SAMPLES));
     cmds.insert(std::make_pair("validate", Options::VALIDATE));
+    cmds.insert(std::make_pair("convert",  Options::CONVERT));
+    cmds.insert(std::make_pair("server",   Options::SERVER));
 
     auto i = cmds.find(command);
     if (i != cmds.end()) {
@@ -170,6 +191,7 @@ void parse_opts(int argc, char** argv,
   case Options::PROGRAM:
   case Options::SAMPLES:
   case Options::VALIDATE:
+  case Options::SERVER:
     // determine the source of our patterns
     if (!optsMap["pattern"].empty()) {
       // keywords from --pattern
@@ -194,11 +216,31 @@ void parse_opts(int argc, char** argv,
 
     opts.CaseInsensitive = optsMap.count("ignore-case") > 0;
     opts.LiteralMode = optsMap.count("fixed-strings") > 0;
+    // there is no option for ASCII mode yet; use the library default
+    opts.UnicodeMode = true;
     opts.Binary = optsMap.count("binary") > 0;
     opts.NoOutput = optsMap.count("no-output") > 0;
+    opts.BinaryOutput = outputFormat == "binary";
     opts.Determinize = optsMap.count("no-det") == 0;
+    opts.ShareSuffixes = optsMap.count("share-suffixes") > 0;
+    opts.CompileStats = optsMap.count("compile-stats") > 0;
     opts.Recursive = optsMap.count("recursive") > 0;
-    opts.MemoryMapped = optsMap.count("mmap") > 0;
+    opts.MmapPopulate = optsMap.count("mmap-populate") > 0;
+    opts.MemoryMapped = optsMap.count("mmap") > 0 || opts.MmapPopulate;
+    opts.IoUring = optsMap.count("io-uring") > 0;
+    opts.DirectIO = optsMap.count("direct-io") > 0;
+
+    if (opts.ReadAhead < 2) {
+      throw po::error("--read-ahead must be at least 2");
+    }
+
+    if (opts.Threads == 0) {
+      opts.Threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    if (opts.CompileThreads == 0) {
+      opts.CompileThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
 
     if (optsMap.count("context") > 0) {
       // "-C N" is equivalent to "-B N -A N"
@@ -210,6 +252,16 @@ void parse_opts(int argc, char** argv,
       opts.MemoryMapped = true;
     }
 
+    if (opts.DirectIO) {
+      if (opts.MemoryMapped) {
+        throw po::error("--direct-io is incompatible with --mmap and context options");
+      }
+
+      if (opts.BlockSize % 4096) {
+        throw po::error("--direct-io needs a --block-size which is a multiple of 4096");
+      }
+    }
+
     // uppercase encoding names
     for (std::string& e : opts.Encodings) {
       std::transform(e.begin(), e.end(), e.begin(), toupper);
@@ -239,9 +291,40 @@ void parse_opts(int argc, char** argv,
         opts.Inputs.push_back("-");
       }
 
+      if (!opts.RingName.empty()) {
+        if (!opts.InputLists.empty() || opts.Inputs != std::vector<std::string>{"-"}) {
+          throw po::error("--ring is incompatible with input files");
+        }
+
+        if (opts.BeforeContext != -1 || opts.AfterContext != -1) {
+          throw po::error("--ring is incompatible with context options");
+        }
+
+        if (opts.RingSlots == 0) {
+          throw po::error("--ring-slots must be at least 1");
+        }
+
+        // the streams are told apart by their ids
+        opts.Inputs.clear();
+        opts.PrintPath = optsMap.count("no-filename") == 0;
+      }
+
       if (opts.MemoryMapped && std::find(opts.Inputs.begin(), opts.Inputs.end(), "-") != opts.Inputs.end()) {
         throw po::error("--mmap is incompatible with reading from stdin");
       }
+
+      if (outputFormat != "text" && outputFormat != "binary") {
+        throw po::invalid_option_value(outputFormat);
+      }
+
+      if (opts.BinaryOutput && (opts.BeforeContext != -1 || opts.AfterContext != -1)) {
+        throw po::error("--output-format binary is incompatible with context options");
+      }
+    }
+    else if (opts.Command == Options::SERVER) {
+      if (opts.Port == 0 && opts.SocketPath.empty()) {
+        throw po::error("the server needs a --port or a --socket to listen on");
+      }
     }
     else if (opts.Command == Options::SAMPLES) {
       opts.SampleLimit =
@@ -266,6 +349,17 @@ void parse_opts(int argc, char** argv,
 
     break;
 
+  case Options::CONVERT:
+    // the hit files to convert
+    if (pargs.empty()) {
+      throw po::error("convert needs a hit file to read");
+    }
+
+    opts.Inputs = pargs;
+    opts.Binary = false;
+    opts.BinaryOutput = false;
+    break;
+
   case Options::SHOW_VERSION:
   case Options::SHOW_HELP:
   case Options::LIST_ENCODINGS:
@@ -1,65 +1,677 @@
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstring>
+#include <filesystem>
+#include <new>
 #include <stdexcept>
 
 #include "reader.h"
 
+#include <fcntl.h>
+
+#ifdef O_DIRECT
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
 namespace {
 
-FILE* try_open(const std::string& path) {
+const size_t PAGE_SIZE = 4096;
+
+size_t aligned(size_t n) {
+  return (n + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+void free_ring(char* ring) {
+  ::operator delete[](ring, std::align_val_t(PAGE_SIZE));
+}
+
+// Opens the file around the page cache if direct is set and the system
+// and file system allow it; clears direct if not
+FILE* try_open(const std::string& path, bool& direct) {
   if (path == "-") {
+    direct = false;
     return stdin;
   }
-  else {
-    FILE* f = std::fopen(path.c_str(), "rb");
-    if (!f) {
+
+#ifdef O_DIRECT
+  if (direct) {
+    const int fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+    if (fd >= 0) {
+      FILE* f = fdopen(fd, "rb");
+      if (!f) {
+        close(fd);
+        throw std::runtime_error(std::strerror(errno));
+      }
+      return f;
+    }
+    else if (errno != EINVAL) {
       throw std::runtime_error(std::strerror(errno));
     }
-    return f;
+    // EINVAL: the file system doesn't do direct I/O
   }
+#endif
+
+  direct = false;
+
+  FILE* f = std::fopen(path.c_str(), "rb");
+  if (!f) {
+    throw std::runtime_error(std::strerror(errno));
+  }
+  return f;
+}
+
+size_t read_block(FILE* file, char* buf, size_t len, bool direct) {
+#ifdef O_DIRECT
+  if (direct) {
+    // a single read; a short one means the end, since reading on from
+    // an unaligned offset would fail
+    ssize_t n;
+    do {
+      n = ::read(fileno(file), buf, len);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+      throw std::runtime_error(std::strerror(errno));
+    }
+    return n;
+  }
+#endif
+
+  const size_t n = std::fread(buf, 1, len, file);
+  if (std::ferror(file)) {
+    throw std::runtime_error(std::strerror(errno));
+  }
+  return n;
+}
+
+// Drops data already read from the page cache, for direct I/O where the
+// file system won't do it
+void drop_cached(int fd, uint64_t off, size_t len) {
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(fd, off, len, POSIX_FADV_DONTNEED);
+#else
+  (void) fd; (void) off; (void) len;
+#endif
 }
 
 }
 
-FileReader::FileReader(const std::string& path, size_t blockSize):
-    File(try_open(path)), Cur(new char[blockSize]), Next(new char[blockSize])
+FileReader::FileReader(const std::string& path, size_t blockSize, uint32_t depth, bool direct):
+  BlockSize(blockSize),
+  Stride(aligned(std::max(blockSize, size_t(1)))),
+  Depth(std::max(depth, 2u)),
+  Ring(
+    static_cast<char*>(::operator new[](Stride * Depth, std::align_val_t(PAGE_SIZE))),
+    &free_ring
+  ),
+  Lengths(Depth, 0),
+  Direct(direct),
+  File(try_open(path, Direct)),
+  DropCache(direct && !Direct),
+  NumFilled(0),
+  NumRead(0),
+  NumFree(Depth),
+  End(false),
+  Stop(false)
 {
+  if (Direct && BlockSize % DIRECT_ALIGNMENT) {
+    std::fclose(File);
+    throw std::invalid_argument("Direct I/O needs blocks aligned to sectors");
+  }
+
   std::setbuf(File, 0); // unbuffered, bitte
+  Thread = std::thread(&FileReader::fill, this);
 }
 
 FileReader::~FileReader() {
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    Stop = true;
+  }
+  Freed.notify_one();
+  Thread.join();
+
   std::fclose(File);
 }
 
-// TODO: would this be better as a 2-element circular buffer, and just
-// reuse the read thread?
-std::future<std::pair<const char*, size_t>> FileReader::read(size_t len){
-  std::swap(Cur, Next);
-  return std::async(
-    std::launch::async,
-    [](char* buf, size_t len, FILE* file) {
-      const size_t alen = std::fread(buf, 1, len, file);
-      if (std::ferror(file)) {
-        throw std::runtime_error(std::strerror(errno));
+void FileReader::fill() {
+  try {
+    for (uint64_t block = 0; ; ++block) {
+      {
+        std::unique_lock<std::mutex> lock(Lock);
+        Freed.wait(lock, [this, block]() { return Stop || block < NumFree; });
+        if (Stop) {
+          return;
+        }
+      }
+
+      // the slot is ours until the block is counted as filled
+      const size_t slot = block % Depth;
+      const size_t len = read_block(File, Ring.get() + slot * Stride, BlockSize, Direct);
+      if (DropCache) {
+        drop_cached(fileno(File), block * BlockSize, len);
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(Lock);
+        Lengths[slot] = len;
+        ++NumFilled;
+        End = len < BlockSize;
+      }
+      Filled.notify_one();
+
+      if (len < BlockSize) {
+        return;
+      }
+    }
+  }
+  catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(Lock);
+      Error = std::current_exception();
+    }
+    Filled.notify_one();
+  }
+}
+
+std::pair<const char*, size_t> FileReader::wait(uint64_t block) {
+  std::unique_lock<std::mutex> lock(Lock);
+  Filled.wait(lock, [this, block]() {
+    return block < NumFilled || End || Error;
+  });
+
+  if (block < NumFilled) {
+    const size_t slot = block % Depth;
+    return {Ring.get() + slot * Stride, Lengths[slot]};
+  }
+  else if (Error) {
+    std::rethrow_exception(Error);
+  }
+  else {
+    // past the end
+    return {Ring.get(), 0};
+  }
+}
+
+std::future<std::pair<const char*, size_t>> FileReader::read(size_t len) {
+  if (len != BlockSize) {
+    throw std::invalid_argument("FileReader reads only whole blocks");
+  }
+
+  {
+    // the caller is done with the block before the one it last got
+    std::lock_guard<std::mutex> lock(Lock);
+    if (NumRead > 1) {
+      NumFree = NumRead - 1 + Depth;
+    }
+  }
+  Freed.notify_one();
+
+  // waiting happens in get(), so the caller can search meanwhile
+  return std::async(std::launch::deferred, &FileReader::wait, this, NumRead++);
+}
+
+#ifdef HAVE_IO_URING
+
+namespace {
+
+// thrown where io_uring can't be used, so that the caller may fall back;
+// for any input, if the kernel won't set it up
+struct IoUringUnavailable: public std::runtime_error {
+  IoUringUnavailable(const char* what, bool anyInput = true):
+    std::runtime_error(what), AnyInput(anyInput) {}
+
+  bool AnyInput;
+};
+
+// cleared once io_uring fails to set up, so that it's not tried per file
+std::atomic<bool> IoUringWorks(true);
+
+}
+
+//
+// The submission and completion queues of an io_uring, set up and used
+// through the raw system calls so as to need no library
+//
+class IoUring {
+public:
+  IoUring(unsigned entries) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+
+    Fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (Fd < 0) {
+      throw IoUringUnavailable(std::strerror(errno));
+    }
+
+    // IORING_OP_READ came with IORING_FEAT_RW_CUR_POS, in Linux 5.6
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+      close(Fd);
+      throw IoUringUnavailable("io_uring lacks IORING_OP_READ");
+    }
+
+    SqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    CqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    SqesSize = p.sq_entries * sizeof(io_uring_sqe);
+
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+      SqSize = CqSize = std::max(SqSize, CqSize);
+    }
+
+    SqRing = map(SqSize, IORING_OFF_SQ_RING);
+    CqRing = single ? SqRing : map(CqSize, IORING_OFF_CQ_RING);
+    Sqes = static_cast<io_uring_sqe*>(map(SqesSize, IORING_OFF_SQES));
+
+    if (SqRing == MAP_FAILED || CqRing == MAP_FAILED || Sqes == MAP_FAILED) {
+      const int err = errno;
+      unmap();
+      throw IoUringUnavailable(std::strerror(err));
+    }
+
+    char* sq = static_cast<char*>(SqRing);
+    SqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    SqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    SqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+    char* cq = static_cast<char*>(CqRing);
+    CqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    CqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    CqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    Cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+    ToSubmit = Unconsumed = 0;
+  }
+
+  ~IoUring() {
+    unmap();
+  }
+
+  bool registerBuffers(const iovec* iov, unsigned num) {
+    return !syscall(__NR_io_uring_register, Fd, IORING_REGISTER_BUFFERS, iov, num);
+  }
+
+  // The next submission queue entry, cleared; the caller must not queue
+  // more entries than the ring has before calling enter()
+  io_uring_sqe& next() {
+    const unsigned tail = *SqTail + ToSubmit++;
+    io_uring_sqe& sqe(Sqes[tail & SqMask]);
+    std::memset(&sqe, 0, sizeof(sqe));
+    SqArray[tail & SqMask] = tail & SqMask;
+    return sqe;
+  }
+
+  // Submits the queued entries, waiting for minComplete completions
+  void enter(unsigned minComplete) {
+    __atomic_store_n(SqTail, *SqTail + ToSubmit, __ATOMIC_RELEASE);
+    Unconsumed += ToSubmit;
+    ToSubmit = 0;
+
+    int ret;
+    do {
+      ret = syscall(
+        __NR_io_uring_enter, Fd, Unconsumed, minComplete,
+        minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0
+      );
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+      throw std::runtime_error(std::strerror(errno));
+    }
+
+    Unconsumed -= ret;
+  }
+
+  // Pops the next completion, if there is one
+  bool pop(io_uring_cqe& cqe) {
+    const unsigned head = *CqHead;
+    if (head == __atomic_load_n(CqTail, __ATOMIC_ACQUIRE)) {
+      return false;
+    }
+
+    cqe = Cqes[head & CqMask];
+    __atomic_store_n(CqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+private:
+  void* map(size_t size, off_t offset) {
+    return mmap(
+      nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      Fd, offset
+    );
+  }
+
+  void unmap() {
+    if (Sqes != MAP_FAILED) {
+      munmap(Sqes, SqesSize);
+    }
+    if (CqRing != MAP_FAILED && CqRing != SqRing) {
+      munmap(CqRing, CqSize);
+    }
+    if (SqRing != MAP_FAILED) {
+      munmap(SqRing, SqSize);
+    }
+    close(Fd);
+  }
+
+  int Fd;
+
+  size_t SqSize, CqSize, SqesSize;
+  void* SqRing = MAP_FAILED;
+  void* CqRing = MAP_FAILED;
+  io_uring_sqe* Sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+
+  unsigned* SqTail;
+  unsigned SqMask;
+  unsigned* SqArray;
+  // entries queued but not yet in the ring, and in it but not yet
+  // taken by the kernel
+  unsigned ToSubmit, Unconsumed;
+
+  unsigned* CqHead;
+  unsigned* CqTail;
+  unsigned CqMask;
+  io_uring_cqe* Cqes;
+};
+
+IoUringReader::IoUringReader(const std::string& path, size_t blockSize, uint32_t depth, bool direct):
+  BlockSize(blockSize),
+  Stride(aligned(std::max(blockSize, size_t(1)))),
+  Depth(std::max(depth, 2u)),
+  Ring(
+    static_cast<char*>(::operator new[](Stride * Depth, std::align_val_t(PAGE_SIZE))),
+    &free_ring
+  ),
+  Lengths(Depth, 0),
+  Done(Depth, false),
+  Direct(direct),
+  DropCache(false),
+  Fd(-1),
+  Fixed(false),
+  NumSubmitted(0),
+  NumRead(0),
+  InFlight(0)
+{
+  if (Direct && BlockSize % FileReader::DIRECT_ALIGNMENT) {
+    throw std::invalid_argument("Direct I/O needs blocks aligned to sectors");
+  }
+
+  Fd = open(path.c_str(), O_RDONLY | (Direct ? O_DIRECT : 0));
+  if (Fd < 0 && Direct && errno == EINVAL) {
+    // the file system doesn't do direct I/O
+    Direct = false;
+    DropCache = true;
+    Fd = open(path.c_str(), O_RDONLY);
+  }
+
+  if (Fd < 0) {
+    throw std::runtime_error(std::strerror(errno));
+  }
+
+  // the reads are at offsets, which only files and devices have
+  struct stat st;
+  if (fstat(Fd, &st)) {
+    const int err = errno;
+    close(Fd);
+    throw std::runtime_error(std::strerror(err));
+  }
+  else if (S_ISREG(st.st_mode)) {
+    Size = st.st_size;
+  }
+  else if (!S_ISBLK(st.st_mode) || ioctl(Fd, BLKGETSIZE64, &Size)) {
+    close(Fd);
+    throw IoUringUnavailable("not a file or block device", false);
+  }
+  NumBlocks = BlockSize ? (Size + BlockSize - 1) / BlockSize : 0;
+
+  try {
+    Uring.reset(new IoUring(Depth));
+  }
+  catch (...) {
+    close(Fd);
+    throw;
+  }
+
+  // registering may exceed RLIMIT_MEMLOCK on older kernels; plain reads
+  // into the same blocks will do then
+  std::vector<iovec> iov(Depth);
+  for (uint32_t i = 0; i < Depth; ++i) {
+    iov[i].iov_base = Ring.get() + i * Stride;
+    iov[i].iov_len = Stride;
+  }
+  Fixed = Uring->registerBuffers(iov.data(), Depth);
+
+  try {
+    submitUpTo(Depth);
+  }
+  catch (...) {
+    // the destructor won't run, so let go of everything here
+    drain();
+    Uring.reset();
+    close(Fd);
+    throw;
+  }
+}
+
+IoUringReader::~IoUringReader() {
+  drain();
+  Uring.reset();
+  close(Fd);
+}
+
+void IoUringReader::drain() {
+  // the kernel may still be reading into the blocks
+  while (InFlight) {
+    const uint32_t inFlight = InFlight;
+    try {
+      reap(true);
+    }
+    catch (...) {
+      if (InFlight == inFlight) {
+        // the ring failed, not a read; nothing more will complete
+        break;
       }
-      return std::pair<const char*, size_t>{buf, alen};
-    },
-    Next.get(), len, File
-  );
+    }
+  }
 }
 
-MemoryMappedFileReader::MemoryMappedFileReader(const std::string& path):
-  M(path.c_str(), bip::read_only), R(M, bip::read_only),
-  Buf(static_cast<const char*>(R.get_address())), Bend(Buf + R.get_size())
+void IoUringReader::submit(uint64_t block, size_t done) {
+  const size_t slot = block % Depth;
+  const uint64_t off = block * BlockSize + done;
+
+  io_uring_sqe& sqe(Uring->next());
+  sqe.opcode = Fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe.fd = Fd;
+  sqe.off = off;
+  sqe.addr = reinterpret_cast<uint64_t>(Ring.get() + slot * Stride + done);
+  // direct reads must be of whole sectors, even at the end
+  sqe.len = Direct ? BlockSize - done :
+    std::min<uint64_t>(BlockSize, Size - block * BlockSize) - done;
+  sqe.buf_index = Fixed ? slot : 0;
+  sqe.user_data = block;
+
+  ++InFlight;
+}
+
+void IoUringReader::submitUpTo(uint64_t end) {
+  end = std::min(end, NumBlocks);
+  if (NumSubmitted >= end) {
+    return;
+  }
+
+  for ( ; NumSubmitted < end; ++NumSubmitted) {
+    const size_t slot = NumSubmitted % Depth;
+    Lengths[slot] = 0;
+    Done[slot] = false;
+    submit(NumSubmitted, 0);
+  }
+
+  Uring->enter(0);
+}
+
+void IoUringReader::reap(bool wait) {
+  Uring->enter(wait ? 1 : 0);
+
+  bool resubmitted = false;
+
+  io_uring_cqe cqe;
+  while (Uring->pop(cqe)) {
+    --InFlight;
+
+    const uint64_t block = cqe.user_data;
+    const size_t slot = block % Depth;
+
+    if (cqe.res < 0) {
+      throw std::runtime_error(std::strerror(-cqe.res));
+    }
+
+    Lengths[slot] += cqe.res;
+
+    const size_t want = std::min<uint64_t>(BlockSize, Size - block * BlockSize);
+    if (cqe.res == 0 || Lengths[slot] >= want) {
+      // done, or the file shrank, in which case we search what we got
+      Done[slot] = true;
+    }
+    else {
+      // a short read; read the rest
+      submit(block, Lengths[slot]);
+      resubmitted = true;
+    }
+  }
+
+  if (resubmitted) {
+    Uring->enter(0);
+  }
+}
+
+std::pair<const char*, size_t> IoUringReader::wait(uint64_t block) {
+  if (block >= NumBlocks) {
+    return {Ring.get(), 0};
+  }
+
+  const size_t slot = block % Depth;
+  while (!Done[slot]) {
+    reap(true);
+  }
+
+  if (DropCache) {
+    drop_cached(Fd, block * BlockSize, Lengths[slot]);
+  }
+
+  return {Ring.get() + slot * Stride, Lengths[slot]};
+}
+
+std::future<std::pair<const char*, size_t>> IoUringReader::read(size_t len) {
+  if (len != BlockSize) {
+    throw std::invalid_argument("IoUringReader reads only whole blocks");
+  }
+
+  // the caller is done with the block before the one it last got
+  if (NumRead > 1) {
+    submitUpTo(NumRead - 1 + Depth);
+  }
+
+  // waiting happens in get(), so the caller can search meanwhile
+  return std::async(std::launch::deferred, &IoUringReader::wait, this, NumRead++);
+}
+
+#endif
+
+std::unique_ptr<Reader> openFileReader(const std::string& path, size_t blockSize, uint32_t depth, bool ioUring, bool direct) {
+#ifdef HAVE_IO_URING
+  if (ioUring && path != "-" && IoUringWorks) {
+    try {
+      return std::unique_ptr<Reader>(new IoUringReader(path, blockSize, depth, direct));
+    }
+    catch (const IoUringUnavailable& e) {
+      // fall back to reading with a thread
+      if (e.AnyInput) {
+        IoUringWorks = false;
+      }
+    }
+  }
+#endif
+
+  return std::unique_ptr<Reader>(new FileReader(path, blockSize, depth, direct));
+}
+
+namespace {
+  bip::map_options_t mapOptions(bool populate) {
+#ifdef MAP_POPULATE
+    return populate ? MAP_POPULATE : bip::default_map_options;
+#else
+    return bip::default_map_options;
+#endif
+  }
+}
+
+MemoryMappedFileReader::MemoryMappedFileReader(const std::string& path, uint32_t depth, bool populate, bool whole):
+  M(path.c_str(), bip::read_only),
+  Size(std::filesystem::file_size(path)),
+  Depth(std::max(depth, 2u)),
+  Populate(populate),
+  Whole(whole),
+  Returned(0),
+  Given(0),
+  MappedEnd(0)
 {
-  R.advise(bip::mapped_region::advice_sequential);
+  if (Whole && Size) {
+    File = bip::mapped_region(M, bip::read_only, 0, Size, nullptr, mapOptions(Populate));
+    File.advise(bip::mapped_region::advice_sequential);
+  }
+}
+
+void MemoryMappedFileReader::map(size_t len) {
+  len = std::min<uint64_t>(len, Size - MappedEnd);
+
+  Blocks.emplace_back(M, bip::read_only, MappedEnd, len, nullptr, mapOptions(Populate));
+  Blocks.back().advise(bip::mapped_region::advice_willneed);
+  MappedEnd += len;
 }
 
 std::future<std::pair<const char*, size_t>> MemoryMappedFileReader::read(size_t len) {
-  len = std::min(len, static_cast<size_t>(Bend - Buf));
   std::promise<std::pair<const char*, size_t>> p;
-  p.set_value(std::make_pair(Buf, len));
-  Buf += len;
+
+  if (Whole) {
+    len = std::min<uint64_t>(len, Size - Returned);
+    p.set_value(std::make_pair(
+      len ? static_cast<const char*>(File.get_address()) + Returned : "", len
+    ));
+    Returned += len;
+    return p.get_future();
+  }
+
+  // the caller is done with the block before the one it last got
+  if (Given == 2) {
+    Blocks.front().advise(bip::mapped_region::advice_dontneed);
+    Blocks.pop_front();
+    --Given;
+  }
+
+  // keep mapped what the caller has, and the rest of the depth ahead
+  while (Blocks.size() < std::max(Depth, Given + 1) && MappedEnd < Size) {
+    map(len);
+  }
+
+  if (Given < Blocks.size()) {
+    const bip::mapped_region& r(Blocks[Given++]);
+    p.set_value(std::make_pair(static_cast<const char*>(r.get_address()), r.get_size()));
+  }
+  else {
+    // past the end
+    p.set_value(std::make_pair("", 0));
+  }
   return p.get_future();
 }
@@ -4,8 +4,11 @@
 #include <algorithm>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 void print_cumulative_stats(double seconds, uint64_t offset) {
   uint64_t units = offset >> 20;
@@ -40,6 +43,10 @@ bool SearchController::searchFile(
 
     lg_search(searcher, buf, buf + blkSize, offset, hinfo, callback);
 
+    // a slow input, such as a pipe, shows the block's hits before the
+    // next block comes
+    hinfo->flush();
+
     offset += blkSize;
 
     thisTime = searchClock.elapsed();
@@ -64,3 +71,103 @@ bool SearchController::searchFile(
   BytesSearched += offset;
   return true;
 }
+
+bool SearchController::searchInput(
+  const std::string& input,
+  bool mmapped,
+  ContextHandle* searcher,
+  HitCounterInfo* hinfo,
+  LG_HITCALLBACK_FN callback)
+{
+  std::unique_ptr<Reader> reader;
+
+  if (input == "-") {
+    // stdin can't be mmap'd
+    reader = openFileReader(input, BlockSize, ReadDepth, false);
+    hinfo->setPath("(standard input)");
+  }
+  else {
+    if (mmapped) {
+      reader.reset(new MemoryMappedFileReader(input, ReadDepth, MmapPopulate, MmapWhole));
+    }
+    else {
+      reader = openFileReader(input, BlockSize, ReadDepth, IoUring, DirectIO);
+    }
+    hinfo->setPath(input);
+  }
+
+  lg_reset_context(searcher);
+  const bool ret = searchFile(searcher, hinfo, *reader, callback);
+  hinfo->flush();
+  return ret;
+}
+
+void SearchController::searchRing(
+  LG_HRING ring,
+  LG_HPROGRAM prog,
+  const LG_ContextOptions& ctxOpts,
+  HitCounterInfo* hinfo,
+  LG_HITCALLBACK_FN callback)
+{
+  typedef std::unique_ptr<ContextHandle, void(*)(ContextHandle*)> ContextPtr;
+
+  // the open streams, and contexts for new ones
+  std::unordered_map<uint64_t, ContextPtr> streams;
+  std::vector<ContextPtr> spare;
+
+  Timer searchClock;
+  double searchTime = 0.0;
+
+  const auto closeOut = [&](ContextPtr ctx) {
+    lg_closeout_search(ctx.get(), hinfo, callback);
+    lg_reset_context(ctx.get());
+    spare.push_back(std::move(ctx));
+  };
+
+  LG_RingSlot slot;
+  uint64_t curID = 0;
+  bool first = true;
+
+  while (lg_ring_next(ring, &slot)) {
+    const double start = searchClock.elapsed();
+
+    auto i = streams.find(slot.StreamID);
+    if (i == streams.end()) {
+      if (spare.empty()) {
+        spare.emplace_back(lg_create_context(prog, &ctxOpts), lg_destroy_context);
+      }
+      i = streams.emplace(slot.StreamID, std::move(spare.back())).first;
+      spare.pop_back();
+    }
+
+    if (first || slot.StreamID != curID) {
+      hinfo->setPath(std::to_string(slot.StreamID));
+      curID = slot.StreamID;
+      first = false;
+    }
+
+    hinfo->setBuffer(slot.Data, slot.Length, slot.Offset);
+    lg_search(i->second.get(), slot.Data, slot.Data + slot.Length, slot.Offset, hinfo, callback);
+    BytesSearched += slot.Length;
+
+    if (slot.Flags & LG_RING_END_OF_STREAM) {
+      closeOut(std::move(i->second));
+      streams.erase(i);
+    }
+
+    // the hits are out of the slot, so the producers may have it back
+    hinfo->flush();
+    lg_ring_release(ring, &slot, nullptr);
+
+    searchTime += searchClock.elapsed() - start;
+  }
+
+  // streams the producers never ended
+  for (auto& s : streams) {
+    hinfo->setPath(std::to_string(s.first));
+    closeOut(std::move(s.second));
+  }
+  hinfo->flush();
+
+  TotalTime += searchTime;
+}
@@ -0,0 +1,228 @@
+#include "searchpool.h"
+
+#include <cstdio>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+
+namespace {
+  // enough to keep the threads busy without walking far ahead of them
+  const size_t QUEUE_PER_THREAD = 64;
+
+  // the most of a file's hits a thread holds in memory
+  const size_t SPILL_SIZE = 1 << 20;
+}
+
+//
+// The stream a thread's hits go to. The hits for a file are collected
+// until the file is done; past SPILL_SIZE bytes of them, they go on to a
+// temporary file of the thread's own, so memory stays bounded. Only
+// writing out the finished file takes the output, so files stay whole
+// without one with many hits holding up the other threads.
+//
+class SearchPool::FileOutput: public std::streambuf {
+public:
+  explicit FileOutput(SearchPool& pool): Pool(pool), Spill(nullptr, std::fclose), SpillFailed(false) {}
+
+  // writes the file's hits to the output
+  void endFile() {
+    if (Spill) {
+      spill();
+      if (SpillFailed) {
+        throw std::runtime_error("Could not write hits to a temporary file");
+      }
+      std::rewind(Spill.get());
+
+      std::lock_guard<std::mutex> lock(Pool.OutLock);
+      if (Pool.Wrote) {
+        Pool.Out << Pool.GroupSeparator;
+      }
+      Pool.Wrote = true;
+
+      char buf[1 << 16];
+      size_t len;
+      while ((len = std::fread(buf, 1, sizeof(buf), Spill.get()))) {
+        Pool.Out.write(buf, len);
+      }
+      Spill.reset();
+    }
+    else {
+      Pool.write(Buf);
+    }
+    Buf.clear();
+  }
+
+protected:
+  virtual std::streamsize xsputn(const char* s, std::streamsize n) override {
+    Buf.append(s, n);
+    if (Buf.size() >= SPILL_SIZE) {
+      spill();
+    }
+    return n;
+  }
+
+  virtual int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      const char ch = traits_type::to_char_type(c);
+      xsputn(&ch, 1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+private:
+  // failures are reported by endFile(), outside the stream, which would
+  // swallow them
+  void spill() {
+    if (!Spill) {
+      Spill.reset(std::tmpfile());
+      SpillFailed = !Spill;
+    }
+    if (Spill && std::fwrite(Buf.data(), 1, Buf.size(), Spill.get()) != Buf.size()) {
+      SpillFailed = true;
+    }
+    Buf.clear();
+  }
+
+  SearchPool& Pool;
+  std::string Buf;
+  std::unique_ptr<FILE,int(*)(FILE*)> Spill;
+  bool SpillFailed;
+};
+
+SearchPool::SearchPool(
+  ProgramHandle* prog,
+  const LG_ContextOptions& ctxOpts,
+  uint32_t numThreads,
+  const SearchController& ctrl,
+  bool mmapped,
+  std::ostream& out,
+  const std::string& groupSeparator,
+  LG_HITCALLBACK_FN callback,
+  HitInfoMaker makeHitInfo
+):
+  BytesSearched(0),
+  NumHits(0),
+  Prog(prog),
+  CtxOpts(ctxOpts),
+  Ctrl(ctrl),
+  MemoryMapped(mmapped),
+  GroupSeparator(groupSeparator),
+  Callback(callback),
+  Done(false),
+  Out(out),
+  Wrote(false)
+{
+  for (uint32_t i = 0; i < numThreads; ++i) {
+    Threads.emplace_back(&SearchPool::work, this, makeHitInfo);
+  }
+}
+
+SearchPool::~SearchPool() {
+  try {
+    finish();
+  }
+  catch (...) {
+    // the error was for the caller, who did not call finish()
+  }
+}
+
+void SearchPool::push(const std::string& input) {
+  std::unique_lock<std::mutex> lock(QueueLock);
+  QueueNotFull.wait(lock, [this]() {
+    return Queue.size() < QUEUE_PER_THREAD * Threads.size() || Error;
+  });
+
+  if (Error) {
+    // a thread failed; stop queueing and let finish() report it
+    return;
+  }
+
+  Queue.push_back(input);
+  QueueNotEmpty.notify_one();
+}
+
+bool SearchPool::pop(std::string& input) {
+  std::unique_lock<std::mutex> lock(QueueLock);
+  QueueNotEmpty.wait(lock, [this]() {
+    return !Queue.empty() || Done || Error;
+  });
+
+  if (Queue.empty() || Error) {
+    return false;
+  }
+
+  input = std::move(Queue.front());
+  Queue.pop_front();
+  QueueNotFull.notify_one();
+  return true;
+}
+
+void SearchPool::finish() {
+  {
+    std::lock_guard<std::mutex> lock(QueueLock);
+    Done = true;
+  }
+  QueueNotEmpty.notify_all();
+
+  for (std::thread& t : Threads) {
+    t.join();
+  }
+  Threads.clear();
+
+  if (Error) {
+    std::exception_ptr e(Error);
+    Error = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+void SearchPool::write(const std::string& hits) {
+  if (hits.empty()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(OutLock);
+  if (Wrote) {
+    Out << GroupSeparator;
+  }
+  Out << hits;
+  Wrote = true;
+}
+
+void SearchPool::work(HitInfoMaker makeHitInfo) {
+  try {
+    std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> searcher(
+      lg_create_context(Prog, &CtxOpts),
+      lg_destroy_context
+    );
+
+    FileOutput fout(*this);
+    std::ostream buf(&fout);
+    const std::unique_ptr<HitCounterInfo> hinfo(makeHitInfo(buf));
+
+    SearchController ctrl(Ctrl);
+
+    std::string input;
+    while (pop(input)) {
+      hinfo->resetGroups();
+
+      ctrl.searchInput(input, MemoryMapped, searcher.get(), hinfo.get(), Callback);
+      hinfo->flush();
+      fout.endFile();
+    }
+
+    std::lock_guard<std::mutex> lock(OutLock);
+    BytesSearched += ctrl.BytesSearched;
+    NumHits += hinfo->NumHits;
+  }
+  catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(QueueLock);
+      if (!Error) {
+        Error = std::current_exception();
+      }
+    }
+    QueueNotEmpty.notify_all();
+    QueueNotFull.notify_all();
+  }
+}
@@ -0,0 +1,548 @@
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+  const size_t HEADER_SIZE = 26;
+
+  const size_t READ_SIZE = 1 << 16;
+
+  // stop reading from a client with this much waiting to be sent to it,
+  // and start again once it is down to the low mark
+  const size_t HIGH_WATER = 4 << 20;
+  const size_t LOW_WATER = 1 << 20;
+
+  // how long to wait for clients to take their last replies on shutdown
+  const int SHUTDOWN_WAIT_MS = 5000;
+
+  uint64_t readLE(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) {
+      v = (v << 8) | p[i];
+    }
+    return v;
+  }
+
+  [[noreturn]] void fail(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+}
+
+struct SearchServer::Connection {
+  explicit Connection(int fd):
+    FD(fd), HeaderLen(0), Remaining(0), Cur(nullptr), CurID(0), Offset(0),
+    Sent(0), Events(0), Paused(false), Closing(false), NumHits(0) {}
+
+  int FD;
+
+  // the header being read
+  unsigned char Header[HEADER_SIZE];
+  size_t HeaderLen;
+
+  // data left for the current SEARCH request, and its stream
+  uint64_t Remaining;
+  ContextHandle* Cur;
+  uint64_t CurID;
+  uint64_t Offset;
+
+  std::unordered_map<uint64_t, ContextHandle*> Streams;
+
+  // replies waiting to be sent, of which Sent bytes have been
+  std::string Out;
+  size_t Sent;
+
+  uint32_t Events;
+  bool Paused;
+  // set once nothing more will be read; closed once Out is sent
+  bool Closing;
+
+  uint64_t NumHits;
+
+  size_t waiting() const { return Out.size() - Sent; }
+
+  void reply(uint8_t cmd, uint64_t id, uint64_t start = 0, uint64_t end = 0, uint32_t patternIndex = 0) {
+    const ServerReply r{cmd, {0, 0, 0}, patternIndex, id, start, end};
+    Out.append(reinterpret_cast<const char*>(&r), sizeof(r));
+  }
+};
+
+void SearchServer::onHit(void* userData, const LG_SearchHit* const hit) {
+  Connection* conn = static_cast<Connection*>(userData);
+  ++conn->NumHits;
+  conn->reply(SEARCH, conn->CurID, hit->Start, hit->End, hit->KeywordIndex);
+}
+
+SearchServer::SearchServer(
+  ProgramHandle* prog,
+  const LG_ContextOptions& ctxOpts,
+  uint16_t port,
+  const std::string& socketPath
+):
+  BytesSearched(0),
+  NumHits(0),
+  NumStreams(0),
+  Prog(prog),
+  CtxOpts(ctxOpts),
+  SocketPath(socketPath),
+  Epoll(epoll_create1(EPOLL_CLOEXEC)),
+  OpenStreams(0),
+  ReadBuf(new char[READ_SIZE]),
+  Stopping(false)
+{
+  if (Epoll == -1) {
+    fail("epoll_create1");
+  }
+
+  try {
+    if (port) {
+      const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd == -1) {
+        fail("socket");
+      }
+      Listeners.push_back(fd);
+
+      const int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+      sockaddr_in addr;
+      std::memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(port);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+      if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+        fail("Could not listen on port " + std::to_string(port));
+      }
+      listenOn(fd);
+    }
+
+    if (!SocketPath.empty()) {
+      sockaddr_un addr;
+      std::memset(&addr, 0, sizeof(addr));
+      if (SocketPath.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Socket path is too long: " + SocketPath);
+      }
+      addr.sun_family = AF_UNIX;
+      std::memcpy(addr.sun_path, SocketPath.c_str(), SocketPath.size());
+
+      const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd == -1) {
+        fail("socket");
+      }
+      Listeners.push_back(fd);
+
+      // replace a socket left by a server which did not shut down, but
+      // nothing else
+      struct stat st;
+      if (!lstat(SocketPath.c_str(), &st) && S_ISSOCK(st.st_mode)) {
+        unlink(SocketPath.c_str());
+      }
+
+      if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+        fail("Could not listen on " + SocketPath);
+      }
+      listenOn(fd);
+    }
+
+    if (Listeners.empty()) {
+      throw std::runtime_error("The server needs a port or a socket to listen on");
+    }
+  }
+  catch (...) {
+    for (int fd : Listeners) {
+      close(fd);
+    }
+    close(Epoll);
+    throw;
+  }
+}
+
+SearchServer::~SearchServer() {
+  for (int fd : Listeners) {
+    close(fd);
+  }
+
+  for (auto& c : Connections) {
+    for (auto& s : c.second->Streams) {
+      Contexts.push_back(s.second);
+    }
+    close(c.first);
+  }
+
+  for (ContextHandle* ctx : Contexts) {
+    lg_destroy_context(ctx);
+  }
+
+  if (!SocketPath.empty() && !Stopping) {
+    unlink(SocketPath.c_str());
+  }
+
+  close(Epoll);
+}
+
+void SearchServer::listenOn(int fd) {
+  if (listen(fd, SOMAXCONN)) {
+    fail("listen");
+  }
+
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(Epoll, EPOLL_CTL_ADD, fd, &ev)) {
+    fail("epoll_ctl");
+  }
+}
+
+void SearchServer::run() {
+  epoll_event events[64];
+
+  while (!Listeners.empty() || !Connections.empty()) {
+    const int n = epoll_wait(Epoll, events, 64, Stopping ? SHUTDOWN_WAIT_MS : -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail("epoll_wait");
+    }
+
+    if (n == 0) {
+      // shutting down, and the clients left have stopped reading
+      while (!Connections.empty()) {
+        drop(Connections.begin()->first);
+      }
+      break;
+    }
+
+    for (int i = 0; i < n; ++i) {
+      const int fd = events[i].data.fd;
+
+      if (std::find(Listeners.begin(), Listeners.end(), fd) != Listeners.end()) {
+        accept(fd);
+        continue;
+      }
+
+      auto c = Connections.find(fd);
+      if (c == Connections.end()) {
+        // dropped while handling an earlier event
+        continue;
+      }
+
+      Connection& conn = *c->second;
+      if (events[i].events & EPOLLERR) {
+        drop(fd);
+        continue;
+      }
+
+      if (events[i].events & (EPOLLIN | EPOLLHUP)) {
+        if (conn.Closing) {
+          // the client hung up without waiting for the rest
+          drop(fd);
+          continue;
+        }
+        read(conn);
+      }
+
+      // the connection may have been dropped, or the server shut down
+      c = Connections.find(fd);
+      if (c != Connections.end()) {
+        write(*c->second);
+      }
+    }
+  }
+}
+
+void SearchServer::accept(int listener) {
+  while (!Stopping) {
+    const int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR) {
+        std::cerr << "accept: " << std::strerror(errno) << std::endl;
+      }
+      return;
+    }
+
+    Connection& conn = *(Connections[fd] = std::unique_ptr<Connection>(new Connection(fd)));
+
+    epoll_event ev;
+    ev.events = conn.Events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(Epoll, EPOLL_CTL_ADD, fd, &ev)) {
+      std::cerr << "epoll_ctl: " << std::strerror(errno) << std::endl;
+      close(fd);
+      Connections.erase(fd);
+    }
+  }
+}
+
+void SearchServer::read(Connection& conn) {
+  const ssize_t len = recv(conn.FD, ReadBuf.get(), READ_SIZE, 0);
+  if (len > 0) {
+    handle(conn, ReadBuf.get(), len);
+  }
+  else if (len == 0) {
+    // the client is done sending without hanging up; it may still be
+    // reading, so end its streams as for HANGUP
+    endStreams(conn);
+    conn.Closing = true;
+  }
+  else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+    drop(conn.FD);
+  }
+}
+
+void SearchServer::handle(Connection& conn, const char* buf, size_t len) {
+  const char* const end = buf + len;
+  while (buf < end && !conn.Closing) {
+    if (conn.Remaining) {
+      // search the data as it comes, or skip it for a refused stream
+      const size_t n = std::min(static_cast<uint64_t>(end - buf), conn.Remaining);
+      if (conn.Cur) {
+        lg_search(conn.Cur, buf, buf + n, conn.Offset, &conn, onHit);
+        BytesSearched += n;
+      }
+      conn.Offset += n;
+      conn.Remaining -= n;
+      buf += n;
+    }
+    else {
+      const size_t n = std::min(static_cast<size_t>(end - buf), HEADER_SIZE - conn.HeaderLen);
+      std::memcpy(conn.Header + conn.HeaderLen, buf, n);
+      conn.HeaderLen += n;
+      buf += n;
+
+      if (conn.HeaderLen == HEADER_SIZE) {
+        conn.HeaderLen = 0;
+        request(conn);
+      }
+    }
+  }
+}
+
+void SearchServer::request(Connection& conn) {
+  const uint8_t cmd = conn.Header[0];
+  const uint64_t id = readLE(conn.Header + 2),
+                 startOffset = readLE(conn.Header + 10),
+                 length = readLE(conn.Header + 18);
+
+  switch (cmd) {
+  case SEARCH:
+    {
+      ContextHandle* ctx = nullptr;
+
+      auto s = conn.Streams.find(id);
+      if (s != conn.Streams.end()) {
+        ctx = s->second;
+      }
+      else if (conn.Streams.size() < MAX_CLIENT_STREAMS && OpenStreams < MAX_STREAMS) {
+        // a new stream
+        if (Contexts.empty()) {
+          ctx = lg_create_context(Prog, &CtxOpts);
+        }
+        else {
+          ctx = Contexts.back();
+          Contexts.pop_back();
+          lg_reset_context(ctx);
+        }
+
+        if (ctx) {
+          conn.Streams.emplace(id, ctx);
+          ++OpenStreams;
+          ++NumStreams;
+        }
+      }
+
+      if (!ctx) {
+        // too many streams, or no memory for another; the client gets
+        // no hits for this piece
+        conn.reply(REFUSED, id, startOffset, startOffset + length);
+      }
+
+      conn.Cur = ctx;
+      conn.CurID = id;
+      conn.Offset = startOffset;
+      conn.Remaining = length;
+    }
+    break;
+
+  case END:
+    endStream(conn, id);
+    break;
+
+  case HANGUP:
+    endStreams(conn);
+    conn.reply(HANGUP, 0);
+    conn.Closing = true;
+    break;
+
+  case SHUTDOWN:
+    shutdown();
+    break;
+
+  default:
+    std::cerr << "Unknown command " << static_cast<unsigned int>(cmd)
+              << " from a client; dropping it" << std::endl;
+    endStreams(conn);
+    conn.Closing = true;
+    break;
+  }
+}
+
+void SearchServer::endStream(Connection& conn, uint64_t id) {
+  auto s = conn.Streams.find(id);
+  if (s != conn.Streams.end()) {
+    conn.CurID = id;
+    lg_closeout_search(s->second, &conn, onHit);
+    Contexts.push_back(s->second);
+    conn.Streams.erase(s);
+    --OpenStreams;
+  }
+
+  conn.reply(END, id);
+}
+
+void SearchServer::endStreams(Connection& conn) {
+  while (!conn.Streams.empty()) {
+    endStream(conn, conn.Streams.begin()->first);
+  }
+}
+
+void SearchServer::write(Connection& conn) {
+  while (conn.waiting()) {
+    const ssize_t len = send(conn.FD, conn.Out.data() + conn.Sent, conn.waiting(), MSG_NOSIGNAL);
+    if (len == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      else if (errno == EINTR) {
+        continue;
+      }
+
+      // the client is gone
+      drop(conn.FD);
+      return;
+    }
+    conn.Sent += len;
+  }
+
+  if (!conn.waiting()) {
+    conn.Out.clear();
+    conn.Sent = 0;
+
+    if (conn.Closing) {
+      drop(conn.FD);
+      return;
+    }
+  }
+  else if (conn.Sent > conn.Out.size() / 2) {
+    conn.Out.erase(0, conn.Sent);
+    conn.Sent = 0;
+  }
+
+  watch(conn);
+}
+
+void SearchServer::watch(Connection& conn) {
+  // hold off reading from a client which is not keeping up with its
+  // replies, so that they don't pile up here
+  if (conn.Paused) {
+    conn.Paused = conn.waiting() > LOW_WATER;
+  }
+  else {
+    conn.Paused = conn.waiting() >= HIGH_WATER;
+  }
+
+  uint32_t events = 0;
+  if (!conn.Paused && !conn.Closing) {
+    events |= EPOLLIN;
+  }
+  if (conn.waiting()) {
+    events |= EPOLLOUT;
+  }
+
+  if (events != conn.Events) {
+    epoll_event ev;
+    ev.events = conn.Events = events;
+    ev.data.fd = conn.FD;
+    if (epoll_ctl(Epoll, EPOLL_CTL_MOD, conn.FD, &ev)) {
+      fail("epoll_ctl");
+    }
+  }
+}
+
+void SearchServer::drop(int fd) {
+  auto c = Connections.find(fd);
+  if (c == Connections.end()) {
+    return;
+  }
+
+  // no one is left to take the last hits of its streams
+  for (auto& s : c->second->Streams) {
+    Contexts.push_back(s.second);
+  }
+  OpenStreams -= c->second->Streams.size();
+
+  NumHits += c->second->NumHits;
+  close(fd);
+  Connections.erase(c);
+}
+
+void SearchServer::shutdown() {
+  Stopping = true;
+
+  for (int fd : Listeners) {
+    close(fd);
+  }
+  Listeners.clear();
+
+  if (!SocketPath.empty()) {
+    unlink(SocketPath.c_str());
+  }
+
+  // send every client the last hits of its streams, then close
+  for (auto& c : Connections) {
+    Connection& conn = *c.second;
+    endStreams(conn);
+    conn.Closing = true;
+    watch(conn);
+  }
+}
+
+#else
+
+SearchServer::SearchServer(
+  ProgramHandle*,
+  const LG_ContextOptions& ctxOpts,
+  uint16_t,
+  const std::string&
+):
+  BytesSearched(0),
+  NumHits(0),
+  NumStreams(0),
+  Prog(nullptr),
+  CtxOpts(ctxOpts),
+  Epoll(-1),
+  OpenStreams(0),
+  Stopping(false)
+{
+  throw std::runtime_error("The server needs epoll, which this system lacks");
+}
+
+SearchServer::~SearchServer() {}
+
+void SearchServer::run() {}
+
+#endif
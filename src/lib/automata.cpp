@@ -26,6 +26,9 @@ std::string Glushkov::label() const {
   std::ostringstream buf;
   if (Trans) {
     buf << Trans->label();
+    if (Rep) {
+      buf << "{" << Rep->Min << "," << Rep->Max << "}";
+    }
     if (Label != NOLABEL) {
       buf << "/" << Label;
     }
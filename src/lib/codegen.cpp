@@ -16,49 +16,184 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <deque>
+#include <algorithm>
+#include <array>
 #include <vector>
 
 #include "codegen.h"
+#include "states.h"
 
-void CodeGenVisitor::discover_vertex(NFA::VertexDescriptor v, const NFA& graph) {
+template <class GraphType>
+void CodeGenVisitor::discover_vertex(NFA::VertexDescriptor v, const GraphType& graph) {
   Helper.discover(v, graph);
 }
 
-uint32_t CodeGenVisitor::calcJumpTableSize(NFA::VertexDescriptor v, const NFA& graph, uint32_t outDegree) {
-  if (outDegree > 3) {
-    TransitionTbl tbl(pivotStates(v, graph));
-    if (maxOutbound(tbl) < outDegree) {
-      uint32_t sizeIndirectTables = 0,
-             num,
-             first = 256,
-             last  = 0;
-
-      for (uint32_t i = 0; i < 256; ++i) {
-        num = tbl[i].size();
-        if (num > 1) {
-          sizeIndirectTables += num;
-        }
-        if (num) {
-          first = std::min(first, i);
-          last  = i;
-        }
+// Identifies where a jump to v lands, mirroring figureOutLanding(): the
+// start of the lone successor for unlabeled, non-matching, uncounted states
+// with one out edge, otherwise the code after v's transition.
+template <class GraphType>
+uint64_t landingKey(NFA::VertexDescriptor v, const GraphType& graph) {
+  return 1 == graph.outDegree(v) && NOLABEL == graph[v].Label &&
+         !graph[v].IsMatch && !graph[v].Rep ?
+    2*uint64_t(graph.outVertex(v, 0)) + 1 : 2*uint64_t(v);
+}
+
+template <class GraphType>
+uint32_t layoutJumpTable(NFA::VertexDescriptor v, const GraphType& graph, uint32_t outDegree, CodeGenHelper& cg) {
+  if (outDegree < 4) {
+    return 0;
+  }
+
+  PivotTable& tbl(cg.Pivots);
+  pivotStates(v, graph, tbl);
+  if (tbl.maxOutbound() >= outDegree) {
+    return 0;
+  }
+
+  uint32_t sizeIndirectTables = 0,
+           num,
+           first = 256,
+           last  = 0;
+
+  for (uint32_t i = 0; i < 256; ++i) {
+    num = tbl.size(i);
+    if (num > 1) {
+      sizeIndirectTables += num;
+    }
+    if (num) {
+      first = std::min(first, i);
+      last  = i;
+    }
+  }
+
+  // JumpTableRange instr + inclusive number
+  const uint32_t rangeSize = 2 + (last - first) + 2*sizeIndirectTables;
+
+  // Bytes going to the same place share a slot, and so does the indirect
+  // table of bytes with the same targets. Sorting the bytes by where their
+  // targets land brings those together; the least byte of each run leads it.
+  std::vector<uint64_t>& keys(cg.LandingKeys);
+  keys.resize(tbl.Targets.size());
+  for (uint32_t j = 0; j < keys.size(); ++j) {
+    keys[j] = landingKey(tbl.Targets[j], graph);
+  }
+
+  const auto keyLess = [&](byte a, byte b) {
+    return std::lexicographical_compare(
+      keys.begin() + tbl.Begin[a], keys.begin() + tbl.Begin[a+1],
+      keys.begin() + tbl.Begin[b], keys.begin() + tbl.Begin[b+1]
+    );
+  };
+
+  std::array<byte,256> order;
+  uint32_t numBytes = 0;
+  for (uint32_t i = first; i <= last; ++i) {
+    if (!tbl.empty(i)) {
+      order[numBytes++] = i;
+    }
+  }
+
+  std::sort(order.begin(), order.begin() + numBytes,
+    [&](byte a, byte b) {
+      return keyLess(a, b) || (!keyLess(b, a) && a < b);
+    }
+  );
+
+  std::array<byte,256> leader;
+  for (uint32_t k = 0; k < numBytes; ++k) {
+    leader[order[k]] = k > 0 && !keyLess(order[k-1], order[k]) ?
+      leader[order[k-1]] : order[k];
+  }
+
+  // slots are numbered in order of first use, which is the order of leaders
+  std::array<byte,256> slotOf;
+  uint32_t numSlots = 0,
+           sizeSharedTables = 0;
+
+  for (uint32_t i = first; i <= last && numSlots < 256; ++i) {
+    if (!tbl.empty(i) && leader[i] == i) {
+      slotOf[i] = ++numSlots;
+      if (tbl.size(i) > 1) {
+        sizeSharedTables += tbl.size(i);
       }
+    }
+  }
 
-      Helper.Snippets[v].Op = JUMP_TABLE_RANGE_OP;
-      // JumpTableRange instr + inclusive number
-      return 2 + (last - first) + 2*sizeIndirectTables;
+  JumpTableLayout layout;
+  layout.First = first;
+  layout.Last = last;
+  layout.SlotBegin = cg.JumpSlots.size();
+  layout.IndexBegin = NONE;
+
+  // too many distinct targets to index with a byte, or no smaller for it
+  const uint32_t indexSize = 1 + JumpTableLayout::indexWords(first, last)
+                             + numSlots + 2*sizeSharedTables;
+  if (numSlots < 256 && indexSize < rangeSize) {
+    layout.Op = JUMP_TABLE_INDEX_OP;
+    layout.Size = indexSize;
+    layout.NumSlots = numSlots;
+    layout.IndexBegin = cg.JumpIndex.size();
+
+    for (uint32_t i = first; i <= last; ++i) {
+      cg.JumpIndex.push_back(tbl.empty(i) ? 0 : slotOf[leader[i]]);
+
+      if (!tbl.empty(i) && leader[i] == i) {
+        cg.JumpSlots.push_back(cg.JumpTargets.size());
+        cg.JumpTargets.insert(cg.JumpTargets.end(), tbl.begin(i), tbl.end(i));
+      }
+    }
+  }
+  else {
+    layout.Op = JUMP_TABLE_RANGE_OP;
+    layout.Size = rangeSize;
+    layout.NumSlots = last - first + 1;
+
+    for (uint32_t i = first; i <= last; ++i) {
+      cg.JumpSlots.push_back(cg.JumpTargets.size());
+      cg.JumpTargets.insert(cg.JumpTargets.end(), tbl.begin(i), tbl.end(i));
     }
   }
-  return 0;
+
+  cg.JumpSlots.push_back(cg.JumpTargets.size());
+
+  cg.Snippets[v].Op = layout.Op;
+  cg.Snippets[v].JumpTable = cg.JumpTables.size();
+  cg.JumpTables.push_back(layout);
+
+  return layout.Size;
+}
+
+template <class GraphType>
+uint32_t CodeGenVisitor::calcJumpTableSize(NFA::VertexDescriptor v, const GraphType& graph, uint32_t outDegree) {
+  if (Helper.JumpTablesDone) {
+    const uint32_t i = Helper.Snippets[v].JumpTable;
+    return i == NONE ? 0 : Helper.JumpTables[i].Size;
+  }
+  return layoutJumpTable(v, graph, outDegree, Helper);
 }
 
-void CodeGenVisitor::finish_vertex(NFA::VertexDescriptor v, const NFA& graph) {
+template <class GraphType>
+void CodeGenVisitor::finish_vertex(NFA::VertexDescriptor v, const GraphType& graph) {
   // std::cerr << "on state " << v << " with discover rank " << Helper.DiscoverRanks[v] << std::endl;
 
   uint32_t label = 0,
          match = 0,
-         eval  = (v == 0 ? 0 : graph[v].Trans->numInstructions());
+         eval  = 0;
+
+  uint32_t count = 0;
+
+  if (v != 0) {
+    eval = Helper.transitionSize(graph[v].Trans);
+
+    if (graph[v].Rep) {
+      count = InstructionSize<COUNT_LOOP_OP>::VAL;
+      if (hasSeparateLoop(graph[v])) {
+        // jump over the loop body to the CountLoop
+        count += InstructionSize<JUMP_OP>::VAL +
+                 Helper.transitionSize(graph[v].Rep->Loop);
+      }
+    }
+  }
 
   const uint32_t outDegree = graph.outDegree(v);
 
@@ -89,7 +224,7 @@ void CodeGenVisitor::finish_vertex(NFA::VertexDescriptor v, const NFA& graph) {
     }
   }
 
-  const uint32_t totalSize = outOps + label + match +
+  const uint32_t totalSize = count + outOps + label + match +
                            (Helper.Snippets[v].CheckIndex == NONE ? 0: 1);
 
   Helper.addSnippet(v, eval, totalSize);
@@ -98,19 +233,30 @@ void CodeGenVisitor::finish_vertex(NFA::VertexDescriptor v, const NFA& graph) {
   // std::cerr << "state " << v << " has snippet " << "(" << Helper.Snippets[v].first << ", " << Helper.Snippets[v].second << ")" << std::endl;
 }
 
-void specialVisit(const NFA& graph, NFA::VertexDescriptor startVertex, CodeGenVisitor& vis) {
-  std::deque<NFA::VertexDescriptor> statesToVisit;
-  std::vector<NFA::VertexDescriptor> inOrder;
-  std::vector<bool> discovered(graph.verticesSize(), false);
+template <class GraphType>
+void specialVisit(const GraphType& graph, NFA::VertexDescriptor startVertex, CodeGenVisitor& vis) {
+  // States are visited breadth-first, except that the lone successor of a
+  // state without branches comes right after it. Each state is queued at
+  // most once, so the queue needs no more room than there are states.
+  static const uint32_t QUEUED = NONE - 1;
+
+  CodeGenHelper& cg(vis.helper());
+  std::vector<NFA::VertexDescriptor>& queue(cg.VisitQueue);
+  std::vector<NFA::VertexDescriptor>& inOrder(cg.VisitOrder);
 
+  queue.resize(graph.verticesSize());
+  inOrder.clear();
   inOrder.reserve(graph.verticesSize());
 
-  discovered[startVertex].flip();
-  statesToVisit.push_back(startVertex);
+  uint32_t head = 0,
+           tail = 0;
 
-  while (!statesToVisit.empty()) {
-    const NFA::VertexDescriptor v = statesToVisit.front();
-    statesToVisit.pop_front();
+  NFA::VertexDescriptor next = startVertex;
+  cg.DiscoverRanks[startVertex] = QUEUED;
+
+  while (next != NONE || head < tail) {
+    const NFA::VertexDescriptor v = next != NONE ? next : queue[head++];
+    next = NONE;
 
     vis.discover_vertex(v, graph);
     inOrder.push_back(v);
@@ -118,14 +264,14 @@ void specialVisit(const NFA& graph, NFA::VertexDescriptor startVertex, CodeGenVi
     const bool nobranch = graph.outDegree(v) < 2;
 
     for (const NFA::VertexDescriptor t : graph.outVertices(v)) {
-      if (!discovered[t]) {
-        discovered[t].flip();
+      if (cg.DiscoverRanks[t] == NONE) {
+        cg.DiscoverRanks[t] = QUEUED;
 
         if (nobranch) {
-          statesToVisit.push_front(t);
+          next = t;
         }
         else {
-          statesToVisit.push_back(t);
+          queue[tail++] = t;
         }
       }
     }
@@ -135,3 +281,18 @@ void specialVisit(const NFA& graph, NFA::VertexDescriptor startVertex, CodeGenVi
     vis.finish_vertex(v, graph);
   }
 }
+
+template void CodeGenVisitor::discover_vertex(NFA::VertexDescriptor v, const NFA& graph);
+template void CodeGenVisitor::discover_vertex(NFA::VertexDescriptor v, const FrozenNFA& graph);
+
+template uint32_t layoutJumpTable(NFA::VertexDescriptor v, const NFA& graph, uint32_t outDegree, CodeGenHelper& cg);
+template uint32_t layoutJumpTable(NFA::VertexDescriptor v, const FrozenNFA& graph, uint32_t outDegree, CodeGenHelper& cg);
+
+template uint32_t CodeGenVisitor::calcJumpTableSize(NFA::VertexDescriptor v, const NFA& graph, uint32_t outDegree);
+template uint32_t CodeGenVisitor::calcJumpTableSize(NFA::VertexDescriptor v, const FrozenNFA& graph, uint32_t outDegree);
+
+template void CodeGenVisitor::finish_vertex(NFA::VertexDescriptor v, const NFA& graph);
+template void CodeGenVisitor::finish_vertex(NFA::VertexDescriptor v, const FrozenNFA& graph);
+
+template void specialVisit(const NFA& graph, NFA::VertexDescriptor startVertex, CodeGenVisitor& vis);
+template void specialVisit(const FrozenNFA& graph, NFA::VertexDescriptor startVertex, CodeGenVisitor& vis);
@@ -0,0 +1,59 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "compile_observer.h"
+
+#include <string>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+uint64_t peakResidentBytes() {
+#ifdef _WIN32
+  return 0;
+#else
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru)) {
+    return 0;
+  }
+#ifdef __APPLE__
+  // bytes on macOS, kilobytes elsewhere
+  return ru.ru_maxrss;
+#else
+  return uint64_t(ru.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+CompileOverBudget::CompileOverBudget(uint64_t budget, const std::string& doing):
+  std::runtime_error(
+    "Compiling went over the memory budget of " + std::to_string(budget) +
+    " bytes " + doing
+  ),
+  Budget(budget)
+{}
+
+void CompileObserver::checkMemory(LG_CompilePhase phase, uint64_t bytes) const {
+  if (overBudget(bytes)) {
+    throw CompileOverBudget(
+      Budget, std::string("in the ") + lg_compile_phase_name(phase) + " phase"
+    );
+  }
+}
@@ -20,16 +20,20 @@
 
 #include "codegen.h"
 #include "program.h"
+#include "states.h"
 #include "utility.h"
 
+#include <algorithm>
 #include <tuple>
 
-uint32_t figureOutLanding(const CodeGenHelper& cg, NFA::VertexDescriptor v, const NFA& graph) {
+template <class GraphType>
+uint32_t figureOutLanding(const CodeGenHelper& cg, NFA::VertexDescriptor v, const GraphType& graph) {
   // If the jump is to a state that has only a single out edge, and there's
   // no label on the state, then jump forward directly to the out-edge state.
-  // i.e., this eliminates an indirect jump... it causes dead code.
+  // i.e., this eliminates an indirect jump... it causes dead code. Counted
+  // states need their CountLoop, so never skip those.
   if (1 == graph.outDegree(v) &&
-      NOLABEL == graph[v].Label && !graph[v].IsMatch) {
+      NOLABEL == graph[v].Label && !graph[v].IsMatch && !graph[v].Rep) {
     return cg.Snippets[graph.outVertex(v, 0)].Start;
   }
   else {
@@ -37,61 +41,48 @@ uint32_t figureOutLanding(const CodeGenHelper& cg, NFA::VertexDescriptor v, cons
   }
 }
 
-std::tuple<uint32_t, uint32_t> minAndMaxValues(const std::vector<std::vector<NFA::VertexDescriptor>>& tbl) {
-  uint32_t first = 0,
-           last  = 255;
+template <class GraphType>
+Instruction* writeIndirectTable(const CodeGenHelper& cg, const JumpTableLayout& layout, uint32_t k, Instruction* indirectTbl, const GraphType& graph) {
+  const NFA::VertexDescriptor* targets = cg.slotBegin(layout, k);
+  const int32_t num = cg.slotEnd(layout, k) - targets;
 
-  for (uint32_t i = 0; i < 256; ++i) {
-    if (!tbl[i].empty()) {
-      first = i;
-      break;
-    }
-  }
-  for (uint32_t i = 255; i > first; --i) {
-    if (!tbl[i].empty()) {
-      last = i;
-      break;
-    }
+  // write the indirect table in reverse edge order because
+  // parent threads have priority over forked children
+  for (int32_t j = num - 1; j >= 0; --j) {
+    const uint32_t landing = figureOutLanding(cg, targets[j], graph);
+
+    *indirectTbl = j > 0 ?
+      Instruction::makeFork(indirectTbl, landing) :
+      Instruction::makeJump(indirectTbl, landing);
+    indirectTbl += 2;
   }
-  return std::make_tuple(first, last);
+  return indirectTbl;
 }
 
 // JumpTables are either ranged, or full-size, and can have indirect tables at the end when there are multiple transitions out on a single byte value
-void createJumpTable(const CodeGenHelper& cg, Instruction const* const base, Instruction* const start, NFA::VertexDescriptor v, const NFA& graph) {
+template <class GraphType>
+void createJumpTable(const CodeGenHelper& cg, Instruction const* const base, Instruction* const start, NFA::VertexDescriptor v, const GraphType& graph) {
+  const JumpTableLayout& layout(cg.JumpTables[cg.Snippets[v].JumpTable]);
   const uint32_t startIndex = start - base;
   Instruction* cur = start,
              * indirectTbl;
 
-  auto tbl(pivotStates(v, graph));
+  *cur++ = Instruction::makeJumpTableRange(layout.First, layout.Last);
+  indirectTbl = start + 2 + (layout.Last - layout.First);
 
-  uint32_t first, last;
-  std::tie(first, last) = minAndMaxValues(tbl);
-
-  *cur++ = Instruction::makeJumpTableRange(first, last);
-  indirectTbl = start + 2 + (last - first);
-
-  for (uint32_t i = first; i <= last; ++i) {
-    if (tbl[i].empty()) {
+  for (uint32_t k = 0; k < layout.NumSlots; ++k) {
+    const uint32_t num = cg.slotEnd(layout, k) - cg.slotBegin(layout, k);
+    if (num == 0) {
       *cur++ = Instruction::makeRaw32(0);
     }
-    else if (tbl[i].size() == 1) {
-      const uint32_t addr = figureOutLanding(cg, *tbl[i].begin(), graph);
+    else if (num == 1) {
+      const uint32_t addr = figureOutLanding(cg, *cg.slotBegin(layout, k), graph);
       *cur++ = Instruction::makeRaw32(addr);
     }
     else {
       const uint32_t addr = startIndex + (indirectTbl - start);
       *cur++ = Instruction::makeRaw32(addr);
-
-      // write the indirect table in reverse edge order because
-      // parent threads have priority over forked children
-      for (int32_t j = tbl[i].size() - 1; j >= 0; --j) {
-        const uint32_t landing = figureOutLanding(cg, tbl[i][j], graph);
-
-        *indirectTbl = j > 0 ?
-          Instruction::makeFork(indirectTbl, landing) :
-          Instruction::makeJump(indirectTbl, landing);
-        indirectTbl += 2;
-      }
+      indirectTbl = writeIndirectTable(cg, layout, k, indirectTbl, graph);
     }
   }
 
@@ -103,17 +94,83 @@ void createJumpTable(const CodeGenHelper& cg, Instruction const* const base, Ins
   }
 }
 
+// Indexed jump tables hold a byte per value in [first, last], naming a slot
+// in the list of distinct targets that follows; bytes with the same targets
+// share a slot and, when there are several targets, an indirect table.
+template <class GraphType>
+void createIndexedJumpTable(const CodeGenHelper& cg, Instruction const* const base, Instruction* const start, NFA::VertexDescriptor v, const GraphType& graph) {
+  const JumpTableLayout& layout(cg.JumpTables[cg.Snippets[v].JumpTable]);
+  const uint32_t indexWords = JumpTableLayout::indexWords(layout.First, layout.Last);
+
+  *start = Instruction::makeJumpTableIndex(layout.First, layout.Last, layout.NumSlots);
+
+  byte* index = reinterpret_cast<byte*>(start + 1);
+  std::fill(index, index + 4*indexWords, 0);
+
+  const auto ibeg = cg.JumpIndex.begin() + layout.IndexBegin;
+  std::copy(ibeg, ibeg + (layout.Last - layout.First + 1), index);
+
+  Instruction* cur = start + 1 + indexWords,
+             * indirectTbl = cur + layout.NumSlots;
+
+  for (uint32_t k = 0; k < layout.NumSlots; ++k) {
+    if (cg.slotEnd(layout, k) - cg.slotBegin(layout, k) == 1) {
+      *cur++ = Instruction::makeRaw32(figureOutLanding(cg, *cg.slotBegin(layout, k), graph));
+    }
+    else {
+      *cur++ = Instruction::makeRaw32(indirectTbl - base);
+      indirectTbl = writeIndirectTable(cg, layout, k, indirectTbl, graph);
+    }
+  }
+
+  if (indirectTbl - base != cg.Snippets[v].end()) {
+    THROW_RUNTIME_ERROR_WITH_OUTPUT("indexed jump table for " << v << " ends at "
+      << (indirectTbl - base) << ", but its snippet ends at " << cg.Snippets[v].end()
+    );
+  }
+}
+
 bool targetCodeFollowsSource(const CodeGenHelper& cg, const NFA::VertexDescriptor source, const NFA::VertexDescriptor target) {
   return cg.DiscoverRanks[source] + 1 == cg.DiscoverRanks[target];
 }
 
-void encodeState(const NFA& graph, NFA::VertexDescriptor v, const CodeGenHelper& cg, Instruction const* const base, Instruction* curOp) {
+Instruction* encodeTransition(const Transition* trans, const CodeGenHelper& cg, Instruction const* const base, Instruction* curOp) {
+  if (cg.PoolByteSets && trans->type() == ByteSetStateType) {
+    *curOp = Instruction::makeBitVectorPool(
+      cg.poolAddress(trans->bytes()) - (curOp - base)
+    );
+    return curOp + InstructionSize<BIT_VECTOR_POOL_OP>::VAL;
+  }
+  else {
+    trans->toInstruction(curOp);
+    return curOp + trans->numInstructions();
+  }
+}
+
+template <class GraphType>
+void encodeState(const GraphType& graph, NFA::VertexDescriptor v, const CodeGenHelper& cg, Instruction const* const base, Instruction* curOp) {
   const NFA::Vertex& state(graph[v]);
   if (state.Trans) {
-    state.Trans->toInstruction(curOp);
-    curOp += state.Trans->numInstructions();
+    curOp = encodeTransition(state.Trans, cg, base, curOp);
     // std::cerr << "wrote " << i << std::endl;
 
+    if (state.Rep) {
+      // the first byte of a counted repetition is consumed by the state's
+      // transition, the rest by the loop body, which is the transition
+      // itself unless the two differ
+      uint32_t body = cg.Snippets[v].Start;
+      if (hasSeparateLoop(state)) {
+        Instruction* const jump = curOp;
+        curOp += InstructionSize<JUMP_OP>::VAL;
+        body = curOp - base;
+        curOp = encodeTransition(state.Rep->Loop, cg, base, curOp);
+        *jump = Instruction::makeJump(jump, curOp - base);
+      }
+
+      *curOp = Instruction::makeCountLoop(curOp, state.Rep->Min, state.Rep->Max, body);
+      curOp += InstructionSize<COUNT_LOOP_OP>::VAL;
+    }
+
     if (state.Label != NOLABEL) {
       *curOp++ = Instruction::makeLabel(state.Label);
     }
@@ -138,6 +195,9 @@ void encodeState(const NFA& graph, NFA::VertexDescriptor v, const CodeGenHelper&
   if (JUMP_TABLE_RANGE_OP == cg.Snippets[v].Op) {
     createJumpTable(cg, base, curOp, v, graph);
   }
+  else if (JUMP_TABLE_INDEX_OP == cg.Snippets[v].Op) {
+    createIndexedJumpTable(cg, base, curOp, v, graph);
+  }
   else {
     const uint32_t v_odeg = graph.outDegree(v);
     if (v_odeg > 0) {
@@ -163,29 +223,98 @@ void encodeState(const NFA& graph, NFA::VertexDescriptor v, const CodeGenHelper&
 // need a two-pass to get it to work with the bgl visitors
 //  discover_vertex: determine slot
 //  finish_vertex:
-ProgramPtr Compiler::createProgram(const NFA& graph) {
+template <class GraphType>
+ProgramPtr Compiler::createProgram(
+  const GraphType& graph,
+  CompileObserver obs,
+  const std::vector<uint32_t>* merged,
+  uint32_t* unmergedSize)
+{
   // std::cerr << "Compiling to byte code" << std::endl;
   const uint32_t numVs = graph.verticesSize();
+
+  std::pair<uint32_t,std::bitset<256*256>> filter;
+  {
+    const CompileObserver::Phase phase(obs, LG_PHASE_FILTER, numVs);
+    filter = bestPair(graph);
+    phase.done();
+  }
+
+  const CompileObserver::Phase phase(obs, LG_PHASE_CODEGEN, numVs);
+
   CodeGenHelper cg(numVs);
   CodeGenVisitor vis(cg);
   specialVisit(graph, 0ul, vis);
+  cg.layoutPool();
+
+  if (cg.Guard >= (1 << 24)) {
+    // pool offsets are 24 bits, so very large programs inline their sets
+    cg.reset(false);
+    specialVisit(graph, 0ul, vis);
+  }
   // std::cerr << "Determined order in first pass" << std::endl;
 
+  if (merged) {
+    // a merged vertex compiles to the same code as each it stands for,
+    // except that a copy of a merged first child would follow its parent
+    // rather than need a jump, unless it loops back to itself, and that a
+    // copy reached from no more vertices than it has copies would need no
+    // CheckHalt; whatever follows the code, such as the byte set pool, is
+    // unchanged
+    uint64_t code = 0, unmergedCode = 0;
+    for (NFA::VertexDescriptor v = 0; v < numVs; ++v) {
+      uint32_t size = cg.Snippets[v].numTotal();
+      code += size;
+
+      if (graph.outDegree(v) && cg.Snippets[v].JumpTable == NONE) {
+        const NFA::VertexDescriptor t = graph.outVertex(v, 0);
+        if (t != v && (*merged)[t] > 1 &&
+            cg.DiscoverRanks[v] + 1 != cg.DiscoverRanks[t])
+        {
+          size -= InstructionSize<JUMP_OP>::VAL;
+        }
+      }
+
+      if ((*merged)[v] > 1 && cg.Snippets[v].CheckIndex != NONE &&
+          !graph[v].Rep && graph.inDegree(v) <= (*merged)[v])
+      {
+        size -= InstructionSize<CHECK_HALT_OP>::VAL;
+      }
+
+      unmergedCode += uint64_t((*merged)[v]) * size;
+    }
+    *unmergedSize = unmergedCode + (cg.Guard - code) + 2;
+  }
+
+  obs.checkMemory(LG_PHASE_CODEGEN,
+    graph.memoryUsage() + cg.memoryUsage() +
+    uint64_t(cg.Guard + 2) * sizeof(Instruction)
+  );
+
   ProgramPtr ret(new Program(cg.Guard+2));
   ret->MaxLabel= cg.MaxLabel;
   ret->MaxCheck = cg.MaxCheck;
-  std::tie(ret->FilterOff, ret->Filter) = bestPair(graph);
+  std::tie(ret->FilterOff, ret->Filter) = filter;
 
   for (NFA::VertexDescriptor v = 0; v < numVs; ++v) {
-    // if (++i % 10000 == 0) {
-    //   std::cerr << "have compiled " << i << " states so far" << std::endl;
-    // }
+    if ((v + 1) % 65536 == 0) {
+      obs.progress(LG_PHASE_CODEGEN, v, numVs);
+    }
     encodeState(graph, v, cg, &(*ret)[0], &(*ret)[cg.Snippets[v].Start]);
   }
+  for (const auto& entry : cg.ByteSetPool) {
+    reinterpret_cast<ByteSet&>((*ret)[cg.PoolStart + 8*entry.second]) = entry.first;
+  }
+
   // penultimate instruction will always be Halt, so Vm can jump there
   (*ret)[cg.Guard] = Instruction::makeHalt();
   // last instruction will always be Finish, for handling matches
   (*ret)[cg.Guard+1] = Instruction::makeFinish();
 
+  phase.done();
   return ret;
 }
+
+template ProgramPtr Compiler::createProgram(const NFA& graph, CompileObserver obs, const std::vector<uint32_t>* merged, uint32_t* unmergedSize);
+template ProgramPtr Compiler::createProgram(const FrozenNFA& graph, CompileObserver obs, const std::vector<uint32_t>* merged, uint32_t* unmergedSize);
+
@@ -0,0 +1,63 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "encodedclasscache.h"
+
+#include <functional>
+
+// Enough for every class in a very large pattern set; past this we
+// start over rather than grow without bound.
+const size_t EncodedClassCache::MAX_ENTRIES = 1 << 16;
+
+EncodedClassCache& EncodedClassCache::instance() {
+  static EncodedClassCache cache;
+  return cache;
+}
+
+size_t EncodedClassCache::KeyHash::operator()(const Key& k) const {
+  size_t h = std::hash<std::string>()(k.first);
+  for (const UnicodeSet::range& r : k.second) {
+    h = h * 31 + r.first;
+    h = h * 31 + r.second;
+  }
+  return h;
+}
+
+std::shared_ptr<const EncodedClass> EncodedClassCache::find(const std::string& chain, const UnicodeSet& uset) const {
+  std::lock_guard<std::mutex> lock(Mutex);
+  const auto i = Cache.find(Key(chain, uset));
+  return i == Cache.end() ? std::shared_ptr<const EncodedClass>() : i->second;
+}
+
+void EncodedClassCache::insert(const std::string& chain, const UnicodeSet& uset, const std::shared_ptr<const EncodedClass>& frag) {
+  std::lock_guard<std::mutex> lock(Mutex);
+  if (Cache.size() >= MAX_ENTRIES) {
+    Cache.clear();
+  }
+  Cache.emplace(Key(chain, uset), frag);
+}
+
+size_t EncodedClassCache::size() const {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Cache.size();
+}
+
+void EncodedClassCache::clear() {
+  std::lock_guard<std::mutex> lock(Mutex);
+  Cache.clear();
+}
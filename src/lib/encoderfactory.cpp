@@ -28,6 +28,8 @@
 #include "encoders/utf32.h"
 #include "encoders/xorencoder.h"
 
+#include <stdexcept>
+
 #include <boost/lexical_cast.hpp>
 
 EncoderFactory::EncoderFactory():
@@ -106,3 +108,34 @@ std::shared_ptr<Encoder> EncoderFactory::get(const std::string& chain) {
 
   return std::shared_ptr<Encoder>(new CachingEncoder(std::move(enc)));
 }
+
+const std::string& EncoderFactory::canonical(const std::string& chain) {
+  auto i = Canonical.find(chain);
+  if (i != Canonical.end()) {
+    return i->second;
+  }
+
+  std::string name;
+  try {
+    std::vector<std::string> charchar, bytebyte;
+    std::string charbyte;
+    std::tie(charchar, charbyte, bytebyte) = parseChain(chain);
+
+    for (const std::string& cc : charchar) {
+      name += cc;
+      name += '|';
+    }
+
+    name += charbyte;
+
+    for (const std::string& bb : bytebyte) {
+      name += '|';
+      name += bb;
+    }
+  }
+  catch (const std::runtime_error&) {
+    name = chain;
+  }
+
+  return Canonical.emplace(chain, name).first->second;
+}
@@ -17,28 +17,53 @@
 */
 
 #include "fsmthingy.h"
+#include "parseutil.h"
+#include "unicode.h"
 #include "encoders/encoder.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
-FSMThingy::FSMThingy(uint32_t sizeHint): Fsm(new NFA(1, sizeHint)) {
+FSMThingy::FSMThingy(uint32_t sizeHint):
+  Fsm(new NFA(1, sizeHint)), UnsharedVertices(0), UnsharedInstructions(0)
+{
   Fsm->TransFac = Nfab.getTransFac();
 }
 
+namespace {
+  void checkNotFrozen(const NFAPtr& fsm) {
+    if (!fsm) {
+      throw std::runtime_error("Patterns cannot be added to an FSM once it is compiled");
+    }
+  }
+}
+
 void FSMThingy::addPattern(const ParseTree& tree, const char* chain, uint32_t label) {
+  checkNotFrozen(Fsm);
+
   // prepare the NFA builder
   Nfab.reset();
   Nfab.setCurLabel(label);
 
   // set the character encoding
-  Nfab.setEncoder(EncFac.get(chain));
+  Nfab.setEncoder(EncFac.get(chain), chain);
 
   // build the NFA for this pattern
-  if (Nfab.build(tree)) {
+  bool built;
+  {
+    const CompileObserver::Timing t(Observer, LG_PHASE_BUILD);
+    built = Nfab.build(tree);
+    if (built) {
+      Comp.pruneBranches(*Nfab.getFsm());
+    }
+  }
+
+  if (built) {
     // and merge it into the greater NFA
-    Comp.pruneBranches(*Nfab.getFsm());
+    const CompileObserver::Timing t(Observer, LG_PHASE_MERGE);
     Comp.mergeIntoFSM(*Fsm, *Nfab.getFsm());
   }
   else {
@@ -46,17 +71,209 @@ void FSMThingy::addPattern(const ParseTree& tree, const char* chain, uint32_t la
   }
 }
 
-void FSMThingy::finalizeGraph(bool determinize) {
+bool FSMThingy::encodeFixedString(const std::string& text, bool caseInsensitive, const std::string& chain) {
+  TempCodePoints.clear();
+  transform_utf8_to_unicode(
+    text.begin(), text.end(), std::back_inserter(TempCodePoints)
+  );
+
+  if (TempCodePoints.empty()) {
+    return false;
+  }
+
+  const std::shared_ptr<Encoder> enc(EncFac.get(chain));
+  TempBuf.resize(enc->maxByteLength());
+  TempTrans.clear();
+  TempBranches = false;
+
+  for (const int cp : TempCodePoints) {
+    if (cp < 1) {
+      // bad UTF-8 or a null; let the parser report it
+      return false;
+    }
+
+    if (caseInsensitive) {
+      UnicodeSet uset;
+      uset.set(cp);
+      if (caseDesensitize(uset)) {
+        // the parser makes a character class here; we handle only the
+        // classes which encode to a single sequence of byte sets
+        TempEncRanges.clear();
+        enc->write(uset & enc->validCodePoints(), TempEncRanges);
+        if (TempEncRanges.size() != 1) {
+          return false;
+        }
+
+        for (const ByteSet& bs : TempEncRanges.front()) {
+          TempTrans.push_back(Fsm->TransFac->getSmallest(bs));
+        }
+
+        TempBranches = true;
+        continue;
+      }
+    }
+
+    const uint32_t len = enc->write(cp, TempBuf.data());
+    if (len == 0) {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < len; ++i) {
+      TempTrans.push_back(Fsm->TransFac->getByte(TempBuf[i]));
+    }
+  }
+
+  return true;
+}
+
+bool FSMThingy::addFixedString(const std::string& text, bool caseInsensitive, const std::string& chain, uint32_t label) {
+  checkNotFrozen(Fsm);
+
+  {
+    const CompileObserver::Timing t(Observer, LG_PHASE_BUILD);
+    if (!encodeFixedString(text, caseInsensitive, chain)) {
+      return false;
+    }
+  }
+
+  const CompileObserver::Timing t(Observer, LG_PHASE_MERGE);
+
+  //
+  // This inserts the string as mergeIntoFSM would merge the chain of
+  // vertices NFABuilder makes for it: follow the first unshared,
+  // unlabeled vertex on the same transition for as long as possible,
+  // then add the remainder as a new branch ahead of the existing ones.
+  //
+
+  NFA& g(*Fsm);
+  NFA::VertexDescriptor head = 0;
+
+  std::vector<Transition*>::const_iterator i(TempTrans.begin());
+  const std::vector<Transition*>::const_iterator last(TempTrans.end() - 1);
+
+  for ( ; i != last; ++i) {
+    NFA::VertexDescriptor next = 0;
+    for (const NFA::VertexDescriptor t : g.outVertices(head)) {
+      if (g[t].Label == Glushkov::NOLABEL && 1 == g.inDegree(t) && !g[t].Rep &&
+          (g[t].Trans == *i || g[t].Trans->bytes() == (*i)->bytes())) {
+        next = t;
+        break;
+      }
+    }
+
+    if (!next) {
+      break;
+    }
+
+    head = next;
+  }
+
+  // the final vertex is a new match state, as no other has this label
+  bool first = true;
+  for ( ; i != TempTrans.end(); ++i) {
+    const NFA::VertexDescriptor tail = g.addVertex();
+    g[tail].Trans = *i;
+
+    if (first) {
+      g.insertEdge(head, tail, 0);
+      first = false;
+    }
+    else {
+      g.addEdge(head, tail);
+    }
+
+    head = tail;
+  }
+
+  g[head].IsMatch = true;
+  g[head].Label = label;
+
+  if (TempBranches) {
+    g.Deterministic = false;
+  }
+
+  return true;
+}
+
+uint64_t FSMThingy::memoryUsage() const {
+  // the graphs share the transition factory
+  return (Fsm ? Fsm->memoryUsage() + Fsm->TransFac->memoryUsage() : 0) +
+         (Frozen ? Frozen->memoryUsage() + (Fsm ? 0 : Frozen->TransFac->memoryUsage()) : 0) +
+         Nfab.getFsm()->memoryUsage();
+}
+
+void FSMThingy::finalizeGraph(bool determinize, bool shareSuffixes, uint32_t threads) {
+  if (Frozen) {
+    // compiled already
+    return;
+  }
+
   if (Fsm->verticesSize() < 2) {
     throw std::runtime_error("No valid patterns were parsed");
   }
 
+  UnsharedVertices = UnsharedInstructions = 0;
+  Merged.clear();
+
   if (determinize && !Fsm->Deterministic) {
+    const CompileObserver::Phase phase(Observer, LG_PHASE_DETERMINIZE, 0);
+
+    // more threads than cores would only contend for the subset table
+    threads = std::min(threads, std::max(std::thread::hardware_concurrency(), 1u));
+
     NFAPtr dfa(new NFA(1, 2 * Fsm->verticesSize(), Fsm->edgesSize()));
     dfa->TransFac = Fsm->TransFac;
-    Comp.subsetDFA(*dfa, *Fsm);
+    Comp.subsetDFA(*dfa, *Fsm, threads, Observer);
     Fsm = dfa;
+
+    phase.done(Fsm->verticesSize());
+
+    // collapse equivalent states left behind by the subset construction
+    minimize(nullptr);
+  }
+
+  if (shareSuffixes) {
+    UnsharedVertices = Fsm->verticesSize();
+
+    {
+      const CompileObserver::Phase phase(Observer, LG_PHASE_GUARDS, Fsm->verticesSize());
+      Comp.labelGuardStates(*Fsm);
+      phase.done();
+    }
+
+    // A thread takes its label at the guard state of its pattern, and
+    // every state past the guard is left unlabeled, so the tails of
+    // different patterns are equivalent once their guards are labeled.
+    // The VM keeps the threads of each label apart at the CheckHalts of
+    // shared states, so overlapping hits survive.
+    minimize(&Merged);
   }
 
-  Comp.labelGuardStates(*Fsm);
+  const CompileObserver::Phase phase(Observer, LG_PHASE_GUARDS, Fsm->verticesSize());
+
+  // the remaining passes leave the edges alone, so run them on a
+  // compact read-only copy of the graph, and let the mutable one go; the
+  // transitions belong to the factory, which the copy shares
+  Frozen.reset(new FrozenNFA(*Fsm, FrozenNFA::ReleaseEdges()));
+  Fsm.reset();
+  Observer.checkMemory(LG_PHASE_GUARDS, memoryUsage());
+  if (!shareSuffixes) {
+    Comp.labelGuardStates(*Frozen);
+  }
+
+  phase.done();
+}
+
+void FSMThingy::minimize(std::vector<uint32_t>* merged) {
+  const CompileObserver::Phase phase(Observer, LG_PHASE_MINIMIZE, Fsm->verticesSize());
+
+  // Equivalent states have the same transition, label, and match status,
+  // and the same successors in the same order, so the minimization is
+  // sound for NFAs too
+  NFAPtr min(new NFA(0, Fsm->verticesSize(), Fsm->edgesSize()));
+  Comp.minimizeDFA(*min, *Fsm, merged);
+  Observer.checkMemory(LG_PHASE_MINIMIZE, memoryUsage() + min->memoryUsage());
+  Fsm = min;
+
+  phase.done();
 }
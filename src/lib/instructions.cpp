@@ -65,12 +65,22 @@ std::string Instruction::toString() const {
   case BIT_VECTOR_OP:
     buf << "BitVector";
     break;
+  case BIT_VECTOR_POOL_OP:
+    buf << "BitVectorPool +" << std::dec << Op.Offset;
+    break;
   case JUMP_OP:
     buf << "Jump 0x" << HexCode<uint32_t>(*reinterpret_cast<const uint32_t*>(this+1)) << '/' << std::dec << (*reinterpret_cast<const uint32_t*>(this+1));
     break;
   case JUMP_TABLE_RANGE_OP:
     buf << "JmpTblRange 0x" << HexCode<byte>(Op.T2.First) << "/'" << Op.T2.First << "'-0x" << HexCode<byte>(Op.T2.Last) << "/'" << Op.T2.Last << '\'';
     break;
+  case JUMP_TABLE_INDEX_OP:
+    buf << "JmpTblIndex 0x" << HexCode<byte>(Op.T2.First) << "/'" << Op.T2.First << "'-0x" << HexCode<byte>(Op.T2.Last) << "/'" << Op.T2.Last << "' " << std::dec << (unsigned short)Op.T2.Flags;
+    break;
+  case COUNT_LOOP_OP:
+    buf << "CountLoop " << std::dec << Op.Offset << '-' << *reinterpret_cast<const uint32_t*>(this+1)
+      << " 0x" << HexCode<uint32_t>(*reinterpret_cast<const uint32_t*>(this+2)) << '/' << std::dec << (*reinterpret_cast<const uint32_t*>(this+2));
+    break;
   case FORK_OP:
     buf << "Fork 0x" << HexCode<uint32_t>(*reinterpret_cast<const uint32_t*>(this+1)) << '/' << std::dec << (*reinterpret_cast<const uint32_t*>(this+1));
     break;
@@ -157,6 +167,36 @@ Instruction Instruction::makeJumpTableRange(byte first, byte last) {
   return i;
 }
 
+Instruction Instruction::makeBitVectorPool(uint32_t offset) {
+  Instruction i = makeRaw24(offset);
+  i.OpCode = BIT_VECTOR_POOL_OP;
+  return i;
+}
+
+Instruction Instruction::makeJumpTableIndex(byte first, byte last, byte numSlots) {
+  Instruction i = makeRange(first, last);
+  i.OpCode = JUMP_TABLE_INDEX_OP;
+  // the slot count rides in the flags byte, which bounds it at 255
+  i.Op.T2.Flags = numSlots;
+  return i;
+}
+
+Instruction Instruction::makeCountLoop(Instruction* ptr, uint32_t min, uint32_t max, uint32_t body) {
+  // the repetition count lives in a 16-bit field of the Thread
+  if (min == 0 || max < min || max > 0xFFFF) {
+    THROW_WITH_OUTPUT(
+      std::range_error,
+      "bad repetition bounds; min = " << min << "; max = " << max
+    );
+  }
+
+  Instruction i = makeRaw24(min);
+  i.OpCode = COUNT_LOOP_OP;
+  *reinterpret_cast<uint32_t*>(ptr+1) = max;
+  *reinterpret_cast<uint32_t*>(ptr+2) = body;
+  return i;
+}
+
 Instruction Instruction::makeRaw24(uint32_t val) {
   if (val >= (1 << 24)) {
     THROW_WITH_OUTPUT(
@@ -249,6 +289,12 @@ std::istream& operator>>(std::istream& in, Instruction& instr) {
   else if (opname == "BitVector") {
     instr = Instruction::makeBitVector();
   }
+  else if (opname == "BitVectorPool") {
+    char plus;
+    uint32_t offset;
+    in >> plus >> std::dec >> offset;
+    instr = Instruction::makeBitVectorPool(offset);
+  }
   else if (opname == "Jump") {
     instr.OpCode = JUMP_OP;
     instr.Op.Offset = 0;
@@ -259,6 +305,18 @@ std::istream& operator>>(std::istream& in, Instruction& instr) {
     instr = Instruction::makeRange(first, last);
     instr.OpCode = JUMP_TABLE_RANGE_OP;
   }
+  else if (opname == "JmpTblIndex") {
+    uint32_t first, last, numSlots;
+    in >> std::hex >> first >> last >> std::dec >> numSlots;
+    instr = Instruction::makeJumpTableIndex(first, last, numSlots);
+  }
+  else if (opname == "CountLoop") {
+    // the max and the loop address are in the following words
+    uint32_t min;
+    in >> std::dec >> min;
+    instr = Instruction::makeRaw24(min);
+    instr.OpCode = COUNT_LOOP_OP;
+  }
   else if (opname == "Fork") {
     instr.OpCode = FORK_OP;
     instr.Op.Offset = 0;
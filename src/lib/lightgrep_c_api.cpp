@@ -29,17 +29,26 @@
 #include "parser.h"
 #include "parsetree.h"
 #include "program.h"
+#include "program_cache.h"
+#include "program_file.h"
+#include "ring.h"
+#include "unicode.h"
 #include "utility.h"
 #include "vm_interface.h"
 
+#include <algorithm>
 #include <cstring>
 #include <functional>
+#include <iterator>
 #include <string>
 #include <vector>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/tokenizer.hpp>
 
+#include <unicode/uchar.h>
+#include <unicode/utf8.h>
+
 namespace {
   template <typename F>
   bool exceptionTrap(F&& func) {
@@ -117,12 +126,91 @@ void lg_destroy_fsm(LG_HFSM hFsm) {
   delete hFsm;
 }
 
+void lg_set_compile_observer(LG_HFSM hFsm, LG_CompileObserver* observer) {
+  hFsm->Impl->Observer = CompileObserver(
+    observer, hFsm->Impl->Observer.budget()
+  );
+}
+
+void lg_set_memory_budget(LG_HFSM hFsm, uint64_t bytes) {
+  hFsm->Impl->Observer = CompileObserver(
+    hFsm->Impl->Observer.observer(), bytes
+  );
+}
+
+const char* lg_compile_phase_name(LG_CompilePhase phase) {
+  static const char* const names[] = {
+    "parse",
+    "build",
+    "merge",
+    "determinize",
+    "minimize",
+    "guards",
+    "filter",
+    "codegen"
+  };
+
+  return phase < LG_PHASE_COUNT ? names[phase] : "unknown";
+}
+
 namespace {
+  // A fixed string matched regardless of case matches the same text as
+  // its case-folded self. Bad UTF-8 is left for adding it to report.
+  std::string foldCase(const std::string& expr) {
+    std::vector<int> cps;
+    transform_utf8_to_unicode(expr.begin(), expr.end(), std::back_inserter(cps));
+
+    std::string folded;
+    for (const int cp : cps) {
+      if (cp < 0) {
+        return expr;
+      }
+
+      const UChar32 f = u_foldCase(cp, U_FOLD_CASE_DEFAULT);
+      char buf[U8_MAX_LENGTH];
+      int32_t len = 0;
+      U8_APPEND_UNSAFE(buf, len, f);
+      folded.append(buf, len);
+    }
+    return folded;
+  }
+
+  // Patterns with equal keys match the same text, so they share a label
+  // and are added to the automaton only once; searching reports hits on
+  // the label for each of them.
+  std::string patternKey(LG_HFSM hFsm, const std::string& expr, const std::string& encoding, bool fixed, bool caseInsensitive, bool unicode) {
+    std::string key(fixed && caseInsensitive ? foldCase(expr) : expr);
+    key += '\0';
+    key += hFsm->Impl->EncFac.canonical(encoding);
+    key += '\0';
+    key += static_cast<char>('0' + (fixed | caseInsensitive << 1 | unicode << 2));
+    return key;
+  }
+
+  std::string patternKey(LG_HFSM hFsm, const std::string& expr, const std::string& encoding, const LG_KeyOptions* keyOpts) {
+    return patternKey(hFsm, expr, encoding, keyOpts->FixedString, keyOpts->CaseInsensitive, keyOpts->UnicodeMode);
+  }
+
   int addPattern(LG_HFSM hFsm, LG_HPROGRAM hProg, LG_HPATTERN hPattern, const char* encoding, uint64_t userIndex) {
-    const uint32_t label = hProg->PMap->Patterns.size();
-    hFsm->Impl->addPattern(hPattern->Tree, encoding, label);
-    hProg->PMap->addPattern(hPattern->Pat.Expression.c_str(), encoding, userIndex);
-    return (int) label;
+    const Pattern& pat(hPattern->Pat);
+    const std::string key(patternKey(hFsm, pat.Expression, encoding, pat.FixedString, pat.CaseInsensitive, pat.UnicodeMode));
+
+    const uint32_t index = hProg->PMap->Patterns.size();
+    uint32_t label = hProg->PMap->labelOf(key);
+    if (label == PatternMap::NOLABEL) {
+      label = hProg->PMap->numLabels();
+      hFsm->Impl->addPattern(hPattern->Tree, encoding, label);
+    }
+
+    hProg->PMap->addPattern(pat.Expression.c_str(), encoding, userIndex, label, key);
+    return (int) index;
+  }
+
+  void checkPatternMemory(LG_HFSM hFsm, const std::string& pat) {
+    const CompileObserver& obs(hFsm->Impl->Observer);
+    if (obs.overBudget(hFsm->Impl->memoryUsage())) {
+      throw CompileOverBudget(obs.budget(), "adding pattern '" + pat + "'");
+    }
   }
 }
 
@@ -135,7 +223,9 @@ int lg_add_pattern(LG_HFSM hFsm,
 {
   return trapWithRetval(
     [hFsm, hProg, hPattern, encoding, userIndex]() {
-      return addPattern(hFsm, hProg, hPattern, encoding, userIndex);
+      const int label = addPattern(hFsm, hProg, hPattern, encoding, userIndex);
+      checkPatternMemory(hFsm, hPattern->Pat.Expression);
+      return label;
     },
     -1,
     err
@@ -143,6 +233,30 @@ int lg_add_pattern(LG_HFSM hFsm,
 }
 
 namespace {
+  bool addFixedString(LG_HFSM hFsm,
+                      LG_HPROGRAM hProg,
+                      const std::string& pat,
+                      const LG_KeyOptions* keyOpts,
+                      const std::string& enc,
+                      int lnum)
+  {
+    // Fixed strings need no parse tree; failures here fall back to the
+    // parser, which reports any error properly.
+    bool added = false;
+    exceptionTrap([&]() {
+      const uint32_t label = hProg->PMap->numLabels();
+      added = hFsm->Impl->addFixedString(
+        pat, keyOpts->CaseInsensitive, enc, label
+      );
+      if (added) {
+        hProg->PMap->addPattern(
+          pat.c_str(), enc.c_str(), lnum, label, patternKey(hFsm, pat, enc, keyOpts)
+        );
+      }
+    });
+    return added;
+  }
+
   template <class E>
   void addPattern(LG_HFSM hFsm,
                   LG_HPROGRAM hProg,
@@ -153,15 +267,40 @@ namespace {
                   int lnum,
                   LG_Error**& err)
   {
-    lg_parse_pattern(hPat, pat.c_str(), keyOpts, err);
-    if (*err) {
-      (*err)->Index = lnum;
-      err = &((*err)->Next);
-      return;
-    }
+    bool parsed = false;
 
     for (const std::string& enc : encodings) {
-      const int label = lg_add_pattern(hFsm, hProg, hPat, enc.c_str(), lnum, err);
+      // a duplicate needs neither parsing nor adding to the automaton
+      const uint32_t label = hProg->PMap->labelOf(patternKey(hFsm, pat, enc, keyOpts));
+      if (label != PatternMap::NOLABEL) {
+        hProg->PMap->addPattern(pat.c_str(), enc.c_str(), lnum, label);
+        continue;
+      }
+
+      if (keyOpts->FixedString &&
+          addFixedString(hFsm, hProg, pat, keyOpts, enc, lnum))
+      {
+        continue;
+      }
+
+      // parse only once, and only if some encoding needs the tree
+      if (!parsed) {
+        const CompileObserver::Timing t(hFsm->Impl->Observer, LG_PHASE_PARSE);
+        lg_parse_pattern(hPat, pat.c_str(), keyOpts, err);
+        if (*err) {
+          (*err)->Index = lnum;
+          err = &((*err)->Next);
+          return;
+        }
+        parsed = true;
+      }
+
+      // the caller checks the memory budget once the line is done
+      trapWithRetval(
+        [=]() { return addPattern(hFsm, hProg, hPat, enc.c_str(), lnum); },
+        -1,
+        err
+      );
       if (*err) {
         (*err)->Index = lnum;
         err = &((*err)->Next);
@@ -192,14 +331,21 @@ namespace {
     typedef boost::tokenizer<char_separator, const char*> cstr_tokenizer;
     typedef boost::tokenizer<char_separator> tokenizer;
 
+    const CompileObserver obs(hFsm->Impl->Observer);
+    const CompileObserver::PeakGrowth peak(obs, LG_PHASE_MERGE);
+
+    const char* const pend = patterns + std::strlen(patterns);
+    const uint64_t numLines = std::count(patterns, pend, '\n') +
+                              (pend > patterns && pend[-1] != '\n');
+
     // read each pattern line
-    const cstr_tokenizer ltok(
-      patterns, patterns + std::strlen(patterns), char_separator("\n")
-    );
+    const cstr_tokenizer ltok(patterns, pend, char_separator("\n"));
 
     cstr_tokenizer::const_iterator lcur(ltok.begin());
     const cstr_tokenizer::const_iterator lend(ltok.end());
     for (int lnum = 0; lcur != lend; ++lcur, ++lnum) {
+      obs.progress(LG_PHASE_MERGE, lnum, numLines);
+
       // split each pattern line into columns
       const tokenizer ctok(*lcur, char_separator("\t"));
       tokenizer::const_iterator ccur(ctok.begin());
@@ -251,8 +397,20 @@ namespace {
         // use default encodings and options
         addPattern(hFsm, hProg, ph.get(), pat, &opts, defEncs, lnum, err);
       }
+
+      try {
+        checkPatternMemory(hFsm, pat);
+      }
+      catch (const CompileOverBudget& e) {
+        // the lines after this one would go over the budget too, so stop
+        if (err) {
+          *err = makeError(e.what(), pat.c_str(), nullptr, source, lnum);
+        }
+        return -1;
+      }
     }
 
+    obs.progress(LG_PHASE_MERGE, numLines, numLines);
     return 0;
   }
 }
@@ -322,67 +480,125 @@ LG_HPROGRAM lg_create_program(unsigned int numTotalPatternsSizeHint) {
 
 namespace {
   int compile_program(LG_HFSM hFsm, LG_HPROGRAM hProg, const LG_ProgramOptions* opts) {
-    hFsm->Impl->finalizeGraph(opts->Determinize);
-    hProg->Prog = Compiler::createProgram(*hFsm->Impl->Fsm);
+    FSMThingy& fsm(*hFsm->Impl);
+    fsm.finalizeGraph(opts->Determinize, opts->ShareSuffixes, opts->Threads);
+    hProg->Prog = Compiler::createProgram(
+      *fsm.Frozen, fsm.Observer,
+      fsm.Merged.empty() ? nullptr : &fsm.Merged, &fsm.UnsharedInstructions
+    );
+    std::vector<uint32_t>().swap(fsm.Merged);
+    // no more patterns can be added, so duplicates need not be found
+    hProg->PMap->clearKeys();
     return hProg->Prog != nullptr;
   }
 }
 
 int lg_compile_program(LG_HFSM hFsm, LG_HPROGRAM hProg,
-                       const LG_ProgramOptions* options)
+                       const LG_ProgramOptions* options,
+                       LG_Error** err)
 {
   return trapWithRetval(
     [hFsm, hProg, options](){ return compile_program(hFsm, hProg, options); },
-    0
+    0,
+    err
+  );
+}
+
+namespace {
+  LG_HPROGRAM link_programs(const LG_HPROGRAM* progs, unsigned int numProgs) {
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> hProg(
+      lg_create_program(0),
+      lg_destroy_program
+    );
+
+    std::vector<const Program*> parts;
+    std::vector<uint32_t> labelOffsets;
+
+    for (unsigned int i = 0; i < numProgs; ++i) {
+      if (!progs[i]->Prog) {
+        THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT("Program " << i << " is not compiled");
+      }
+
+      parts.push_back(progs[i]->Prog.get());
+
+      const PatternMap& pmap(*progs[i]->PMap);
+      const uint32_t labelOff = hProg->PMap->numLabels();
+      labelOffsets.push_back(labelOff);
+
+      for (uint32_t j = 0; j < pmap.Patterns.size(); ++j) {
+        const LG_PatternInfo& pi(pmap.Patterns[j]);
+        hProg->PMap->addPattern(
+          pi.Pattern, pi.EncodingChain, pi.UserIndex, pmap.label(j) + labelOff
+        );
+      }
+    }
+
+    hProg->Prog = linkPrograms(parts, labelOffsets);
+    return hProg.release();
+  }
+}
+
+LG_HPROGRAM lg_link_programs(const LG_HPROGRAM* progs,
+                             unsigned int numProgs,
+                             LG_Error** err)
+{
+  return trapWithRetval(
+    [progs, numProgs](){ return link_programs(progs, numProgs); },
+    nullptr,
+    err
   );
 }
 
 unsigned int lg_program_size(const LG_HPROGRAM hProg) {
-  return sizeof(uint64_t) + hProg->PMap->bufSize() +
-         sizeof(uint64_t) + hProg->Prog->bufSize();
+  return programFileSize(*hProg);
 }
 
 namespace {
   void write_program(const LG_HPROGRAM hProg, void* buffer) {
-    char* dst = reinterpret_cast<char*>(buffer);
-
-    const std::vector<char> pmap_buf = hProg->PMap->marshall();
-    const uint64_t pmap_size = pmap_buf.size();
-    *reinterpret_cast<uint64_t*>(dst) = pmap_size;
-    dst += sizeof(pmap_size);
-    std::memcpy(dst, pmap_buf.data(), pmap_size);
-    dst += pmap_size;
-
-    const std::vector<char> prog_buf = hProg->Prog->marshall();
-    const uint64_t prog_size = prog_buf.size();
-    *reinterpret_cast<uint64_t*>(dst) = prog_size;
-    dst += sizeof(prog_size);
-    std::memcpy(dst, prog_buf.data(), prog_size);
-    dst += prog_size;
+    writeProgramFile(*hProg, buffer);
   }
 
-  LG_HPROGRAM read_program(const void* buffer, size_t size) {
+  // reads the unversioned format written by earlier releases: a sized
+  // pattern map followed by a sized program
+  LG_HPROGRAM read_legacy_program(const void* buffer, size_t size) {
     std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> hProg(
       new ProgramHandle,
       lg_destroy_program
     );
 
     const char* src = reinterpret_cast<const char*>(buffer);
+    const char* const end = src + size;
+
+    // reads the size of a section, which must fit in the rest of the buffer
+    const auto sectionSize = [&src, end]() {
+      uint64_t len;
+      if (static_cast<size_t>(end - src) < sizeof(len)) {
+        throw std::runtime_error("Program is truncated");
+      }
+
+      std::memcpy(&len, src, sizeof(len));
+      src += sizeof(len);
+
+      if (len > static_cast<uint64_t>(end - src)) {
+        throw std::runtime_error("Program is truncated");
+      }
+      return len;
+    };
 
-    const uint64_t pmap_size = *reinterpret_cast<const uint64_t*>(src);
-    src += sizeof(pmap_size);
+    const uint64_t pmap_size = sectionSize();
     hProg->PMap = PatternMap::unmarshall(src, pmap_size);
     src += pmap_size;
 
-    const uint64_t prog_size = *reinterpret_cast<const uint64_t*>(src);
-    src += sizeof(prog_size);
+    const uint64_t prog_size = sectionSize();
     hProg->Prog = Program::unmarshall(src, prog_size);
-    src += prog_size;
-
-// TODO: don't go beyond size?
 
     return hProg.release();
   }
+
+  LG_HPROGRAM read_program(const void* buffer, size_t size) {
+    return isProgramFile(buffer, size) ?
+      readProgramFile(buffer, size) : read_legacy_program(buffer, size);
+  }
 }
 
 LG_HPROGRAM lg_read_program(const void* buffer, int size) {
@@ -392,6 +608,21 @@ LG_HPROGRAM lg_read_program(const void* buffer, int size) {
   );
 }
 
+LG_HPROGRAM lg_map_program(const char* path, LG_Error** err) {
+  return trapWithRetval(
+    [path](){ return mapProgramFile(path); },
+    nullptr,
+    err
+  );
+}
+
+int lg_verify_program(const void* buffer, uint64_t size, LG_Error** err) {
+  return trapWithVals(
+    [buffer, size](){ verifyProgramFile(buffer, size); },
+    1, 0, err
+  );
+}
+
 void lg_write_program(const LG_HPROGRAM hProg, void* buffer) {
   exceptionTrap(std::bind(write_program, hProg, buffer));
 }
@@ -400,6 +631,56 @@ void lg_destroy_program(LG_HPROGRAM hProg) {
   delete hProg;
 }
 
+LG_HPROGRAM lg_load_cached_program(const LG_CacheOptions* cache,
+                                   const char** patternLists,
+                                   unsigned int patternListsNum,
+                                   const char** defaultEncodings,
+                                   unsigned int defaultEncodingsNum,
+                                   const LG_KeyOptions* defaultOptions,
+                                   const LG_ProgramOptions* progOptions)
+{
+  return trapWithRetval(
+    [=]() {
+      return loadCachedProgram(
+        cache->Directory,
+        programCacheKey(
+          patternLists, patternListsNum,
+          defaultEncodings, defaultEncodingsNum,
+          *defaultOptions, *progOptions
+        )
+      );
+    },
+    nullptr
+  );
+}
+
+int lg_store_cached_program(const LG_CacheOptions* cache,
+                            const LG_HPROGRAM hProg,
+                            const char** patternLists,
+                            unsigned int patternListsNum,
+                            const char** defaultEncodings,
+                            unsigned int defaultEncodingsNum,
+                            const LG_KeyOptions* defaultOptions,
+                            const LG_ProgramOptions* progOptions,
+                            LG_Error** err)
+{
+  return trapWithVals(
+    [=]() {
+      storeCachedProgram(
+        cache->Directory,
+        programCacheKey(
+          patternLists, patternListsNum,
+          defaultEncodings, defaultEncodingsNum,
+          *defaultOptions, *progOptions
+        ),
+        hProg,
+        cache->MaxSize
+      );
+    },
+    1, 0, err
+  );
+}
+
 namespace {
   LG_HCONTEXT create_context(LG_HPROGRAM hProg,
 #ifdef LBT_TRACE_ENABLED
@@ -415,6 +696,7 @@ namespace {
     );
 
     hCtx->Impl = VmInterface::create(hProg->Prog);
+    hCtx->FanOut = hProg->PMap->fanOut();
 #ifdef LBT_TRACE_ENABLED
     hCtx->Impl->setDebugRange(beginTrace, endTrace);
 #endif
@@ -444,6 +726,36 @@ void lg_reset_context(LG_HCONTEXT hCtx) {
   exceptionTrap(std::bind(&VmInterface::reset, hCtx->Impl));
 }
 
+namespace {
+  // Reports a hit on a shared label once for each pattern having it
+  struct FanOutHits {
+    const LabelFanOut& FanOut;
+    void* UserData;
+    LG_HITCALLBACK_FN CallbackFn;
+
+    static void hit(void* userData, const LG_SearchHit* const hit) {
+      const FanOutHits& f(*static_cast<const FanOutHits*>(userData));
+      const uint32_t label = hit->KeywordIndex;
+
+      LG_SearchHit h(*hit);
+      for (uint32_t i = f.FanOut.Begin[label]; i < f.FanOut.Begin[label+1]; ++i) {
+        h.KeywordIndex = f.FanOut.Patterns[i];
+        (*f.CallbackFn)(f.UserData, &h);
+      }
+    }
+  };
+
+  template <class F>
+  auto withFanOut(LG_HCONTEXT hCtx, void* userData, LG_HITCALLBACK_FN callbackFn, F search) -> decltype(search(userData, callbackFn)) {
+    if (!hCtx->FanOut) {
+      return search(userData, callbackFn);
+    }
+
+    FanOutHits f{*hCtx->FanOut, userData, callbackFn};
+    return search(&f, &FanOutHits::hit);
+  }
+}
+
 void lg_starts_with(LG_HCONTEXT hCtx,
                    const char* bufStart,
                    const char* bufEnd,
@@ -451,7 +763,11 @@ void lg_starts_with(LG_HCONTEXT hCtx,
                    void* userData,
                    LG_HITCALLBACK_FN callbackFn)
 {
-  exceptionTrap(std::bind(&VmInterface::startsWith, hCtx->Impl, (const byte*) bufStart, (const byte*) bufEnd, startOffset, callbackFn, userData));
+  withFanOut(hCtx, userData, callbackFn,
+    [=](void* ud, LG_HITCALLBACK_FN fn) {
+      exceptionTrap(std::bind(&VmInterface::startsWith, hCtx->Impl, (const byte*) bufStart, (const byte*) bufEnd, startOffset, fn, ud));
+    }
+  );
 }
 
 uint64_t lg_search(LG_HCONTEXT hCtx,
@@ -461,14 +777,22 @@ uint64_t lg_search(LG_HCONTEXT hCtx,
                        void* userData,
                        LG_HITCALLBACK_FN callbackFn)
 {
-  return trapWithRetval(std::bind(&VmInterface::search, hCtx->Impl, (const byte*) bufStart, (const byte*) bufEnd, startOffset, callbackFn, userData), std::numeric_limits<uint64_t>::max());
+  return withFanOut(hCtx, userData, callbackFn,
+    [=](void* ud, LG_HITCALLBACK_FN fn) {
+      return trapWithRetval(std::bind(&VmInterface::search, hCtx->Impl, (const byte*) bufStart, (const byte*) bufEnd, startOffset, fn, ud), std::numeric_limits<uint64_t>::max());
+    }
+  );
 }
 
 void lg_closeout_search(LG_HCONTEXT hCtx,
                         void* userData,
                         LG_HITCALLBACK_FN callbackFn)
 {
-  exceptionTrap(std::bind(&VmInterface::closeOut, hCtx->Impl, callbackFn, userData));
+  withFanOut(hCtx, userData, callbackFn,
+    [=](void* ud, LG_HITCALLBACK_FN fn) {
+      exceptionTrap(std::bind(&VmInterface::closeOut, hCtx->Impl, fn, ud));
+    }
+  );
 }
 
 uint64_t lg_search_resolve(LG_HCONTEXT hCtx,
@@ -478,5 +802,67 @@ uint64_t lg_search_resolve(LG_HCONTEXT hCtx,
                        void* userData,
                        LG_HITCALLBACK_FN callbackFn)
 {
-  return trapWithRetval(std::bind(&VmInterface::searchResolve, hCtx->Impl, (const byte*) bufStart, (const byte*) bufEnd, startOffset, callbackFn, userData), std::numeric_limits<uint64_t>::max());
+  return withFanOut(hCtx, userData, callbackFn,
+    [=](void* ud, LG_HITCALLBACK_FN fn) {
+      return trapWithRetval(std::bind(&VmInterface::searchResolve, hCtx->Impl, (const byte*) bufStart, (const byte*) bufEnd, startOffset, fn, ud), std::numeric_limits<uint64_t>::max());
+    }
+  );
+}
+
+LG_HRING lg_create_ring(const char* name,
+                        unsigned int numSlots,
+                        unsigned int slotSize,
+                        LG_Error** err)
+{
+  return trapWithRetval(
+    [=]() {
+      return new RingHandle{std::unique_ptr<Ring>(Ring::create(name, numSlots, slotSize))};
+    },
+    nullptr,
+    err
+  );
+}
+
+LG_HRING lg_open_ring(const char* name, LG_Error** err) {
+  return trapWithRetval(
+    [name]() {
+      return new RingHandle{std::unique_ptr<Ring>(Ring::open(name))};
+    },
+    nullptr,
+    err
+  );
+}
+
+void lg_destroy_ring(LG_HRING hRing) {
+  delete hRing;
+}
+
+unsigned int lg_ring_slot_size(LG_HRING hRing) {
+  return hRing->Impl->slotSize();
+}
+
+int lg_ring_acquire(LG_HRING hRing, LG_RingSlot* slot) {
+  return hRing->Impl->acquire(*slot);
+}
+
+int lg_ring_publish(LG_HRING hRing, const LG_RingSlot* slot, LG_Error** err) {
+  return trapWithVals(
+    [=]() { hRing->Impl->publish(*slot); },
+    1, 0, err
+  );
+}
+
+void lg_ring_close(LG_HRING hRing) {
+  hRing->Impl->close();
+}
+
+int lg_ring_next(LG_HRING hRing, LG_RingSlot* slot) {
+  return hRing->Impl->next(*slot);
+}
+
+int lg_ring_release(LG_HRING hRing, const LG_RingSlot* slot, LG_Error** err) {
+  return trapWithVals(
+    [=]() { hRing->Impl->release(*slot); },
+    1, 0, err
+  );
 }
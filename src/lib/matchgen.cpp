@@ -89,6 +89,14 @@ void matchgen(const NFA& g, std::set<std::string>& matches,
           if (g[w].Trans) {
             g[w].Trans->getBytes(allowed);
             match += chooseByte(allowed, rng);
+
+            if (g[w].Rep) {
+              // counted states repeat as few times as they can
+              g[w].Rep->Loop->getBytes(allowed);
+              for (uint32_t r = 1; r < g[w].Rep->Min; ++r) {
+                match += chooseByte(allowed, rng);
+              }
+            }
           }
         }
 
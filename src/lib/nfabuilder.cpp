@@ -17,6 +17,7 @@
 */
 
 #include "nfabuilder.h"
+#include "encodedclasscache.h"
 #include "parsetree.h"
 #include "states.h"
 #include "transitionfactory.h"
@@ -28,6 +29,9 @@
 #include <utility>
 #include <cctype>
 
+// repetitions with fewer copies than this are cheaper expanded than counted
+static const uint32_t MIN_COUNTED_REPETITION = 16;
+
 
 // static std::ostream& operator<<(std::ostream& out, const InListT& list) {
 //   out << '[';
@@ -95,7 +99,12 @@ void NFABuilder::init() {
 }
 
 void NFABuilder::setEncoder(const std::shared_ptr<Encoder>& e) {
+  setEncoder(e, std::string());
+}
+
+void NFABuilder::setEncoder(const std::shared_ptr<Encoder>& e, const std::string& chain) {
   Enc = e;
+  Chain = chain;
   TempBuf.reset(new byte[Enc->maxByteLength()]);
 }
 
@@ -195,109 +204,178 @@ void NFABuilder::charClass(const ParseNode& n) {
     (*Fsm)[v].Trans = Fsm->TransFac->getSmallest(n.Set.Breakout.Bytes);
     TempFrag.initFull(v, n);
   }
+  else if (!Chain.empty() && n.Set.Breakout.Bytes.none()) {
+    // classes without breakout bytes depend only on the code points and
+    // the encoding, so their fragments can be shared across patterns
+    EncodedClassCache& cache(EncodedClassCache::instance());
+
+    const std::shared_ptr<const EncodedClass> frag(cache.find(Chain, uset));
+    if (frag) {
+      addEncodedClass(*frag, n);
+    }
+    else {
+      const NFA::VertexDescriptor first = Fsm->verticesSize();
+      encodeClass(n, uset);
+      cache.insert(Chain, uset, makeEncodedClass(first));
+    }
+  }
   else {
-    // convert the code point set into collapsed encoding ranges
-    TempEncRanges.clear();
-    Enc->write(uset, TempEncRanges);
-
-    // handle the breakout bytes
-    if (n.Set.Breakout.Bytes.any()) {
-      if (n.Set.Breakout.Additive) {
-        // add breakout bytes to encodings
-        if (TempEncRanges[0].size() == 1) {
-          TempEncRanges[0][0] |= n.Set.Breakout.Bytes;
-        }
-        else {
-          TempEncRanges.emplace_back(1);
-          TempEncRanges.back()[0] = n.Set.Breakout.Bytes;
-        }
+    encodeClass(n, uset);
+  }
+
+  Fsm->Deterministic = false;
+  Stack.push(TempFrag);
+}
+
+void NFABuilder::encodeClass(const ParseNode& n, const UnicodeSet& uset) {
+  // convert the code point set into collapsed encoding ranges
+  TempEncRanges.clear();
+  Enc->write(uset, TempEncRanges);
+
+  // handle the breakout bytes
+  if (n.Set.Breakout.Bytes.any()) {
+    if (n.Set.Breakout.Additive) {
+      // add breakout bytes to encodings
+      if (TempEncRanges[0].size() == 1) {
+        TempEncRanges[0][0] |= n.Set.Breakout.Bytes;
       }
       else {
-        // subtract breakout bytes from encodings
-        if (TempEncRanges[0].size() == 1) {
-          TempEncRanges[0][0] &= ~n.Set.Breakout.Bytes;
-          if (TempEncRanges[0][0].none()) {
-            TempEncRanges.erase(TempEncRanges.begin());
-
-            // ensure that at least one initial byte remains
-            if (TempEncRanges.empty()) {
-              THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT(
-                "intersection of character class with " << Enc->name()
-                                                        << " is empty"
-              );
-            }
+        TempEncRanges.emplace_back(1);
+        TempEncRanges.back()[0] = n.Set.Breakout.Bytes;
+      }
+    }
+    else {
+      // subtract breakout bytes from encodings
+      if (TempEncRanges[0].size() == 1) {
+        TempEncRanges[0][0] &= ~n.Set.Breakout.Bytes;
+        if (TempEncRanges[0][0].none()) {
+          TempEncRanges.erase(TempEncRanges.begin());
+
+          // ensure that at least one initial byte remains
+          if (TempEncRanges.empty()) {
+            THROW_RUNTIME_ERROR_WITH_CLEAN_OUTPUT(
+              "intersection of character class with " << Enc->name()
+                                                      << " is empty"
+            );
           }
         }
       }
     }
+  }
 
-    ByteSet bs;
-    TempFrag.reset(n);
-
-    // create a graph from the collapsed ranges
-    for (const std::vector<ByteSet>& enc : TempEncRanges) {
-      NFA::VertexDescriptor head, tail;
-
-      //
-      // find a suffix of enc in this fragment
-      //
+  ByteSet bs;
+  TempFrag.reset(n);
 
-      int32_t b = enc.size()-1;
+  // create a graph from the collapsed ranges
+  for (const std::vector<ByteSet>& enc : TempEncRanges) {
+    NFA::VertexDescriptor head, tail;
 
-      // find a match for the last transition
-      const auto oi = std::find_if(
-        TempFrag.OutList.begin(), TempFrag.OutList.end(),
-        [&](const std::pair<NFA::VertexDescriptor,uint32_t>& p) {
-          return (*Fsm)[p.first].Trans->getBytes(bs) == enc[b];
-        }
-      );
+    //
+    // find a suffix of enc in this fragment
+    //
 
-      if (oi != TempFrag.OutList.end()) {
-        // match, use this tail
-        tail = oi->first;
+    int32_t b = enc.size()-1;
 
-        // walk backwards until a transition mismatch
-        for (--b; b >= 0; --b) {
-          head = 0;
-          for (const NFA::VertexDescriptor h : Fsm->inVertices(tail)) {
-            (*Fsm)[h].Trans->getBytes(bs);
-            if (bs == enc[b]) {
-              tail = head = h;
-              break;
-            }
-            head = 0;
-          }
+    // find a match for the last transition
+    const auto oi = std::find_if(
+      TempFrag.OutList.begin(), TempFrag.OutList.end(),
+      [&](const std::pair<NFA::VertexDescriptor,uint32_t>& p) {
+        return (*Fsm)[p.first].Trans->getBytes(bs) == enc[b];
+      }
+    );
 
-          if (!head) {
-            // tail is as far back as we can go
+    if (oi != TempFrag.OutList.end()) {
+      // match, use this tail
+      tail = oi->first;
+
+      // walk backwards until a transition mismatch
+      for (--b; b >= 0; --b) {
+        head = 0;
+        for (const NFA::VertexDescriptor h : Fsm->inVertices(tail)) {
+          (*Fsm)[h].Trans->getBytes(bs);
+          if (bs == enc[b]) {
+            tail = head = h;
             break;
           }
+          head = 0;
+        }
+
+        if (!head) {
+          // tail is as far back as we can go
+          break;
         }
       }
-      else {
-        // no match, build a new tail
-        tail = Fsm->addVertex();
-        (*Fsm)[tail].Trans = Fsm->TransFac->getSmallest(enc[b--]);
-        TempFrag.OutList.emplace_back(tail, 0);
-      }
+    }
+    else {
+      // no match, build a new tail
+      tail = Fsm->addVertex();
+      (*Fsm)[tail].Trans = Fsm->TransFac->getSmallest(enc[b--]);
+      TempFrag.OutList.emplace_back(tail, 0);
+    }
 
-      //
-      // build from the start of enc to meet the existing suffix
-      //
+    //
+    // build from the start of enc to meet the existing suffix
+    //
 
-      for ( ; b >= 0; --b) {
-        head = Fsm->addVertex();
-        (*Fsm)[head].Trans = Fsm->TransFac->getSmallest(enc[b]);
-        Fsm->addEdge(head, tail);
-        tail = head;
-      }
+    for ( ; b >= 0; --b) {
+      head = Fsm->addVertex();
+      (*Fsm)[head].Trans = Fsm->TransFac->getSmallest(enc[b]);
+      Fsm->addEdge(head, tail);
+      tail = head;
+    }
+
+    TempFrag.InList.push_back(tail);
+  }
+}
+
+std::shared_ptr<const EncodedClass> NFABuilder::makeEncodedClass(NFA::VertexDescriptor first) const {
+  // the vertices from first on are exactly those encodeClass just built
+  std::shared_ptr<EncodedClass> frag(new EncodedClass);
+  frag->Vertices.resize(Fsm->verticesSize() - first);
 
-      TempFrag.InList.push_back(tail);
+  for (NFA::VertexDescriptor v = first; v < Fsm->verticesSize(); ++v) {
+    EncodedClass::Vertex& fv(frag->Vertices[v - first]);
+    fv.Bytes = (*Fsm)[v].Trans->bytes();
+    for (const NFA::VertexDescriptor t : Fsm->outVertices(v)) {
+      fv.Out.push_back(t - first);
     }
   }
 
-  Fsm->Deterministic = false;
-  Stack.push(TempFrag);
+  for (const NFA::VertexDescriptor v : TempFrag.InList) {
+    frag->InList.push_back(v - first);
+  }
+
+  for (const std::pair<NFA::VertexDescriptor,uint32_t>& p : TempFrag.OutList) {
+    frag->OutList.push_back(p.first - first);
+  }
+
+  return frag;
+}
+
+void NFABuilder::addEncodedClass(const EncodedClass& frag, const ParseNode& n) {
+  const NFA::VertexDescriptor first = Fsm->verticesSize();
+
+  for (const EncodedClass::Vertex& fv : frag.Vertices) {
+    const NFA::VertexDescriptor v = Fsm->addVertex();
+    (*Fsm)[v].Trans = Fsm->TransFac->getSmallest(fv.Bytes);
+  }
+
+  // adding edges in vertex order reproduces the original edge order
+  for (uint32_t i = 0; i < frag.Vertices.size(); ++i) {
+    for (const uint32_t t : frag.Vertices[i].Out) {
+      Fsm->addEdge(first + i, first + t);
+    }
+  }
+
+  TempFrag.reset(n);
+
+  for (const uint32_t v : frag.InList) {
+    TempFrag.InList.push_back(first + v);
+  }
+
+  for (const uint32_t v : frag.OutList) {
+    TempFrag.OutList.emplace_back(first + v, 0);
+  }
 }
 
 void NFABuilder::question(const ParseNode&) {
@@ -354,7 +432,65 @@ void NFABuilder::repetition(const ParseNode& n) {
     return;
   }
 
-  // all other cases are already reduced by traverse
+  // traverse leaves bounded repetitions to be counted when it can, and
+  // reduces all other cases
+  if (n.Child.Rep.Max != UNBOUNDED && countable(n)) {
+    counted(n);
+  }
+}
+
+void NFABuilder::counted(const ParseNode& n) {
+  // traverse lets through only repetitions of single vertices
+  Fragment& repeat = Stack.top();
+  repeat.N = n;
+
+  NFA& g(*Fsm);
+  const NFA::VertexDescriptor v = repeat.InList.front();
+  g[v].Rep = g.TransFac->getRepetition(
+    std::max(n.Child.Rep.Min, 1u), n.Child.Rep.Max, g[v].Trans
+  );
+
+  if (n.Child.Rep.Min == 0) {
+    question(n);
+  }
+}
+
+bool NFABuilder::countable(const ParseNode& n) {
+  // Counting pays off only for long repetitions, and a Thread has only
+  // 16 bits for the count. Unbounded ones are counted up to their
+  // minimum, as T{n,} = T{n}T*.
+  const uint32_t bound = n.Child.Rep.Max == UNBOUNDED ?
+    n.Child.Rep.Min : n.Child.Rep.Max;
+
+  return n.Type == ParseNode::REPETITION &&
+         MIN_COUNTED_REPETITION <= bound && bound <= 0xFFFF &&
+         encodesToOneByte(*n.Child.Left);
+}
+
+bool NFABuilder::encodesToOneByte(const ParseNode& n) {
+  switch (n.Type) {
+  case ParseNode::BYTE:
+    return true;
+  case ParseNode::LITERAL:
+    return Enc->write(n.Val, TempBuf.get()) == 1;
+  case ParseNode::DOT:
+    return encodesToOneByte(ParseNode(ParseNode::CHAR_CLASS, 0, 0x10FFFF));
+  case ParseNode::CHAR_CLASS:
+    {
+      // as in charClass(); breakout bytes are added to or removed from
+      // a single-byte encoding without lengthening it
+      const UnicodeSet uset(n.Set.CodePoints & Enc->validCodePoints());
+      if (uset.none()) {
+        return true;
+      }
+
+      TempEncRanges.clear();
+      Enc->write(uset, TempEncRanges);
+      return TempEncRanges.size() == 1 && TempEncRanges[0].size() == 1;
+    }
+  default:
+    return false;
+  }
 }
 
 void NFABuilder::repetition_ng(const ParseNode& n) {
@@ -479,12 +615,36 @@ void NFABuilder::traverse(const ParseNode* root) {
          n->Type == ParseNode::REPETITION ||
          n->Type == ParseNode::REPETITION_NG) && n->Child.Left) {
       // This node has a left child
-      if ((n->Type == ParseNode::REPETITION ||
-           n->Type == ParseNode::REPETITION_NG) &&
-         !((n->Child.Rep.Min == 0 &&
-           (n->Child.Rep.Max == 1 || n->Child.Rep.Max == UNBOUNDED)) ||
-           (n->Child.Rep.Min == 1 && n->Child.Rep.Max == UNBOUNDED)))
-      {
+      const bool special = !(n->Type == ParseNode::REPETITION ||
+                             n->Type == ParseNode::REPETITION_NG) ||
+        (n->Child.Rep.Min == 0 &&
+          (n->Child.Rep.Max == 1 || n->Child.Rep.Max == UNBOUNDED)) ||
+        (n->Child.Rep.Min == 1 && n->Child.Rep.Max == UNBOUNDED);
+
+      if (!special && countable(*n)) {
+        if (n->Child.Rep.Max == UNBOUNDED) {
+          // T{n,} = T{n}T*, counting the mandatory part
+          synth.push_back(std::shared_ptr<ParseNode>(
+            new ParseNode(n->Type, n->Child.Left, n->Child.Rep.Min, n->Child.Rep.Min))
+          );
+          ParseNode* counted = synth.back().get();
+
+          synth.push_back(std::shared_ptr<ParseNode>(
+            new ParseNode(n->Type, n->Child.Left, 0, UNBOUNDED))
+          );
+          ParseNode* star = synth.back().get();
+
+          synth.push_back(std::shared_ptr<ParseNode>(
+            new ParseNode(ParseNode::CONCATENATION, counted, star))
+          );
+          wind.push(synth.back().get());
+        }
+        else {
+          // a counted repetition is built from one copy of its child
+          wind.push(n->Child.Left);
+        }
+      }
+      else if (!special) {
         // This is a repetition, but not one of the special named ones.
         // We synthesize nodes here to eliminate counted repetitions.
 
@@ -23,10 +23,19 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <mutex>
 #include <set>
 #include <stack>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 static const NFA::VertexDescriptor NONE = 0xFFFFFFFF;
@@ -34,7 +43,7 @@ static const NFA::VertexDescriptor UNLABELABLE = 0xFFFFFFFE;
 
 const uint32_t NOLABEL = std::numeric_limits<uint32_t>::max();
 
-bool NFAOptimizer::canMerge(const NFA& dst, NFA::VertexDescriptor dstTail, const Transition* dstTrans, ByteSet& dstBits, const NFA& src, NFA::VertexDescriptor srcTail, const ByteSet& srcBits) const {
+bool NFAOptimizer::canMerge(const NFA& dst, NFA::VertexDescriptor dstTail, const Transition* dstTrans, const NFA& src, NFA::VertexDescriptor srcTail, const Transition* srcTrans) const {
   // Explanation of the condition:
   //
   // Vertices match if:
@@ -48,9 +57,11 @@ bool NFAOptimizer::canMerge(const NFA& dst, NFA::VertexDescriptor dstTail, const
   // 6) if the destination has been matched with a source, then that
   //    source has only one incoming edge
   // 7) the source has only one incoming edge
+  // 8) they count the same repetitions, if any
 
   if (
     dst[dstTail].Label == src[srcTail].Label &&
+    dst[dstTail].Rep == src[srcTail].Rep &&
     (
       dst[dstTail].Label == NOLABEL ||
       (0 == src.outDegree(srcTail) && 0 == dst.outDegree(dstTail))
@@ -60,8 +71,8 @@ bool NFAOptimizer::canMerge(const NFA& dst, NFA::VertexDescriptor dstTail, const
   {
     const std::map<NFA::VertexDescriptor, std::vector<NFA::VertexDescriptor>>::const_iterator i(Dst2Src.find(dstTail));
     if (i == Dst2Src.end() || 1 == src.inDegree(i->second.front())) {
-      dstTrans->getBytes(dstBits);
-      return dstBits == srcBits;
+      // interned Transitions are equal if they are the same object
+      return dstTrans == srcTrans || dstTrans->bytes() == srcTrans->bytes();
     }
   }
 
@@ -86,16 +97,12 @@ NFAOptimizer::StatePair NFAOptimizer::processChild(const NFA& src, NFA& dst, uin
   else {
     const Transition* srcTrans(src[srcTail].Trans);
 
-    ByteSet srcBits;
-    srcTrans->getBytes(srcBits);
-
     // try to match it with a successor of the destination vertex,
     // preserving the relative order of the source vertex's successors
 
     // find dstTail range to which we could map srcTail, by branch order
 
     bool found = false;
-    ByteSet dstBits;
 
     std::map<NFA::VertexDescriptor, uint32_t>::const_iterator i(DstPos.find(dstHead));
     di = i == DstPos.end() ? 0 : i->second;
@@ -106,8 +113,8 @@ NFAOptimizer::StatePair NFAOptimizer::processChild(const NFA& src, NFA& dst, uin
 
 //      std::cerr << "match src " << srcTail << " with dst " << dstTail << "? ";
 
-      if (canMerge(dst, dstTail, dstTrans, dstBits,
-                   src, srcTail,           srcBits)) {
+      if (canMerge(dst, dstTail, dstTrans,
+                   src, srcTail, srcTrans)) {
         found = true;
         break;
       }
@@ -245,19 +252,22 @@ void NFAOptimizer::pruneBranches(NFA& g) {
       }
 */
 
-      if (g[tail].IsMatch) {
+      // a counted match state has not matched after its first byte
+      if (g[tail].IsMatch && !g[tail].Rep) {
         mbs |= obs;
       }
     }
   }
 }
 
-void NFAOptimizer::labelGuardStates(NFA& g) {
+template <class GraphType>
+void NFAOptimizer::labelGuardStates(GraphType& g) {
   propagateMatchLabels(g);
   removeNonMinimalLabels(g);
 }
 
-void NFAOptimizer::propagateMatchLabels(NFA& g) {
+template <class GraphType>
+void NFAOptimizer::propagateMatchLabels(GraphType& g) {
   // uint32_t count = 0;
 
   std::stack<NFA::VertexDescriptor, std::vector<NFA::VertexDescriptor>> next, unext;
@@ -326,7 +336,8 @@ void NFAOptimizer::propagateMatchLabels(NFA& g) {
   }
 }
 
-void NFAOptimizer::removeNonMinimalLabels(NFA& g) {
+template <class GraphType>
+void NFAOptimizer::removeNonMinimalLabels(GraphType& g) {
   // Make a list of all tails of edges where the head is an ancestor of
   // multiple match states, but the tail is an ancestor of only one.
   std::vector<bool> visited(g.verticesSize());
@@ -378,6 +389,15 @@ void NFAOptimizer::removeNonMinimalLabels(NFA& g) {
   }
 }
 
+template void NFAOptimizer::labelGuardStates(NFA& g);
+template void NFAOptimizer::labelGuardStates(FrozenNFA& g);
+
+template void NFAOptimizer::propagateMatchLabels(NFA& g);
+template void NFAOptimizer::propagateMatchLabels(FrozenNFA& g);
+
+template void NFAOptimizer::removeNonMinimalLabels(NFA& g);
+template void NFAOptimizer::removeNonMinimalLabels(FrozenNFA& g);
+
 typedef std::vector<NFA::VertexDescriptor> VDList;
 typedef std::pair<ByteSet, VDList> SubsetState;
 typedef std::array<VDList,256> ByteToVertices;
@@ -398,10 +418,10 @@ struct SubsetStateComp {
   }
 };
 
-void makePerByteOutNeighborhoods(const NFA& src, const NFA::VertexDescriptor srcHead, ByteToVertices& srcTailLists, ByteSet& outBytes) {
+void makePerByteOutNeighborhoods(const NFA& src, const NFA::VertexDescriptor srcHead, ByteToVertices& srcTailLists) {
   // for each srcTail, add it to srcHead's per-byte outneighborhood
   for (const NFA::VertexDescriptor srcTail : src.outVertices(srcHead)) {
-    src[srcTail].Trans->getBytes(outBytes);
+    const ByteSet& outBytes(src[srcTail].Trans->bytes());
 
     for (uint32_t b = 0; b < 256; ++b) {
       if (outBytes[b]) {
@@ -432,8 +452,9 @@ void makeByteSetsWithDistinctOutNeighborhoods(const ByteToVertices& srcTailLists
 }
 
 void addToDeterminizationGroup(const NFA& src, const NFA::VertexDescriptor srcTail, const ByteSet& bs, std::map<ByteSet, std::vector<VDList>>& dstListGroups, bool& startGroup) {
-  if (src[srcTail].IsMatch) {
-    // match states are always singleton groups
+  if (src[srcTail].IsMatch || src[srcTail].Rep) {
+    // match states are always singleton groups, as are counted states,
+    // which loop on themselves
     dstListGroups[bs].emplace_back();
     startGroup = true;
   }
@@ -447,8 +468,28 @@ void addToDeterminizationGroup(const NFA& src, const NFA::VertexDescriptor srcTa
 
 typedef std::map<SubsetState, NFA::VertexDescriptor, SubsetStateComp> SubsetStateToState;
 
-void makeDestinationState(const NFA& src, NFA& dst, const NFA::VertexDescriptor dstHead, const ByteSet& bs, const VDList& dstList, SubsetStateToState& dstList2Dst, std::stack<SubsetState>& dstStack) {
+void setDestinationAttributes(const NFA& src, NFA& dst, const NFA::VertexDescriptor dstTail, const VDList& dstList) {
+  if (src[dstList.front()].IsMatch) {
+    dst[dstTail].IsMatch = true;
+    dst[dstTail].Label = src[dstList.front()].Label;
+  }
+
+  // a counted state keeps its loop, which need not consume the same
+  // bytes as the transition into it does now
+  dst[dstTail].Rep = src[dstList.front()].Rep;
+}
+
+// roughly the bytes the determinizer holds for each subset state: one copy
+// in the table, with the table's node, and one waiting to be expanded
+uint64_t subsetStateBytes(const SubsetState& ss) {
+  return 2 * (sizeof(SubsetState) + ss.second.capacity() * sizeof(NFA::VertexDescriptor)) +
+         4 * sizeof(void*);
+}
+
+// returns the bytes held for the subset state, if it is new
+uint64_t makeDestinationState(const NFA& src, NFA& dst, const NFA::VertexDescriptor dstHead, const ByteSet& bs, const VDList& dstList, SubsetStateToState& dstList2Dst, std::stack<SubsetState>& dstStack) {
   const SubsetState ss(bs, dstList);
+  uint64_t held = 0;
   const SubsetStateToState::const_iterator l(dstList2Dst.find(ss));
 
   NFA::VertexDescriptor dstTail;
@@ -457,26 +498,26 @@ void makeDestinationState(const NFA& src, NFA& dst, const NFA::VertexDescriptor
     dstList2Dst[ss] = dstTail = dst.addVertex();
     dstStack.push(ss);
     dst[dstTail].Trans = dst.TransFac->getSmallest(bs);
+    held = subsetStateBytes(ss);
   }
   else {
     // old sublist vertex
     dstTail = l->second;
   }
 
-  if (src[dstList.front()].IsMatch) {
-    dst[dstTail].IsMatch = true;
-    dst[dstTail].Label = src[dstList.front()].Label;
-  }
+  setDestinationAttributes(src, dst, dstTail, dstList);
 
   dst.addEdge(dstHead, dstTail);
+  return held;
 }
 
-void handleSubsetState(const NFA& src, NFA& dst, const VDList& srcHeadList, const NFA::VertexDescriptor dstHead, std::stack<SubsetState>& dstStack, ByteSet& outBytes, SubsetStateToState& dstList2Dst) {
+// Finds the successors of a subset state, in edge order
+void expandSubsetState(const NFA& src, const VDList& srcHeadList, std::vector<SubsetState>& succ) {
   ByteToVertices srcTailLists;
 
   // for each byte, collect all srcTails leaving srcHeads
   for (const NFA::VertexDescriptor srcHead : srcHeadList) {
-    makePerByteOutNeighborhoods(src, srcHead, srcTailLists, outBytes);
+    makePerByteOutNeighborhoods(src, srcHead, srcTailLists);
   }
 
   // remove right duplicates from each srcTailsList
@@ -503,40 +544,362 @@ void handleSubsetState(const NFA& src, NFA& dst, const VDList& srcHeadList, cons
   }
 
   // determinize for each outgoing byte
-  for (const std::map<ByteSet, std::vector<VDList>>::value_type& v : dstListGroups) {
-    const ByteSet& bs(v.first);
-    const std::vector<VDList>& dstLists(v.second);
-    for (const VDList& dstList : dstLists) {
-      makeDestinationState(src, dst, dstHead, bs, dstList, dstList2Dst, dstStack);
+  for (std::map<ByteSet, std::vector<VDList>>::value_type& v : dstListGroups) {
+    for (VDList& dstList : v.second) {
+      succ.emplace_back(v.first, std::move(dstList));
     }
   }
 }
 
-void NFAOptimizer::subsetDFA(NFA& dst, const NFA& src) {
+// returns the bytes held for the new subset states found
+uint64_t handleSubsetState(const NFA& src, NFA& dst, const VDList& srcHeadList, const NFA::VertexDescriptor dstHead, std::stack<SubsetState>& dstStack, SubsetStateToState& dstList2Dst, std::vector<SubsetState>& succ) {
+  succ.clear();
+  expandSubsetState(src, srcHeadList, succ);
+
+  uint64_t held = 0;
+  for (const SubsetState& ss : succ) {
+    held += makeDestinationState(src, dst, dstHead, ss.first, ss.second, dstList2Dst, dstStack);
+  }
+  return held;
+}
+
+// roughly the bytes held while determinizing src into dst
+uint64_t subsetMemoryUsage(const NFA& dst, const NFA& src, uint64_t held) {
+  return src.memoryUsage() + dst.memoryUsage() +
+         dst.TransFac->memoryUsage() + held;
+}
+
+struct SubsetStateHash {
+  size_t operator()(const SubsetState& ss) const {
+    size_t h = std::hash<std::bitset<256>>()(ss.first);
+    for (const NFA::VertexDescriptor v : ss.second) {
+      h = h * 31 + v;
+    }
+    return h;
+  }
+};
+
+// Numbers subset states as the workers find them. The table is split into
+// shards with a lock each, so that workers rarely wait for one another.
+class SubsetStateTable {
+public:
+  SubsetStateTable(uint32_t numShards): Shards(numShards), Next(0) {}
+
+  // returns the number of the subset state, and whether it is new
+  std::pair<uint32_t,bool> insert(const SubsetState& ss) {
+    Shard& shard(Shards[SubsetStateHash()(ss) % Shards.size()]);
+    std::lock_guard<std::mutex> lock(shard.Mutex);
+
+    const auto i = shard.Numbers.insert(std::make_pair(ss, 0));
+    if (i.second) {
+      i.first->second = Next++;
+    }
+    return std::make_pair(i.first->second, i.second);
+  }
+
+  uint32_t size() const { return Next; }
+
+private:
+  struct Shard {
+    std::mutex Mutex;
+    std::unordered_map<SubsetState, uint32_t, SubsetStateHash> Numbers;
+  };
+
+  std::vector<Shard> Shards;
+  std::atomic<uint32_t> Next;
+};
+
+struct ExpandedSubsetState {
+  uint32_t Number;
+  SubsetState State;
+  std::vector<uint32_t> Succ;
+};
+
+void NFAOptimizer::subsetDFA(NFA& dst, const NFA& src, uint32_t threads, CompileObserver obs) {
+  if (threads > 1) {
+    parallelSubsetDFA(dst, src, threads, obs);
+    return;
+  }
+
   // std::cerr << "starting subsetDFA" << std::endl;
   std::stack<SubsetState> dstStack;
   SubsetStateToState dstList2Dst;
+  std::vector<SubsetState> succ;
 
   // set up initial dst state
   const SubsetState d0(ByteSet(), VDList(1, 0));
   dstList2Dst[d0] = 0;
   dstStack.push(d0);
-
-  ByteSet outBytes;
+  uint64_t held = subsetStateBytes(d0);
 
   // process each subset state
-  // uint32_t num = 0;
+  uint32_t num = 0;
   while (!dstStack.empty()) {
-    // if (++num % 10000 == 0) {
-    //   std::cerr << "processed " << num << " subset states so far" << std::endl;
-    // }
+    if (++num % 4096 == 0) {
+      obs.progress(LG_PHASE_DETERMINIZE, num, 0);
+      obs.checkMemory(LG_PHASE_DETERMINIZE, subsetMemoryUsage(dst, src, held));
+    }
     const SubsetState ss(dstStack.top());
     dstStack.pop();
 
     const VDList& srcHeadList(ss.second);
     const NFA::VertexDescriptor dstHead = dstList2Dst[ss];
 
-    handleSubsetState(src, dst, srcHeadList, dstHead, dstStack, outBytes, dstList2Dst);
+    held += handleSubsetState(src, dst, srcHeadList, dstHead, dstStack, dstList2Dst, succ);
   }
+
+  obs.checkMemory(LG_PHASE_DETERMINIZE, subsetMemoryUsage(dst, src, held));
   // std::cerr << "done with subsetDFA" << std::endl;
 }
+
+void NFAOptimizer::parallelSubsetDFA(NFA& dst, const NFA& src, uint32_t threads, CompileObserver obs) {
+  //
+  // The workers expand subset states in whatever order they get to them,
+  // so the numbers they give the states vary from run to run. Once all
+  // states are known, we build dst by replaying the single-threaded
+  // traversal over the recorded successors, which numbers the states and
+  // orders the edges exactly as subsetDFA() does with one thread.
+  //
+
+  SubsetStateTable table(16 * threads);
+
+  std::mutex queueMutex;
+  std::condition_variable queueCond;
+  std::vector<std::pair<uint32_t, SubsetState>> queue;
+  uint32_t pending = 1; // states queued or being expanded
+  std::exception_ptr error;
+  std::atomic<uint64_t> held(0);
+
+  std::vector<std::vector<ExpandedSubsetState>> expanded(threads);
+
+  const SubsetState d0(ByteSet(), VDList(1, 0));
+  queue.emplace_back(table.insert(d0).first, d0);
+
+  auto work = [&](std::vector<ExpandedSubsetState>& out) {
+    std::vector<SubsetState> succ;
+    std::vector<std::pair<uint32_t, SubsetState>> found;
+
+    // only the calling thread reports progress
+    const bool caller = &out == &expanded[0];
+
+    for (;;) {
+      std::pair<uint32_t, SubsetState> job;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueCond.wait(lock, [&]() { return !queue.empty() || pending == 0; });
+        if (queue.empty()) {
+          return;
+        }
+
+        job = std::move(queue.back());
+        queue.pop_back();
+      }
+
+      try {
+        succ.clear();
+        expandSubsetState(src, job.second.second, succ);
+
+        out.push_back(ExpandedSubsetState{job.first, std::move(job.second), {}});
+        std::vector<uint32_t>& numbers(out.back().Succ);
+        numbers.reserve(succ.size());
+
+        uint64_t bytes = sizeof(ExpandedSubsetState) +
+                         succ.size() * sizeof(uint32_t);
+        found.clear();
+        for (SubsetState& ss : succ) {
+          const std::pair<uint32_t,bool> n(table.insert(ss));
+          numbers.push_back(n.first);
+          if (n.second) {
+            bytes += subsetStateBytes(ss);
+            found.emplace_back(n.first, std::move(ss));
+          }
+        }
+        held += bytes;
+
+        if (caller && out.size() % 4096 == 0) {
+          obs.progress(LG_PHASE_DETERMINIZE, table.size(), 0);
+          obs.checkMemory(LG_PHASE_DETERMINIZE, subsetMemoryUsage(dst, src, held));
+        }
+      }
+      catch (...) {
+        // stop everyone; the first error is rethrown once they have
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        queue.clear();
+        pending = 0;
+        queueCond.notify_all();
+        return;
+      }
+
+      std::lock_guard<std::mutex> lock(queueMutex);
+      if (error) {
+        return;
+      }
+
+      for (std::pair<uint32_t, SubsetState>& f : found) {
+        queue.push_back(std::move(f));
+      }
+
+      pending += found.size();
+      if (--pending == 0 || !found.empty()) {
+        queueCond.notify_all();
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (uint32_t i = 1; i < threads; ++i) {
+    workers.emplace_back(work, std::ref(expanded[i]));
+  }
+  work(expanded[0]);
+
+  for (std::thread& w : workers) {
+    w.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  // index the expanded states by number
+  std::vector<const ExpandedSubsetState*> states(table.size());
+  for (const std::vector<ExpandedSubsetState>& ex : expanded) {
+    for (const ExpandedSubsetState& e : ex) {
+      states[e.Number] = &e;
+    }
+  }
+
+  // renumber, replaying the single-threaded traversal
+  std::vector<NFA::VertexDescriptor> dstOf(states.size(), NONE);
+  std::stack<uint32_t> dstStack;
+
+  const uint32_t n0 = table.insert(d0).first;
+  dstOf[n0] = 0;
+  dstStack.push(n0);
+
+  while (!dstStack.empty()) {
+    const ExpandedSubsetState& head(*states[dstStack.top()]);
+    dstStack.pop();
+
+    const NFA::VertexDescriptor dstHead = dstOf[head.Number];
+
+    for (const uint32_t t : head.Succ) {
+      const SubsetState& ss(states[t]->State);
+
+      NFA::VertexDescriptor& dstTail(dstOf[t]);
+      if (dstTail == NONE) {
+        dstTail = dst.addVertex();
+        dstStack.push(t);
+        dst[dstTail].Trans = dst.TransFac->getSmallest(ss.first);
+      }
+
+      setDestinationAttributes(src, dst, dstTail, ss.second);
+
+      dst.addEdge(dstHead, dstTail);
+    }
+  }
+
+  obs.checkMemory(LG_PHASE_DETERMINIZE, subsetMemoryUsage(dst, src, held));
+}
+
+typedef std::vector<uint32_t> BlockSignature;
+
+void NFAOptimizer::minimizeDFA(NFA& dst, const NFA& src, std::vector<uint32_t>* merged) {
+  // Moore-style partition refinement: vertices start out grouped by
+  // transition, repetition, match status, and label, and blocks are split
+  // until every vertex in a block has the same ordered list of successor
+  // blocks. Successor order is significant, as it determines match priority.
+  const uint32_t vnum = src.verticesSize();
+
+  std::vector<uint32_t> block(vnum), next(vnum);
+  uint32_t bnum = 0;
+
+  {
+    std::map<std::tuple<const Transition*, const Repetition*, bool, uint32_t>, uint32_t> initial;
+    for (NFA::VertexDescriptor v = 0; v < vnum; ++v) {
+      const std::tuple<const Transition*, const Repetition*, bool, uint32_t> key(
+        src[v].Trans, src[v].Rep, src[v].IsMatch, src[v].Label
+      );
+
+      block[v] = initial.insert(std::make_pair(key, initial.size())).first->second;
+    }
+    bnum = initial.size();
+  }
+
+  BlockSignature sig;
+  std::map<BlockSignature, uint32_t> sigs;
+
+  for (;;) {
+    sigs.clear();
+
+    for (NFA::VertexDescriptor v = 0; v < vnum; ++v) {
+      sig.clear();
+      sig.push_back(block[v]);
+      for (const NFA::VertexDescriptor t : src.outVertices(v)) {
+        sig.push_back(block[t]);
+      }
+
+      next[v] = sigs.insert(std::make_pair(sig, sigs.size())).first->second;
+    }
+
+    block.swap(next);
+
+    if (sigs.size() == bnum) {
+      // no block was split, so the partition is stable
+      break;
+    }
+
+    bnum = sigs.size();
+  }
+
+  // number the blocks in order of their first vertex, so that the
+  // initial state remains 0 and the vertex order is otherwise preserved
+  std::vector<NFA::VertexDescriptor> rep(bnum, NONE), b2v(bnum, NONE);
+  uint32_t dnum = 0;
+  for (NFA::VertexDescriptor v = 0; v < vnum; ++v) {
+    if (rep[block[v]] == NONE) {
+      rep[block[v]] = v;
+      b2v[block[v]] = dnum++;
+    }
+  }
+
+  dst.clear();
+  dst.Deterministic = src.Deterministic;
+  dst.TransFac = src.TransFac;
+
+  for (uint32_t i = 0; i < dnum; ++i) {
+    dst.addVertex();
+  }
+
+  if (merged) {
+    merged->assign(dnum, 0);
+    for (NFA::VertexDescriptor v = 0; v < vnum; ++v) {
+      ++(*merged)[b2v[block[v]]];
+    }
+  }
+
+  std::vector<bool> seen(dnum);
+
+  for (uint32_t b = 0; b < bnum; ++b) {
+    const NFA::VertexDescriptor head = rep[b];
+    const NFA::VertexDescriptor dstHead = b2v[b];
+
+    dst[dstHead] = src[head];
+
+    // an edge to a block already reached from this vertex would only
+    // spawn a lower-priority thread with the same future, so drop it
+    for (const NFA::VertexDescriptor t : src.outVertices(head)) {
+      const NFA::VertexDescriptor dstTail = b2v[block[t]];
+      if (!seen[dstTail]) {
+        seen[dstTail] = true;
+        dst.addEdge(dstHead, dstTail);
+      }
+    }
+
+    for (const NFA::VertexDescriptor t : src.outVertices(head)) {
+      seen[b2v[block[t]]] = false;
+    }
+  }
+}
@@ -35,6 +35,10 @@ namespace {
     const std::string::size_type cr = pattern.rfind('{', pattern.length()-3);
     return cr > 0 && cr != std::string::npos;
   }
+
+  bool containsPossibleAlternation(const std::string& pattern) {
+    return pattern.find('|') != std::string::npos;
+  }
 }
 
 void parseAndReduce(const Pattern& pattern, ParseTree& tree) {
@@ -59,4 +63,8 @@ void reduce(const std::string& text, ParseTree& tree) {
     reduceEmptySubtrees(tree.Root);
     reduceUselessRepetitions(tree.Root);
   }
+
+  if (containsPossibleAlternation(text)) {
+    factorAlternations(tree.Root);
+  }
 }
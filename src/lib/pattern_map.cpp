@@ -1,12 +1,28 @@
 #include "pattern_map.h"
 
+#include "basic.h"
+
 #include <algorithm>
 #include <iterator>
 #include <cstring>
+#include <map>
 #include <memory>
 #include <numeric>
+#include <stdexcept>
+#include <string>
 
 void PatternMap::addPattern(const char* pattern, const char* chain, uint64_t idx) {
+  addPattern(pattern, chain, idx, numLabels());
+}
+
+void PatternMap::addPattern(const char* pattern, const char* chain, uint64_t idx, uint32_t label, const std::string& key) {
+  const uint32_t i = Patterns.size();
+  const uint32_t n = numLabels();
+
+  if (label > n) {
+    THROW_RUNTIME_ERROR_WITH_OUTPUT("label " << label << " skips " << n);
+  }
+
   std::unique_ptr<char[]> patcopy(new char[std::strlen(pattern)+1]);
   std::strcpy(patcopy.get(), pattern);
 
@@ -16,6 +32,77 @@ void PatternMap::addPattern(const char* pattern, const char* chain, uint64_t idx
   usePattern(patcopy.get(), chcopy.get(), idx);
   patcopy.release();
   chcopy.release();
+
+  if (Labels.empty() && label != i) {
+    // the first pattern to share a label; until now, each had its own
+    Labels.resize(i);
+    std::iota(Labels.begin(), Labels.end(), 0);
+    NumLabels = n;
+  }
+
+  if (!Labels.empty()) {
+    Labels.push_back(label);
+    NumLabels = std::max(NumLabels, label + 1);
+  }
+
+  if (!key.empty()) {
+    Keys.emplace(key, label);
+  }
+}
+
+uint32_t PatternMap::labelOf(const std::string& key) const {
+  const auto i = Keys.find(key);
+  return i == Keys.end() ? NOLABEL : i->second;
+}
+
+void PatternMap::clearKeys() {
+  // swap, as clear() keeps the buckets
+  std::unordered_map<std::string, uint32_t>().swap(Keys);
+}
+
+void PatternMap::setLabels(const uint32_t* labels) {
+  Labels.clear();
+  NumLabels = 0;
+
+  bool shared = false;
+  for (uint32_t i = 0; i < Patterns.size(); ++i) {
+    if (labels[i] > NumLabels) {
+      THROW_RUNTIME_ERROR_WITH_OUTPUT("label " << labels[i] << " skips " << NumLabels);
+    }
+    else if (labels[i] == NumLabels) {
+      ++NumLabels;
+    }
+    else {
+      shared = true;
+    }
+  }
+
+  if (shared) {
+    Labels.assign(labels, labels + Patterns.size());
+  }
+}
+
+std::shared_ptr<const LabelFanOut> PatternMap::fanOut() const {
+  if (Labels.empty()) {
+    return std::shared_ptr<const LabelFanOut>();
+  }
+
+  // count the patterns for each label, then place them
+  std::shared_ptr<LabelFanOut> f(new LabelFanOut);
+  f->Begin.assign(NumLabels + 1, 0);
+  for (const uint32_t l : Labels) {
+    ++f->Begin[l + 1];
+  }
+
+  std::partial_sum(f->Begin.begin(), f->Begin.end(), f->Begin.begin());
+
+  std::vector<uint32_t> next(f->Begin.begin(), f->Begin.end() - 1);
+  f->Patterns.resize(Labels.size());
+  for (uint32_t i = 0; i < Labels.size(); ++i) {
+    f->Patterns[next[Labels[i]]++] = i;
+  }
+
+  return f;
 }
 
 void PatternMap::usePattern(const char* pattern, const char* chain, uint64_t idx) {
@@ -68,9 +155,17 @@ std::unique_ptr<PatternMap> PatternMap::unmarshall(const void* buf, size_t len)
   const char* const end = i + len;
   
   while (i < end) {
+    // each entry is two strings and an index, all within the buffer
     pat = i;
-    chain = pat + std::strlen(pat) + 1;
-    idx = chain + std::strlen(chain) + 1;
+    chain = static_cast<const char*>(std::memchr(pat, '\0', end - pat));
+    if (!chain++) {
+      throw std::runtime_error("Program has a malformed pattern map");
+    }
+
+    idx = static_cast<const char*>(std::memchr(chain, '\0', end - chain));
+    if (!idx++ || static_cast<size_t>(end - idx) < sizeof(LG_PatternInfo::UserIndex)) {
+      throw std::runtime_error("Program has a malformed pattern map");
+    }
 
     p->usePattern(pat, chain, *reinterpret_cast<const uint64_t*>(idx));
 
@@ -80,8 +175,50 @@ std::unique_ptr<PatternMap> PatternMap::unmarshall(const void* buf, size_t len)
   return std::move(p);
 }
 
+void PatternMap::marshallTable(std::vector<TableEntry>& table, std::vector<char>& strings) const {
+  // encoding chains repeat heavily, so store each only once
+  std::map<std::string, uint64_t> chains;
+
+  const auto addString = [&strings](const char* str) {
+    const uint64_t off = strings.size();
+    strings.insert(strings.end(), str, str + std::strlen(str) + 1);
+    return off;
+  };
+
+  table.clear();
+  table.reserve(Patterns.size());
+
+  for (const LG_PatternInfo& pi: Patterns) {
+    const uint64_t pat = addString(pi.Pattern);
+
+    uint64_t chain;
+    const auto c = chains.find(pi.EncodingChain);
+    if (c == chains.end()) {
+      chain = chains[pi.EncodingChain] = addString(pi.EncodingChain);
+    }
+    else {
+      chain = c->second;
+    }
+
+    table.push_back({pat, chain, pi.UserIndex});
+  }
+}
+
+std::unique_ptr<PatternMap> PatternMap::unmarshallTable(const TableEntry* table, size_t num, const char* strings) {
+  std::unique_ptr<PatternMap> p(new PatternMap(num));
+  p->Shared = true;
+
+  for (const TableEntry* e = table; e != table + num; ++e) {
+    p->usePattern(strings + e->Pattern, strings + e->EncodingChain, e->UserIndex);
+  }
+
+  return p;
+}
+
 bool PatternMap::operator==(const PatternMap& rhs) const {
-  return std::equal(Patterns.begin(), Patterns.end(), rhs.Patterns.begin());
+  return Patterns.size() == rhs.Patterns.size() &&
+         std::equal(Patterns.begin(), Patterns.end(), rhs.Patterns.begin()) &&
+         Labels == rhs.Labels;
 }
 
 bool operator==(const LG_PatternInfo& lhs, const LG_PatternInfo& rhs) {
@@ -18,8 +18,11 @@
 
 #include "program.h"
 
+#include <algorithm>
 #include <cstring>
 #include <iomanip>
+#include <limits>
+#include <stdexcept>
 
 bool Program::operator==(const Program& rhs) const {
   return MaxLabel == rhs.MaxLabel &&
@@ -47,17 +50,8 @@ std::vector<char> Program::marshall() const {
   i += sizeof(FilterOff);
 
   // Filter
-  for (size_t b = 0; b < Filter.size(); b += 8) {
-    *i = Filter[b] |
-         (Filter[b+1] << 1) |
-         (Filter[b+2] << 2) |
-         (Filter[b+3] << 3) |
-         (Filter[b+4] << 4) |
-         (Filter[b+5] << 5) |
-         (Filter[b+6] << 6) |
-         (Filter[b+7] << 7);
-    ++i;
-  }
+  packFilter(i);
+  i += FilterBytes;
 
   // Instructions
   std::memcpy(i, IBeg.get(), size()*sizeof(Instruction));
@@ -69,9 +63,15 @@ std::vector<char> Program::marshall() const {
 
 ProgramPtr Program::unmarshall(const void* buf, size_t len) {
   const char* i = static_cast<const char*>(buf);
-  const size_t icount = (len - (sizeof(Program::MaxLabel) + sizeof(Program::MaxCheck) + sizeof(Program::FilterOff) + 256*256/8)) / sizeof(Instruction);
+  const size_t hlen = sizeof(Program::MaxLabel) + sizeof(Program::MaxCheck) + sizeof(Program::FilterOff) + FilterBytes;
+  if (len < hlen) {
+    throw std::runtime_error("Program is truncated");
+  }
 
-  ProgramPtr p(new Program(0));
+  const size_t icount = (len - hlen) / sizeof(Program::value_type);
+
+  // The caller is responsible for freeing buf.
+  ProgramPtr p(view(reinterpret_cast<const Instruction*>(i + hlen), icount));
 
   p->MaxLabel = *reinterpret_cast<const decltype(p->MaxLabel)*>(i);
   i += sizeof(p->MaxLabel);
@@ -82,38 +82,108 @@ ProgramPtr Program::unmarshall(const void* buf, size_t len) {
   p->FilterOff = *reinterpret_cast<const decltype(p->FilterOff)*>(i);
   i += sizeof(p->FilterOff);
 
-  for (size_t b = 0; b < p->Filter.size() / 8; ++b, ++i) {
-    p->Filter[8*b]   = *i & 0x01;
-    p->Filter[8*b+1] = *i & 0x02;
-    p->Filter[8*b+2] = *i & 0x04;
-    p->Filter[8*b+3] = *i & 0x08;
-    p->Filter[8*b+4] = *i & 0x10;
-    p->Filter[8*b+5] = *i & 0x20;
-    p->Filter[8*b+6] = *i & 0x40;
-    p->Filter[8*b+7] = *i & 0x80;
-  }
+  p->unpackFilter(i);
+
+  return p;
+}
 
-  // The caller is responsible for freeing buf. We subvert std::unique_ptr
-  // here by giving it an empty deleter.
+ProgramPtr Program::view(const Instruction* ibeg, size_t icount) {
+  ProgramPtr p(new Program(0));
+
+  // We subvert std::unique_ptr here by giving it an empty deleter.
   p->IBeg = std::unique_ptr<Instruction[], void(*)(Instruction*)>(
-    reinterpret_cast<Instruction*>(const_cast<char*>(i)), [](Instruction*){}
+    const_cast<Instruction*>(ibeg), [](Instruction*){}
   );
 
   p->IEnd = p->IBeg.get() + icount;
-
   return p;
 }
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && defined(__GLIBCXX__)
+// libstdc++ stores a bitset as an array of words, low bit first, which on
+// a little-endian machine is exactly the packed layout
+static_assert(sizeof(std::bitset<256*256>) == Program::FilterBytes, "unexpected bitset layout");
+#define LG_FILTER_MEMCPY
+#endif
+
+void Program::packFilter(char* dst) const {
+#ifdef LG_FILTER_MEMCPY
+  std::memcpy(dst, &Filter, FilterBytes);
+#else
+  for (size_t b = 0; b < Filter.size(); b += 8) {
+    *dst++ = Filter[b] |
+             (Filter[b+1] << 1) |
+             (Filter[b+2] << 2) |
+             (Filter[b+3] << 3) |
+             (Filter[b+4] << 4) |
+             (Filter[b+5] << 5) |
+             (Filter[b+6] << 6) |
+             (Filter[b+7] << 7);
+  }
+#endif
+}
+
+void Program::unpackFilter(const char* src) {
+#ifdef LG_FILTER_MEMCPY
+  std::memcpy(&Filter, src, FilterBytes);
+#else
+  for (size_t b = 0; b < Filter.size() / 8; ++b, ++src) {
+    Filter[8*b]   = *src & 0x01;
+    Filter[8*b+1] = *src & 0x02;
+    Filter[8*b+2] = *src & 0x04;
+    Filter[8*b+3] = *src & 0x08;
+    Filter[8*b+4] = *src & 0x10;
+    Filter[8*b+5] = *src & 0x20;
+    Filter[8*b+6] = *src & 0x40;
+    Filter[8*b+7] = *src & 0x80;
+  }
+#endif
+}
+
 std::ostream& printIndex(std::ostream& out, uint32_t i) {
   out << std::setfill('0') << std::hex << std::setw(8) << i << ' ';
   return out;
 }
 
 std::ostream& operator<<(std::ostream& out, const Program& prog) {
+  // the byte set pool sits between the code and the final Halt, Finish;
+  // every reference to it precedes it
+  uint32_t poolStart = prog.size() < 2 ? 0 : prog.size() - 2;
+
   for (uint32_t i = 0; i < prog.size(); ++i) {
+    if (poolStart <= i && i + 2 < prog.size()) {
+      out << std::hex << std::setfill('0') << std::setw(8)
+          << i << '\t' << *(uint32_t*)(&prog[i]) << '\n' << std::dec;
+      continue;
+    }
+
     printIndex(out, i) << prog[i] << '\n';
 
-    if (prog[i].OpCode == BIT_VECTOR_OP) {
+    if (prog[i].OpCode == BIT_VECTOR_POOL_OP) {
+      poolStart = std::min(poolStart, i + prog[i].Op.Offset);
+    }
+    else if (prog[i].OpCode == JUMP_TABLE_INDEX_OP) {
+      const uint32_t first = prog[i].Op.T2.First,
+                     last = prog[i].Op.T2.Last,
+                     indexWords = (last - first + 4) / 4,
+                     numSlots = prog[i].Op.T2.Flags;
+      const byte* index = reinterpret_cast<const byte*>(&prog[i] + 1);
+
+      for (uint32_t j = 0; j < indexWords; ++j) {
+        ++i;
+        printIndex(out, i);
+        for (uint32_t k = 4*j; k < 4*j + 4 && first + k <= last; ++k) {
+          out << std::dec << std::setfill(' ') << std::setw(3) << (first + k)
+              << ": " << (unsigned short)index[k] << ' ';
+        }
+        out << '\n';
+      }
+      for (uint32_t j = 1; j <= numSlots; ++j) {
+        ++i;
+        printIndex(out, i) << "slot " << std::dec << j << ": " << std::hex << reinterpret_cast<const uint32_t&>(prog[i]) << '\n';
+      }
+    }
+    else if (prog[i].OpCode == BIT_VECTOR_OP) {
       for (uint32_t j = 1; j < 9; ++j) {
         out << std::hex << std::setfill('0') << std::setw(8)
             << i + j << '\t' << *(uint32_t*)(&prog[i]+j) << '\n';
@@ -133,7 +203,145 @@ std::ostream& operator<<(std::ostream& out, const Program& prog) {
       ++i;
       printIndex(out, i) << reinterpret_cast<const uint32_t&>(prog[i]) << '\n';
     }
+    else if (prog[i].OpCode == COUNT_LOOP_OP) {
+      for (uint32_t j = 1; j < 3; ++j) {
+        ++i;
+        printIndex(out, i) << reinterpret_cast<const uint32_t&>(prog[i]) << '\n';
+      }
+    }
   }
 
   return out;
 }
+
+namespace {
+  uint32_t& word(Instruction* i) {
+    return reinterpret_cast<uint32_t&>(*i);
+  }
+
+  // Copies src to dst, which is at addr in the linked program, adjusting
+  // addresses, labels, and check indices as it goes. The byte set pool,
+  // which follows the code, is copied as is; references to it are relative.
+  void relocate(const Program& src, Instruction* dst, uint32_t addr, uint32_t labelOff, uint32_t checkOff) {
+    std::copy(src.begin(), src.end(), dst);
+
+    // every reference to the pool precedes it, as in operator<<
+    uint32_t poolStart = src.size() - 2;
+
+    for (uint32_t i = 0; i < poolStart; ) {
+      Instruction& instr(dst[i]);
+
+      switch (instr.OpCode) {
+      case BIT_VECTOR_POOL_OP:
+        poolStart = std::min(poolStart, i + instr.Op.Offset);
+        ++i;
+        break;
+
+      case JUMP_TABLE_RANGE_OP:
+        {
+          const uint32_t n = instr.Op.T2.Last - instr.Op.T2.First + 1;
+          for (uint32_t j = 1; j <= n; ++j) {
+            // 0 means no target, as nothing jumps back to the start
+            if (word(&instr + j)) {
+              word(&instr + j) += addr;
+            }
+          }
+          i += 1 + n;
+        }
+        break;
+
+      case JUMP_TABLE_INDEX_OP:
+        {
+          const uint32_t indexWords = (instr.Op.T2.Last - instr.Op.T2.First + 4) >> 2,
+                         numSlots = instr.Op.T2.Flags;
+          for (uint32_t j = 1; j <= numSlots; ++j) {
+            word(&instr + indexWords + j) += addr;
+          }
+          i += 1 + indexWords + numSlots;
+        }
+        break;
+
+      case FORK_OP:
+      case JUMP_OP:
+        word(&instr + 1) += addr;
+        i += InstructionSize<FORK_OP>::VAL;
+        break;
+
+      case COUNT_LOOP_OP:
+        word(&instr + 2) += addr;
+        i += InstructionSize<COUNT_LOOP_OP>::VAL;
+        break;
+
+      case LABEL_OP:
+        instr.Op.Offset += labelOff;
+        ++i;
+        break;
+
+      case CHECK_HALT_OP:
+        instr.Op.Offset += checkOff;
+        ++i;
+        break;
+
+      default:
+        i += instr.wordSize();
+      }
+    }
+  }
+}
+
+ProgramPtr linkPrograms(const std::vector<const Program*>& progs, const std::vector<uint32_t>& labelOffsets) {
+  if (progs.empty()) {
+    throw std::runtime_error("No programs to link");
+  }
+
+  // the start forks to each program but the last, then jumps to it
+  const uint32_t startSize = 2 * progs.size();
+
+  uint64_t size = startSize;
+  uint64_t maxLabel = 0, maxCheck = 0;
+  for (size_t i = 0; i < progs.size(); ++i) {
+    size += progs[i]->size();
+    maxLabel = std::max(maxLabel, uint64_t(labelOffsets[i]) + progs[i]->MaxLabel);
+    maxCheck += progs[i]->MaxCheck;
+  }
+
+  // labels and check indices are 24-bit operands
+  if (maxLabel >= (1 << 24) || maxCheck >= (1 << 24) ||
+      size > std::numeric_limits<uint32_t>::max())
+  {
+    throw std::runtime_error("Linked program is too large");
+  }
+
+  ProgramPtr ret(new Program(size));
+  ret->MaxLabel = maxLabel;
+  ret->MaxCheck = maxCheck;
+
+  // the filter survives only if every program filters at the same offset
+  ret->FilterOff = progs.front()->FilterOff;
+  for (const Program* p : progs) {
+    if (p->FilterOff != ret->FilterOff) {
+      ret->FilterOff = 0;
+      ret->Filter.set();
+      break;
+    }
+    ret->Filter |= p->Filter;
+  }
+
+  Instruction* const base = &(*ret)[0];
+  uint32_t addr = startSize;
+  uint32_t checkOff = 0;
+
+  for (size_t i = 0; i < progs.size(); ++i) {
+    Instruction* const op = base + 2*i;
+    *op = i + 1 < progs.size() ?
+      Instruction::makeFork(op, addr) : Instruction::makeJump(op, addr);
+
+    relocate(*progs[i], base + addr, addr, labelOffsets[i], checkOff);
+
+    addr += progs[i]->size();
+    checkOff += progs[i]->MaxCheck;
+  }
+
+  // the last program ends with the Halt and Finish the Vm expects
+  return ret;
+}
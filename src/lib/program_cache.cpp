@@ -0,0 +1,308 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "program_cache.h"
+
+#include "handles.h"
+#include "program_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/tokenizer.hpp>
+
+#ifndef PACKAGE_VERSION
+#define PACKAGE_VERSION "unknown"
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+  const char CACHE_MAGIC[8] = { 'L', 'G', 'P', 'C', 'A', 'C', 'H', 'E' };
+
+  // bump this whenever the cache file layout changes
+  const uint32_t CACHE_FORMAT = 2;
+
+  const char CACHE_EXT[] = ".lgc";
+
+  uint64_t fnv1a(const std::string& s) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (const char c : s) {
+      h ^= static_cast<unsigned char>(c);
+      h *= 0x100000001B3ull;
+    }
+    return h;
+  }
+
+  size_t padded(size_t len) {
+    return (len + 7) & ~static_cast<size_t>(7);
+  }
+
+  const char* boolStr(char b) {
+    return b ? "1" : "0";
+  }
+
+  void normalizeOption(const std::string& col, char& opt, std::string& bad) {
+    try {
+      opt = boost::lexical_cast<bool>(col);
+    }
+    catch (const boost::bad_lexical_cast&) {
+      // lg_add_pattern_list will reject this, but keep the key faithful
+      bad += '\t';
+      bad += col;
+    }
+  }
+
+  // Tokenizes the pattern list exactly as lg_add_pattern_list does.
+  void normalizePatternList(
+    const char* patterns,
+    const std::string& defEncs,
+    const LG_KeyOptions& defOpts,
+    std::ostringstream& key)
+  {
+    typedef boost::char_separator<char> char_separator;
+    typedef boost::tokenizer<char_separator, const char*> cstr_tokenizer;
+    typedef boost::tokenizer<char_separator> tokenizer;
+
+    const cstr_tokenizer ltok(
+      patterns, patterns + std::strlen(patterns), char_separator("\n")
+    );
+
+    for (const std::string& line : ltok) {
+      const tokenizer ctok(line, char_separator("\t"));
+      tokenizer::const_iterator ccur(ctok.begin());
+      const tokenizer::const_iterator cend(ctok.end());
+
+      if (ccur == cend) {
+        key << "\t\n";
+        continue;
+      }
+
+      key << *ccur << '\t';
+
+      LG_KeyOptions opts(defOpts);
+      std::string bad;
+
+      if (++ccur != cend) {
+        const tokenizer etok(*ccur, char_separator(","));
+        std::string encs;
+        for (const std::string& e : etok) {
+          if (!encs.empty()) {
+            encs += ',';
+          }
+          encs += e;
+        }
+        key << encs;
+
+        if (++ccur != cend) {
+          normalizeOption(*ccur, opts.FixedString, bad);
+          if (++ccur != cend) {
+            normalizeOption(*ccur, opts.CaseInsensitive, bad);
+            if (++ccur != cend) {
+              normalizeOption(*ccur, opts.UnicodeMode, bad);
+            }
+          }
+        }
+      }
+      else {
+        key << defEncs;
+      }
+
+      key << '\t' << boolStr(opts.FixedString)
+          << '\t' << boolStr(opts.CaseInsensitive)
+          << '\t' << boolStr(opts.UnicodeMode)
+          << bad << '\n';
+    }
+  }
+
+  bool isCacheFile(const fs::directory_entry& e) {
+    return e.is_regular_file() && e.path().extension() == CACHE_EXT;
+  }
+}
+
+std::string programCacheKey(
+  const char** patternLists,
+  size_t patternListsNum,
+  const char** defaultEncodings,
+  size_t defaultEncodingsNum,
+  const LG_KeyOptions& defaultOptions,
+  const LG_ProgramOptions& progOptions)
+{
+  std::ostringstream key;
+
+  key << "lightgrep " << PACKAGE_VERSION << ' ' << CACHE_FORMAT << '\n'
+      << "determinize " << boolStr(progOptions.Determinize) << '\n'
+      << "share-suffixes " << boolStr(progOptions.ShareSuffixes) << '\n';
+
+  std::string defEncs;
+  for (size_t i = 0; i < defaultEncodingsNum; ++i) {
+    if (i) {
+      defEncs += ',';
+    }
+    defEncs += defaultEncodings[i];
+  }
+
+  // pattern indices restart with each list, so mark the boundaries
+  for (size_t i = 0; i < patternListsNum; ++i) {
+    key << "list " << i << '\n';
+    normalizePatternList(patternLists[i], defEncs, defaultOptions, key);
+  }
+
+  return key.str();
+}
+
+std::string programCachePath(const std::string& dir, const std::string& key) {
+  std::ostringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << fnv1a(key)
+       << CACHE_EXT;
+  return (fs::path(dir) / name.str()).string();
+}
+
+LG_HPROGRAM loadCachedProgram(const std::string& dir, const std::string& key) {
+  const std::string path(programCachePath(dir, key));
+
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  if (!in) {
+    return nullptr;
+  }
+
+  char magic[sizeof(CACHE_MAGIC)];
+  uint64_t klen;
+  if (!in.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) ||
+      !in.read(reinterpret_cast<char*>(&klen), sizeof(klen)) ||
+      klen != key.size())
+  {
+    return nullptr;
+  }
+
+  std::string k(padded(klen), '\0');
+  if (!in.read(&k[0], k.size()) || k.compare(0, klen, key)) {
+    // a hash collision or a corrupt file
+    return nullptr;
+  }
+
+  uint64_t plen;
+  if (!in.read(reinterpret_cast<char*>(&plen), sizeof(plen))) {
+    return nullptr;
+  }
+
+  const uint64_t offset = in.tellg();
+  in.close();
+
+  // map the program in place, rather than reading it
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> hProg(
+    mapProgramFile(path, offset),
+    lg_destroy_program
+  );
+
+  // record the use, for eviction
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+  return hProg.release();
+}
+
+void storeCachedProgram(
+  const std::string& dir,
+  const std::string& key,
+  const LG_HPROGRAM hProg,
+  uint64_t maxSize)
+{
+  fs::create_directories(dir);
+
+  const std::string path(programCachePath(dir, key));
+
+  // write to a temporary file and rename it into place, so that concurrent
+  // readers never see a partial program
+  std::random_device rd;
+  std::ostringstream tmpname;
+  tmpname << path << '.' << std::hex << rd() << ".tmp";
+  const std::string tmp(tmpname.str());
+
+  {
+    const uint64_t klen = key.size();
+    const uint64_t plen = lg_program_size(hProg);
+
+    std::vector<char> pbuf(plen);
+    lg_write_program(hProg, pbuf.data());
+
+    std::ofstream out(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    out.write(reinterpret_cast<const char*>(&klen), sizeof(klen));
+    out.write(key.data(), klen);
+    out.write("\0\0\0\0\0\0\0", padded(klen) - klen);
+    out.write(reinterpret_cast<const char*>(&plen), sizeof(plen));
+    out.write(pbuf.data(), plen);
+    out.close();
+
+    if (!out) {
+      std::error_code ec;
+      fs::remove(tmp, ec);
+      THROW_RUNTIME_ERROR_WITH_OUTPUT("Could not write cache file " << tmp);
+    }
+  }
+
+  fs::rename(tmp, path);
+
+  if (maxSize) {
+    evictCachedPrograms(dir, maxSize);
+  }
+}
+
+void evictCachedPrograms(const std::string& dir, uint64_t maxSize) {
+  typedef std::tuple<fs::file_time_type, uint64_t, fs::path> Entry;
+
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+
+  for (const fs::directory_entry& e : fs::directory_iterator(dir)) {
+    if (isCacheFile(e)) {
+      const uint64_t size = e.file_size();
+      entries.emplace_back(e.last_write_time(), size, e.path());
+      total += size;
+    }
+  }
+
+  // remove the least recently used programs first
+  std::sort(entries.begin(), entries.end());
+
+  for (const Entry& e : entries) {
+    if (total <= maxSize) {
+      break;
+    }
+
+    std::error_code ec;
+    if (fs::remove(std::get<2>(e), ec)) {
+      total -= std::get<1>(e);
+    }
+  }
+}
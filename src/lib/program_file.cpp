@@ -0,0 +1,283 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "program_file.h"
+
+#include "handles.h"
+#include "program.h"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace bip = boost::interprocess;
+
+namespace {
+  const char MAGIC[8] = { 'L', 'G', 'P', 'R', 'O', 'G', 'R', 'M' };
+
+  const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+  // align sections to cache lines
+  const uint64_t ALIGNMENT = 64;
+
+  uint64_t aligned(uint64_t n) {
+    return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+  }
+
+  // FNV-1a, taken a word at a time so that checking a large program
+  // runs at close to memory speed
+  uint64_t checksum(const char* beg, const char* end, uint64_t h = 0xCBF29CE484222325ull) {
+    uint64_t w;
+    for ( ; end - beg >= 8; beg += 8) {
+      std::memcpy(&w, beg, sizeof(w));
+      h = (h ^ w) * 0x100000001B3ull;
+    }
+
+    for ( ; beg < end; ++beg) {
+      h = (h ^ static_cast<unsigned char>(*beg)) * 0x100000001B3ull;
+    }
+
+    return h;
+  }
+
+  uint64_t fileChecksum(const char* buf, const ProgramFileHeader& hdr) {
+    ProgramFileHeader h(hdr);
+    h.Checksum = 0;
+
+    const char* hbeg = reinterpret_cast<const char*>(&h);
+    return checksum(
+      buf + sizeof(h), buf + hdr.Size, checksum(hbeg, hbeg + sizeof(h))
+    );
+  }
+
+  ProgramFileHeader makeHeader(const ProgramHandle& hProg, std::vector<PatternMap::TableEntry>& table, std::vector<char>& strings) {
+    hProg.PMap->marshallTable(table, strings);
+
+    const Program& prog(*hProg.Prog);
+
+    ProgramFileHeader hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+
+    std::memcpy(hdr.Magic, MAGIC, sizeof(MAGIC));
+    hdr.Version = PROGRAM_FILE_VERSION;
+    hdr.ByteOrder = BYTE_ORDER_MARK;
+
+    hdr.MaxLabel = prog.MaxLabel;
+    hdr.MaxCheck = prog.MaxCheck;
+    hdr.FilterOff = prog.FilterOff;
+
+    hdr.FilterPos = aligned(sizeof(hdr));
+    hdr.InstructionsPos = aligned(hdr.FilterPos + Program::FilterBytes);
+    hdr.InstructionsNum = prog.size();
+    hdr.PatternsPos = aligned(hdr.InstructionsPos + prog.size() * sizeof(Instruction));
+    hdr.PatternsNum = table.size();
+    hdr.StringsPos = aligned(hdr.PatternsPos + table.size() * sizeof(PatternMap::TableEntry));
+    hdr.StringsSize = strings.size();
+    hdr.Size = hdr.StringsPos + hdr.StringsSize;
+
+    if (!hProg.PMap->labels().empty()) {
+      hdr.LabelsPos = aligned(hdr.Size);
+      hdr.Size = hdr.LabelsPos + table.size() * sizeof(uint32_t);
+    }
+
+    return hdr;
+  }
+
+  bool inBounds(const ProgramFileHeader& hdr, uint64_t pos, uint64_t num, uint64_t size) {
+    return pos % ALIGNMENT == 0 && pos <= hdr.Size &&
+           (hdr.Size - pos) / size >= num;
+  }
+}
+
+uint64_t programFileSize(const ProgramHandle& hProg) {
+  std::vector<PatternMap::TableEntry> table;
+  std::vector<char> strings;
+  return makeHeader(hProg, table, strings).Size;
+}
+
+void writeProgramFile(const ProgramHandle& hProg, void* buf) {
+  std::vector<PatternMap::TableEntry> table;
+  std::vector<char> strings;
+  ProgramFileHeader hdr(makeHeader(hProg, table, strings));
+
+  char* dst = static_cast<char*>(buf);
+
+  // zero the padding between sections too, so output is reproducible
+  std::memset(dst, 0, hdr.Size);
+
+  hProg.Prog->packFilter(dst + hdr.FilterPos);
+
+  std::memcpy(
+    dst + hdr.InstructionsPos, &(*hProg.Prog)[0],
+    hdr.InstructionsNum * sizeof(Instruction)
+  );
+
+  std::memcpy(
+    dst + hdr.PatternsPos, table.data(),
+    table.size() * sizeof(PatternMap::TableEntry)
+  );
+
+  std::memcpy(dst + hdr.StringsPos, strings.data(), strings.size());
+
+  if (hdr.LabelsPos) {
+    std::memcpy(
+      dst + hdr.LabelsPos, hProg.PMap->labels().data(),
+      hdr.PatternsNum * sizeof(uint32_t)
+    );
+  }
+
+  hdr.Checksum = fileChecksum(dst, hdr);
+  std::memcpy(dst, &hdr, sizeof(hdr));
+}
+
+bool isProgramFile(const void* buf, size_t size) {
+  return size >= sizeof(MAGIC) && !std::memcmp(buf, MAGIC, sizeof(MAGIC));
+}
+
+namespace {
+  ProgramFileHeader readHeader(const void* buf, size_t size) {
+    if (!isProgramFile(buf, size) || size < sizeof(ProgramFileHeader)) {
+      throw std::runtime_error("Not a program file");
+    }
+
+    ProgramFileHeader hdr;
+    std::memcpy(&hdr, buf, sizeof(hdr));
+
+    if (hdr.Version < PROGRAM_FILE_MIN_VERSION || hdr.Version > PROGRAM_FILE_VERSION) {
+      THROW_RUNTIME_ERROR_WITH_OUTPUT(
+        "Unsupported program file version " << hdr.Version
+        << ", expected " << PROGRAM_FILE_MIN_VERSION << " to " << PROGRAM_FILE_VERSION
+      );
+    }
+
+    if (hdr.ByteOrder != BYTE_ORDER_MARK) {
+      throw std::runtime_error("Program file has the wrong byte order");
+    }
+
+    if (hdr.Size > size) {
+      THROW_RUNTIME_ERROR_WITH_OUTPUT(
+        "Program file is truncated: " << size << " of " << hdr.Size << " bytes"
+      );
+    }
+
+    if (!inBounds(hdr, hdr.FilterPos, 1, Program::FilterBytes) ||
+        !inBounds(hdr, hdr.InstructionsPos, hdr.InstructionsNum, sizeof(Instruction)) ||
+        !inBounds(hdr, hdr.PatternsPos, hdr.PatternsNum, sizeof(PatternMap::TableEntry)) ||
+        !inBounds(hdr, hdr.StringsPos, hdr.StringsSize, 1) ||
+        (hdr.Version < 4 && hdr.LabelsPos) ||
+        (hdr.LabelsPos && !inBounds(hdr, hdr.LabelsPos, hdr.PatternsNum, sizeof(uint32_t))))
+    {
+      throw std::runtime_error("Program file has a malformed section");
+    }
+
+    return hdr;
+  }
+}
+
+void verifyProgramFile(const void* buf, size_t size) {
+  const ProgramFileHeader hdr(readHeader(buf, size));
+  if (fileChecksum(static_cast<const char*>(buf), hdr) != hdr.Checksum) {
+    throw std::runtime_error("Program file checksum mismatch");
+  }
+}
+
+LG_HPROGRAM readProgramFile(const void* buf, size_t size) {
+  // the checksum is not taken here, as that would read every page of a
+  // large program; the header and tables are checked all the same
+  const ProgramFileHeader hdr(readHeader(buf, size));
+
+  const char* src = static_cast<const char*>(buf);
+
+  if (reinterpret_cast<uintptr_t>(src) % alignof(PatternMap::TableEntry)) {
+    // the sections can't be used in place; use an aligned copy instead
+    std::shared_ptr<uint64_t> copy(
+      new uint64_t[(hdr.Size + 7) / 8], std::default_delete<uint64_t[]>()
+    );
+    std::memcpy(copy.get(), src, hdr.Size);
+
+    LG_HPROGRAM hProg = readProgramFile(copy.get(), hdr.Size);
+    hProg->Storage = copy;
+    return hProg;
+  }
+
+  const PatternMap::TableEntry* table =
+    reinterpret_cast<const PatternMap::TableEntry*>(src + hdr.PatternsPos);
+  const char* strings = src + hdr.StringsPos;
+
+  // every string must be terminated within the string table
+  if (hdr.StringsSize && strings[hdr.StringsSize - 1]) {
+    throw std::runtime_error("Program file has a malformed string table");
+  }
+
+  for (uint64_t i = 0; i < hdr.PatternsNum; ++i) {
+    if (table[i].Pattern >= hdr.StringsSize ||
+        table[i].EncodingChain >= hdr.StringsSize)
+    {
+      throw std::runtime_error("Program file has a malformed pattern table");
+    }
+  }
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> hProg(
+    new ProgramHandle,
+    lg_destroy_program
+  );
+
+  hProg->PMap = PatternMap::unmarshallTable(table, hdr.PatternsNum, strings);
+  if (hdr.LabelsPos) {
+    hProg->PMap->setLabels(
+      reinterpret_cast<const uint32_t*>(src + hdr.LabelsPos)
+    );
+
+    // hits are fanned out by label, so each must have its patterns
+    if (hdr.MaxLabel >= hProg->PMap->numLabels()) {
+      throw std::runtime_error("Program file has a malformed label table");
+    }
+  }
+
+  hProg->Prog = Program::view(
+    reinterpret_cast<const Instruction*>(src + hdr.InstructionsPos),
+    hdr.InstructionsNum
+  );
+
+  hProg->Prog->MaxLabel = hdr.MaxLabel;
+  hProg->Prog->MaxCheck = hdr.MaxCheck;
+  hProg->Prog->FilterOff = hdr.FilterOff;
+  hProg->Prog->unpackFilter(src + hdr.FilterPos);
+
+  return hProg.release();
+}
+
+LG_HPROGRAM mapProgramFile(const std::string& path, uint64_t offset) {
+  std::shared_ptr<bip::mapped_region> region;
+
+  {
+    const bip::file_mapping fm(path.c_str(), bip::read_only);
+    region.reset(new bip::mapped_region(fm, bip::read_only, offset));
+  }
+
+  LG_HPROGRAM hProg = readProgramFile(
+    region->get_address(), region->get_size()
+  );
+
+  hProg->Storage = region;
+  return hProg;
+}
@@ -656,3 +656,214 @@ bool reduceTrailingNongreedyThenEmpty(ParseNode* root) {
   std::stack<ParseNode*> branch;
   return reduceTrailingNongreedyThenEmpty(root, branch);
 }
+
+bool is_single_character(const ParseNode* n) {
+  switch (n->Type) {
+  case ParseNode::DOT:
+  case ParseNode::CHAR_CLASS:
+  case ParseNode::LITERAL:
+  case ParseNode::BYTE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool foldable_into_class(const ParseNode* n) {
+  switch (n->Type) {
+  case ParseNode::DOT:
+    return true;
+  case ParseNode::LITERAL:
+    // a literal missing from the encoding is an error, but a class
+    // silently drops it, so fold only literals every encoding has
+    return n->Val < 0x80;
+  case ParseNode::CHAR_CLASS:
+    return n->Set.Breakout.Bytes.none();
+  default:
+    return false;
+  }
+}
+
+void add_code_points(const ParseNode* n, UnicodeSet& cps) {
+  switch (n->Type) {
+  case ParseNode::DOT:
+    cps.insert(0, 0x110000);
+    break;
+  case ParseNode::LITERAL:
+    cps.set(n->Val);
+    break;
+  default:
+    cps |= n->Set.CodePoints;
+    break;
+  }
+}
+
+// Concatenations need not be right-associative here, so the first
+// element is found by walking left and the last by walking right.
+
+ParseNode* first_concatenation(ParseNode* n, ParseNode*& parent) {
+  parent = nullptr;
+  while (n->Child.Left->Type == ParseNode::CONCATENATION) {
+    parent = n;
+    n = n->Child.Left;
+  }
+  return n;
+}
+
+ParseNode* last_concatenation(ParseNode* n, ParseNode*& parent) {
+  parent = nullptr;
+  while (n->Child.Right->Type == ParseNode::CONCATENATION) {
+    parent = n;
+    n = n->Child.Right;
+  }
+  return n;
+}
+
+ParseNode* remove_first_element(ParseNode* n, ParseNode* firstCat, ParseNode* parent) {
+  if (parent) {
+    parent->Child.Left = firstCat->Child.Right;
+    return n;
+  }
+  else {
+    return firstCat->Child.Right;
+  }
+}
+
+ParseNode* remove_last_element(ParseNode* n, ParseNode* lastCat, ParseNode* parent) {
+  if (parent) {
+    parent->Child.Right = lastCat->Child.Left;
+    return n;
+  }
+  else {
+    return lastCat->Child.Left;
+  }
+}
+
+ParseNode* combine_alternatives(ParseNode* l, ParseNode* r, ParseNode* spare) {
+  // Combines adjacent alternatives l|r into one subtree, reusing spare,
+  // the alternation node which the combination frees. Returns null if
+  // l and r have nothing in common. Each shared node matches exactly
+  // one character in exactly one way, so priority is unchanged.
+
+  if (foldable_into_class(l) && foldable_into_class(r)) {
+    // a|[bc] = [abc]
+    UnicodeSet cps;
+    add_code_points(l, cps);
+    add_code_points(r, cps);
+    *l = ParseNode(ParseNode::CHAR_CLASS, cps);
+    return l;
+  }
+
+  if (l->Type != ParseNode::CONCATENATION ||
+      r->Type != ParseNode::CONCATENATION) {
+    return nullptr;
+  }
+
+  ParseNode* lp;
+  ParseNode* rp;
+  ParseNode* lc = first_concatenation(l, lp);
+  ParseNode* rc = first_concatenation(r, rp);
+  ParseNode* first = lc->Child.Left;
+
+  if (is_single_character(first) && *first == *rc->Child.Left) {
+    // xS|xT = x(S|T)
+    ParseNode* ls = remove_first_element(l, lc, lp);
+    ParseNode* rs = remove_first_element(r, rc, rp);
+
+    spare->setType(ParseNode::ALTERNATION);
+    spare->Child.Left = ls;
+    spare->Child.Right = rs;
+
+    lc->Child.Right = spare;
+    return lc;
+  }
+
+  lc = last_concatenation(l, lp);
+  rc = last_concatenation(r, rp);
+  ParseNode* last = lc->Child.Right;
+
+  if (is_single_character(last) && *last == *rc->Child.Right) {
+    // Sx|Tx = (S|T)x
+    ParseNode* ls = remove_last_element(l, lc, lp);
+    ParseNode* rs = remove_last_element(r, rc, rp);
+
+    lc->setType(ParseNode::ALTERNATION);
+    lc->Child.Left = ls;
+    lc->Child.Right = rs;
+
+    spare->setType(ParseNode::CONCATENATION);
+    spare->Child.Left = lc;
+    spare->Child.Right = last;
+    return spare;
+  }
+
+  return nullptr;
+}
+
+bool factor_alternations(ParseNode*& n) {
+  bool ret = false;
+
+  switch (n->Type) {
+  case ParseNode::REGEXP:
+    if (!n->Child.Left) {
+      return ret;
+    }
+    [[fallthrough]];
+  case ParseNode::REPETITION:
+  case ParseNode::REPETITION_NG:
+    ret = factor_alternations(n->Child.Left);
+    break;
+
+  case ParseNode::CONCATENATION:
+    ret = factor_alternations(n->Child.Left);
+    ret |= factor_alternations(n->Child.Right);
+    break;
+
+  case ParseNode::ALTERNATION:
+    ret = factor_alternations(n->Child.Left);
+    ret |= factor_alternations(n->Child.Right);
+
+    // Alternations are right-associative, so the first two alternatives
+    // are our left child and either our right child or its left child.
+    // Only adjacent alternatives are combined, to preserve priority.
+    while (n->Type == ParseNode::ALTERNATION) {
+      ParseNode* r = n->Child.Right;
+
+      if (r->Type == ParseNode::ALTERNATION) {
+        ParseNode* rest = r->Child.Right;
+        ParseNode* c = combine_alternatives(n->Child.Left, r->Child.Left, r);
+        if (!c) {
+          break;
+        }
+
+        n->Child.Left = c;
+        n->Child.Right = rest;
+        factor_alternations(n->Child.Left);
+      }
+      else {
+        ParseNode* c = combine_alternatives(n->Child.Left, r, n);
+        if (!c) {
+          break;
+        }
+
+        n = c;
+        factor_alternations(n);
+      }
+
+      ret = true;
+    }
+    break;
+
+  default:
+    // branch finished
+    break;
+  }
+
+  return ret;
+}
+
+bool factorAlternations(ParseNode* root) {
+  // a|b|[cd] = [a-d]
+  // foobar|foobaz = fooba[rz]
+  return factor_alternations(root);
+}
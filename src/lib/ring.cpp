@@ -0,0 +1,388 @@
+/*
+  liblightgrep: not the worst forensics regexp engine
+  Copyright (C) 2013, Lightbox Technologies, Inc
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bip = boost::interprocess;
+
+//
+// The shared memory is laid out as the header, the descriptors, and then
+// the slots, each slot starting on a page boundary:
+//
+//   Header
+//   Descriptor [NumSlots]
+//   slot       [NumSlots]    SlotStride bytes apart
+//
+// Every field is in the byte order of the machine, as the ring is only
+// shared by processes on it. The counters producers and the searcher
+// contend for each have a cache line of their own.
+//
+struct Ring::Header {
+  char     Magic[8];
+  uint32_t Version;
+  uint32_t NumSlots;
+  uint32_t SlotSize;
+  uint32_t SlotStride;
+  uint64_t SlotsOffset;
+
+  // the next position for a producer to claim, with CLOSED set once the
+  // ring is closed
+  alignas(64) std::atomic<uint64_t> Head;
+
+  // the next position for the searcher to take
+  alignas(64) std::atomic<uint64_t> Tail;
+
+  // bumped on every publish and release, for waiters to sleep on
+  alignas(64) std::atomic<uint32_t> Published;
+  std::atomic<uint32_t> PublishWaiters;
+
+  alignas(64) std::atomic<uint32_t> Released;
+  std::atomic<uint32_t> ReleaseWaiters;
+};
+
+struct alignas(64) Ring::Descriptor {
+  std::atomic<uint64_t> Sequence;
+  uint64_t StreamID,
+           Offset;
+  uint32_t Length,
+           Flags;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs lock-free 64-bit atomics");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the ring needs lock-free 32-bit atomics");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be 32 bits");
+static_assert(sizeof(Ring::Header) == 320, "Ring::Header is not packed");
+static_assert(sizeof(Ring::Descriptor) == 64, "Ring::Descriptor is not packed");
+
+namespace {
+  const char MAGIC[8] = {'L', 'G', 'R', 'I', 'N', 'G', '\0', '\0'};
+
+  const uint32_t FORMAT_VERSION = 1;
+
+  const uint64_t CLOSED = uint64_t(1) << 63;
+
+  // how long the searcher waits for slots acquired before the ring closed
+  // to be published, once it is closed
+  const std::chrono::milliseconds CLOSE_GRACE(1000);
+
+  const uint64_t PAGE_SIZE = 4096;
+
+  uint64_t pageAligned(uint64_t n) {
+    return (n + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  }
+
+  void badRing(const char* why) {
+    throw std::runtime_error(std::string("not a lightgrep ring: ") + why);
+  }
+
+  // Sleeps until word changes from val, or for a while, whichever is
+  // sooner; the timeout covers a process which died between changing a
+  // slot and bumping the word
+  void sleepOn(std::atomic<uint32_t>& word, uint32_t val) {
+#ifdef __linux__
+    // not FUTEX_PRIVATE_FLAG, as the word is shared between processes
+    const timespec timeout{0, 100000000};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, val, &timeout, nullptr, 0);
+#else
+    if (word.load() == val) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+#endif
+  }
+
+  void bump(std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiters) {
+    word.fetch_add(1);
+    // the waiter counts itself before it checks its condition, so either
+    // it sees what we did or we see it waiting
+    if (waiters.load()) {
+#ifdef __linux__
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, std::numeric_limits<int>::max(), nullptr, nullptr, 0);
+#endif
+    }
+  }
+
+  template <typename Ready>
+  void waitFor(std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiters, Ready ready) {
+    while (!ready()) {
+      waiters.fetch_add(1);
+      const uint32_t val = word.load();
+      if (!ready()) {
+        sleepOn(word, val);
+      }
+      waiters.fetch_sub(1);
+    }
+  }
+}
+
+Ring::Ring(const std::string& name, bool owner):
+  Name(name), Owner(owner), Hdr(nullptr), Descs(nullptr), Slots(nullptr),
+  SawClosed(false)
+{}
+
+Ring* Ring::create(const std::string& name, uint32_t numSlots, uint32_t slotSize) {
+  if (numSlots == 0 || slotSize == 0) {
+    throw std::runtime_error("a ring needs at least one slot of at least one byte");
+  }
+
+  const uint64_t slotsOffset = pageAligned(sizeof(Header) + uint64_t(numSlots) * sizeof(Descriptor));
+  const uint64_t stride = pageAligned(slotSize);
+  if (stride > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("ring slots are too large");
+  }
+
+  bip::shared_memory_object::remove(name.c_str());
+
+  std::unique_ptr<Ring> ring(new Ring(name, true));
+  ring->Shm = bip::shared_memory_object(bip::create_only, name.c_str(), bip::read_write);
+  ring->Shm.truncate(slotsOffset + numSlots * stride);
+  ring->Region = bip::mapped_region(ring->Shm, bip::read_write);
+
+  // the memory starts zeroed, and with it the counters
+  Header* hdr = static_cast<Header*>(ring->Region.get_address());
+  hdr->Version = FORMAT_VERSION;
+  hdr->NumSlots = numSlots;
+  hdr->SlotSize = slotSize;
+  hdr->SlotStride = stride;
+  hdr->SlotsOffset = slotsOffset;
+
+  Descriptor* descs = reinterpret_cast<Descriptor*>(hdr + 1);
+  for (uint32_t i = 0; i < numSlots; ++i) {
+    descs[i].Sequence.store(i, std::memory_order_relaxed);
+  }
+
+  // the magic goes in last, so that a ring which has it is ready
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(hdr->Magic, MAGIC, sizeof(hdr->Magic));
+
+  ring->init();
+  return ring.release();
+}
+
+Ring* Ring::open(const std::string& name) {
+  std::unique_ptr<Ring> ring(new Ring(name, false));
+  ring->Shm = bip::shared_memory_object(bip::open_only, name.c_str(), bip::read_write);
+  ring->Region = bip::mapped_region(ring->Shm, bip::read_write);
+
+  if (ring->Region.get_size() < sizeof(Header)) {
+    badRing("too short");
+  }
+
+  const Header* hdr = static_cast<const Header*>(ring->Region.get_address());
+  if (std::memcmp(hdr->Magic, MAGIC, sizeof(hdr->Magic))) {
+    badRing("bad header");
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  if (hdr->Version != FORMAT_VERSION) {
+    badRing("unknown version");
+  }
+
+  if (hdr->NumSlots == 0 || hdr->SlotSize == 0 || hdr->SlotStride < hdr->SlotSize ||
+      hdr->SlotsOffset < sizeof(Header) + uint64_t(hdr->NumSlots) * sizeof(Descriptor) ||
+      ring->Region.get_size() < hdr->SlotsOffset + uint64_t(hdr->NumSlots) * hdr->SlotStride)
+  {
+    badRing("bad layout");
+  }
+
+  ring->init();
+  return ring.release();
+}
+
+void Ring::init() {
+  Hdr = static_cast<Header*>(Region.get_address());
+  Descs = reinterpret_cast<Descriptor*>(Hdr + 1);
+  Slots = static_cast<char*>(Region.get_address()) + Hdr->SlotsOffset;
+}
+
+Ring::~Ring() {
+  if (Owner) {
+    // wake any producers left waiting, so they see it is closed; the
+    // memory stays mapped in their processes after the name is gone
+    if (Hdr) {
+      close();
+    }
+    bip::shared_memory_object::remove(Name.c_str());
+  }
+}
+
+uint32_t Ring::numSlots() const {
+  return Hdr->NumSlots;
+}
+
+uint32_t Ring::slotSize() const {
+  return Hdr->SlotSize;
+}
+
+Ring::Descriptor& Ring::descriptor(uint64_t pos) const {
+  return Descs[pos % Hdr->NumSlots];
+}
+
+bool Ring::acquire(LG_RingSlot& slot) {
+  uint64_t pos = Hdr->Head.load(std::memory_order_relaxed);
+  for (;;) {
+    if (pos & CLOSED) {
+      return false;
+    }
+
+    const Descriptor& d = descriptor(pos);
+    const uint64_t seq = d.Sequence.load(std::memory_order_acquire);
+    if (seq == pos) {
+      // the slot is free; claim it, unless another producer beat us to it
+      if (Hdr->Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    else if (seq < pos) {
+      // the ring is full; wait for the searcher to release the slot
+      waitFor(Hdr->Released, Hdr->ReleaseWaiters, [this, &d, seq]() {
+        return d.Sequence.load(std::memory_order_acquire) != seq ||
+               (Hdr->Head.load() & CLOSED);
+      });
+      pos = Hdr->Head.load(std::memory_order_relaxed);
+    }
+    else {
+      // another producer claimed the slot
+      pos = Hdr->Head.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot.Data = Slots + (pos % Hdr->NumSlots) * Hdr->SlotStride;
+  slot.Position = pos;
+  slot.StreamID = 0;
+  slot.Offset = 0;
+  slot.Length = Hdr->SlotSize;
+  slot.Flags = 0;
+  return true;
+}
+
+void Ring::publish(const LG_RingSlot& slot) {
+  Descriptor& d = descriptor(slot.Position);
+  if (d.Sequence.load(std::memory_order_relaxed) != slot.Position) {
+    throw std::runtime_error("ring slot was not acquired");
+  }
+  if (slot.Length > Hdr->SlotSize) {
+    throw std::runtime_error("ring slot length exceeds the slot size");
+  }
+
+  d.StreamID = slot.StreamID;
+  d.Offset = slot.Offset;
+  d.Length = slot.Length;
+  d.Flags = slot.Flags;
+  d.Sequence.store(slot.Position + 1, std::memory_order_release);
+
+  bump(Hdr->Published, Hdr->PublishWaiters);
+}
+
+bool Ring::next(LG_RingSlot& slot) {
+  for (;;) {
+    // only the searcher moves Tail
+    const uint64_t pos = Hdr->Tail.load(std::memory_order_relaxed);
+    Descriptor& d = descriptor(pos);
+
+    bool drained = false, abandoned = false;
+    waitFor(Hdr->Published, Hdr->PublishWaiters, [&d, &drained, &abandoned, pos, this]() {
+      if (d.Sequence.load(std::memory_order_acquire) == pos + 1) {
+        return true;
+      }
+
+      const uint64_t head = Hdr->Head.load(std::memory_order_acquire);
+      if (!(head & CLOSED)) {
+        return false;
+      }
+
+      // once closed, Head does not move, so there is an end in sight;
+      // but a producer which died holding a slot will never publish it,
+      // so give those left a while, and then give up on them
+      if ((head & ~CLOSED) == pos) {
+        return drained = true;
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+      if (!SawClosed) {
+        SawClosed = true;
+        GiveUpAt = now + CLOSE_GRACE;
+      }
+      return abandoned = now >= GiveUpAt;
+    });
+
+    if (drained) {
+      return false;
+    }
+
+    if (!abandoned) {
+      // the descriptor is the producer's to write, so check what it says
+      const uint32_t length = d.Length;
+      if (length <= Hdr->SlotSize) {
+        slot.Data = Slots + (pos % Hdr->NumSlots) * Hdr->SlotStride;
+        slot.Position = pos;
+        slot.StreamID = d.StreamID;
+        slot.Offset = d.Offset;
+        slot.Length = length;
+        slot.Flags = d.Flags;
+
+        Hdr->Tail.store(pos + 1, std::memory_order_relaxed);
+        return true;
+      }
+
+      // drop the slot, and let the producers have it back
+      Hdr->Tail.store(pos + 1, std::memory_order_relaxed);
+      d.Sequence.store(pos + Hdr->NumSlots, std::memory_order_release);
+      bump(Hdr->Released, Hdr->ReleaseWaiters);
+    }
+    else {
+      // skip the position; the ring is closed, so its slot will not be
+      // used again
+      Hdr->Tail.store(pos + 1, std::memory_order_relaxed);
+    }
+  }
+}
+
+void Ring::release(const LG_RingSlot& slot) {
+  Descriptor& d = descriptor(slot.Position);
+  if (d.Sequence.load(std::memory_order_relaxed) != slot.Position + 1 ||
+      slot.Position >= Hdr->Tail.load(std::memory_order_relaxed))
+  {
+    throw std::runtime_error("ring slot was not taken");
+  }
+
+  d.Sequence.store(slot.Position + Hdr->NumSlots, std::memory_order_release);
+
+  bump(Hdr->Released, Hdr->ReleaseWaiters);
+}
+
+void Ring::close() {
+  Hdr->Head.fetch_or(CLOSED);
+  bump(Hdr->Published, Hdr->PublishWaiters);
+  bump(Hdr->Released, Hdr->ReleaseWaiters);
+}
@@ -94,7 +94,7 @@ std::string RangeState::label() const {
 bool ByteSetState::toInstruction(Instruction* addr) const {
   *addr = Instruction::makeBitVector();
   ByteSet* setPtr = reinterpret_cast<ByteSet*>(addr+1);
-  *setPtr = Allowed;
+  *setPtr = Bytes;
   return true;
 }
 
@@ -109,7 +109,7 @@ std::string ByteSetState::label() const {
   int32_t beg = -1, end;
 
   for (uint32_t i = 0; i < 256; ++i) {
-    if (Allowed.test(i)) {
+    if (Bytes.test(i)) {
       if (beg == -1) {
         beg = i;
       }
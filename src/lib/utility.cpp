@@ -21,7 +21,8 @@
 #include <algorithm>
 #include <set>
 
-std::pair<uint32_t,std::bitset<256*256>> bestPair(const NFA& graph) {
+template <class GraphType>
+std::pair<uint32_t,std::bitset<256*256>> bestPair(const GraphType& graph) {
   std::set<std::pair<uint32_t,NFA::VertexDescriptor>> next;
   next.emplace(0, 0);
 
@@ -42,7 +43,8 @@ std::pair<uint32_t,std::bitset<256*256>> bestPair(const NFA& graph) {
       break;
     }
 
-    if (graph[h].IsMatch && depth < lmin) {
+    // depths past a counted state vary, so we treat it as the end
+    if ((graph[h].IsMatch || graph[h].Rep) && depth < lmin) {
       lmin = depth;
     }
 
@@ -62,11 +64,10 @@ std::pair<uint32_t,std::bitset<256*256>> bestPair(const NFA& graph) {
     uint8_t* const bb = reinterpret_cast<uint8_t* const>(&b[depth]);
  
     for (const NFA::VertexDescriptor t0 : graph.outVertices(h)) {
-      ByteSet first;
-      graph[t0].Trans->orBytes(first);
+      const ByteSet& first(graph[t0].Trans->bytes());
 
-      if (graph[t0].IsMatch) {
-        // match; record each first byte followed by any byte
+      if (graph[t0].IsMatch || graph[t0].Rep) {
+        // match or counted; record each first byte followed by any byte
         for (uint32_t s = 0; s < 256; ++s) {
           *reinterpret_cast<std::bitset<256>*>(bb + (s << 5)) |= first;
         }
@@ -74,8 +75,7 @@ std::pair<uint32_t,std::bitset<256*256>> bestPair(const NFA& graph) {
       else {
         // no match; record each first byte followed by each second byte
         for (const NFA::VertexDescriptor t1 : graph.outVertices(t0)) {
-          ByteSet second;
-          graph[t1].Trans->orBytes(second);
+          const ByteSet& second(graph[t1].Trans->bytes());
 
           for (uint32_t s = 0; s < 256; ++s) {
             if (second.test(s)) {
@@ -108,21 +108,82 @@ std::pair<uint32_t,std::bitset<256*256>> bestPair(const NFA& graph) {
   return {i-b.begin(), *i};
 }
 
-std::vector<std::vector<NFA::VertexDescriptor>> pivotStates(NFA::VertexDescriptor source, const NFA& graph) {
-  std::vector<std::vector<NFA::VertexDescriptor>> ret(256);
-  ByteSet permitted;
+template <class GraphType>
+void pivotStates(NFA::VertexDescriptor source, const GraphType& graph, PivotTable& tbl) {
+  // drop repeated out vertices, keeping the first of each
+  if (tbl.Seen.size() < graph.verticesSize()) {
+    tbl.Seen.resize(graph.verticesSize());
+  }
 
+  tbl.Outs.clear();
   for (const NFA::VertexDescriptor ov : graph.outVertices(source)) {
-    graph[ov].Trans->getBytes(permitted);
+    if (!tbl.Seen[ov]) {
+      tbl.Seen[ov] = true;
+      tbl.Outs.push_back(ov);
+    }
+  }
+
+  for (const NFA::VertexDescriptor ov : tbl.Outs) {
+    tbl.Seen[ov] = false;
+  }
+
+  // count the targets on each byte, then place them
+  tbl.Begin.fill(0);
+  for (const NFA::VertexDescriptor ov : tbl.Outs) {
+    const ByteSet& permitted(graph[ov].Trans->bytes());
     for (uint32_t i = 0; i < 256; ++i) {
-      if (permitted[i] && std::find(ret[i].begin(), ret[i].end(), ov) == ret[i].end()) {
-        ret[i].push_back(ov);
+      tbl.Begin[i+1] += permitted[i];
+    }
+  }
+
+  for (uint32_t i = 0; i < 256; ++i) {
+    tbl.Begin[i+1] += tbl.Begin[i];
+  }
+
+  tbl.Targets.resize(tbl.Begin[256]);
+
+  std::array<uint32_t,256> next;
+  std::copy(tbl.Begin.begin(), tbl.Begin.end() - 1, next.begin());
+
+  for (const NFA::VertexDescriptor ov : tbl.Outs) {
+    const ByteSet& permitted(graph[ov].Trans->bytes());
+    for (uint32_t i = 0; i < 256; ++i) {
+      if (permitted[i]) {
+        tbl.Targets[next[i]++] = ov;
       }
     }
   }
+}
+
+template <class GraphType>
+std::vector<std::vector<NFA::VertexDescriptor>> pivotStates(NFA::VertexDescriptor source, const GraphType& graph) {
+  PivotTable tbl;
+  pivotStates(source, graph, tbl);
+
+  std::vector<std::vector<NFA::VertexDescriptor>> ret(256);
+  for (uint32_t i = 0; i < 256; ++i) {
+    ret[i].assign(tbl.begin(i), tbl.end(i));
+  }
   return ret;
 }
 
+uint32_t PivotTable::maxOutbound() const {
+  uint32_t ret = 0;
+  for (uint32_t i = 0; i < 256; ++i) {
+    ret = std::max(ret, size(i));
+  }
+  return ret;
+}
+
+template std::pair<uint32_t,std::bitset<256*256>> bestPair(const NFA& graph);
+template std::pair<uint32_t,std::bitset<256*256>> bestPair(const FrozenNFA& graph);
+
+template void pivotStates(NFA::VertexDescriptor source, const NFA& graph, PivotTable& tbl);
+template void pivotStates(NFA::VertexDescriptor source, const FrozenNFA& graph, PivotTable& tbl);
+
+template std::vector<std::vector<NFA::VertexDescriptor>> pivotStates(NFA::VertexDescriptor source, const NFA& graph);
+template std::vector<std::vector<NFA::VertexDescriptor>> pivotStates(NFA::VertexDescriptor source, const FrozenNFA& graph);
+
 uint32_t maxOutbound(const std::vector<std::vector<NFA::VertexDescriptor>>& tranTable) {
   return std::max_element(tranTable.begin(), tranTable.end(),
     [](const std::vector<NFA::VertexDescriptor>& l,
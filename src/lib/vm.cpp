@@ -125,7 +125,7 @@ Vm::Vm(ProgramPtr prog):
   Prog(prog),
   ProgEnd(&(*prog)[prog->size() - 2]), // not end, but penultimate, guaranteed to be a halt; threads die just short of the finish
   First(), Active(1, &(*prog)[0]), Next(),
-  CheckLabels(prog->MaxCheck+1),
+  CheckLabels(prog->MaxCheck+1), CheckOwners(prog->MaxCheck+1),
   LiveNoLabel(false), Live(prog->MaxLabel+1),
   MatchEnds(prog->MaxLabel+1), MatchEndsMax(0),
   CurHitFn(nullptr), UserData(nullptr)
@@ -166,6 +166,8 @@ void Vm::reset() {
   Next.clear();
 
   CheckLabels.clear();
+  SharedChecks.clear();
+  LoopChecks.clear();
 
   LiveNoLabel = false;
   Live.clear();
@@ -203,6 +205,17 @@ inline bool Vm::_execute(const Instruction* const base, ThreadList::iterator t,
     }
     break;
 
+  case JUMP_TABLE_INDEX_OP:
+    if (instr.Op.T2.First <= *cur && *cur <= instr.Op.T2.Last) {
+      const byte slot = reinterpret_cast<const byte*>(t->PC + 1)[*cur - instr.Op.T2.First];
+      if (slot) {
+        const uint32_t indexWords = (instr.Op.T2.Last - instr.Op.T2.First + 4) >> 2;
+        t->jump(base, *reinterpret_cast<const uint32_t*>(t->PC + indexWords + slot));
+        return true;
+      }
+    }
+    break;
+
   case BYTE_OP:
     if ((*cur == instr.Op.T1.Byte) ^ (instr.Op.T1.Flags & Instruction::NEGATE)) {
       t->advance(InstructionSize<BYTE_OP>::VAL);
@@ -217,6 +230,13 @@ inline bool Vm::_execute(const Instruction* const base, ThreadList::iterator t,
     }
     break;
 
+  case BIT_VECTOR_POOL_OP:
+    if ((*reinterpret_cast<const ByteSet*>(t->PC + instr.Op.Offset))[*cur]) {
+      t->advance(InstructionSize<BIT_VECTOR_POOL_OP>::VAL);
+      return true;
+    }
+    break;
+
   case EITHER_OP:
     if ((*cur == instr.Op.T2.First || *cur == instr.Op.T2.Last) ^ (instr.Op.T2.Flags & Instruction::NEGATE)) {
       t->advance(InstructionSize<EITHER_OP>::VAL);
@@ -256,6 +276,37 @@ inline bool Vm::_liveCheck(const uint64_t start, const uint32_t label) const {
   }
 }
 
+inline bool Vm::_checkTaken(const uint32_t check, const uint32_t label) const {
+  if (!CheckLabels.find(check)) {
+    return false;
+  }
+  else if (CheckOwners[check] == label) {
+    return true;
+  }
+  else {
+    return !SharedChecks.empty() &&
+           SharedChecks.count((uint64_t(check) << 32) | label);
+  }
+}
+
+inline void Vm::_takeCheck(const uint32_t check, const uint32_t label) {
+  if (!CheckLabels.find(check)) {
+    CheckLabels.insert(check);
+    CheckOwners[check] = label;
+  }
+  else {
+    SharedChecks.insert((uint64_t(check) << 32) | label);
+  }
+}
+
+inline bool Vm::_loopTaken(const uint32_t loop, const uint32_t count, const uint32_t label) const {
+  return !LoopChecks.empty() && LoopChecks.count(LoopKey{loop, count, label});
+}
+
+inline void Vm::_takeLoop(const uint32_t loop, const uint32_t count, const uint32_t label) {
+  LoopChecks.insert(LoopKey{loop, count, label});
+}
+
 // while base is always == &Program[0], we pass it in because it then should get inlined away
 template <uint32_t X>
 inline bool Vm::_executeEpsilon(const Instruction* const base, ThreadList::iterator t, const uint64_t offset) {
@@ -337,16 +388,73 @@ inline bool Vm::_executeEpsilon(const Instruction* const base, ThreadList::itera
     t->jump(base, *reinterpret_cast<const uint32_t* const>(t->PC+1));
     return true;
 
+  case COUNT_LOOP_OP:
+    {
+      // the thread has just consumed a byte of a counted repetition
+      const uint32_t count = t->Count + 1u;
+      const uint32_t max = *reinterpret_cast<const uint32_t*>(t->PC+1);
+      const uint32_t body = *reinterpret_cast<const uint32_t*>(t->PC+2);
+
+      if (count < max) {
+        const uint32_t loop = t->PC - base;
+        if (_loopTaken(loop, count, t->Label)) {
+          // another thread with our label has gone around with our count,
+          // so going around again would only repeat it
+          if (count < instr.Op.Offset) {
+            t->PC = 0;
+            return false;
+          }
+        }
+        else {
+          if (!_liveCheck(t->Start, t->Label)) {
+            // nothing blocks us, we take the lock
+            _takeLoop(loop, count, t->Label);
+          }
+
+          if (count < instr.Op.Offset) {
+            // too few bytes to leave yet, go around again
+            t->Count = count;
+            t->jump(base, body);
+            return true;
+          }
+
+          // the repetition is greedy, so going around again has priority
+          Thread f = *t;
+          t->Count = count;
+          t->jump(base, body);
+
+          if (_executeEpSequence<X == 0 ? 0 : X-1>(base, t, offset)) {
+            _markLive(t->Label);
+            Next.push_back(*t);
+          }
+
+          // the leaving child takes the parent's place in Active, as for FORK
+          *t = f;
+
+          #ifdef LBT_TRACE_ENABLED
+          new_thread_json.insert(t->Id = NextId++);
+          #endif
+        }
+      }
+
+      // leave the repetition; threads outside one always have Count 0,
+      // so threads leaving at the same offset are equivalent and the
+      // CheckHalt which follows keeps only the first
+      t->Count = 0;
+      t->advance(InstructionSize<COUNT_LOOP_OP>::VAL);
+      return true;
+    }
+
   case CHECK_HALT_OP:
     {
-      if (CheckLabels.find(instr.Op.Offset)) {
-        // another thread has the lock, we die
+      if (_checkTaken(instr.Op.Offset, t->Label)) {
+        // another thread with our label has the lock, we die
         t->PC = 0;
         return false;
       }
       else if (!_liveCheck(t->Start, t->Label)) {
         // nothing blocks us, we take the lock
-        CheckLabels.insert(instr.Op.Offset);
+        _takeCheck(instr.Op.Offset, t->Label);
       }
 
       t->advance(InstructionSize<CHECK_HALT_OP>::VAL);
@@ -495,6 +603,12 @@ inline void Vm::_cleanup() {
   Next.clear();
 
   CheckLabels.clear();
+  if (!SharedChecks.empty()) {
+    SharedChecks.clear();
+  }
+  if (!LoopChecks.empty()) {
+    LoopChecks.clear();
+  }
 
   LiveNoLabel = false;
   Live.clear();
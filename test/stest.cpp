@@ -74,9 +74,9 @@ void STest::init(const std::vector<Pattern>& pats) {
     ++i;
   }
 
-  LG_ProgramOptions progOpts{1};
+  LG_ProgramOptions progOpts{1, 0, 0};
 
-  if (lg_compile_program(fsm.get(), Prog.get(), &progOpts)) {
+  if (lg_compile_program(fsm.get(), Prog.get(), &progOpts, nullptr)) {
     LG_ContextOptions ctxOpts;
 
     Ctx = std::unique_ptr<ContextHandle,void(*)(ContextHandle*)>(
@@ -21,12 +21,25 @@
 #include "lightgrep/api.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 #include <iostream>
 
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#include "handles.h"
 #include "pattern_map.h"
+#include "program.h"
 
 // #include "basic.h"
 
@@ -45,6 +58,8 @@ SCOPE_TEST(testDedupeOnDiffEncodings) {
 
   LG_ProgramOptions progOpts;
   progOpts.Determinize = 1;
+  progOpts.ShareSuffixes = 0;
+  progOpts.Threads = 0;
 
   std::shared_ptr<ProgramHandle> prog(
     lg_create_program(parser.get(), &progOpts),
@@ -223,8 +238,8 @@ SCOPE_TEST(testLgWriteProgramLgReadProgram) {
     std::unique_ptr<LG_Error,void(*)(LG_Error*)> e{err, lg_free_error};
     SCOPE_ASSERT(!err);
 
-    LG_ProgramOptions progOpts{1};
-    int ret = lg_compile_program(fsm.get(), prog1.get(), &progOpts);
+    LG_ProgramOptions progOpts{1, 0, 0};
+    int ret = lg_compile_program(fsm.get(), prog1.get(), &progOpts, nullptr);
     SCOPE_ASSERT(ret);
   }
 
@@ -278,3 +293,1056 @@ SCOPE_TEST(testLgWriteProgramLgReadProgram) {
     );
   }
 }
+
+namespace {
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> compileList(const char* pats, const char** defEncs, size_t defEncsNum, const LG_KeyOptions& defOpts, const LG_ProgramOptions& progOpts) {
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+      lg_create_program(0),
+      lg_destroy_program
+    );
+
+    std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+      lg_create_fsm(0),
+      lg_destroy_fsm
+    );
+
+    LG_Error* err = nullptr;
+    lg_add_pattern_list(
+      fsm.get(), prog.get(), pats, "compileList",
+      defEncs, defEncsNum, &defOpts, &err
+    );
+
+    std::unique_ptr<LG_Error,void(*)(LG_Error*)> e{err, lg_free_error};
+    SCOPE_ASSERT(!err);
+    SCOPE_ASSERT(lg_compile_program(fsm.get(), prog.get(), &progOpts, nullptr));
+    return prog;
+  }
+}
+
+namespace {
+  // a path under the temporary directory which no other test run shares
+  std::filesystem::path tempPath(const std::string& name) {
+    std::random_device rd;
+    return std::filesystem::temp_directory_path() /
+           (name + '-' + std::to_string(rd()));
+  }
+}
+
+SCOPE_TEST(testLgStoreCachedProgramLgLoadCachedProgram) {
+  const std::filesystem::path dir(
+    tempPath("lg_test_program_cache")
+  );
+  std::filesystem::remove_all(dir);
+
+  const std::string dirStr(dir.string());
+  const LG_CacheOptions cacheOpts{dirStr.c_str(), 0};
+
+  const char* lists[] = {
+    "foo\tUTF-8,UTF-16LE\t0\t0\n"
+    "bar\tISO-8859-11,UTF-16BE\t0\t1\n",
+    "baz\n"
+  };
+  const size_t listsNum = std::extent<decltype(lists)>::value;
+
+  const char* defEncs[] = { "ASCII", "UTF-8" };
+  const size_t defEncsNum = std::extent<decltype(defEncs)>::value;
+  const LG_KeyOptions defOpts{0, 0, 1};
+  const LG_ProgramOptions progOpts{1, 0, 0};
+
+  // nothing cached yet
+  SCOPE_ASSERT(!lg_load_cached_program(
+    &cacheOpts, lists, listsNum, defEncs, defEncsNum, &defOpts, &progOpts
+  ));
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog1(
+    compileList(lists[0], defEncs, defEncsNum, defOpts, progOpts)
+  );
+
+  LG_Error* err = nullptr;
+  SCOPE_ASSERT(lg_store_cached_program(
+    &cacheOpts, prog1.get(), lists, listsNum,
+    defEncs, defEncsNum, &defOpts, &progOpts, &err
+  ));
+  SCOPE_ASSERT(!err);
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog2(
+    lg_load_cached_program(
+      &cacheOpts, lists, listsNum, defEncs, defEncsNum, &defOpts, &progOpts
+    ),
+    lg_destroy_program
+  );
+
+  SCOPE_ASSERT(prog2);
+  SCOPE_ASSERT_EQUAL(lg_program_size(prog1.get()), lg_program_size(prog2.get()));
+
+  const size_t p1count = lg_pattern_count(prog1.get());
+  SCOPE_ASSERT_EQUAL(p1count, lg_pattern_count(prog2.get()));
+  for (size_t i = 0; i < p1count; ++i) {
+    SCOPE_ASSERT_EQUAL(
+      *lg_pattern_info(prog1.get(), i),
+      *lg_pattern_info(prog2.get(), i)
+    );
+  }
+
+  // omitted columns are filled in from the defaults before keying
+  const char* explicitLists[] = {
+    "foo\tUTF-8,UTF-16LE\t0\t0\t1\n"
+    "bar\tISO-8859-11,UTF-16BE\t0\t1\t1\n",
+    "baz\tASCII,UTF-8\t0\t0\t1\n"
+  };
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog3(
+    lg_load_cached_program(
+      &cacheOpts, explicitLists, listsNum,
+      defEncs, defEncsNum, &defOpts, &progOpts
+    ),
+    lg_destroy_program
+  );
+
+  SCOPE_ASSERT(prog3);
+
+  // different options are a different key
+  const LG_ProgramOptions nfaOpts{0, 0, 0};
+  SCOPE_ASSERT(!lg_load_cached_program(
+    &cacheOpts, lists, listsNum, defEncs, defEncsNum, &defOpts, &nfaOpts
+  ));
+
+  const LG_ProgramOptions shareOpts{1, 1, 0};
+  SCOPE_ASSERT(!lg_load_cached_program(
+    &cacheOpts, lists, listsNum, defEncs, defEncsNum, &defOpts, &shareOpts
+  ));
+
+  const LG_KeyOptions ciOpts{0, 1, 1};
+  SCOPE_ASSERT(!lg_load_cached_program(
+    &cacheOpts, lists, listsNum, defEncs, defEncsNum, &ciOpts, &progOpts
+  ));
+
+  // moving a line to another list changes its pattern index
+  const char* mergedLists[] = {
+    "foo\tUTF-8,UTF-16LE\t0\t0\n"
+    "bar\tISO-8859-11,UTF-16BE\t0\t1\n"
+    "baz\n"
+  };
+  SCOPE_ASSERT(!lg_load_cached_program(
+    &cacheOpts, mergedLists, 1, defEncs, defEncsNum, &defOpts, &progOpts
+  ));
+
+  std::filesystem::remove_all(dir);
+}
+
+SCOPE_TEST(testLgStoreCachedProgramEviction) {
+  const std::filesystem::path dir(
+    tempPath("lg_test_program_cache_evict")
+  );
+  std::filesystem::remove_all(dir);
+
+  const std::string dirStr(dir.string());
+
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 1};
+  const LG_ProgramOptions progOpts{1, 0, 0};
+
+  const char* lists1[] = { "foo\n" };
+  const char* lists2[] = { "bar\n" };
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog1(
+    compileList(lists1[0], defEncs, 1, defOpts, progOpts)
+  );
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog2(
+    compileList(lists2[0], defEncs, 1, defOpts, progOpts)
+  );
+
+  const LG_CacheOptions unbounded{dirStr.c_str(), 0};
+  SCOPE_ASSERT(lg_store_cached_program(
+    &unbounded, prog1.get(), lists1, 1, defEncs, 1, &defOpts, &progOpts, nullptr
+  ));
+
+  // make the first program clearly the least recently used
+  for (const auto& e : std::filesystem::directory_iterator(dir)) {
+    std::filesystem::last_write_time(
+      e.path(), e.last_write_time() - std::chrono::hours(1)
+    );
+  }
+
+  // room for only one program
+  std::uintmax_t size = 0;
+  for (const auto& e : std::filesystem::directory_iterator(dir)) {
+    size += e.file_size();
+  }
+
+  const LG_CacheOptions bounded{dirStr.c_str(), size + size / 2};
+  SCOPE_ASSERT(lg_store_cached_program(
+    &bounded, prog2.get(), lists2, 1, defEncs, 1, &defOpts, &progOpts, nullptr
+  ));
+
+  SCOPE_ASSERT(!lg_load_cached_program(
+    &bounded, lists1, 1, defEncs, 1, &defOpts, &progOpts
+  ));
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog3(
+    lg_load_cached_program(&bounded, lists2, 1, defEncs, 1, &defOpts, &progOpts),
+    lg_destroy_program
+  );
+  SCOPE_ASSERT(prog3);
+
+  std::filesystem::remove_all(dir);
+}
+
+SCOPE_TEST(testLgMapProgram) {
+  const char* defEncs[] = { "ASCII", "UTF-8" };
+  const LG_KeyOptions defOpts{0, 0, 1};
+  const LG_ProgramOptions progOpts{1, 0, 0};
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog1(
+    compileList("foo\tUTF-8,UTF-16LE\nbar\n", defEncs, 2, defOpts, progOpts)
+  );
+
+  const size_t psize = lg_program_size(prog1.get());
+  std::unique_ptr<char[]> buf(new char[psize]);
+  lg_write_program(prog1.get(), buf.get());
+
+  const std::filesystem::path path(
+    tempPath("lg_test_map_program").replace_extension(".lgp")
+  );
+
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write(buf.get(), psize);
+  }
+
+  LG_Error* err = nullptr;
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog2(
+    lg_map_program(path.string().c_str(), &err),
+    lg_destroy_program
+  );
+
+  SCOPE_ASSERT(!err);
+  SCOPE_ASSERT(prog2);
+  SCOPE_ASSERT_EQUAL(*prog1->Prog, *prog2->Prog);
+  SCOPE_ASSERT_EQUAL(*prog1->PMap, *prog2->PMap);
+
+  SCOPE_ASSERT(lg_verify_program(buf.get(), psize, &err));
+  SCOPE_ASSERT(!err);
+
+  // a flipped bit is caught by the checksum, when asked for
+  buf[psize - 2] ^= 0x10;
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write(buf.get(), psize);
+  }
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog3(
+    lg_map_program(path.string().c_str(), &err),
+    lg_destroy_program
+  );
+
+  SCOPE_ASSERT(!err);
+  SCOPE_ASSERT(prog3);
+
+  SCOPE_ASSERT(!lg_verify_program(buf.get(), psize, &err));
+  SCOPE_ASSERT(err);
+  SCOPE_ASSERT_EQUAL(std::string("Program file checksum mismatch"), err->Message);
+  lg_free_error(err);
+
+  // and so is truncation
+  SCOPE_ASSERT(!lg_read_program(buf.get(), psize - 1));
+
+  std::filesystem::remove(path);
+}
+
+SCOPE_TEST(testLgReadProgramLegacyFormat) {
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 1};
+  const LG_ProgramOptions progOpts{1, 0, 0};
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog1(
+    compileList("foo\nbar\n", defEncs, 1, defOpts, progOpts)
+  );
+
+  // the unversioned layout: sized pattern map, then sized program
+  const std::vector<char> pmap(prog1->PMap->marshall());
+  const std::vector<char> prog(prog1->Prog->marshall());
+  const uint64_t pmapSize = pmap.size(), progSize = prog.size();
+
+  std::vector<char> buf;
+  buf.insert(buf.end(), reinterpret_cast<const char*>(&pmapSize), reinterpret_cast<const char*>(&pmapSize) + sizeof(pmapSize));
+  buf.insert(buf.end(), pmap.begin(), pmap.end());
+  buf.insert(buf.end(), reinterpret_cast<const char*>(&progSize), reinterpret_cast<const char*>(&progSize) + sizeof(progSize));
+  buf.insert(buf.end(), prog.begin(), prog.end());
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog2(
+    lg_read_program(buf.data(), buf.size()),
+    lg_destroy_program
+  );
+
+  SCOPE_ASSERT(prog2);
+  SCOPE_ASSERT_EQUAL(*prog1->Prog, *prog2->Prog);
+  SCOPE_ASSERT_EQUAL(*prog1->PMap, *prog2->PMap);
+
+  // a truncated buffer is refused rather than read past its end
+  for (size_t len = 0; len < buf.size(); ++len) {
+    SCOPE_ASSERT(!lg_read_program(buf.data(), len));
+  }
+
+  // as is garbage
+  const std::vector<char> garbage(64, '\xFF');
+  SCOPE_ASSERT(!lg_read_program(garbage.data(), garbage.size()));
+}
+
+SCOPE_TEST(testLgAddPatternListFixedStringsMatchParsedPatterns) {
+  const char* pats[] = {
+    "abc", "abd", "ab", "xabc", "Straße", "aBc", "k", "s.t", "abc"
+  };
+  const bool ci[] = { 0, 0, 0, 0, 1, 1, 1, 0, 1 };
+  const char* encs[] = { "UTF-8", "UTF-16LE" };
+
+  std::string list;
+  for (uint32_t i = 0; i < std::extent<decltype(pats)>::value; ++i) {
+    list += std::string(pats[i]) + "\tUTF-8,UTF-16LE\t1\t" +
+            (ci[i] ? "1" : "0") + "\t0\n";
+  }
+
+  // the fixed-string path, via the pattern list
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> fprog(
+    lg_create_program(0), lg_destroy_program
+  );
+  std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> ffsm(
+    lg_create_fsm(0), lg_destroy_fsm
+  );
+
+  const LG_KeyOptions defOpts{1, 0, 0};
+  LG_Error* err = nullptr;
+  lg_add_pattern_list(
+    ffsm.get(), fprog.get(), list.c_str(), "fixed", encs, 2, &defOpts, &err
+  );
+  SCOPE_ASSERT(!err);
+
+  // the parser path, one pattern at a time
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> pprog(
+    lg_create_program(0), lg_destroy_program
+  );
+  std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> pfsm(
+    lg_create_fsm(0), lg_destroy_fsm
+  );
+  std::unique_ptr<PatternHandle,void(*)(PatternHandle*)> pat(
+    lg_create_pattern(), lg_destroy_pattern
+  );
+
+  for (uint32_t i = 0; i < std::extent<decltype(pats)>::value; ++i) {
+    const LG_KeyOptions opts{1, ci[i], 0};
+    SCOPE_ASSERT(lg_parse_pattern(pat.get(), pats[i], &opts, &err));
+    for (const char* enc : encs) {
+      SCOPE_ASSERT(lg_add_pattern(pfsm.get(), pprog.get(), pat.get(), enc, i, &err) >= 0);
+    }
+  }
+
+  const NFA& fg(*ffsm->Impl->Fsm);
+  const NFA& pg(*pfsm->Impl->Fsm);
+
+  SCOPE_ASSERT_EQUAL(pg.verticesSize(), fg.verticesSize());
+  SCOPE_ASSERT_EQUAL(pg.Deterministic, fg.Deterministic);
+
+  for (uint32_t v = 0; v < pg.verticesSize(); ++v) {
+    SCOPE_ASSERT_EQUAL(pg[v].IsMatch, fg[v].IsMatch);
+    SCOPE_ASSERT_EQUAL(pg[v].Label, fg[v].Label);
+    SCOPE_ASSERT_EQUAL(!pg[v].Trans, !fg[v].Trans);
+    if (pg[v].Trans) {
+      SCOPE_ASSERT_EQUAL(pg[v].Trans->bytes(), fg[v].Trans->bytes());
+    }
+
+    SCOPE_ASSERT_EQUAL(pg.outDegree(v), fg.outDegree(v));
+    for (uint32_t o = 0; o < pg.outDegree(v); ++o) {
+      SCOPE_ASSERT_EQUAL(pg.outVertex(v, o), fg.outVertex(v, o));
+    }
+  }
+
+  const LG_ProgramOptions progOpts{1, 0, 0};
+  SCOPE_ASSERT(lg_compile_program(ffsm.get(), fprog.get(), &progOpts, nullptr));
+  SCOPE_ASSERT(lg_compile_program(pfsm.get(), pprog.get(), &progOpts, nullptr));
+  SCOPE_ASSERT(*pprog->Prog == *fprog->Prog);
+  SCOPE_ASSERT_EQUAL(lg_pattern_count(pprog.get()), lg_pattern_count(fprog.get()));
+}
+
+namespace {
+  void collectHits(void* userData, const LG_SearchHit* const hit) {
+    static_cast<std::vector<std::tuple<uint64_t,uint64_t,uint32_t>>*>(userData)->emplace_back(hit->Start, hit->End, hit->KeywordIndex);
+  }
+
+  struct Shared {
+    uint64_t Vertices, Instructions, UnsharedVertices, UnsharedInstructions;
+    std::vector<std::tuple<uint64_t,uint64_t,uint32_t>> Hits;
+  };
+
+  Shared compileShared(const char* pats, const char* text, bool share) {
+    const char* defEncs[] = { "ASCII" };
+    const LG_KeyOptions defOpts{0, 0, 0};
+
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+      lg_create_program(0), lg_destroy_program
+    );
+    std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+      lg_create_fsm(0), lg_destroy_fsm
+    );
+
+    LG_Error* err = nullptr;
+    lg_add_pattern_list(
+      fsm.get(), prog.get(), pats, "share", defEncs, 1, &defOpts, &err
+    );
+    SCOPE_ASSERT(!err);
+
+    const LG_ProgramOptions progOpts{0, char(share), 0};
+    SCOPE_ASSERT(lg_compile_program(fsm.get(), prog.get(), &progOpts, nullptr));
+
+    Shared ret{
+      fsm->Impl->Frozen->verticesSize(), prog->Prog->size(),
+      fsm->Impl->UnsharedVertices, fsm->Impl->UnsharedInstructions, {}
+    };
+
+    const LG_ContextOptions ctxOpts{0, 0};
+    std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+      lg_create_context(prog.get(), &ctxOpts), lg_destroy_context
+    );
+    lg_search(ctx.get(), text, text + std::strlen(text), 0, &ret.Hits, collectHits);
+    lg_closeout_search(ctx.get(), &ret.Hits, collectHits);
+    std::sort(ret.Hits.begin(), ret.Hits.end());
+    return ret;
+  }
+}
+
+SCOPE_TEST(testLgCompileProgramShareSuffixes) {
+  // both branches end in "b+", which the NFA repeats for each
+  const char* pats = "x(ab+|cb+)\nzz\n";
+  const char* text = "xabb xcb zzz xab";
+
+  const Shared plain = compileShared(pats, text, false),
+               shared = compileShared(pats, text, true);
+
+  SCOPE_ASSERT_EQUAL(plain.Vertices, shared.UnsharedVertices);
+  SCOPE_ASSERT_EQUAL(plain.Instructions, shared.UnsharedInstructions);
+  SCOPE_ASSERT(shared.Vertices < plain.Vertices);
+  SCOPE_ASSERT(shared.Instructions < plain.Instructions);
+
+  SCOPE_ASSERT_EQUAL(4u, plain.Hits.size());
+  SCOPE_ASSERT(plain.Hits == shared.Hits);
+}
+
+SCOPE_TEST(testLgCompileProgramShareSuffixesAcrossPatterns) {
+  // the patterns differ only before ".com" or ".exe"
+  const char* pats = "foo\\.com\nbar\\.com\nbaz\\.com\nquux\\.exe\nzork\\.exe\n";
+  const char* text = "foo.com bar.exe quux.exe baz.com zork.com";
+
+  const Shared plain = compileShared(pats, text, false),
+               shared = compileShared(pats, text, true);
+
+  SCOPE_ASSERT_EQUAL(plain.Vertices, shared.UnsharedVertices);
+  SCOPE_ASSERT(shared.Vertices < plain.Vertices);
+  SCOPE_ASSERT(shared.Instructions < plain.Instructions);
+
+  SCOPE_ASSERT_EQUAL(3u, plain.Hits.size());
+  SCOPE_ASSERT(plain.Hits == shared.Hits);
+}
+
+SCOPE_TEST(testLgCompileProgramShareSuffixesOverlappingHits) {
+  // threads of both patterns reach the shared ".com" at the same offset
+  const char* pats = "ba\\.com\na\\.com\n";
+  const char* text = "ba.com a.com";
+
+  const Shared plain = compileShared(pats, text, false),
+               shared = compileShared(pats, text, true);
+
+  SCOPE_ASSERT(shared.Vertices < plain.Vertices);
+
+  SCOPE_ASSERT_EQUAL(3u, plain.Hits.size());
+  SCOPE_ASSERT(plain.Hits == shared.Hits);
+}
+
+SCOPE_TEST(testLgCompileProgramClampsThreads) {
+  // an absurd thread count is held to the number of cores
+  const char* pats = "a+b\nab?c\n(ab|ac)*d\n[a-d]{2,5}x\n\\w+z\n";
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 0};
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> seq(
+    compileList(pats, defEncs, 1, defOpts, LG_ProgramOptions{1, 0, 0})
+  );
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> par(
+    compileList(pats, defEncs, 1, defOpts, LG_ProgramOptions{1, 0, 0xFFFFFFFF})
+  );
+
+  SCOPE_ASSERT_EQUAL(*seq->Prog, *par->Prog);
+}
+
+namespace {
+  std::vector<std::tuple<uint64_t,uint64_t,uint32_t>> searchAll(ProgramHandle* prog, const char* text) {
+    std::vector<std::tuple<uint64_t,uint64_t,uint32_t>> hits;
+
+    const LG_ContextOptions ctxOpts{0, 0};
+    std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+      lg_create_context(prog, &ctxOpts), lg_destroy_context
+    );
+    lg_search(ctx.get(), text, text + std::strlen(text), 0, &hits, collectHits);
+    lg_closeout_search(ctx.get(), &hits, collectHits);
+
+    std::sort(hits.begin(), hits.end());
+    return hits;
+  }
+}
+
+SCOPE_TEST(testLgLinkPrograms) {
+  // between them, these use jump tables, pooled byte sets, counted
+  // repetitions, and checked states
+  const char* pats[] = {
+    "foo\nba[rz]+\n[a-f0-9]{3}x\n",
+    "bar\nqu+x\n(ab|cd)e{2,300}\n[^a]oo\n"
+  };
+  const char* text = "foobarbazz 0a9x quux abeee cdee xoo barfoo";
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 0};
+
+  for (const char det : { 0, 1 }) {
+    const LG_ProgramOptions progOpts{det, 0, 0};
+
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> a(
+      compileList(pats[0], defEncs, 1, defOpts, progOpts)
+    );
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> b(
+      compileList(pats[1], defEncs, 1, defOpts, progOpts)
+    );
+
+    const LG_HPROGRAM progs[] = { a.get(), b.get() };
+    LG_Error* err = nullptr;
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> linked(
+      lg_link_programs(progs, 2, &err), lg_destroy_program
+    );
+    std::unique_ptr<LG_Error,void(*)(LG_Error*)> e{err, lg_free_error};
+    SCOPE_ASSERT(!err);
+    SCOPE_ASSERT(linked);
+
+    // b's patterns follow a's
+    const unsigned int acount = lg_pattern_count(a.get());
+    SCOPE_ASSERT_EQUAL(acount + lg_pattern_count(b.get()), lg_pattern_count(linked.get()));
+    SCOPE_ASSERT_EQUAL(*lg_pattern_info(a.get(), 1), *lg_pattern_info(linked.get(), 1));
+    SCOPE_ASSERT_EQUAL(*lg_pattern_info(b.get(), 2), *lg_pattern_info(linked.get(), acount + 2));
+
+    // one pass with the linked program finds what a pass with each does
+    std::vector<std::tuple<uint64_t,uint64_t,uint32_t>> expected(searchAll(a.get(), text));
+    for (const auto& h : searchAll(b.get(), text)) {
+      expected.emplace_back(std::get<0>(h), std::get<1>(h), std::get<2>(h) + acount);
+    }
+    std::sort(expected.begin(), expected.end());
+
+    SCOPE_ASSERT_EQUAL(14u, expected.size());
+    SCOPE_ASSERT(expected == searchAll(linked.get(), text));
+  }
+}
+
+SCOPE_TEST(testLgLinkProgramsUncompiled) {
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    lg_create_program(0), lg_destroy_program
+  );
+
+  const LG_HPROGRAM progs[] = { prog.get() };
+  LG_Error* err = nullptr;
+  SCOPE_ASSERT(!lg_link_programs(progs, 1, &err));
+
+  std::unique_ptr<LG_Error,void(*)(LG_Error*)> e{err, lg_free_error};
+  SCOPE_ASSERT(err);
+  SCOPE_ASSERT_EQUAL(std::string("Program 0 is not compiled"), err->Message);
+}
+
+SCOPE_TEST(testLgAddPatternDuplicates) {
+  // lines 2 and 4 repeat line 0, and line 3 repeats line 1 as a fixed
+  // string; "foo" in another encoding is no duplicate
+  const char* pats = "foo\nba[rz]\nfoo\nba[rz]\tASCII\t1\nfoo\nfoo\tUTF-16LE\n";
+  const char* uniq = "foo\nba[rz]\nba[rz]\tASCII\t1\nfoo\tUTF-16LE\n";
+  const char* text = "foo bar baz ba[rz]";
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 0};
+  const LG_ProgramOptions progOpts{1, 0, 0};
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    compileList(pats, defEncs, 1, defOpts, progOpts)
+  );
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> uprog(
+    compileList(uniq, defEncs, 1, defOpts, progOpts)
+  );
+
+  // the duplicates cost the program nothing
+  SCOPE_ASSERT_EQUAL(6u, lg_pattern_count(prog.get()));
+  SCOPE_ASSERT_EQUAL(3u, prog->Prog->MaxLabel);
+  SCOPE_ASSERT_EQUAL(uprog->Prog->size(), prog->Prog->size());
+
+  // each hit is reported for every pattern
+  const std::vector<std::tuple<uint64_t,uint64_t,uint32_t>> expected{
+    std::make_tuple(0, 3, 0), std::make_tuple(0, 3, 2), std::make_tuple(0, 3, 4),
+    std::make_tuple(4, 7, 1), std::make_tuple(8, 11, 1), std::make_tuple(12, 18, 3)
+  };
+  SCOPE_ASSERT(expected == searchAll(prog.get(), text));
+
+  // the labels survive writing and reading the program
+  const unsigned int psize = lg_program_size(prog.get());
+  std::unique_ptr<uint64_t[]> buf(new uint64_t[(psize + 7) / 8]);
+  lg_write_program(prog.get(), buf.get());
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog2(
+    lg_read_program(buf.get(), psize), lg_destroy_program
+  );
+  SCOPE_ASSERT(prog2);
+  SCOPE_ASSERT(*prog->PMap == *prog2->PMap);
+  SCOPE_ASSERT(expected == searchAll(prog2.get(), text));
+
+  // and linking
+  const LG_HPROGRAM progs[] = { uprog.get(), prog.get() };
+  LG_Error* err = nullptr;
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> linked(
+    lg_link_programs(progs, 2, &err), lg_destroy_program
+  );
+  std::unique_ptr<LG_Error,void(*)(LG_Error*)> e{err, lg_free_error};
+  SCOPE_ASSERT(!err);
+
+  std::vector<std::tuple<uint64_t,uint64_t,uint32_t>> lexpected(searchAll(uprog.get(), text));
+  for (const auto& h : expected) {
+    lexpected.emplace_back(std::get<0>(h), std::get<1>(h), std::get<2>(h) + 4);
+  }
+  std::sort(lexpected.begin(), lexpected.end());
+  SCOPE_ASSERT(lexpected == searchAll(linked.get(), text));
+}
+
+SCOPE_TEST(testLgAddPatternDuplicateAliases) {
+  // US-ASCII is an alias of ASCII, and fixed strings matched regardless
+  // of case are duplicates when they differ only in case
+  const char* pats = "foo\tASCII\nfoo\tUS-ASCII\n\xC3\x84rger\tUTF-8\t1\t1\n\xC3\xA4RGER\tUTF-8\t1\t1\nAerger\tUTF-8\t1\t1\n";
+  const char* text = "foo \xC3\x84RGER aerger";
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 0};
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    compileList(pats, defEncs, 1, defOpts, LG_ProgramOptions{1, 0, 0})
+  );
+
+  SCOPE_ASSERT_EQUAL(5u, lg_pattern_count(prog.get()));
+  SCOPE_ASSERT_EQUAL(3u, prog->PMap->numLabels());
+
+  const std::vector<std::tuple<uint64_t,uint64_t,uint32_t>> expected{
+    std::make_tuple(0, 3, 0), std::make_tuple(0, 3, 1),
+    std::make_tuple(4, 10, 2), std::make_tuple(4, 10, 3),
+    std::make_tuple(11, 17, 4)
+  };
+  SCOPE_ASSERT(expected == searchAll(prog.get(), text));
+}
+
+SCOPE_TEST(testLgAddPatternDuplicateIndex) {
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    lg_create_program(0), lg_destroy_program
+  );
+  std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+    lg_create_fsm(0), lg_destroy_fsm
+  );
+  std::unique_ptr<PatternHandle,void(*)(PatternHandle*)> pat(
+    lg_create_pattern(), lg_destroy_pattern
+  );
+
+  const LG_KeyOptions opts{0, 0, 0};
+  SCOPE_ASSERT(lg_parse_pattern(pat.get(), "a+b", &opts, nullptr));
+
+  // a duplicate still gets its own index
+  for (int i = 0; i < 3; ++i) {
+    SCOPE_ASSERT_EQUAL(i, lg_add_pattern(fsm.get(), prog.get(), pat.get(), "ASCII", 7 + i, nullptr));
+  }
+
+  SCOPE_ASSERT_EQUAL(1u, prog->PMap->numLabels());
+  SCOPE_ASSERT_EQUAL(9u, lg_pattern_info(prog.get(), 2)->UserIndex);
+}
+
+namespace {
+  struct ProgressLog {
+    std::vector<std::tuple<LG_CompilePhase,uint64_t,uint64_t>> Calls;
+    LG_CompilePhase CancelIn = LG_PHASE_COUNT;
+  };
+
+  int logProgress(void* userData, LG_CompilePhase phase, uint64_t done, uint64_t total) {
+    ProgressLog* log = static_cast<ProgressLog*>(userData);
+    log->Calls.emplace_back(phase, done, total);
+    return phase == log->CancelIn;
+  }
+}
+
+SCOPE_TEST(testLgSetCompileObserver) {
+  const char* pats = "a+b\nfoo\nba[rz]\n";
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 0};
+  const LG_ProgramOptions progOpts{1, 0, 0};
+
+  ProgressLog log;
+  LG_CompileObserver observer{logProgress, &log, {}};
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    lg_create_program(0), lg_destroy_program
+  );
+  std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+    lg_create_fsm(0), lg_destroy_fsm
+  );
+  lg_set_compile_observer(fsm.get(), &observer);
+
+  LG_Error* err = nullptr;
+  lg_add_pattern_list(
+    fsm.get(), prog.get(), pats, "observer", defEncs, 1, &defOpts, &err
+  );
+  SCOPE_ASSERT(!err);
+
+  // a call per pattern, and one at the end
+  SCOPE_ASSERT_EQUAL(4u, log.Calls.size());
+  for (uint32_t i = 0; i < 4; ++i) {
+    SCOPE_ASSERT(std::make_tuple(LG_PHASE_MERGE, uint64_t(i), uint64_t(3)) == log.Calls[i]);
+  }
+
+  log.Calls.clear();
+  SCOPE_ASSERT(lg_compile_program(fsm.get(), prog.get(), &progOpts, nullptr));
+
+  // each whole-graph phase reports its start and end, in order
+  const LG_CompilePhase phases[] = {
+    LG_PHASE_DETERMINIZE, LG_PHASE_MINIMIZE, LG_PHASE_GUARDS,
+    LG_PHASE_FILTER, LG_PHASE_CODEGEN
+  };
+
+  SCOPE_ASSERT_EQUAL(10u, log.Calls.size());
+  for (uint32_t i = 0; i < 5; ++i) {
+    SCOPE_ASSERT_EQUAL(phases[i], std::get<0>(log.Calls[2*i]));
+    SCOPE_ASSERT_EQUAL(0u, std::get<1>(log.Calls[2*i]));
+    SCOPE_ASSERT_EQUAL(phases[i], std::get<0>(log.Calls[2*i+1]));
+    SCOPE_ASSERT_EQUAL(std::get<2>(log.Calls[2*i+1]), std::get<1>(log.Calls[2*i+1]));
+  }
+
+  for (uint32_t i = 0; i < LG_PHASE_COUNT; ++i) {
+    SCOPE_ASSERT(observer.Stats.Seconds[i] > 0.0);
+  }
+
+  SCOPE_ASSERT_EQUAL(std::string("determinize"), lg_compile_phase_name(LG_PHASE_DETERMINIZE));
+}
+
+SCOPE_TEST(testLgSetCompileObserverCancel) {
+  const char* pats = "a+b\nfoo\nba[rz]\n";
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 0};
+  const LG_ProgramOptions progOpts{1, 0, 0};
+
+  for (LG_CompilePhase cancel : { LG_PHASE_MERGE, LG_PHASE_DETERMINIZE, LG_PHASE_CODEGEN }) {
+    ProgressLog log;
+    log.CancelIn = cancel;
+    LG_CompileObserver observer{logProgress, &log, {}};
+
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+      lg_create_program(0), lg_destroy_program
+    );
+    std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+      lg_create_fsm(0), lg_destroy_fsm
+    );
+    lg_set_compile_observer(fsm.get(), &observer);
+
+    LG_Error* err = nullptr;
+    lg_add_pattern_list(
+      fsm.get(), prog.get(), pats, "cancel", defEncs, 1, &defOpts, &err
+    );
+
+    std::unique_ptr<LG_Error,void(*)(LG_Error*)> e{err, lg_free_error};
+    if (cancel == LG_PHASE_MERGE) {
+      SCOPE_ASSERT(err);
+      SCOPE_ASSERT_EQUAL(std::string("Compiling was cancelled"), err->Message);
+      // the first pattern was not added
+      SCOPE_ASSERT_EQUAL(0u, lg_pattern_count(prog.get()));
+    }
+    else {
+      SCOPE_ASSERT(!err);
+      SCOPE_ASSERT(!lg_compile_program(fsm.get(), prog.get(), &progOpts, &err));
+      SCOPE_ASSERT_EQUAL(cancel, std::get<0>(log.Calls.back()));
+
+      std::unique_ptr<LG_Error,void(*)(LG_Error*)> ce{err, lg_free_error};
+      SCOPE_ASSERT(err);
+      SCOPE_ASSERT_EQUAL(std::string("Compiling was cancelled"), err->Message);
+    }
+  }
+}
+
+SCOPE_TEST(testLgSetMemoryBudget) {
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 0};
+
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    lg_create_program(0), lg_destroy_program
+  );
+  std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+    lg_create_fsm(0), lg_destroy_fsm
+  );
+  lg_set_memory_budget(fsm.get(), 1);
+
+  LG_Error* err = nullptr;
+  SCOPE_ASSERT_EQUAL(-1, lg_add_pattern_list(
+    fsm.get(), prog.get(), "foo\nbar\n", "budget", defEncs, 1, &defOpts, &err
+  ));
+
+  std::unique_ptr<LG_Error,void(*)(LG_Error*)> e{err, lg_free_error};
+  SCOPE_ASSERT(err);
+  SCOPE_ASSERT(!err->Next);
+  SCOPE_ASSERT_EQUAL(
+    std::string("Compiling went over the memory budget of 1 bytes adding pattern 'foo'"),
+    err->Message
+  );
+  SCOPE_ASSERT_EQUAL(std::string("foo"), err->Pattern);
+  SCOPE_ASSERT_EQUAL(0, err->Index);
+  // adding stops at the pattern which went over
+  SCOPE_ASSERT_EQUAL(1u, lg_pattern_count(prog.get()));
+}
+
+SCOPE_TEST(testLgSetMemoryBudgetDeterminize) {
+  // the DFA for this has more than 4096 states, so the determinizer checks
+  // its budget while it runs
+  const char* pats = "(a|b)*a(a|b){12}\n";
+  const char* defEncs[] = { "ASCII" };
+  const LG_KeyOptions defOpts{0, 0, 0};
+  const LG_ProgramOptions progOpts{1, 0, 0};
+
+  for (uint64_t budget : { 0, 1 }) {
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+      lg_create_program(0), lg_destroy_program
+    );
+    std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+      lg_create_fsm(0), lg_destroy_fsm
+    );
+
+    LG_Error* err = nullptr;
+    lg_add_pattern_list(
+      fsm.get(), prog.get(), pats, "budget", defEncs, 1, &defOpts, &err
+    );
+    SCOPE_ASSERT(!err);
+
+    // leave room for the NFA, but not for the DFA
+    if (budget) {
+      budget = 2 * fsm->Impl->memoryUsage();
+      lg_set_memory_budget(fsm.get(), budget);
+    }
+
+    const int ret = lg_compile_program(fsm.get(), prog.get(), &progOpts, &err);
+    std::unique_ptr<LG_Error,void(*)(LG_Error*)> e{err, lg_free_error};
+    if (budget) {
+      SCOPE_ASSERT(!ret);
+      SCOPE_ASSERT(err);
+      SCOPE_ASSERT_EQUAL(
+        "Compiling went over the memory budget of " + std::to_string(budget) +
+        " bytes in the determinize phase",
+        err->Message
+      );
+    }
+    else {
+      SCOPE_ASSERT(ret);
+      SCOPE_ASSERT(!err);
+    }
+  }
+}
+
+namespace {
+  namespace bip = boost::interprocess;
+
+  const char RING_NAME[] = "lightgrep-test-ring";
+
+  typedef std::unique_ptr<RingHandle,void(*)(RingHandle*)> RingPtr;
+
+  void publish(LG_HRING ring, uint64_t id, uint64_t off, const std::string& data, uint32_t flags = 0) {
+    LG_RingSlot slot;
+    SCOPE_ASSERT(lg_ring_acquire(ring, &slot));
+    SCOPE_ASSERT(data.size() <= slot.Length);
+    std::memcpy(slot.Data, data.data(), data.size());
+    slot.StreamID = id;
+    slot.Offset = off;
+    slot.Length = data.size();
+    slot.Flags = flags;
+    SCOPE_ASSERT(lg_ring_publish(ring, &slot, nullptr));
+  }
+}
+
+SCOPE_TEST(testLgRingRoundTrip) {
+  LG_Error* err = nullptr;
+  RingPtr searcher(lg_create_ring(RING_NAME, 3, 100, &err), lg_destroy_ring);
+  SCOPE_ASSERT(!err);
+  SCOPE_ASSERT(searcher);
+
+  RingPtr producer(lg_open_ring(RING_NAME, &err), lg_destroy_ring);
+  SCOPE_ASSERT(!err);
+  SCOPE_ASSERT(producer);
+  SCOPE_ASSERT_EQUAL(100u, lg_ring_slot_size(producer.get()));
+
+  // go around the ring a few times
+  for (uint64_t i = 0; i < 10; ++i) {
+    publish(producer.get(), i % 2, i * 10, "slot " + std::to_string(i), i == 9 ? LG_RING_END_OF_STREAM : 0);
+
+    LG_RingSlot slot;
+    SCOPE_ASSERT(lg_ring_next(searcher.get(), &slot));
+    SCOPE_ASSERT_EQUAL(i, slot.Position);
+    SCOPE_ASSERT_EQUAL(i % 2, slot.StreamID);
+    SCOPE_ASSERT_EQUAL(i * 10, slot.Offset);
+    SCOPE_ASSERT_EQUAL("slot " + std::to_string(i), std::string(slot.Data, slot.Length));
+    SCOPE_ASSERT_EQUAL(i == 9 ? LG_RING_END_OF_STREAM : 0u, slot.Flags);
+    SCOPE_ASSERT(lg_ring_release(searcher.get(), &slot, nullptr));
+  }
+}
+
+SCOPE_TEST(testLgRingClose) {
+  RingPtr searcher(lg_create_ring(RING_NAME, 4, 10, nullptr), lg_destroy_ring);
+  RingPtr producer(lg_open_ring(RING_NAME, nullptr), lg_destroy_ring);
+  SCOPE_ASSERT(searcher);
+  SCOPE_ASSERT(producer);
+
+  publish(producer.get(), 1, 0, "one");
+
+  LG_RingSlot acquired;
+  SCOPE_ASSERT(lg_ring_acquire(producer.get(), &acquired));
+
+  lg_ring_close(producer.get());
+
+  LG_RingSlot slot;
+  SCOPE_ASSERT(!lg_ring_acquire(producer.get(), &slot));
+
+  // what was acquired before the ring closed can still be published
+  std::memcpy(acquired.Data, "two", 3);
+  acquired.StreamID = 1;
+  acquired.Offset = 3;
+  acquired.Length = 3;
+  acquired.Flags = LG_RING_END_OF_STREAM;
+  SCOPE_ASSERT(lg_ring_publish(producer.get(), &acquired, nullptr));
+
+  SCOPE_ASSERT(lg_ring_next(searcher.get(), &slot));
+  SCOPE_ASSERT_EQUAL("one", std::string(slot.Data, slot.Length));
+  SCOPE_ASSERT(lg_ring_release(searcher.get(), &slot, nullptr));
+
+  SCOPE_ASSERT(lg_ring_next(searcher.get(), &slot));
+  SCOPE_ASSERT_EQUAL("two", std::string(slot.Data, slot.Length));
+  SCOPE_ASSERT(lg_ring_release(searcher.get(), &slot, nullptr));
+
+  SCOPE_ASSERT(!lg_ring_next(searcher.get(), &slot));
+}
+
+SCOPE_TEST(testLgRingBadSlots) {
+  RingPtr ring(lg_create_ring(RING_NAME, 2, 10, nullptr), lg_destroy_ring);
+  SCOPE_ASSERT(ring);
+
+  LG_RingSlot slot;
+  SCOPE_ASSERT(lg_ring_acquire(ring.get(), &slot));
+
+  // a slot must be taken before it is released
+  LG_Error* err = nullptr;
+  SCOPE_ASSERT(!lg_ring_release(ring.get(), &slot, &err));
+  SCOPE_ASSERT(err);
+  SCOPE_ASSERT_EQUAL(std::string("ring slot was not taken"), err->Message);
+  lg_free_error(err);
+  err = nullptr;
+
+  slot.Length = 11;
+  SCOPE_ASSERT(!lg_ring_publish(ring.get(), &slot, &err));
+  SCOPE_ASSERT(err);
+  SCOPE_ASSERT_EQUAL(std::string("ring slot length exceeds the slot size"), err->Message);
+  lg_free_error(err);
+}
+
+SCOPE_TEST(testLgRingBadLength) {
+  RingPtr searcher(lg_create_ring(RING_NAME, 2, 10, nullptr), lg_destroy_ring);
+  RingPtr producer(lg_open_ring(RING_NAME, nullptr), lg_destroy_ring);
+  SCOPE_ASSERT(searcher);
+  SCOPE_ASSERT(producer);
+
+  publish(producer.get(), 1, 0, "one");
+
+  // a producer may scribble on a descriptor after publishing it; the
+  // first one follows the 320-byte header, with Length 24 bytes in
+  {
+    bip::shared_memory_object shm(bip::open_only, RING_NAME, bip::read_write);
+    bip::mapped_region region(shm, bip::read_write);
+    const uint32_t length = 11;
+    std::memcpy(static_cast<char*>(region.get_address()) + 320 + 24, &length, sizeof(length));
+  }
+
+  publish(producer.get(), 1, 3, "two");
+
+  // the bad slot is dropped, and given back to the producers
+  LG_RingSlot slot;
+  SCOPE_ASSERT(lg_ring_next(searcher.get(), &slot));
+  SCOPE_ASSERT_EQUAL(1u, slot.Position);
+  SCOPE_ASSERT_EQUAL("two", std::string(slot.Data, slot.Length));
+
+  LG_RingSlot again;
+  SCOPE_ASSERT(lg_ring_acquire(producer.get(), &again));
+  SCOPE_ASSERT_EQUAL(2u, again.Position);
+}
+
+SCOPE_TEST(testLgRingDeadProducer) {
+  RingPtr searcher(lg_create_ring(RING_NAME, 4, 10, nullptr), lg_destroy_ring);
+  RingPtr producer(lg_open_ring(RING_NAME, nullptr), lg_destroy_ring);
+  SCOPE_ASSERT(searcher);
+  SCOPE_ASSERT(producer);
+
+  // a producer acquires a slot and dies before publishing it, while
+  // another goes on
+  LG_RingSlot dead;
+  SCOPE_ASSERT(lg_ring_acquire(producer.get(), &dead));
+  publish(producer.get(), 1, 0, "one");
+
+  lg_ring_close(searcher.get());
+
+  // the searcher gives up on the dead slot, and takes the rest
+  const auto start = std::chrono::steady_clock::now();
+
+  LG_RingSlot slot;
+  SCOPE_ASSERT(lg_ring_next(searcher.get(), &slot));
+  SCOPE_ASSERT_EQUAL(1u, slot.Position);
+  SCOPE_ASSERT_EQUAL("one", std::string(slot.Data, slot.Length));
+  SCOPE_ASSERT(lg_ring_release(searcher.get(), &slot, nullptr));
+
+  SCOPE_ASSERT(!lg_ring_next(searcher.get(), &slot));
+  SCOPE_ASSERT(!lg_ring_next(searcher.get(), &slot));
+
+  SCOPE_ASSERT(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+}
+
+SCOPE_TEST(testLgOpenRingMissing) {
+  LG_Error* err = nullptr;
+  SCOPE_ASSERT(!lg_open_ring("lightgrep-test-no-such-ring", &err));
+  SCOPE_ASSERT(err);
+  lg_free_error(err);
+}
+
+SCOPE_TEST(testLgRingProducerThreads) {
+  RingPtr searcher(lg_create_ring(RING_NAME, 2, 8, nullptr), lg_destroy_ring);
+  SCOPE_ASSERT(searcher);
+
+  // two producers, each with a stream, through a ring too small to hold
+  // more than a little of either
+  std::vector<std::thread> producers;
+  for (uint64_t id = 0; id < 2; ++id) {
+    producers.emplace_back([id]() {
+      RingPtr producer(lg_open_ring(RING_NAME, nullptr), lg_destroy_ring);
+      for (uint64_t i = 0; i < 1000; ++i) {
+        publish(producer.get(), id, i, std::to_string(i), i == 999 ? LG_RING_END_OF_STREAM : 0);
+      }
+    });
+  }
+
+  uint64_t next[2] = {0, 0};
+  unsigned int ended = 0;
+
+  LG_RingSlot slot;
+  while (ended < 2 && lg_ring_next(searcher.get(), &slot)) {
+    SCOPE_ASSERT(slot.StreamID < 2);
+    SCOPE_ASSERT_EQUAL(next[slot.StreamID], slot.Offset);
+    SCOPE_ASSERT_EQUAL(std::to_string(slot.Offset), std::string(slot.Data, slot.Length));
+    ++next[slot.StreamID];
+    if (slot.Flags & LG_RING_END_OF_STREAM) {
+      ++ended;
+    }
+    SCOPE_ASSERT(lg_ring_release(searcher.get(), &slot, nullptr));
+  }
+
+  for (std::thread& t : producers) {
+    t.join();
+  }
+
+  SCOPE_ASSERT_EQUAL(1000u, next[0]);
+  SCOPE_ASSERT_EQUAL(1000u, next[1]);
+}
@@ -184,8 +184,91 @@ SCOPE_TEST(testBitVectorGeneration) {
   ProgramPtr p = Compiler::createProgram(fsm);
   Program& prog(*p);
   SCOPE_ASSERT_EQUAL(14u, prog.size());
-  SCOPE_ASSERT_EQUAL(Instruction::makeBitVector(), prog[0]);
-  SCOPE_ASSERT_EQUAL(bits, reinterpret_cast<ByteSet&>(prog[1]));
+  SCOPE_ASSERT_EQUAL(Instruction::makeBitVectorPool(4), prog[0]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeLabel(0), prog[1]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[2]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[3]);
+  SCOPE_ASSERT_EQUAL(bits, reinterpret_cast<ByteSet&>(prog[4]));
+  SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[12]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[13]);
+}
+
+SCOPE_TEST(testBitVectorPoolSharesSets) {
+  ByteSet bits;
+  bits.reset();
+  bits.set('0');
+  bits.set('2');
+  bits.set('4');
+  bits.set('8');
+  NFA fsm(3); // [0248][0248]
+  edge(0, 1, fsm, fsm.TransFac->getByteSet(bits));
+  edge(1, 2, fsm, fsm.TransFac->getByteSet(bits));
+  fsm[2].Label = 0;
+  fsm[2].IsMatch = true;
+
+  ProgramPtr p = Compiler::createProgram(fsm);
+  Program& prog(*p);
+  SCOPE_ASSERT_EQUAL(15u, prog.size());
+  SCOPE_ASSERT_EQUAL(Instruction::makeBitVectorPool(5), prog[0]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeBitVectorPool(4), prog[1]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeLabel(0), prog[2]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[3]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[4]);
+  SCOPE_ASSERT_EQUAL(bits, reinterpret_cast<ByteSet&>(prog[5]));
+  SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[13]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[14]);
+}
+
+SCOPE_TEST(testCountedState) {
+  NFA fsm(3); // a{20}b
+  edge(0, 1, fsm, fsm.TransFac->getByte('a'));
+  edge(1, 2, fsm, fsm.TransFac->getByte('b'));
+  fsm[1].Rep = fsm.TransFac->getRepetition(20, 20, fsm[1].Trans);
+  fsm[2].Label = 0;
+  fsm[2].IsMatch = true;
+
+  ProgramPtr p = Compiler::createProgram(fsm);
+  Program& prog(*p);
+
+  // the state loops on its own transition
+  SCOPE_ASSERT_EQUAL(11u, prog.size());
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('a'), prog[0]);
+  SCOPE_ASSERT_EQUAL(COUNT_LOOP_OP, prog[1].OpCode);
+  SCOPE_ASSERT_EQUAL(20u, prog[1].Op.Offset);
+  SCOPE_ASSERT_EQUAL(20u, *(uint32_t*) &prog[2]);
+  SCOPE_ASSERT_EQUAL(0u, *(uint32_t*) &prog[3]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeCheckHalt(1), prog[4]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('b'), prog[5]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeLabel(0), prog[6]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[7]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[8]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[9]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[10]);
+}
+
+SCOPE_TEST(testCountedStateSeparateLoop) {
+  NFA fsm(3); // a[ab]{19}b
+  edge(0, 1, fsm, fsm.TransFac->getByte('a'));
+  edge(1, 2, fsm, fsm.TransFac->getByte('b'));
+  fsm[1].Rep = fsm.TransFac->getRepetition(20, 20, fsm.TransFac->getRange('a', 'b'));
+  fsm[2].Label = 0;
+  fsm[2].IsMatch = true;
+
+  ProgramPtr p = Compiler::createProgram(fsm);
+  Program& prog(*p);
+
+  // the loop body follows the state's transition, which jumps over it
+  SCOPE_ASSERT_EQUAL(14u, prog.size());
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('a'), prog[0]);
+  SCOPE_ASSERT_EQUAL(JUMP_OP, prog[1].OpCode);
+  SCOPE_ASSERT_EQUAL(4u, *(uint32_t*) &prog[2]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeRange('a', 'b'), prog[3]);
+  SCOPE_ASSERT_EQUAL(COUNT_LOOP_OP, prog[4].OpCode);
+  SCOPE_ASSERT_EQUAL(20u, prog[4].Op.Offset);
+  SCOPE_ASSERT_EQUAL(20u, *(uint32_t*) &prog[5]);
+  SCOPE_ASSERT_EQUAL(3u, *(uint32_t*) &prog[6]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeCheckHalt(1), prog[7]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('b'), prog[8]);
   SCOPE_ASSERT_EQUAL(Instruction::makeLabel(0), prog[9]);
   SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[10]);
   SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[11]);
@@ -211,32 +294,49 @@ SCOPE_TEST(generateJumpTableRange) {
   ProgramPtr p = Compiler::createProgram(fsm);
   Program& prog(*p);
 
-  SCOPE_ASSERT_EQUAL(25u, prog.size());
+  // all four bytes land on 'f', so they share one slot
+  SCOPE_ASSERT_EQUAL(22u, prog.size());
   SCOPE_ASSERT_EQUAL(Instruction::makeByte('a'), prog[0]);
   SCOPE_ASSERT_EQUAL(Instruction::makeLabel(0), prog[1]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeJumpTableRange('b', 'g'), prog[2]);
-  SCOPE_ASSERT_EQUAL(10u, *(uint32_t*) &prog[3]); // b
-  SCOPE_ASSERT_EQUAL(10u, *(uint32_t*) &prog[4]); // c
-  SCOPE_ASSERT_EQUAL(10u, *(uint32_t*) &prog[5]); // d
-  SCOPE_ASSERT_EQUAL(0u, *(uint32_t*) &prog[6]); // e
-  SCOPE_ASSERT_EQUAL(0u, *(uint32_t*) &prog[7]); // f
-  SCOPE_ASSERT_EQUAL(10u, *(uint32_t*) &prog[8]); // g
-  SCOPE_ASSERT_EQUAL(Instruction::makeByte('b'), prog[9]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeByte('f'), prog[10]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeCheckHalt(1), prog[11]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[12]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[13]);
-// From here on, this is garbage---maybe don't even test this?
-/*
-  SCOPE_ASSERT_EQUAL(Instruction::makeByte('c'), prog[13]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeJump(&prog[14], 9), prog[14]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeByte('d'), prog[14]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeJump(&prog[15], 9), prog[15]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeByte('g'), prog[17]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeJump(&prog[18], 9), prog[18]);
-*/
-  SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[23]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[24]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeJumpTableIndex('b', 'g', 1), prog[2]);
+  const byte* index = reinterpret_cast<const byte*>(&prog[3]);
+  SCOPE_ASSERT_EQUAL(1u, index[0]); // b
+  SCOPE_ASSERT_EQUAL(1u, index[1]); // c
+  SCOPE_ASSERT_EQUAL(1u, index[2]); // d
+  SCOPE_ASSERT_EQUAL(0u, index[3]); // e
+  SCOPE_ASSERT_EQUAL(0u, index[4]); // f
+  SCOPE_ASSERT_EQUAL(1u, index[5]); // g
+  SCOPE_ASSERT_EQUAL(7u, *(uint32_t*) &prog[5]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('b'), prog[6]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('f'), prog[7]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeCheckHalt(1), prog[8]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[9]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[10]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[20]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[21]);
+}
+
+SCOPE_TEST(generateJumpTableRangeDistinctTargets) {
+  NFA fsm(6); // a(b|c|d|g)
+  edge(0, 1, fsm, fsm.TransFac->getByte('a'));
+  edge(1, 2, fsm, fsm.TransFac->getByte('b'));
+  edge(1, 3, fsm, fsm.TransFac->getByte('c'));
+  edge(1, 4, fsm, fsm.TransFac->getByte('d'));
+  edge(1, 5, fsm, fsm.TransFac->getByte('g'));
+
+  for (uint32_t i = 2; i < 6; ++i) {
+    fsm[i].Label = i;
+    fsm[i].IsMatch = true;
+  }
+
+  ProgramPtr p = Compiler::createProgram(fsm);
+  Program& prog(*p);
+
+  // four distinct targets: a slot per byte is no bigger than an index
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('a'), prog[0]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeJumpTableRange('b', 'g'), prog[1]);
+  SCOPE_ASSERT_EQUAL(0u, *(uint32_t*) &prog[5]); // e
+  SCOPE_ASSERT_EQUAL(0u, *(uint32_t*) &prog[6]); // f
 }
 
 SCOPE_TEST(generateJumpTableRangePreLabel) {
@@ -261,31 +361,33 @@ SCOPE_TEST(generateJumpTableRangePreLabel) {
   ProgramPtr p = Compiler::createProgram(fsm);
   Program& prog(*p);
 
-  SCOPE_ASSERT_EQUAL(34u, prog.size());
+  SCOPE_ASSERT_EQUAL(31u, prog.size());
   SCOPE_ASSERT_EQUAL(Instruction::makeByte('a'), prog[0]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeJumpTableRange('b', 'g'), prog[1]);
-  SCOPE_ASSERT_EQUAL(9u, *(uint32_t*) &prog[2]); // b
-  SCOPE_ASSERT_EQUAL(9u, *(uint32_t*) &prog[3]); // c
-  SCOPE_ASSERT_EQUAL(9u, *(uint32_t*) &prog[4]); // d
-  SCOPE_ASSERT_EQUAL(0u, *(uint32_t*) &prog[5]); // e
-  SCOPE_ASSERT_EQUAL(0u, *(uint32_t*) &prog[6]); // f
-  SCOPE_ASSERT_EQUAL(9u, *(uint32_t*) &prog[7]); // g
-//  SCOPE_ASSERT_EQUAL(Instruction::makeByte('b'), prog[8]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeByte('f'), prog[9]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeCheckHalt(1), prog[10]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeFork(&prog[11], 28), prog[11]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeJump(&prog[13], 24), prog[13]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeJumpTableIndex('b', 'g', 1), prog[1]);
+  const byte* index = reinterpret_cast<const byte*>(&prog[2]);
+  SCOPE_ASSERT_EQUAL(1u, index[0]); // b
+  SCOPE_ASSERT_EQUAL(1u, index[1]); // c
+  SCOPE_ASSERT_EQUAL(1u, index[2]); // d
+  SCOPE_ASSERT_EQUAL(0u, index[3]); // e
+  SCOPE_ASSERT_EQUAL(0u, index[4]); // f
+  SCOPE_ASSERT_EQUAL(1u, index[5]); // g
+  SCOPE_ASSERT_EQUAL(6u, *(uint32_t*) &prog[4]);
+//  SCOPE_ASSERT_EQUAL(Instruction::makeByte('b'), prog[5]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('f'), prog[6]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeCheckHalt(1), prog[7]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFork(&prog[8], 25), prog[8]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeJump(&prog[10], 21), prog[10]);
 // intervening crap
-  SCOPE_ASSERT_EQUAL(Instruction::makeByte('g'), prog[24]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeLabel(0), prog[25]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[26]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[27]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeByte('h'), prog[28]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeLabel(1), prog[29]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[30]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[31]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[32]);
-  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[33]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('g'), prog[21]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeLabel(0), prog[22]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[23]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[24]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeByte('h'), prog[25]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeLabel(1), prog[26]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeMatch(), prog[27]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[28]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[29]);
+  SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[30]);
 }
 
 SCOPE_TEST(testFirstChildNext) {
@@ -343,3 +445,32 @@ SCOPE_TEST(testFirstChildPrev) {
   SCOPE_ASSERT_EQUAL(Instruction::makeHalt(), prog[14]);
   SCOPE_ASSERT_EQUAL(Instruction::makeFinish(), prog[15]);
 }
+
+SCOPE_TEST(frozenGraphProgramMatchesNFAProgram) {
+  NFA fsm(7); // a(b|c|d|g)fg + a(b|c|d|g)fh
+  edge(0, 1, fsm, fsm.TransFac->getByte('a'));
+  edge(1, 2, fsm, fsm.TransFac->getByte('b'));
+  edge(1, 3, fsm, fsm.TransFac->getByte('c'));
+  edge(1, 4, fsm, fsm.TransFac->getByte('d'));
+  edge(1, 5, fsm, fsm.TransFac->getByte('g'));
+  edge(2, 6, fsm, fsm.TransFac->getByte('f'));
+  edge(3, 6, fsm, fsm.TransFac->getByte('f'));
+  edge(4, 6, fsm, fsm.TransFac->getByte('f'));
+  edge(5, 6, fsm, fsm.TransFac->getByte('f'));
+  edge(6, 7, fsm, fsm.TransFac->getByte('g'));
+  edge(6, 8, fsm, fsm.TransFac->getByte('h'));
+
+  fsm[7].Label = 0;
+  fsm[8].Label = 1;
+  fsm[7].IsMatch = true;
+  fsm[8].IsMatch = true;
+
+  const FrozenNFA frozen(fsm);
+
+  ProgramPtr exp = Compiler::createProgram(fsm);
+  ProgramPtr act = Compiler::createProgram(frozen);
+
+  SCOPE_ASSERT(*exp == *act);
+  SCOPE_ASSERT_EQUAL(exp->FilterOff, act->FilterOff);
+  SCOPE_ASSERT_EQUAL(exp->Filter, act->Filter);
+}
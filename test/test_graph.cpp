@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <vector>
 
+#include "frozengraph.h"
 #include "graph.h"
 #include "simplevectorfamily.h"
 
@@ -204,3 +205,35 @@ SCOPE_TEST(graphOutVertices) {
   const std::vector<G::VertexDescriptor> exp{2,3,4};
   SCOPE_ASSERT_EQUAL(exp, act);
 }
+
+SCOPE_TEST(frozenGraphKeepsEdgeOrder) {
+  Graph<X,X,X,S> g(4);
+  g.addEdge(0, 2);
+  g.addEdge(0, 1);
+  g.addEdge(1, 3);
+  g.addEdge(2, 3);
+  g.addEdge(0, 3);
+
+  const FrozenGraph<X,X> f(g);
+
+  SCOPE_ASSERT_EQUAL(g.verticesSize(), f.verticesSize());
+  SCOPE_ASSERT_EQUAL(g.edgesSize(), f.edgesSize());
+
+  for (uint32_t v = 0; v < g.verticesSize(); ++v) {
+    SCOPE_ASSERT_EQUAL(g.outDegree(v), f.outDegree(v));
+    SCOPE_ASSERT_EQUAL(g.inDegree(v), f.inDegree(v));
+
+    for (uint32_t i = 0; i < g.outDegree(v); ++i) {
+      SCOPE_ASSERT_EQUAL(g.outVertex(v, i), f.outVertex(v, i));
+    }
+
+    for (uint32_t i = 0; i < g.inDegree(v); ++i) {
+      SCOPE_ASSERT_EQUAL(g.inVertex(v, i), f.inVertex(v, i));
+    }
+  }
+
+  const std::vector<uint32_t> exp{2, 1, 3};
+  const auto outs(f.outVertices(0));
+  SCOPE_ASSERT(std::equal(exp.begin(), exp.end(), outs.begin()));
+  SCOPE_ASSERT_EQUAL(0u, f.outDegree(3));
+}
@@ -89,6 +89,8 @@ NFAPtr createGraph(const std::vector<Pattern>& pats, bool determinize) {
   ParseTree tree;
   NFAOptimizer comp;
   NFAPtr g(new NFA(1));
+  // g holds the builder's transitions, so must keep its factory alive
+  g->TransFac = nfab.getTransFac();
 
   for (uint32_t i = 0; i < pats.size(); ++i) {
     parse(pats[i], tree);
@@ -1,7 +1,13 @@
+#include "hitfile.h"
 #include "hitwriter.h"
 
 #include <scope/test.h>
 
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
 /*
 SCOPE_TEST(hitWriterOutput) {
   std::vector<std::pair<uint32_t, uint32_t >> tbl;
@@ -97,3 +103,185 @@ SCOPE_TEST(findTrailingContext5) {
 SCOPE_TEST(findTrailingContext6) {
   SCOPE_ASSERT_EQUAL(TXT+19, find_trailing_context(TXT+11, TXT+19, 6));
 }
+
+SCOPE_TEST(hitBufferFormat) {
+  std::ostringstream ss;
+  {
+    HitBuffer buf(ss);
+    buf << uint64_t(0) << '\t' << uint64_t(18446744073709551615u) << '\t'
+        << "abc" << std::string("def");
+  }
+  SCOPE_ASSERT_EQUAL("0\t18446744073709551615\tabcdef", ss.str());
+}
+
+SCOPE_TEST(hitBufferFlushWhenFull) {
+  std::ostringstream ss;
+  HitBuffer buf(ss);
+
+  const std::string s(HitBuffer::FLUSH_SIZE - 1, 'x');
+  buf << s;
+  SCOPE_ASSERT(ss.str().empty());
+
+  buf << 'y' << 'z';
+  SCOPE_ASSERT(ss.str().empty());
+
+  buf << "";
+  SCOPE_ASSERT_EQUAL(HitBuffer::FLUSH_SIZE + 1, ss.str().size());
+
+  buf.flush();
+  SCOPE_ASSERT_EQUAL(HitBuffer::FLUSH_SIZE + 1, ss.str().size());
+}
+
+namespace {
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> makeProgram() {
+    const char pats[] = "foo\tASCII\t0\t0\nba+r\tUTF-16LE\t0\t0\n";
+    const char* defEncs[] = { "ASCII" };
+    const LG_KeyOptions defOpts{0, 0, 1};
+
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+      lg_create_program(2),
+      lg_destroy_program
+    );
+
+    std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+      lg_create_fsm(0),
+      lg_destroy_fsm
+    );
+
+    LG_Error* err = nullptr;
+    lg_add_pattern_list(
+      fsm.get(), prog.get(), pats, "makeProgram",
+      defEncs, 1, &defOpts, &err
+    );
+    lg_free_error(err);
+
+    return prog;
+  }
+
+  void writeHitFile(std::ostream& out, ProgramHandle* prog, uint32_t flags) {
+    HitFileWriter file(out, prog, flags);
+    uint64_t numHits = 0;
+    {
+      BinaryHitWriterInfo hinfo(out, file);
+
+      hinfo.setPath("one");
+      const LG_SearchHit h0{3, 6, 0};
+      binaryHitWriter(&hinfo, &h0);
+      hinfo.flush();
+
+      hinfo.setPath("two");
+      const LG_SearchHit h1{1, 5, 1};
+      binaryHitWriter(&hinfo, &h1);
+      const LG_SearchHit h2{8, 9, 0};
+      binaryHitWriter(&hinfo, &h2);
+      hinfo.flush();
+
+      numHits = hinfo.NumHits;
+    }
+    file.finish(numHits);
+  }
+}
+
+SCOPE_TEST(hitFileRoundTrip) {
+  auto prog = makeProgram();
+  SCOPE_ASSERT_EQUAL(2u, lg_pattern_count(prog.get()));
+
+  std::ostringstream ss;
+  writeHitFile(ss, prog.get(), HitFileWriter::PRINT_PATH);
+  const std::string data(ss.str());
+
+  SCOPE_ASSERT_EQUAL(0u, data.size() % 8);
+
+  HitFileReader r(data.data(), data.size());
+  SCOPE_ASSERT_EQUAL(HitFileWriter::PRINT_PATH, r.flags());
+
+  SCOPE_ASSERT_EQUAL(3u, r.numHits());
+  SCOPE_ASSERT_EQUAL(3u, r.hits()[0].Start);
+  SCOPE_ASSERT_EQUAL(6u, r.hits()[0].End);
+  SCOPE_ASSERT_EQUAL(0u, r.hits()[0].PatternIndex);
+  SCOPE_ASSERT_EQUAL(0u, r.hits()[0].FileID);
+  SCOPE_ASSERT_EQUAL(1u, r.hits()[1].PatternIndex);
+  SCOPE_ASSERT_EQUAL(1u, r.hits()[1].FileID);
+  SCOPE_ASSERT_EQUAL(1u, r.hits()[2].FileID);
+
+  SCOPE_ASSERT_EQUAL(2u, r.numPaths());
+  SCOPE_ASSERT_EQUAL("one", r.path(0));
+  SCOPE_ASSERT_EQUAL("two", r.path(1));
+
+  SCOPE_ASSERT_EQUAL(2u, r.numPatterns());
+  SCOPE_ASSERT_EQUAL("foo", r.string(r.pattern(0).Pattern));
+  SCOPE_ASSERT_EQUAL("ASCII", r.string(r.pattern(0).EncodingChain));
+  SCOPE_ASSERT_EQUAL("ba+r", r.string(r.pattern(1).Pattern));
+  SCOPE_ASSERT_EQUAL("UTF-16LE", r.string(r.pattern(1).EncodingChain));
+}
+
+SCOPE_TEST(hitFileAsText) {
+  auto prog = makeProgram();
+
+  std::ostringstream bin;
+  writeHitFile(bin, prog.get(), HitFileWriter::PRINT_PATH);
+  const std::string data(bin.str());
+
+  std::ostringstream txt;
+  writeHitsAsText(HitFileReader(data.data(), data.size()), txt);
+
+  // as pathWriter would have written them
+  std::ostringstream exp;
+  {
+    PathWriterInfo hinfo(exp, prog.get());
+    hinfo.setPath("one");
+    const LG_SearchHit h0{3, 6, 0};
+    pathWriter(&hinfo, &h0);
+    hinfo.setPath("two");
+    const LG_SearchHit h1{1, 5, 1};
+    pathWriter(&hinfo, &h1);
+    const LG_SearchHit h2{8, 9, 0};
+    pathWriter(&hinfo, &h2);
+  }
+
+  SCOPE_ASSERT_EQUAL(exp.str(), txt.str());
+}
+
+SCOPE_TEST(hitFileAsTextNoPath) {
+  auto prog = makeProgram();
+
+  std::ostringstream bin;
+  writeHitFile(bin, prog.get(), 0);
+  const std::string data(bin.str());
+
+  std::ostringstream txt;
+  writeHitsAsText(HitFileReader(data.data(), data.size()), txt);
+
+  std::ostringstream exp;
+  {
+    HitWriterInfo hinfo(exp, prog.get());
+    const LG_SearchHit h0{3, 6, 0};
+    hitWriter(&hinfo, &h0);
+    const LG_SearchHit h1{1, 5, 1};
+    hitWriter(&hinfo, &h1);
+    const LG_SearchHit h2{8, 9, 0};
+    hitWriter(&hinfo, &h2);
+  }
+
+  SCOPE_ASSERT_EQUAL(exp.str(), txt.str());
+}
+
+SCOPE_TEST(hitFileUnfinished) {
+  auto prog = makeProgram();
+
+  std::ostringstream ss;
+  writeHitFile(ss, prog.get(), 0);
+  const std::string data(ss.str());
+
+  // no trailer
+  SCOPE_EXPECT(
+    HitFileReader(data.data(), data.size() - sizeof(HitFileTrailer)),
+    std::runtime_error
+  );
+
+  // no header
+  SCOPE_EXPECT(
+    HitFileReader(data.data() + 8, data.size() - 8),
+    std::runtime_error
+  );
+}
@@ -117,6 +117,39 @@ SCOPE_TEST(makeBitVector) {
   SCOPE_ASSERT_EQUAL(32u, sizeof(ByteSet));
 }
 
+SCOPE_TEST(makeBitVectorPool) {
+  Instruction i = Instruction::makeBitVectorPool(12);
+  SCOPE_ASSERT_EQUAL(BIT_VECTOR_POOL_OP, i.OpCode);
+  SCOPE_ASSERT_EQUAL(1u, i.wordSize());
+  SCOPE_ASSERT_EQUAL(12u, i.Op.Offset);
+  SCOPE_ASSERT_EQUAL("BitVectorPool +12", i.toString());
+}
+
+SCOPE_TEST(makeJumpTableIndex) {
+  Instruction i = Instruction::makeJumpTableIndex('A', 'Z', 3);
+  SCOPE_ASSERT_EQUAL(JUMP_TABLE_INDEX_OP, i.OpCode);
+  SCOPE_ASSERT_EQUAL(1u, i.wordSize());
+  SCOPE_ASSERT_EQUAL('A', i.Op.T2.First);
+  SCOPE_ASSERT_EQUAL('Z', i.Op.T2.Last);
+  SCOPE_ASSERT_EQUAL(3u, i.Op.T2.Flags);
+  SCOPE_ASSERT_EQUAL("JmpTblIndex 0x41/'A'-0x5a/'Z' 3", i.toString());
+}
+
+SCOPE_TEST(makeCountLoop) {
+  Instruction i[3];
+  i[0] = Instruction::makeCountLoop(i, 64, 2000, 7);
+  SCOPE_ASSERT_EQUAL(COUNT_LOOP_OP, i[0].OpCode);
+  SCOPE_ASSERT_EQUAL(3u, i[0].wordSize());
+  SCOPE_ASSERT_EQUAL(64u, i[0].Op.Offset);
+  SCOPE_ASSERT_EQUAL(2000u, *reinterpret_cast<uint32_t*>(&i[1]));
+  SCOPE_ASSERT_EQUAL(7u, *reinterpret_cast<uint32_t*>(&i[2]));
+  SCOPE_ASSERT_EQUAL("CountLoop 64-2000 0x00000007/7", i[0].toString());
+
+  SCOPE_EXPECT(Instruction::makeCountLoop(i, 0, 10, 0), std::range_error);
+  SCOPE_EXPECT(Instruction::makeCountLoop(i, 10, 9, 0), std::range_error);
+  SCOPE_EXPECT(Instruction::makeCountLoop(i, 1, 0x10000, 0), std::range_error);
+}
+
 SCOPE_TEST(makeFork) {
   Instruction i[2];
   i[0] = Instruction::makeFork(i, 16777216);
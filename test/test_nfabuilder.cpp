@@ -19,6 +19,7 @@
 #include <scope/test.h>
 
 #include "automata.h"
+#include "encodedclasscache.h"
 #include "instructions.h"
 #include "nfabuilder.h"
 #include "parser.h"
@@ -802,11 +803,33 @@ SCOPE_TEST(parseZeroDotStarZero) {
   SCOPE_ASSERT(g[n].IsMatch);
 
 SCOPE_TEST(parse_aLCnRC) {
-  for (uint32_t c = 1; c < 100; ++c) {
+  // longer repetitions are counted
+  for (uint32_t c = 1; c < 16; ++c) {
     TEST_REPETITION_N("a", c);
   }
 }
 
+SCOPE_TEST(parse_aLCnRC_Counted) {
+  for (uint32_t c = 16; c < 100; ++c) {
+    NFABuilder nfab;
+    NFA& g(*nfab.getFsm());
+    ParseTree tree;
+    std::ostringstream ss;
+    ss << "a{" << c << '}';
+    SCOPE_ASSERT(parse({ss.str(), false, false}, tree));
+    SCOPE_ASSERT(nfab.build(tree));
+
+    SCOPE_ASSERT_EQUAL(2u, g.verticesSize());
+    SCOPE_ASSERT_EQUAL(1u, g.outDegree(0));
+    SCOPE_ASSERT_EQUAL(0u, g.outDegree(1));
+    SCOPE_ASSERT(g[1].IsMatch);
+    SCOPE_ASSERT(g[1].Rep);
+    SCOPE_ASSERT_EQUAL(c, g[1].Rep->Min);
+    SCOPE_ASSERT_EQUAL(c, g[1].Rep->Max);
+    SCOPE_ASSERT_EQUAL(g[1].Trans, g[1].Rep->Loop);
+  }
+}
+
 #define TEST_REPETITION_N_U(pattern, n) \
   std::ostringstream ss; \
   ss << pattern << '{' << n << ",}"; \
@@ -836,11 +859,74 @@ SCOPE_TEST(parse_aLCnRC) {
   SCOPE_ASSERT(g[n].IsMatch);
 
 SCOPE_TEST(parse_aLCn_RC) {
-  for (uint32_t n = 1; n < 100; ++n) {
+  for (uint32_t n = 1; n < 16; ++n) {
     TEST_REPETITION_N_U("a", n);
   }
 }
 
+SCOPE_TEST(parse_aLCn_RC_Counted) {
+  // T{n,} = T{n}T*, with T{n} counted
+  NFABuilder nfab;
+  NFA& g(*nfab.getFsm());
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"a{20,}", false, false}, tree));
+  SCOPE_ASSERT(nfab.build(tree));
+
+  SCOPE_ASSERT_EQUAL(3u, g.verticesSize());
+
+  SCOPE_ASSERT_EQUAL(1u, g.outDegree(0));
+  SCOPE_ASSERT_EQUAL(1u, g.outVertex(0, 0));
+
+  SCOPE_ASSERT_EQUAL(1u, g.outDegree(1));
+  SCOPE_ASSERT_EQUAL(2u, g.outVertex(1, 0));
+  SCOPE_ASSERT(g[1].IsMatch);
+  SCOPE_ASSERT(g[1].Rep);
+  SCOPE_ASSERT_EQUAL(20u, g[1].Rep->Min);
+  SCOPE_ASSERT_EQUAL(20u, g[1].Rep->Max);
+
+  SCOPE_ASSERT_EQUAL(2u, g.inDegree(2));
+  SCOPE_ASSERT_EQUAL(1u, g.outDegree(2));
+  SCOPE_ASSERT_EQUAL(2u, g.outVertex(2, 0));
+  SCOPE_ASSERT(g[2].IsMatch);
+  SCOPE_ASSERT(!g[2].Rep);
+}
+
+SCOPE_TEST(parse_xLC0_2000RCy_Counted) {
+  NFABuilder nfab;
+  NFA& g(*nfab.getFsm());
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"x[0-9]{0,2000}y", false, false}, tree));
+  SCOPE_ASSERT(nfab.build(tree));
+
+  SCOPE_ASSERT_EQUAL(4u, g.verticesSize());
+
+  SCOPE_ASSERT_EQUAL(2u, g.outDegree(1));
+  SCOPE_ASSERT_EQUAL(2u, g.outVertex(1, 0));
+  SCOPE_ASSERT_EQUAL(3u, g.outVertex(1, 1));
+
+  SCOPE_ASSERT(g[2].Rep);
+  SCOPE_ASSERT_EQUAL(1u, g[2].Rep->Min);
+  SCOPE_ASSERT_EQUAL(2000u, g[2].Rep->Max);
+  SCOPE_ASSERT_EQUAL(1u, g.outDegree(2));
+  SCOPE_ASSERT_EQUAL(3u, g.outVertex(2, 0));
+
+  SCOPE_ASSERT(g[3].IsMatch);
+}
+
+SCOPE_TEST(parse_multibyteRepetitionNotCounted) {
+  NFABuilder nfab;
+  nfab.setEncoder(std::shared_ptr<Encoder>(new UTF8));
+  NFA& g(*nfab.getFsm());
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"\\x{E9}{20}", false, false}, tree));
+  SCOPE_ASSERT(nfab.build(tree));
+
+  SCOPE_ASSERT_EQUAL(41u, g.verticesSize());
+  for (NFA::VertexDescriptor v = 0; v < g.verticesSize(); ++v) {
+    SCOPE_ASSERT(!g[v].Rep);
+  }
+}
+
 SCOPE_TEST(parse_aLC0_RCQb) {
   NFABuilder nfab;
   NFA& g(*nfab.getFsm());
@@ -900,7 +986,7 @@ SCOPE_TEST(parse_aLC0_RCQb) {
   SCOPE_ASSERT(g[n].IsMatch);
 
 SCOPE_TEST(parse_aLCn_RCQb) {
-  for (uint32_t n = 1; n < 100; ++n) {
+  for (uint32_t n = 1; n < 16; ++n) {
     TEST_REPETITION_N_U("a", n);
   }
 }
@@ -1256,3 +1342,38 @@ SCOPE_TEST(parseEncodingNegCCCodePointWithBreakout) {
   g[1].Trans->getBytes(actual);
   SCOPE_ASSERT_EQUAL(expected, actual);
 }
+
+SCOPE_TEST(sharedEncodedClassMatchesUnshared) {
+  EncodedClassCache::instance().clear();
+
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"x[\\x{100}-\\x{2FF}a-f]y[\\x{100}-\\x{2FF}a-f]", false, false}, tree));
+
+  NFABuilder plain;
+  plain.setEncoder(std::shared_ptr<Encoder>(new UTF8));
+  SCOPE_ASSERT(plain.build(tree));
+
+  // the first shared build fills the cache, the second copies from it
+  for (uint32_t i = 0; i < 2; ++i) {
+    NFABuilder shared;
+    shared.setEncoder(std::shared_ptr<Encoder>(new UTF8), "UTF-8");
+    SCOPE_ASSERT(shared.build(tree));
+
+    SCOPE_ASSERT_EQUAL(1u, EncodedClassCache::instance().size());
+
+    const NFA& exp(*plain.getFsm());
+    const NFA& act(*shared.getFsm());
+
+    ASSERT_EQUAL_GRAPHS(exp, act);
+    ASSERT_EQUAL_MATCHES(exp, act);
+
+    for (uint32_t v = 1; v < exp.verticesSize(); ++v) {
+      SCOPE_ASSERT_EQUAL(exp[v].Trans->bytes(), act[v].Trans->bytes());
+      for (uint32_t o = 0; o < exp.outDegree(v); ++o) {
+        SCOPE_ASSERT_EQUAL(exp.outVertex(v, o), act.outVertex(v, o));
+      }
+    }
+  }
+
+  EncodedClassCache::instance().clear();
+}
@@ -656,3 +656,75 @@ SCOPE_TEST(testPruneBranches) {
   ASSERT_EQUAL_LABELS(exp, g);
   ASSERT_EQUAL_MATCHES(exp, g);
 }
+
+SCOPE_TEST(testMinimizeDFA) {
+  NFA g(4);
+  edge(0, 1, g, g.TransFac->getByte('d'));
+  edge(1, 2, g, g.TransFac->getByte('d'));
+  edge(1, 1, g, g.TransFac->getByte('d'));
+  edge(1, 3, g, g.TransFac->getByte('x'));
+  edge(2, 1, g, g.TransFac->getByte('d'));
+  edge(2, 3, g, g.TransFac->getByte('x'));
+
+  g[3].IsMatch = true;
+  g[3].Label = 0;
+
+  NFA h(1);
+  NFAOptimizer comp;
+  comp.subsetDFA(h, g);
+
+  NFA m;
+  comp.minimizeDFA(m, h);
+
+  NFA exp(3);
+  edge(0, 1, exp, exp.TransFac->getByte('d'));
+  edge(1, 2, exp, exp.TransFac->getByte('x'));
+  edge(1, 1, exp, exp.TransFac->getByte('d'));
+
+  exp[2].IsMatch = true;
+  exp[2].Label = 0;
+
+  ASSERT_EQUAL_GRAPHS(exp, m);
+  ASSERT_EQUAL_LABELS(exp, m);
+  ASSERT_EQUAL_MATCHES(exp, m);
+}
+
+SCOPE_TEST(testMinimizeDFAKeepsDistinctLabels) {
+  NFA g(5);
+  edge(0, 1, g, g.TransFac->getByte('a'));
+  edge(0, 2, g, g.TransFac->getByte('b'));
+  edge(1, 3, g, g.TransFac->getByte('c'));
+  edge(2, 4, g, g.TransFac->getByte('c'));
+
+  g[3].IsMatch = true;
+  g[3].Label = 0;
+  g[4].IsMatch = true;
+  g[4].Label = 1;
+
+  NFAOptimizer comp;
+  NFA m;
+  comp.minimizeDFA(m, g);
+
+  ASSERT_EQUAL_GRAPHS(g, m);
+  ASSERT_EQUAL_LABELS(g, m);
+  ASSERT_EQUAL_MATCHES(g, m);
+}
+
+SCOPE_TEST(testDeterminizeParallelMatchesSequential) {
+  NFAPtr g(createGraph(
+    {"a+b", "ab?c", "(ab|ac)*d", "[a-d]{2,5}x", "bcd", "\\w+z", "a.c"},
+    false
+  ));
+
+  NFAOptimizer comp;
+
+  NFA seq(1);
+  comp.subsetDFA(seq, *g);
+
+  NFA par(1);
+  comp.subsetDFA(par, *g, 4);
+
+  ASSERT_EQUAL_GRAPHS(seq, par);
+  ASSERT_EQUAL_LABELS(seq, par);
+  ASSERT_EQUAL_MATCHES(seq, par);
+}
@@ -100,3 +100,91 @@ SCOPE_TEST(endThreePosArgs) {
   SCOPE_ASSERT_EQUAL(kf, opts.KeyFiles);
   SCOPE_ASSERT_EQUAL(inputs, opts.Inputs);
 }
+
+SCOPE_TEST(threadsOption) {
+  const char* cargv[] = { "--threads", "4", "-p", "foo", "bar" };
+  Options opts;
+  TEST_OPTS(cargv, opts);
+
+  SCOPE_ASSERT_EQUAL(4u, opts.Threads);
+}
+
+SCOPE_TEST(threadsOptionZero) {
+  // 0 means one thread per core
+  const char* cargv[] = { "--threads", "0", "-p", "foo", "bar" };
+  Options opts;
+  TEST_OPTS(cargv, opts);
+
+  SCOPE_ASSERT(opts.Threads > 0);
+}
+
+SCOPE_TEST(compileThreadsOption) {
+  const char* cargv[] = { "--compile-threads", "4", "-p", "foo", "bar" };
+  Options opts;
+  TEST_OPTS(cargv, opts);
+
+  SCOPE_ASSERT_EQUAL(4u, opts.CompileThreads);
+  SCOPE_ASSERT_EQUAL(1u, opts.Threads);
+}
+
+SCOPE_TEST(compileThreadsOptionZero) {
+  // 0 means one thread per core
+  const char* cargv[] = { "--compile-threads", "0", "-p", "foo", "bar" };
+  Options opts;
+  TEST_OPTS(cargv, opts);
+
+  SCOPE_ASSERT(opts.CompileThreads > 0);
+}
+
+SCOPE_TEST(directIOUnalignedBlockSize) {
+  const char* cargv[] = { "--direct-io", "--block-size", "1000", "-p", "foo", "bar" };
+  Options opts;
+
+  SCOPE_EXPECT(
+    TEST_OPTS(cargv, opts),
+    boost::program_options::error
+  );
+}
+
+SCOPE_TEST(serverCommand) {
+  const char* cargv[] = { "-c", "server", "-p", "foo", "--socket", "/tmp/lg.sock" };
+  Options opts;
+  TEST_OPTS(cargv, opts);
+
+  SCOPE_ASSERT_EQUAL(Options::SERVER, opts.Command);
+  SCOPE_ASSERT_EQUAL(12777u, opts.Port);
+  SCOPE_ASSERT_EQUAL("/tmp/lg.sock", opts.SocketPath);
+  SCOPE_ASSERT_EQUAL(std::vector<std::string>{"foo"}, opts.CmdLinePatterns);
+}
+
+SCOPE_TEST(serverCommandNowhereToListen) {
+  const char* cargv[] = { "-c", "server", "-p", "foo", "--port", "0" };
+  Options opts;
+
+  SCOPE_EXPECT(
+    TEST_OPTS(cargv, opts),
+    boost::program_options::error
+  );
+}
+
+SCOPE_TEST(ringSearch) {
+  const char* cargv[] = { "-p", "foo", "--ring", "lg-ring", "--ring-slots", "4" };
+  Options opts;
+  TEST_OPTS(cargv, opts);
+
+  SCOPE_ASSERT_EQUAL(Options::SEARCH, opts.Command);
+  SCOPE_ASSERT_EQUAL("lg-ring", opts.RingName);
+  SCOPE_ASSERT_EQUAL(4u, opts.RingSlots);
+  SCOPE_ASSERT(opts.Inputs.empty());
+  SCOPE_ASSERT(opts.PrintPath);
+}
+
+SCOPE_TEST(ringSearchWithInputs) {
+  const char* cargv[] = { "-p", "foo", "--ring", "lg-ring", "a.txt" };
+  Options opts;
+
+  SCOPE_EXPECT(
+    TEST_OPTS(cargv, opts),
+    boost::program_options::error
+  );
+}
@@ -37,3 +37,16 @@ SCOPE_TEST(testPatternMapSerialization) {
     p1.Patterns.size()*sizeof(decltype(p1.Patterns)::value_type))
   );
 }
+
+SCOPE_TEST(testPatternMapClearKeys) {
+  PatternMap p(2);
+  p.addPattern("foo", "ASCII", 0, 0, "foo/ASCII");
+  p.addPattern("foo", "ASCII", 1, 0, "foo/ASCII");
+  SCOPE_ASSERT_EQUAL(0u, p.labelOf("foo/ASCII"));
+
+  // the labels outlive the keys
+  p.clearKeys();
+  SCOPE_ASSERT(PatternMap::NOLABEL == p.labelOf("foo/ASCII"));
+  SCOPE_ASSERT_EQUAL(2u, p.Patterns.size());
+  SCOPE_ASSERT_EQUAL(0u, p.label(1));
+}
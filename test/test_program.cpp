@@ -60,3 +60,22 @@ SCOPE_TEST(testProgramSerialization) {
   // p1 and p2 have different buffers
   SCOPE_ASSERT(&p1->front() != &p2->front());
 }
+
+SCOPE_TEST(testProgramFilterPacking) {
+  ProgramPtr p1(makeProgram());
+  p1->Filter.set(0);
+  p1->Filter.set(9);
+  p1->Filter.set(256*256 - 1);
+
+  std::vector<char> buf(Program::FilterBytes);
+  p1->packFilter(buf.data());
+
+  // least significant bit first
+  SCOPE_ASSERT_EQUAL(0x01, buf[0]);
+  SCOPE_ASSERT_EQUAL(0x02, buf[1]);
+  SCOPE_ASSERT_EQUAL(char(0x80), buf[Program::FilterBytes - 1]);
+
+  ProgramPtr p2(new Program(0));
+  p2->unpackFilter(buf.data());
+  SCOPE_ASSERT(p1->Filter == p2->Filter);
+}
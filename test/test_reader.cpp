@@ -0,0 +1,329 @@
+#include "reader.h"
+#include "searchcontroller.h"
+
+#include <scope/test.h>
+
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef HAVE_IO_URING
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace {
+  // around the page and block sizes, and many blocks
+  const size_t SIZES[] = { 0, 1, 4095, 4096, 4097, 12345, 196625, 1000000 };
+
+  // a path under the temporary directory which no other test run shares
+  std::filesystem::path tempPath(const std::string& name) {
+    std::random_device rd;
+    return std::filesystem::temp_directory_path() /
+           (name + '-' + std::to_string(rd()));
+  }
+
+  // A file of pseudorandom bytes, removed when done
+  struct TempFile {
+    explicit TempFile(size_t size):
+      Path(tempPath("lg_test_reader")),
+      Bytes(size, '\0')
+    {
+      std::mt19937 gen(size);
+      for (char& c : Bytes) {
+        c = static_cast<char>(gen());
+      }
+      std::ofstream(Path, std::ios::binary).write(Bytes.data(), Bytes.size());
+    }
+
+    ~TempFile() {
+      std::filesystem::remove(Path);
+    }
+
+    std::string path() const { return Path.string(); }
+
+    std::filesystem::path Path;
+    std::string Bytes;
+  };
+
+  // Reads to the end, asking for each block before using the one before
+  // it, as SearchController does
+  std::string readAll(Reader& reader, size_t blockSize) {
+    std::string ret;
+    std::pair<const char*, size_t> blk(reader.read(blockSize).get());
+    while (blk.second) {
+      std::future<std::pair<const char*, size_t>> next(reader.read(blockSize));
+      ret.append(blk.first, blk.second);
+      blk = next.get();
+    }
+    return ret;
+  }
+}
+
+SCOPE_TEST(fileReaderReadsWholeFile) {
+  for (const size_t size : SIZES) {
+    TempFile f(size);
+    for (const size_t blockSize : { 1000, 4096, 65536 }) {
+      for (const uint32_t depth : { 2, 4 }) {
+        FileReader reader(f.path(), blockSize, depth);
+        SCOPE_ASSERT(f.Bytes == readAll(reader, blockSize));
+      }
+    }
+  }
+}
+
+SCOPE_TEST(fileReaderDirectReadsWholeFile) {
+  for (const size_t size : SIZES) {
+    TempFile f(size);
+    for (const size_t blockSize : { 4096, 65536 }) {
+      FileReader reader(f.path(), blockSize, 4, true);
+      SCOPE_ASSERT(f.Bytes == readAll(reader, blockSize));
+    }
+  }
+}
+
+SCOPE_TEST(fileReaderDirectUnalignedBlocks) {
+  TempFile f(12345);
+  SCOPE_EXPECT(FileReader(f.path(), 1000, 4, true), std::invalid_argument);
+}
+
+#ifdef __linux__
+
+SCOPE_TEST(fileReaderDirectFallsBackOnEINVAL) {
+  // procfs refuses O_DIRECT with EINVAL, so this reads through the cache
+  std::ifstream in("/proc/version", std::ios::binary);
+  const std::string expected(
+    (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()
+  );
+  SCOPE_ASSERT(!expected.empty());
+
+  FileReader reader("/proc/version", 4096, 4, true);
+  SCOPE_ASSERT(expected == readAll(reader, 4096));
+}
+
+#endif
+
+SCOPE_TEST(fileReaderWholeBlocksOnly) {
+  TempFile f(12345);
+  FileReader reader(f.path(), 4096);
+  SCOPE_EXPECT(reader.read(1000), std::invalid_argument);
+}
+
+#ifdef HAVE_IO_URING
+
+SCOPE_TEST(ioUringReaderReadsWholeFile) {
+  for (const size_t size : SIZES) {
+    TempFile f(size);
+    for (const size_t blockSize : { 1000, 4096, 65536 }) {
+      for (const uint32_t depth : { 2, 4 }) {
+        std::unique_ptr<IoUringReader> reader;
+        try {
+          reader.reset(new IoUringReader(f.path(), blockSize, depth));
+        }
+        catch (const std::runtime_error&) {
+          // the kernel or sandbox has no io_uring; openFileReader() will
+          // fall back, as below
+          return;
+        }
+        SCOPE_ASSERT(f.Bytes == readAll(*reader, blockSize));
+      }
+    }
+  }
+}
+
+SCOPE_TEST(ioUringReaderDirectReadsWholeFile) {
+  for (const size_t size : SIZES) {
+    TempFile f(size);
+    for (const size_t blockSize : { 4096, 65536 }) {
+      std::unique_ptr<IoUringReader> reader;
+      try {
+        reader.reset(new IoUringReader(f.path(), blockSize, 4, true));
+      }
+      catch (const std::runtime_error&) {
+        return;
+      }
+      SCOPE_ASSERT(f.Bytes == readAll(*reader, blockSize));
+    }
+  }
+}
+
+SCOPE_TEST(openFileReaderWithIoUringReadsWholeFile) {
+  // with io_uring where it works, and a FileReader where it doesn't
+  for (const size_t size : SIZES) {
+    TempFile f(size);
+    std::unique_ptr<Reader> reader(openFileReader(f.path(), 4096, 4, true));
+    SCOPE_ASSERT(f.Bytes == readAll(*reader, 4096));
+  }
+}
+
+SCOPE_TEST(openFileReaderWithIoUringFallsBackForDevices) {
+  // io_uring reads only files and block devices, at offsets
+  std::unique_ptr<Reader> reader(openFileReader("/dev/null", 4096, 4, true));
+  SCOPE_ASSERT(dynamic_cast<FileReader*>(reader.get()));
+  SCOPE_ASSERT(readAll(*reader, 4096).empty());
+}
+
+SCOPE_TEST(openFileReaderWithIoUringFallsBackWhenSetupFails) {
+  TempFile f(196625);
+
+  // leave room to open the file, but not to set up an io_uring
+  const int fd = open("/dev/null", O_RDONLY);
+  close(fd);
+
+  rlimit old;
+  getrlimit(RLIMIT_NOFILE, &old);
+  rlimit lim(old);
+  lim.rlim_cur = fd + 1;
+  setrlimit(RLIMIT_NOFILE, &lim);
+
+  std::unique_ptr<Reader> reader;
+  try {
+    reader = openFileReader(f.path(), 4096, 4, true);
+  }
+  catch (...) {
+    setrlimit(RLIMIT_NOFILE, &old);
+    throw;
+  }
+  setrlimit(RLIMIT_NOFILE, &old);
+
+  SCOPE_ASSERT(dynamic_cast<FileReader*>(reader.get()));
+  SCOPE_ASSERT(f.Bytes == readAll(*reader, 4096));
+}
+
+#endif
+
+SCOPE_TEST(memoryMappedFileReaderReadsWholeFile) {
+  for (const size_t size : SIZES) {
+    TempFile f(size);
+    for (const size_t blockSize : { 1000, 4096, 65536 }) {
+      for (const uint32_t depth : { 2, 4 }) {
+        for (const bool populate : { false, true }) {
+          for (const bool whole : { false, true }) {
+            MemoryMappedFileReader reader(f.path(), depth, populate, whole);
+            SCOPE_ASSERT(f.Bytes == readAll(reader, blockSize));
+          }
+        }
+      }
+    }
+  }
+}
+
+SCOPE_TEST(memoryMappedFileReaderWholeIsContiguous) {
+  TempFile f(196625);
+  MemoryMappedFileReader reader(f.path(), 2, false, true);
+
+  std::pair<const char*, size_t> prev(reader.read(4096).get()), blk;
+  while ((blk = reader.read(4096).get()).second) {
+    SCOPE_ASSERT(prev.first + prev.second == blk.first);
+    prev = blk;
+  }
+}
+
+namespace {
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> compileNeedle() {
+    const LG_KeyOptions keyOpts{0, 0, 0};
+    const LG_ProgramOptions progOpts{1, 0, 0};
+    const char* encs[] = { "ASCII" };
+
+    std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+      lg_create_fsm(0), lg_destroy_fsm
+    );
+    std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+      lg_create_program(0), lg_destroy_program
+    );
+    LG_Error* err = nullptr;
+    lg_add_pattern_list(
+      fsm.get(), prog.get(), "needle", "test", encs, 1, &keyOpts, &err
+    );
+    SCOPE_ASSERT(!err);
+    SCOPE_ASSERT(lg_compile_program(fsm.get(), prog.get(), &progOpts, nullptr));
+    return prog;
+  }
+}
+
+SCOPE_TEST(contextForHitAcrossMappedBlocks) {
+  // "needle" starts 3 bytes before the second block of 4096
+  std::string text;
+  while (text.size() < 3 * 4096) {
+    text += "z\n";
+  }
+  text.replace(4093, 6, "needle");
+
+  const std::filesystem::path path(
+    tempPath("lg_test_reader_context")
+  );
+  std::ofstream(path, std::ios::binary).write(text.data(), text.size());
+
+  const auto prog(compileNeedle());
+
+  const LG_ContextOptions ctxOpts{0, 0};
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+    lg_create_context(prog.get(), &ctxOpts), lg_destroy_context
+  );
+
+  std::ostringstream out;
+  {
+    LineContextHitWriterInfo hinfo(out, prog.get(), 1, 1, "--");
+    SearchController ctrl(4096, 2, false, false, false, true);
+    ctrl.searchInput(path.string(), true, ctx.get(), &hinfo, &lineContextHitWriter);
+  }
+  std::filesystem::remove(path);
+
+  // the hit is decoded from the bytes before the block it ended in
+  SCOPE_ASSERT_EQUAL(
+    std::string("4093\t4099\t0\tneedle\tASCII\t4096\tneedle\\nz\n"),
+    out.str()
+  );
+}
+
+namespace {
+  // Hands out the given blocks, noting the output as each is waited for
+  struct BlockReader: public Reader {
+    BlockReader(std::vector<std::string> blocks, const std::ostringstream& out):
+      Blocks(std::move(blocks)), Out(out) {}
+
+    virtual std::future<std::pair<const char*, size_t>> read(size_t) override {
+      return std::async(std::launch::deferred, [this]() {
+        Seen.push_back(Out.str());
+        const std::string& blk(Blocks[Seen.size() - 1]);
+        return std::make_pair(blk.data(), blk.size());
+      });
+    }
+
+    std::vector<std::string> Blocks;
+    const std::ostringstream& Out;
+    std::vector<std::string> Seen;
+  };
+}
+
+SCOPE_TEST(hitsWrittenBeforeWaitingForNextBlock) {
+  const auto prog(compileNeedle());
+
+  const LG_ContextOptions ctxOpts{0, 0};
+  std::unique_ptr<ContextHandle,void(*)(ContextHandle*)> ctx(
+    lg_create_context(prog.get(), &ctxOpts), lg_destroy_context
+  );
+
+  // a slow input, such as a pipe, shows each block's hits before the
+  // next block comes
+  std::ostringstream out;
+  HitWriterInfo hinfo(out, prog.get());
+  BlockReader reader({ "a needle", "b needle", "" }, out);
+  SearchController ctrl(4096, 2, false, false, false, false);
+  SCOPE_ASSERT(ctrl.searchFile(ctx.get(), &hinfo, reader, &hitWriter));
+
+  const std::string first("2\t8\t0\tneedle\tASCII\n");
+  SCOPE_ASSERT_EQUAL(3u, reader.Seen.size());
+  SCOPE_ASSERT_EQUAL(std::string(), reader.Seen[0]);
+  SCOPE_ASSERT_EQUAL(first, reader.Seen[1]);
+  SCOPE_ASSERT_EQUAL(first + "10\t16\t0\tneedle\tASCII\n", reader.Seen[2]);
+}
@@ -545,3 +545,68 @@ SCOPE_TEST(makeBinopsRightAssociative_aOrLPbOrcRP_Test) {
   SCOPE_ASSERT(!makeBinopsRightAssociative(tree.Root));
   SCOPE_ASSERT_EQUAL("a|b|c", unparse(tree));
 }
+
+SCOPE_TEST(factorAlternations_aOrbOrLBcdRB_Test) {
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"a|b|[cd]", false, false}, tree));
+  makeBinopsRightAssociative(tree.Root);
+  SCOPE_ASSERT(factorAlternations(tree.Root));
+  SCOPE_ASSERT_EQUAL("[a-d]", unparse(tree));
+}
+
+SCOPE_TEST(factorAlternations_foobarOrfoobaz_Test) {
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"foobar|foobaz", false, false}, tree));
+  makeBinopsRightAssociative(tree.Root);
+  SCOPE_ASSERT(factorAlternations(tree.Root));
+  SCOPE_ASSERT_EQUAL("fooba[rz]", unparse(tree));
+}
+
+SCOPE_TEST(factorAlternations_xabOryab_Test) {
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"x.ab|y.ab", false, false}, tree));
+  makeBinopsRightAssociative(tree.Root);
+  SCOPE_ASSERT(factorAlternations(tree.Root));
+  SCOPE_ASSERT_EQUAL("[xy].ab", unparse(tree));
+}
+
+SCOPE_TEST(factorAlternations_abOracOrd_Test) {
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"ab|ac|d", false, false}, tree));
+  makeBinopsRightAssociative(tree.Root);
+  SCOPE_ASSERT(factorAlternations(tree.Root));
+  SCOPE_ASSERT_EQUAL("a[bc]|d", unparse(tree));
+}
+
+SCOPE_TEST(factorAlternations_abOrcOrad_Test) {
+  // combining nonadjacent alternatives would change their priority
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"ab|c|ad", false, false}, tree));
+  makeBinopsRightAssociative(tree.Root);
+  SCOPE_ASSERT(!factorAlternations(tree.Root));
+  SCOPE_ASSERT_EQUAL("ab|c|ad", unparse(tree));
+}
+
+SCOPE_TEST(factorAlternations_fooOrfoobar_Test) {
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"foo|foobar", false, false}, tree));
+  makeBinopsRightAssociative(tree.Root);
+  SCOPE_ASSERT(factorAlternations(tree.Root));
+  SCOPE_ASSERT_EQUAL("fo(o|obar)", unparse(tree));
+}
+
+SCOPE_TEST(factorAlternations_abPOrcbP_Test) {
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"ab+|cb+", false, false}, tree));
+  makeBinopsRightAssociative(tree.Root);
+  SCOPE_ASSERT(!factorAlternations(tree.Root));
+  SCOPE_ASSERT_EQUAL("ab+|cb+", unparse(tree));
+}
+
+SCOPE_TEST(factorAlternations_nonAsciiLiteral_Test) {
+  // U+00E9 might not exist in the encoding, which a class would hide
+  ParseTree tree;
+  SCOPE_ASSERT(parse({"a|\\x{E9}", false, false}, tree));
+  makeBinopsRightAssociative(tree.Root);
+  SCOPE_ASSERT(!factorAlternations(tree.Root));
+}
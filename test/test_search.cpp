@@ -511,11 +511,12 @@ SCOPE_FIXTURE_CTOR(aPQab_aPQaOrbSearch, STest, STest({ "a+?ab", "a+?a|b" })) {
 }
 
 SCOPE_FIXTURE_CTOR(aPQa_aPQaSearch, STest, STest({ "a+?a", "a+?a" })) {
+  // the duplicate shares a label, so its hits follow in pattern order
   const char text[] = "aaa";
   fixture.search(text, text + 3, 0);
   SCOPE_ASSERT_EQUAL(2u, fixture.Hits.size());
-  SCOPE_ASSERT_EQUAL(SearchHit(0, 2, 1), fixture.Hits[0]);
-  SCOPE_ASSERT_EQUAL(SearchHit(0, 2, 0), fixture.Hits[1]);
+  SCOPE_ASSERT_EQUAL(SearchHit(0, 2, 0), fixture.Hits[0]);
+  SCOPE_ASSERT_EQUAL(SearchHit(0, 2, 1), fixture.Hits[1]);
 }
 
 SCOPE_FIXTURE_CTOR(aSQaSQDot_aPDotPQSearch, STest, STest({ "a*?a*?.", "a+.+?" })) {
@@ -644,3 +645,27 @@ SCOPE_FIXTURE_CTOR(hitCaching, STest, STest("[a-zA-Z]+ing")) {
   SCOPE_ASSERT_EQUAL(SearchHit(5, 12, 0), fixture.Hits[1]);
 }
 */
+
+SCOPE_FIXTURE_CTOR(countedRepetitionSearch, STest, STest("[0-9A-F]{20}")) {
+  const char text[] = "zz0123456789ABCDEF0123456789yy";
+  fixture.search(text, text + 30, 0);
+  SCOPE_ASSERT_EQUAL(1u, fixture.Hits.size());
+  SCOPE_ASSERT_EQUAL(SearchHit(2, 22, 0), fixture.Hits[0]);
+}
+
+SCOPE_FIXTURE_CTOR(countedOptionalRepetitionSearch, STest, STest("a[0-9]{0,20}b")) {
+  const char text[] = "a12b ab a123456789012345678901b a1234567890123456789b";
+  fixture.search(text, text + 53, 0);
+  SCOPE_ASSERT_EQUAL(3u, fixture.Hits.size());
+  SCOPE_ASSERT_EQUAL(SearchHit(0, 4, 0), fixture.Hits[0]);
+  SCOPE_ASSERT_EQUAL(SearchHit(5, 7, 0), fixture.Hits[1]);
+  SCOPE_ASSERT_EQUAL(SearchHit(32, 53, 0), fixture.Hits[2]);
+}
+
+SCOPE_FIXTURE_CTOR(countedUnboundedRepetitionSearch, STest, STest("x[0-9]{16,}")) {
+  const char text[] = "x1234567890123456 x12345678901234567890y x123";
+  fixture.search(text, text + 45, 0);
+  SCOPE_ASSERT_EQUAL(2u, fixture.Hits.size());
+  SCOPE_ASSERT_EQUAL(SearchHit(0, 17, 0), fixture.Hits[0]);
+  SCOPE_ASSERT_EQUAL(SearchHit(18, 39, 0), fixture.Hits[1]);
+}
@@ -374,3 +374,51 @@ SCOPE_TEST(testMaxOutbound) {
   std::vector<std::vector<NFA::VertexDescriptor>> tbl = pivotStates(0, fsm);
   SCOPE_ASSERT_EQUAL(2u, maxOutbound(tbl));
 }
+
+SCOPE_TEST(testPivotTableReuse) {
+  NFA fsm(5);
+  edge(0, 1, fsm, fsm.TransFac->getByte('a'));
+  edge(0, 2, fsm, fsm.TransFac->getByte('a'));
+  edge(0, 3, fsm, fsm.TransFac->getByte('b'));
+  edge(3, 4, fsm, fsm.TransFac->getByte('c'));
+
+  PivotTable tbl;
+  pivotStates(0, fsm, tbl);
+  SCOPE_ASSERT_EQUAL(2u, tbl.maxOutbound());
+  SCOPE_ASSERT_EQUAL(2u, tbl.size('a'));
+  SCOPE_ASSERT_EQUAL(1u, tbl.begin('a')[0]);
+  SCOPE_ASSERT_EQUAL(2u, tbl.begin('a')[1]);
+  SCOPE_ASSERT_EQUAL(1u, tbl.size('b'));
+  SCOPE_ASSERT_EQUAL(3u, tbl.begin('b')[0]);
+  SCOPE_ASSERT_EQUAL(3u, tbl.Targets.size());
+
+  // refilling for another state leaves nothing of the first behind
+  pivotStates(3, fsm, tbl);
+  SCOPE_ASSERT_EQUAL(1u, tbl.maxOutbound());
+  SCOPE_ASSERT(tbl.empty('a'));
+  SCOPE_ASSERT(tbl.empty('b'));
+  SCOPE_ASSERT_EQUAL(1u, tbl.size('c'));
+  SCOPE_ASSERT_EQUAL(4u, tbl.begin('c')[0]);
+  SCOPE_ASSERT_EQUAL(1u, tbl.Targets.size());
+}
+
+SCOPE_TEST(testPivotTableRepeatedOutVertex) {
+  NFA fsm(4);
+  edge(0, 2, fsm, fsm.TransFac->getByte('a'));
+  edge(0, 1, fsm, fsm.TransFac->getByte('a'));
+  edge(0, 2, fsm, fsm.TransFac->getByte('a'));
+  edge(0, 3, fsm, fsm.TransFac->getByte('b'));
+
+  // a repeated out vertex is counted once, where it first appears
+  PivotTable tbl;
+  pivotStates(0, fsm, tbl);
+  SCOPE_ASSERT_EQUAL(2u, tbl.size('a'));
+  SCOPE_ASSERT_EQUAL(2u, tbl.begin('a')[0]);
+  SCOPE_ASSERT_EQUAL(1u, tbl.begin('a')[1]);
+  SCOPE_ASSERT_EQUAL(3u, tbl.Targets.size());
+
+  // and is not remembered for the next state
+  pivotStates(0, fsm, tbl);
+  SCOPE_ASSERT_EQUAL(2u, tbl.size('a'));
+  SCOPE_ASSERT_EQUAL(1u, tbl.size('b'));
+}
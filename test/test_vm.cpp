@@ -19,11 +19,16 @@
 #include <scope/test.h>
 
 #include "byteset.h"
+#include "handles.h"
 #include "vm.h"
 #include "mockcallback.h"
 #include "program.h"
 
+#include "lightgrep/api.h"
+
 #include <iostream>
+#include <memory>
+#include <string>
 
 SCOPE_TEST(executeByte) {
   byte b = 'a';
@@ -226,6 +231,70 @@ SCOPE_TEST(executeJumpTableRange) {
   }
 }
 
+SCOPE_TEST(executeJumpTableIndex) {
+  byte b;
+  ProgramPtr p(new Program(6, Instruction::makeHalt()));
+  (*p)[0] = Instruction::makeJumpTableIndex('a', 'c', 2);
+  byte* index = reinterpret_cast<byte*>(&(*p)[1]);
+  index[0] = 2; // a
+  index[1] = 0; // b
+  index[2] = 1; // c
+  index[3] = 0;
+  *(uint32_t*)&((*p)[2]) = 4;
+  *(uint32_t*)&((*p)[3]) = 5;
+
+  Vm s(p);
+  Thread cur(&(*p)[0], 0, 0, 0);
+
+  for (uint32_t i = 0; i < 256; ++i) {
+    b = i;
+    if ('a' == i || 'c' == i) {
+      SCOPE_ASSERT(s.execute(&cur, &b));
+      SCOPE_ASSERT_EQUAL(1u, s.numActive());
+      SCOPE_ASSERT_EQUAL(0u, s.numNext());
+      SCOPE_ASSERT_EQUAL(Thread(&(*p)[0] + ('a' == i ? 5 : 4), 0, 0, 0), s.active().front());
+    }
+    else {
+      SCOPE_ASSERT(!s.execute(&cur, &b));
+      SCOPE_ASSERT_EQUAL(1u, s.numActive());
+      SCOPE_ASSERT_EQUAL(0u, s.numNext());
+      SCOPE_ASSERT_EQUAL(Thread(&(*p)[0], 0, 0, 0), s.active().front());
+    }
+
+    s.reset();
+  }
+}
+
+SCOPE_TEST(executeBitVectorPool) {
+  ProgramPtr p(new Program(10, Instruction::makeHalt()));
+  (*p)[0] = Instruction::makeBitVectorPool(2);
+  ByteSet *setPtr = reinterpret_cast<ByteSet*>(&(*p)[2]);
+  setPtr->reset();
+  setPtr->set('A');
+  setPtr->set('b');
+
+  Vm s(p);
+  Thread cur(&(*p)[0], 0, 0, 0);
+  byte b;
+  for (uint32_t i = 0; i < 256; ++i) {
+    b = i;
+    if (i == 'A' || i == 'b') {
+      SCOPE_ASSERT(s.execute(&cur, &b));
+      SCOPE_ASSERT_EQUAL(1u, s.numActive());
+      SCOPE_ASSERT_EQUAL(0u, s.numNext());
+      SCOPE_ASSERT_EQUAL(Thread(&(*p)[1], 0, 0, 0), s.active().front());
+    }
+    else {
+      SCOPE_ASSERT(!s.execute(&cur, &b));
+      SCOPE_ASSERT_EQUAL(1u, s.numActive());
+      SCOPE_ASSERT_EQUAL(0u, s.numNext());
+      SCOPE_ASSERT_EQUAL(Thread(&(*p)[0], 0, 0, 0), s.active().front());
+    }
+
+    s.reset();
+  }
+}
+
 SCOPE_TEST(executeBitVector) {
   SCOPE_ASSERT_EQUAL(32u, sizeof(ByteSet));
 
@@ -307,6 +376,123 @@ SCOPE_TEST(executeFork) {
   SCOPE_ASSERT_EQUAL(&(*p)[3], s.active().front().PC);
 }
 
+SCOPE_TEST(executeCountLoop) {
+  ProgramPtr p(new Program(5, Instruction()));
+  (*p)[0] = Instruction::makeByte('a');
+  (*p)[1] = Instruction::makeCountLoop(&(*p)[1], 2, 3, 0);
+
+  {
+    // too few bytes, so go around again
+    Vm s(p);
+    Thread cur(&(*p)[1], 0, 0, 0);
+    SCOPE_ASSERT(s.executeEpsilon(&cur, 0));
+    SCOPE_ASSERT_EQUAL(1u, s.numActive());
+    SCOPE_ASSERT_EQUAL(0u, s.numNext());
+    SCOPE_ASSERT_EQUAL(&(*p)[0], s.active().front().PC);
+    SCOPE_ASSERT_EQUAL(1u, s.active().front().Count);
+  }
+
+  {
+    // enough bytes to leave, but going around again has priority
+    Vm s(p);
+    Thread cur(&(*p)[1], 0, 0, 0);
+    cur.Count = 1;
+    SCOPE_ASSERT(s.executeEpsilon(&cur, 1));
+    SCOPE_ASSERT_EQUAL(1u, s.numActive());
+    SCOPE_ASSERT_EQUAL(1u, s.numNext());
+    SCOPE_ASSERT_EQUAL(&(*p)[0], s.next()[0].PC);
+    SCOPE_ASSERT_EQUAL(2u, s.next()[0].Count);
+    SCOPE_ASSERT_EQUAL(&(*p)[4], s.active().front().PC);
+    SCOPE_ASSERT_EQUAL(0u, s.active().front().Count);
+  }
+
+  {
+    // as many bytes as allowed, so leave
+    Vm s(p);
+    Thread cur(&(*p)[1], 0, 0, 0);
+    cur.Count = 2;
+    SCOPE_ASSERT(s.executeEpsilon(&cur, 2));
+    SCOPE_ASSERT_EQUAL(1u, s.numActive());
+    SCOPE_ASSERT_EQUAL(0u, s.numNext());
+    SCOPE_ASSERT_EQUAL(&(*p)[4], s.active().front().PC);
+    SCOPE_ASSERT_EQUAL(0u, s.active().front().Count);
+  }
+}
+
+SCOPE_TEST(executeCountLoopTwice) {
+  ProgramPtr p(new Program(5, Instruction()));
+  (*p)[0] = Instruction::makeByte('a');
+  (*p)[1] = Instruction::makeCountLoop(&(*p)[1], 2, 4, 0);
+
+  {
+    // too few bytes, and another thread has gone around, so die
+    Vm s(p);
+    Thread cur(&(*p)[1], 0, 0, 0);
+    SCOPE_ASSERT(s.executeEpsilon(&cur, 0));
+    SCOPE_ASSERT(!s.executeEpsilon(&cur, 0));
+    SCOPE_ASSERT_EQUAL(2u, s.numActive());
+    SCOPE_ASSERT_EQUAL(0u, s.numNext());
+    SCOPE_ASSERT_EQUAL(&(*p)[0], s.active()[0].PC);
+    SCOPE_ASSERT(!s.active()[1].PC);
+  }
+
+  {
+    // enough bytes to leave, and another thread has gone around, so leave
+    Vm s(p);
+    Thread cur(&(*p)[1], 0, 0, 0);
+    cur.Count = 1;
+    SCOPE_ASSERT(s.executeEpsilon(&cur, 1));
+    SCOPE_ASSERT(s.executeEpsilon(&cur, 1));
+    SCOPE_ASSERT_EQUAL(2u, s.numActive());
+    SCOPE_ASSERT_EQUAL(1u, s.numNext());
+    SCOPE_ASSERT_EQUAL(&(*p)[4], s.active()[1].PC);
+  }
+
+  {
+    // another label's thread going around doesn't hold us
+    Vm s(p);
+    Thread cur(&(*p)[1], 0, 0, 0);
+    SCOPE_ASSERT(s.executeEpsilon(&cur, 0));
+    cur.Label = 1;
+    SCOPE_ASSERT(s.executeEpsilon(&cur, 0));
+    SCOPE_ASSERT_EQUAL(2u, s.numActive());
+    SCOPE_ASSERT_EQUAL(&(*p)[0], s.active()[1].PC);
+  }
+}
+
+SCOPE_TEST(searchCountLoopThreads) {
+  std::unique_ptr<PatternHandle,void(*)(PatternHandle*)> pat(
+    lg_create_pattern(), lg_destroy_pattern
+  );
+  std::unique_ptr<ProgramHandle,void(*)(ProgramHandle*)> prog(
+    lg_create_program(1), lg_destroy_program
+  );
+  std::unique_ptr<FSMHandle,void(*)(FSMHandle*)> fsm(
+    lg_create_fsm(0), lg_destroy_fsm
+  );
+
+  LG_Error* err = nullptr;
+  const LG_KeyOptions keyOpts{0, 0, 0};
+  lg_parse_pattern(pat.get(), "(ab|b).{0,2000}", &keyOpts, &err);
+  lg_add_pattern(fsm.get(), prog.get(), pat.get(), "ASCII", 0, &err);
+  SCOPE_ASSERT(!err);
+
+  // left undeterminized, the threads starting at 0 and 1 reach the
+  // repetition together, so only the first goes around it
+  const LG_ProgramOptions progOpts{0, 0, 0};
+  SCOPE_ASSERT(lg_compile_program(fsm.get(), prog.get(), &progOpts, nullptr));
+
+  Vm s(prog->Prog);
+  const std::string text = "ab" + std::string(100, 'x');
+  const byte* const b = reinterpret_cast<const byte*>(text.data());
+  s.search(b, b + text.size(), 0, nullptr, nullptr);
+  SCOPE_ASSERT_EQUAL(3u, s.numActive());
+  SCOPE_ASSERT_EQUAL(100u, s.active()[0].Count);
+  SCOPE_ASSERT_EQUAL(0u, s.active()[0].Start);
+  SCOPE_ASSERT_EQUAL(0u, s.active()[1].Count);
+  SCOPE_ASSERT_EQUAL(0u, s.active()[2].Count);
+}
+
 // re-enable this once check halt is restored to former glory
 // SCOPE_TEST(executeCheckHalt) {
 //   ProgramPtr p(new Program(2, Instruction::makeCheckHalt(5)));